@@ -11,14 +11,28 @@
  * microcontroller manufactured by Nanjing Qinheng Microelectronics.
  *******************************************************************************/
 #include <debug.h>
+#include "clock.h"
 
 static uint8_t  p_us = 0;
 static uint16_t p_ms = 0;
+static volatile uint8_t deadline = 0;
+
+/* SysTick CTLR/SR bits */
+#define SYSTICK_STE     (1 << 0)
+#define SYSTICK_STIE    (1 << 1)
+#define SYSTICK_CNTIF   (1 << 0)
+
+/* longest single sleep; keeps the tick difference well inside 31 bits */
+#define DELAY_MAX_CHUNK_MS  100000
+
+void SysTick_Handler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
 
 /*********************************************************************
  * @fn      Delay_Init
  *
  * @brief   Initializes Delay Funcation.
+ *          SysTick runs free at HCLK/8 and is never reset, the delays
+ *          compare against its count.
  *
  * @return  none
  */
@@ -26,12 +40,34 @@ void Delay_Init(void)
 {
     p_us = SystemCoreClock / 8000000;
     p_ms = (uint16_t)p_us * 1000;
+
+    SysTick->CTLR = 0;
+    SysTick->SR = 0;
+    SysTick->CNT = 0;
+    SysTick->CMP = 0xffffffff;
+    SysTick->CTLR = SYSTICK_STE; /* HCLK/8, keep counting up past CMP */
+    NVIC_EnableIRQ(SysTicK_IRQn);
+}
+
+/*********************************************************************
+ * @fn      SysTick_Handler
+ *
+ * @brief   Compare match; ends the current Delay_Ms sleep.
+ *
+ * @return  none
+ */
+void SysTick_Handler(void)
+{
+    SysTick->CTLR &= ~SYSTICK_STIE;
+    SysTick->SR &= ~SYSTICK_CNTIF;
+    deadline = 1;
 }
 
 /*********************************************************************
  * @fn      Delay_Us
  *
  * @brief   Microsecond Delay Time.
+ *          Too short to be worth sleeping, so it polls the counter.
  *
  * @param   n - Microsecond number.
  *
@@ -39,17 +75,88 @@ void Delay_Init(void)
  */
 void Delay_Us(uint32_t n)
 {
-    uint32_t i;
+    uint32_t start = SysTick->CNT;
+    uint32_t i = (uint32_t)n * p_us;
 
-    SysTick->SR &= ~(1 << 0);
-    i = (uint32_t)n * p_us;
+    while((SysTick->CNT - start) < i);
+}
 
-    SysTick->CMP = i;
-    SysTick->CNT = 0;
-    SysTick->CTLR |=(1 << 0);
+/*********************************************************************
+ * @fn      Delay_GetTick
+ *
+ * @brief   Free-running SysTick count (HCLK/8), for timestamps.
+ *          It stops while the MCU is in standby.
+ *
+ * @return  current count
+ */
+uint32_t Delay_GetTick(void)
+{
+    return SysTick->CNT;
+}
 
-    while((SysTick->SR & (1 << 0)) != (1 << 0));
-    SysTick->CTLR &= ~(1 << 0);
+/*********************************************************************
+ * @fn      Delay_MsToTicks
+ *
+ * @brief   Converts milliseconds to SysTick ticks.
+ *
+ * @param   n - Millisecond number.
+ *
+ * @return  ticks
+ */
+uint32_t Delay_MsToTicks(uint32_t n)
+{
+    return n * p_ms;
+}
+
+/*********************************************************************
+ * @fn      Delay_TicksToUs
+ *
+ * @brief   Converts SysTick ticks to microseconds (rounded down).
+ *          It divides, so keep it out of the time critical paths.
+ *
+ * @param   n - SysTick ticks.
+ *
+ * @return  microseconds
+ */
+uint32_t Delay_TicksToUs(uint32_t n)
+{
+    return n / p_us;
+}
+
+/*********************************************************************
+ * @fn      Delay_Wait
+ *
+ * @brief   Sleeps the core (WFI) until SysTick has advanced by n ticks.
+ *          Other interrupts wake it early; it goes back to sleep until
+ *          the compare match unless they set *wake.
+ *
+ * @param   n - SysTick ticks (HCLK/8), less than 2^31.
+ *          wake - flag set by an interrupt to end the wait early, or NULL.
+ *
+ * @return  None
+ */
+void Delay_Wait(uint32_t n, volatile uint8_t *wake)
+{
+    uint32_t start = SysTick->CNT;
+    uint16_t gated;
+
+    deadline = 0;
+    SysTick->SR &= ~SYSTICK_CNTIF;
+    SysTick->CMP = start + n;
+    SysTick->CTLR |= SYSTICK_STIE;
+
+    gated = clockSleep(); /* idle peripherals don't need a clock while we wait */
+    __disable_irq();
+    while(!deadline && (SysTick->CNT - start) < n && !(wake && *wake))
+    {
+        /* a pending interrupt still ends WFI while they're masked */
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+    clockWake(gated);
+    SysTick->CTLR &= ~SYSTICK_STIE;
 }
 
 /*********************************************************************
@@ -65,15 +172,12 @@ void Delay_Ms(uint32_t n)
 {
     uint32_t i;
 
-    SysTick->SR &= ~(1 << 0);
-    i = (uint32_t)n * p_ms;
-
-    SysTick->CMP = i;
-    SysTick->CNT = 0;
-    SysTick->CTLR |=(1 << 0);
-
-    while((SysTick->SR & (1 << 0)) != (1 << 0));
-    SysTick->CTLR &= ~(1 << 0);
+    while(n)
+    {
+        i = (n > DELAY_MAX_CHUNK_MS) ? DELAY_MAX_CHUNK_MS : n;
+        Delay_Wait(i * p_ms, NULL);
+        n -= i;
+    }
 }
 
 /*********************************************************************
@@ -90,7 +194,8 @@ void USART_Printf_Init(uint32_t baudrate)
     GPIO_InitTypeDef  GPIO_InitStructure;
     USART_InitTypeDef USART_InitStructure;
 
-    RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOD | RCC_APB2Periph_USART1, ENABLE);
+    clockAcquire(CLOCK_GPIOD);
+    clockAcquire(CLOCK_USART1);
 
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_5;
     GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
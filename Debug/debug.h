@@ -31,6 +31,10 @@
 void Delay_Init(void);
 void Delay_Us(uint32_t n);
 void Delay_Ms(uint32_t n);
+void Delay_Wait(uint32_t n, volatile uint8_t *wake);
+uint32_t Delay_GetTick(void);
+uint32_t Delay_MsToTicks(uint32_t n);
+uint32_t Delay_TicksToUs(uint32_t n);
 void USART_Printf_Init(uint32_t baudrate);
 
 #ifdef __cplusplus
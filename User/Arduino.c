@@ -19,6 +19,17 @@
 //
 #include "debug.h"
 #include "Arduino.h"
+#include "clock.h"
+#include "pwm.h"
+#include "telemetry.h"
+#include "i2ctrace.h"
+#include "profile.h"
+#include "diag.h"
+
+// Pins configured on each GPIO port (A, B, C, D); a port's clock is
+// acquired when its first pin is used
+static uint8_t u8PortPins[4];
+static const uint8_t u8PortClock[4] = {CLOCK_GPIOA, CLOCK_GPIOA, CLOCK_GPIOC, CLOCK_GPIOD};
 
 void delay(int i)
 {
@@ -29,6 +40,7 @@ void delay(int i)
 void pinMode(uint8_t u8Pin, int iMode)
 {
     GPIO_InitTypeDef GPIO_InitStructure = {0};
+    int iPort;
     if (u8Pin < 0xa0 || u8Pin > 0xdf) return; // invalid pin number
 
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_0 << (u8Pin & 0xf);
@@ -40,18 +52,23 @@ void pinMode(uint8_t u8Pin, int iMode)
     	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPU;
     else if (iMode == INPUT_PULLDOWN)
     	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPD;
+    else if (iMode == OUTPUT_AF)
+    	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
     GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    iPort = (u8Pin >> 4) - 0xa;
+    if (!(u8PortPins[iPort] & (1 << (u8Pin & 7)))) { // first use of this pin
+    	if (u8PortPins[iPort] == 0)
+    		clockAcquire(u8PortClock[iPort]);
+    	u8PortPins[iPort] |= (1 << (u8Pin & 7));
+    }
     switch (u8Pin & 0xf0) {
     case 0xa0:
-    	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA, ENABLE);
         GPIO_Init(GPIOA, &GPIO_InitStructure);
     	break;
     case 0xc0:
-    	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOC, ENABLE);
         GPIO_Init(GPIOC, &GPIO_InitStructure);
     	break;
     case 0xd0:
-    	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOD, ENABLE);
         GPIO_Init(GPIOD, &GPIO_InitStructure);
     	break;
     }
@@ -59,38 +76,14 @@ void pinMode(uint8_t u8Pin, int iMode)
 
 uint8_t digitalRead(uint8_t u8Pin)
 {
-    uint8_t u8GPIO = GPIO_Pin_0 << (u8Pin & 0xf);
-    uint8_t u8Value = 0;
-    switch (u8Pin & 0xf0) {
-    case 0xa0:
-    	u8Value = GPIO_ReadInputDataBit(GPIOA, u8GPIO);
-    	break;
-    case 0xc0:
-    	u8Value = GPIO_ReadInputDataBit(GPIOC, u8GPIO);
-    	break;
-    case 0xd0:
-    	u8Value = GPIO_ReadInputDataBit(GPIOD, u8GPIO);
-    	break;
-    }
-    return u8Value;
+    if (u8Pin < 0xa0 || u8Pin > 0xdf) return 0; // invalid pin number
+    return digitalReadFast(u8Pin);
 } /* digitalRead() */
 
 void digitalWrite(uint8_t u8Pin, uint8_t u8Value)
 {
-	uint8_t u8GPIO = GPIO_Pin_0 << (u8Pin & 0xf);
-	u8Value = (u8Value) ? Bit_SET : Bit_RESET;
-
-	switch (u8Pin & 0xf0) {
-	case 0xa0:
-		GPIO_WriteBit(GPIOA, u8GPIO, u8Value);
-		break;
-	case 0xc0:
-		GPIO_WriteBit(GPIOC, u8GPIO, u8Value);
-		break;
-	case 0xd0:
-		GPIO_WriteBit(GPIOD, u8GPIO, u8Value);
-		break;
-	}
+    if (u8Pin < 0xa0 || u8Pin > 0xdf) return; // invalid pin number
+    digitalWriteFast(u8Pin, u8Value);
 } /* digitalWrite() */
 
 void I2CSetSpeed(int iSpeed)
@@ -111,8 +104,11 @@ void I2CInit(int iSpeed)
     GPIO_InitTypeDef GPIO_InitStructure={0};
 
     // Fixed to pins C1/C2 for now
-    RCC_APB2PeriphClockCmd( RCC_APB2Periph_GPIOC | RCC_APB2Periph_AFIO, ENABLE );
-    RCC_APB1PeriphClockCmd( RCC_APB1Periph_I2C1, ENABLE );
+    if (!clockIsOn(CLOCK_I2C1)) { // called again after every standby; only count it once
+        clockAcquire(CLOCK_GPIOC);
+        clockAcquire(CLOCK_AFIO);
+        clockAcquire(CLOCK_I2C1);
+    }
 
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_2;
     GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_OD;
@@ -132,8 +128,23 @@ void I2CInit(int iSpeed)
     while( I2C_GetFlagStatus( I2C1, I2C_FLAG_BUSY ) != RESET );
 } /* I2CInit() */
 
+//
+// Count the error flags left by the last transfer for the diagnostics screen
+//
+static void I2CCheckErrors(void)
+{
+    if (I2C1->STAR1 & (I2C_STAR1_BERR | I2C_STAR1_ARLO | I2C_STAR1_AF)) {
+        diagError(DIAG_ERR_I2C);
+        I2C1->STAR1 = 0; // the error flags clear when written with 0, the rest are read-only
+    }
+} /* I2CCheckErrors() */
+
 void I2CRead(uint8_t u8Addr, uint8_t *pData, int iLen)
 {
+#ifdef I2C_TRACE
+    uint32_t u32TraceStart = Delay_GetTick();
+    int iTraceLen = iLen;
+#endif
     I2C_GenerateSTART( I2C1, ENABLE );
     while( !I2C_CheckEvent( I2C1, I2C_EVENT_MASTER_MODE_SELECT ) );
 
@@ -152,12 +163,19 @@ void I2CRead(uint8_t u8Addr, uint8_t *pData, int iLen)
     }
 
     I2C_GenerateSTOP( I2C1, ENABLE );
-
+#ifdef I2C_TRACE
+    i2cTraceRecord(u8Addr | I2C_TRACE_READ, iTraceLen, u32TraceStart);
+#endif
+    I2CCheckErrors();
 
 } /* I2CRead() */
 
 void I2CWrite(uint8_t u8Addr, uint8_t *pData, int iLen)
 {
+#ifdef I2C_TRACE
+    uint32_t u32TraceStart = Delay_GetTick();
+    int iTraceLen = iLen;
+#endif
     I2C_GenerateSTART( I2C1, ENABLE );
     while( !I2C_CheckEvent( I2C1, I2C_EVENT_MASTER_MODE_SELECT ) );
 
@@ -177,6 +195,10 @@ void I2CWrite(uint8_t u8Addr, uint8_t *pData, int iLen)
 
     while( !I2C_CheckEvent( I2C1, I2C_EVENT_MASTER_BYTE_TRANSMITTED ) );
     I2C_GenerateSTOP( I2C1, ENABLE );
+#ifdef I2C_TRACE
+    i2cTraceRecord(u8Addr, iTraceLen, u32TraceStart);
+#endif
+    I2CCheckErrors();
 
 } /* I2CWrite() */
 
@@ -196,28 +218,70 @@ int I2CTest(uint8_t u8Addr)
 // Put CPU into standby mode for a multiple of 82ms tick increments
 // max ticks value is 63
 void Standby82ms(uint8_t iTicks)
+{
+    Standby82msWake(iTicks, 0, 0);
+} /* Standby82ms() */
+
+//
+// Standby for up to iTicks x 82ms (max 63); a falling edge on u8Pin0 or
+// u8Pin1 (pins 0-7 whose EXTI lines the caller has routed, 0 = none) ends
+// it early. Those pins stay pulled up, and their edge is left pending so the
+// caller's EXTI interrupt sees it after the wake up.
+// returns 1 if one of the pins woke the chip
+//
+int Standby82msWake(uint8_t iTicks, uint8_t u8Pin0, uint8_t u8Pin1)
 {
     EXTI_InitTypeDef EXTI_InitStructure = {0};
     GPIO_InitTypeDef GPIO_InitStructure = {0};
+    GPIO_TypeDef *pPort[3] = {GPIOA, GPIOC, GPIOD};
+    uint8_t u8Keep[3] = {0, 0, 0}; // pins pulled up on each port
+    uint8_t u8Pins[2];
+    uint32_t u32IntMask, u32Rising, u32Falling, u32Wake = 0;
+    int i, iPort, bPin;
+
+    u8Pins[0] = u8Pin0; u8Pins[1] = u8Pin1;
+    for (i=0; i<2; i++) {
+        if (u8Pins[i] == 0)
+            continue;
+        u32Wake |= 1 << (u8Pins[i] & 7);
+        iPort = (u8Pins[i] >> 4) - 0xa;
+        if (iPort) iPort--; // there's no GPIOB
+        u8Keep[iPort] |= PIN_MASK(u8Pins[i]);
+    }
+    // let PWM ramps, patterns and telemetry finish; standby would freeze them
+    while (pwmActive() || telemetryBusy())
+        Delay_Ms(PWM_TICK_MS);
+    // pulling the pins down below would fire the pin change interrupts
+    u32IntMask = EXTI->INTENR;
+    u32Rising = EXTI->RTENR;
+    u32Falling = EXTI->FTENR;
+    EXTI->INTENR = 0;
 
     // init external interrupts
-    RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+    clockAcquire(CLOCK_AFIO);
 
-    EXTI_InitStructure.EXTI_Line = EXTI_Line9;
+    EXTI_InitStructure.EXTI_Line = EXTI_Line9 | u32Wake;
     EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Event;
     EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Falling;
     EXTI_InitStructure.EXTI_LineCmd = ENABLE;
     EXTI_Init(&EXTI_InitStructure);
+    EXTI->INTFR = u32Wake; // only new presses wake it
 
     // Init GPIOs
-    RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_GPIOC | RCC_APB2Periph_GPIOD, ENABLE);
-    RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, ENABLE);
-    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_All;
-    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPD;
-
-    GPIO_Init(GPIOA, &GPIO_InitStructure);
-    GPIO_Init(GPIOC, &GPIO_InitStructure);
-    GPIO_Init(GPIOD, &GPIO_InitStructure);
+    clockAcquire(CLOCK_GPIOA);
+    clockAcquire(CLOCK_GPIOC);
+    clockAcquire(CLOCK_GPIOD);
+    clockAcquire(CLOCK_PWR);
+    for (i=0; i<3; i++) {
+        GPIO_InitStructure.GPIO_Pin = GPIO_Pin_All & ~u8Keep[i];
+        GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPD;
+        GPIO_Init(pPort[i], &GPIO_InitStructure);
+        if (u8Keep[i]) {
+            GPIO_InitStructure.GPIO_Pin = u8Keep[i];
+            GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPU;
+            GPIO_Init(pPort[i], &GPIO_InitStructure);
+        }
+    }
 
     // init wake up timer and enter standby mode
     RCC_LSICmd(ENABLE);
@@ -226,12 +290,75 @@ void Standby82ms(uint8_t iTicks)
     PWR_AWU_SetWindowValue(iTicks);
     PWR_AutoWakeUpCmd(ENABLE);
     PWR_EnterSTANDBYMode(PWR_STANDBYEntry_WFE);
+    PROFILE_BEGIN(PROF_WAKE); // SysTick was stopped until now
+    clockStandby();
+    bPin = (EXTI->INTFR & u32Wake) != 0;
+
+    for (i=0; i<3; i++) {
+        GPIO_DeInit(pPort[i]);
+        if (u8Keep[i]) { // no floating moment for the wake pins
+            GPIO_InitStructure.GPIO_Pin = u8Keep[i];
+            GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPU;
+            GPIO_Init(pPort[i], &GPIO_InitStructure);
+        }
+    }
+    // ports without pins in use are gated off again
+    clockRelease(CLOCK_GPIOA);
+    clockRelease(CLOCK_GPIOC);
+    clockRelease(CLOCK_GPIOD);
+    clockRelease(CLOCK_PWR);
+    clockRelease(CLOCK_AFIO);
+    EXTI->EVENR &= ~u32Wake;
+    EXTI->RTENR = u32Rising;
+    EXTI->FTENR = u32Falling;
+    EXTI->INTFR = u32IntMask & ~u32Wake; // edges seen while the pins were pulled down
+    EXTI->INTENR = u32IntMask;
+    PROFILE_END(PROF_WAKE);
+    diagStandby(iTicks);
+    return bPin;
+} /* Standby82msWake() */
 
-    GPIO_DeInit(GPIOA);
-    GPIO_DeInit(GPIOC);
-    GPIO_DeInit(GPIOD);
-
-} /* Standby82ms() */
+//
+// Measure the supply (battery) voltage in millivolts
+// by converting the 1.2V internal reference against VDD
+// The ADC keeps its calibration while its clock is off, so it is
+// calibrated once; the result takes a divide, so don't call it often
+//
+int readVDD(void)
+{
+    static uint8_t bCalibrated = 0;
+    ADC_InitTypeDef ADC_InitStructure = {0};
+    int iRaw;
+
+    clockAcquire(CLOCK_ADC1);
+    RCC_ADCCLKConfig(RCC_PCLK2_Div8);
+    ADC_InitStructure.ADC_Mode = ADC_Mode_Independent;
+    ADC_InitStructure.ADC_ScanConvMode = DISABLE;
+    ADC_InitStructure.ADC_ContinuousConvMode = DISABLE;
+    ADC_InitStructure.ADC_ExternalTrigConv = ADC_ExternalTrigConv_None;
+    ADC_InitStructure.ADC_DataAlign = ADC_DataAlign_Right;
+    ADC_InitStructure.ADC_NbrOfChannel = 1;
+    ADC_Init(ADC1, &ADC_InitStructure);
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_Vrefint, 1, ADC_SampleTime_241Cycles);
+    ADC_Cmd(ADC1, ENABLE);
+    if (!bCalibrated) {
+        ADC_ResetCalibration(ADC1);
+        while (ADC_GetResetCalibrationStatus(ADC1));
+        ADC_StartCalibration(ADC1);
+        while (ADC_GetCalibrationStatus(ADC1));
+        bCalibrated = 1;
+    } else {
+        Delay_Us(1); // ADC power-up time
+    }
+    ADC_SoftwareStartConvCmd(ADC1, ENABLE);
+    while (!ADC_GetFlagStatus(ADC1, ADC_FLAG_EOC));
+    iRaw = ADC_GetConversionValue(ADC1);
+    ADC_Cmd(ADC1, DISABLE);
+    clockRelease(CLOCK_ADC1);
+    if (iRaw == 0)
+        return 0;
+    return (1200 * 1023) / iRaw; // 10-bit result
+} /* readVDD() */
 
 //
 // Ramp an LED brightness with PWM from 0 to 50%
@@ -241,6 +368,11 @@ void breatheLED(uint8_t u8Pin, int iPeriod)
 {
 	int i, j, iStep, iCount, iOnTime;
 
+	if (pwmBreathe(u8Pin, PWM_MAX/2, iPeriod, 1) == 0) {
+		pwmWait(u8Pin); // the timer ramps the duty while the core sleeps
+		return;
+	}
+	// no timer output on this pin; bit-bang it
 	pinMode(u8Pin, OUTPUT);
 	// Use a pwm freq of 1000hz and 50 steps up then 50 steps down
 	iStep = 10000/iPeriod; // us per step
@@ -249,9 +381,9 @@ void breatheLED(uint8_t u8Pin, int iPeriod)
 	iOnTime = 0;
 	for (i=0; i<iCount; i++) {
 		for (j=0; j<20; j++) { // 20ms per step
-			digitalWrite(u8Pin, 1); // on period
+			digitalWriteFast(u8Pin, 1); // on period
 			Delay_Us(iOnTime);
-			digitalWrite(u8Pin, 0); // off period
+			digitalWriteFast(u8Pin, 0); // off period
 			Delay_Us(1000 - iOnTime);
 		} // for j
 		iOnTime += iStep;
@@ -260,9 +392,9 @@ void breatheLED(uint8_t u8Pin, int iPeriod)
 	iOnTime = 500;
 	for (i=0; i<iCount; i++) {
 		for (j=0; j<20; j++) { // 20ms per step
-			digitalWrite(u8Pin, 1); // on period
+			digitalWriteFast(u8Pin, 1); // on period
 			Delay_Us(iOnTime);
-			digitalWrite(u8Pin, 0); // off period
+			digitalWriteFast(u8Pin, 0); // off period
 			Delay_Us(1000 - iOnTime);
 		} // for j
 		iOnTime -= iStep;
@@ -274,7 +406,10 @@ void SPI_begin(int iSpeed, int iMode)
     GPIO_InitTypeDef GPIO_InitStructure={0};
     SPI_InitTypeDef SPI_InitStructure={0};
 
-    RCC_APB2PeriphClockCmd( RCC_APB2Periph_GPIOC | RCC_APB2Periph_SPI1, ENABLE );
+    if (!clockIsOn(CLOCK_SPI1)) {
+        clockAcquire(CLOCK_GPIOC);
+        clockAcquire(CLOCK_SPI1);
+    }
 
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_5;
     GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
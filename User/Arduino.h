@@ -20,12 +20,15 @@
 #ifndef USER_ARDUINO_H_
 #define USER_ARDUINO_H_
 
+#include <ch32v00x.h>
+
 // GPIO pin states
 enum {
 	OUTPUT = 0,
 	INPUT,
 	INPUT_PULLUP,
-	INPUT_PULLDOWN
+	INPUT_PULLDOWN,
+	OUTPUT_AF // push-pull, driven by a peripheral
 };
 
 #define PROGMEM
@@ -33,6 +36,18 @@ enum {
 #define pgm_read_byte(s) *(uint8_t *)s
 #define pgm_read_word(s) *(uint16_t *)s
 
+//
+// Run a function from RAM (the .ramfunc section, copied there by the
+// startup code). Above 24MHz every FLASH fetch takes a wait state, so
+// it pays off for the few CPU-bound inner loops; each one costs its size
+// in RAM, which is scarce. It must not be inlined into a caller in FLASH.
+//
+#ifdef __riscv
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline, noclone))
+#else
+#define RAMFUNC // host build
+#endif
+
 // Wrapper methods
 void delay(int i);
 //
@@ -45,6 +60,51 @@ void pinMode(uint8_t u8Pin, int iMode);
 uint8_t digitalRead(uint8_t u8Pin);
 void digitalWrite(uint8_t u8Pin, uint8_t u8Value);
 
+//
+// Fast path versions of the above
+// The port base and bit are computed from the pin number without a switch,
+// so a constant pin number folds into a single register access.
+// No range checking; pinModeFast() only reconfigures a pin that was set up
+// with pinMode() before (it doesn't enable the port clock).
+//
+#define PIN_PORT(p) ((GPIO_TypeDef *)(GPIOA_BASE + ((((p) >> 4) - 0xa) << 10)))
+#define PIN_MASK(p) (1 << ((p) & 0xf))
+
+static inline __attribute__((always_inline)) void digitalWriteFast(uint8_t u8Pin, uint8_t u8Value)
+{
+	if (u8Value)
+		PIN_PORT(u8Pin)->BSHR = PIN_MASK(u8Pin);
+	else
+		PIN_PORT(u8Pin)->BCR = PIN_MASK(u8Pin);
+} /* digitalWriteFast() */
+
+static inline __attribute__((always_inline)) uint8_t digitalReadFast(uint8_t u8Pin)
+{
+	return (PIN_PORT(u8Pin)->INDR >> (u8Pin & 0xf)) & 1;
+} /* digitalReadFast() */
+
+static inline __attribute__((always_inline)) void pinModeFast(uint8_t u8Pin, int iMode)
+{
+	GPIO_TypeDef *pPort = PIN_PORT(u8Pin);
+	int iShift = (u8Pin & 7) * 4;
+	uint32_t u32Cfg;
+
+	// 4 bits per pin: CNF[1:0] MODE[1:0]
+	if (iMode == OUTPUT)
+		u32Cfg = 0x3; // push-pull, 50MHz
+	else if (iMode == OUTPUT_AF)
+		u32Cfg = 0xb; // alternate function push-pull, 50MHz
+	else if (iMode == INPUT)
+		u32Cfg = 0x4; // floating
+	else
+		u32Cfg = 0x8; // pull-up/down, selected by OUTDR
+	pPort->CFGLR = (pPort->CFGLR & ~(0xf << iShift)) | (u32Cfg << iShift);
+	if (iMode == INPUT_PULLUP)
+		pPort->BSHR = PIN_MASK(u8Pin);
+	else if (iMode == INPUT_PULLDOWN)
+		pPort->BCR = PIN_MASK(u8Pin);
+} /* pinModeFast() */
+
 // The Wire library is a C++ class; I've created a work-alike to my
 // BitBang_I2C API which is a set of C functions to simplify I2C
 void I2CInit(int iSpeed);
@@ -60,6 +120,8 @@ void SPI_begin(int iSpeed, int iMode);
 
 // Random stuff
 void Standby82ms(uint8_t iTicks);
+int Standby82msWake(uint8_t iTicks, uint8_t u8Pin0, uint8_t u8Pin1); // returns 1 if a pin ended it
+int readVDD(void); // supply voltage in mV
 void breatheLED(uint8_t u8Pin, int iPeriod);
 
 
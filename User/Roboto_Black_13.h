@@ -196,5 +196,5 @@ const GFXglyph Roboto_Black_13Glyphs[] PROGMEM = {
 	  {   635,   4,  12,   5,    0,  -10 } // '}'
 };
 const GFXfont Roboto_Black_13 PROGMEM = {
-(uint8_t  *)Roboto_Black_13Bitmaps,(GFXglyph *)Roboto_Black_13Glyphs,0x20, 0x7E, 17};
+(uint8_t  *)Roboto_Black_13Bitmaps,(GFXglyph *)Roboto_Black_13Glyphs,0x20, 0x7D, 17}; // no glyph for 0x7E
 
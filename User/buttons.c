@@ -0,0 +1,291 @@
+//
+// Interrupt-driven button events
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "Arduino.h"
+#include "clock.h"
+#include "buttons.h"
+
+#define EDGE_RING 8 // raw edges kept per button (power of 2)
+#define EVENT_QUEUE 8 // debounced events (power of 2)
+
+typedef struct tagButton
+{
+	uint8_t u8Pin;
+	uint8_t bDown; // debounced state
+	uint8_t bPendingPress; // press held back for BTN_CHORD_MS
+	uint8_t bDouble; // the pending press is a double press
+	uint8_t bLongSent;
+	uint8_t bReleased; // u32ReleaseTime is valid for double press detection
+	uint32_t u32PressTime, u32ReleaseTime;
+	// raw edges written by the interrupt handler
+	volatile uint8_t u8EdgeHead;
+	uint8_t u8EdgeTail;
+	volatile uint8_t u8EdgeLevel[EDGE_RING]; // 1 = pressed
+	volatile uint32_t u32EdgeTime[EDGE_RING];
+} BUTTON;
+
+static BUTTON buttons[2];
+static uint8_t bChord;
+static BTN_EVENT events[EVENT_QUEUE];
+static uint8_t u8EventHead, u8EventTail;
+static volatile uint8_t u8NewEdge; // wakes btnWaitEvent
+static uint32_t u32Debounce, u32ChordWindow, u32LongPress, u32DoubleWindow; // in ticks
+
+void EXTI7_0_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+
+//
+// Capture the edge and time of each button
+//
+void EXTI7_0_IRQHandler(void)
+{
+	int i;
+	uint32_t u32Now = Delay_GetTick();
+
+	for (i=0; i<2; i++) {
+		BUTTON *pBtn = &buttons[i];
+		uint32_t u32Line = 1 << (pBtn->u8Pin & 7);
+		if (EXTI->INTFR & u32Line) {
+			EXTI->INTFR = u32Line; // clear it
+			if (((pBtn->u8EdgeHead - pBtn->u8EdgeTail) & 0xff) < EDGE_RING) { // drop it if full
+				pBtn->u8EdgeLevel[pBtn->u8EdgeHead & (EDGE_RING-1)] = !digitalReadFast(pBtn->u8Pin);
+				pBtn->u32EdgeTime[pBtn->u8EdgeHead & (EDGE_RING-1)] = u32Now;
+				pBtn->u8EdgeHead++;
+			}
+			u8NewEdge = 1;
+		}
+	}
+} /* EXTI7_0_IRQHandler() */
+
+static void btnPush(uint8_t u8Type, uint8_t u8Buttons, uint32_t u32Time)
+{
+	BTN_EVENT *pEvent;
+
+	if (((u8EventHead - u8EventTail) & 0xff) >= EVENT_QUEUE)
+		return; // nobody is reading them
+	pEvent = &events[u8EventHead & (EVENT_QUEUE-1)];
+	pEvent->u8Type = u8Type;
+	pEvent->u8Buttons = u8Buttons;
+	pEvent->u32Time = u32Time;
+	u8EventHead++;
+} /* btnPush() */
+
+static void btnReportPress(int i)
+{
+	BUTTON *pBtn = &buttons[i];
+
+	if (pBtn->bPendingPress) {
+		pBtn->bPendingPress = 0;
+		btnPush(BTN_EVT_PRESS, 1 << i, pBtn->u32PressTime);
+		if (pBtn->bDouble)
+			btnPush(BTN_EVT_DOUBLE, 1 << i, pBtn->u32PressTime);
+	}
+} /* btnReportPress() */
+
+//
+// A debounced edge of button i
+//
+static void btnEdge(int i, int bDown, uint32_t u32Time)
+{
+	BUTTON *pBtn = &buttons[i], *pOther = &buttons[i^1];
+
+	pBtn->bDown = bDown;
+	if (bDown) {
+		if (pOther->bDown) { // second button of a chord
+			if (!bChord) {
+				bChord = 1;
+				pOther->bPendingPress = 0;
+				pBtn->bReleased = pOther->bReleased = 0;
+				btnPush(BTN_EVT_CHORD, 3, u32Time);
+			}
+		} else {
+			pBtn->u32PressTime = u32Time;
+			pBtn->bPendingPress = 1;
+			pBtn->bLongSent = 0;
+			pBtn->bDouble = (pBtn->bReleased && (u32Time - pBtn->u32ReleaseTime) <= u32DoubleWindow);
+		}
+	} else { // released
+		if (bChord) { // chords have no release events
+			if (!pOther->bDown)
+				bChord = 0;
+		} else {
+			btnReportPress(i);
+			btnPush(BTN_EVT_RELEASE, 1 << i, u32Time);
+			pBtn->u32ReleaseTime = u32Time;
+			pBtn->bReleased = !pBtn->bDouble && !pBtn->bLongSent;
+		}
+	}
+} /* btnEdge() */
+
+//
+// Turn the raw edges into events
+// returns the number of ticks until it needs to run again (0xffffffff = idle)
+//
+static uint32_t btnService(void)
+{
+	int i, iFirst;
+	uint32_t u32Now = Delay_GetTick(), u32Wait = 0xffffffff, u32Age;
+
+	while (1) { // debounce the edges of both buttons in time order
+		iFirst = -1;
+		for (i=0; i<2; i++) {
+			BUTTON *pBtn = &buttons[i];
+			if (pBtn->u8EdgeTail != pBtn->u8EdgeHead && (iFirst < 0 ||
+			    (int32_t)(pBtn->u32EdgeTime[pBtn->u8EdgeTail & (EDGE_RING-1)] - buttons[iFirst].u32EdgeTime[buttons[iFirst].u8EdgeTail & (EDGE_RING-1)]) < 0))
+				iFirst = i;
+		}
+		if (iFirst < 0)
+			break;
+		BUTTON *pBtn = &buttons[iFirst];
+		uint8_t u8Tail = pBtn->u8EdgeTail & (EDGE_RING-1);
+		uint32_t u32Time = pBtn->u32EdgeTime[u8Tail];
+		if ((uint8_t)(pBtn->u8EdgeTail + 1) != pBtn->u8EdgeHead) { // another edge follows
+			u32Age = pBtn->u32EdgeTime[(u8Tail + 1) & (EDGE_RING-1)] - u32Time;
+		} else {
+			u32Age = u32Now - u32Time;
+			if (u32Age < u32Debounce) { // not settled yet
+				u32Wait = u32Debounce - u32Age;
+				break;
+			}
+		}
+		if (u32Age >= u32Debounce && pBtn->u8EdgeLevel[u8Tail] != pBtn->bDown)
+			btnEdge(iFirst, pBtn->u8EdgeLevel[u8Tail], u32Time);
+		pBtn->u8EdgeTail++; // shorter pulses are bounce
+	}
+	for (i=0; i<2; i++) { // timed gestures
+		BUTTON *pBtn = &buttons[i];
+		if (!pBtn->bDown || bChord)
+			continue;
+		u32Age = u32Now - pBtn->u32PressTime;
+		if (pBtn->bPendingPress) {
+			if (u32Age >= u32ChordWindow)
+				btnReportPress(i);
+			else if (u32ChordWindow - u32Age < u32Wait)
+				u32Wait = u32ChordWindow - u32Age;
+		}
+		if (!pBtn->bLongSent) {
+			if (u32Age >= u32LongPress) {
+				btnReportPress(i);
+				btnPush(BTN_EVT_LONG, 1 << i, u32Now);
+				pBtn->bLongSent = 1;
+			} else if (u32LongPress - u32Age < u32Wait) {
+				u32Wait = u32LongPress - u32Age;
+			}
+		}
+	}
+	return u32Wait;
+} /* btnService() */
+
+void btnInit(uint8_t u8Pin0, uint8_t u8Pin1)
+{
+	EXTI_InitTypeDef EXTI_InitStructure = {0};
+	int i;
+
+	u32Debounce = Delay_MsToTicks(BTN_DEBOUNCE_MS);
+	u32ChordWindow = Delay_MsToTicks(BTN_CHORD_MS);
+	u32LongPress = Delay_MsToTicks(BTN_LONG_MS);
+	u32DoubleWindow = Delay_MsToTicks(BTN_DOUBLE_MS);
+	buttons[0].u8Pin = u8Pin0;
+	buttons[1].u8Pin = u8Pin1;
+	clockAcquire(CLOCK_AFIO); // only needed to route the lines
+	for (i=0; i<2; i++) {
+		uint8_t u8Pin = buttons[i].u8Pin;
+		pinMode(u8Pin, INPUT_PULLUP);
+		buttons[i].bDown = !digitalRead(u8Pin);
+		GPIO_EXTILineConfig((u8Pin >> 4) - 0xa, u8Pin & 7);
+		EXTI_InitStructure.EXTI_Line |= (1 << (u8Pin & 7));
+	}
+	clockRelease(CLOCK_AFIO);
+	EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+	EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising_Falling;
+	EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+	EXTI_Init(&EXTI_InitStructure);
+	EXTI->INTFR = EXTI_InitStructure.EXTI_Line;
+	NVIC_EnableIRQ(EXTI7_0_IRQn);
+} /* btnInit() */
+
+void btnResync(void)
+{
+	int i;
+
+	for (i=0; i<2; i++)
+		pinModeFast(buttons[i].u8Pin, INPUT_PULLUP);
+} /* btnResync() */
+
+int btnGetState(void)
+{
+	int i, iState = 0;
+
+	for (i=0; i<2; i++) {
+		if (digitalReadFast(buttons[i].u8Pin) == 0)
+			iState |= (1 << i);
+	}
+	return iState;
+} /* btnGetState() */
+
+int btnGetEvent(BTN_EVENT *pEvent)
+{
+	btnService();
+	if (u8EventTail == u8EventHead)
+		return 0;
+	*pEvent = events[u8EventTail & (EVENT_QUEUE-1)];
+	u8EventTail++;
+	return 1;
+} /* btnGetEvent() */
+
+int btnWaitEvent(BTN_EVENT *pEvent, int iTimeoutMs)
+{
+	uint32_t u32Start = Delay_GetTick(), u32Wait, u32Left = 0;
+	uint32_t u32Timeout = (iTimeoutMs < 0) ? 0 : Delay_MsToTicks(iTimeoutMs);
+
+	while (1) {
+		u8NewEdge = 0;
+		u32Wait = btnService();
+		if (u8EventTail != u8EventHead)
+			return btnGetEvent(pEvent);
+		if (iTimeoutMs >= 0) {
+			u32Left = Delay_GetTick() - u32Start;
+			if (u32Left >= u32Timeout)
+				return 0;
+			u32Left = u32Timeout - u32Left;
+			if (u32Left < u32Wait)
+				u32Wait = u32Left;
+		}
+		if (u32Wait > 0x40000000)
+			u32Wait = 0x40000000;
+		Delay_Wait(u32Wait, &u8NewEdge); // sleep until an edge or the next gesture deadline
+	}
+} /* btnWaitEvent() */
+
+void btnFlush(void)
+{
+	uint32_t u32Wait;
+
+	while (1) {
+		u8NewEdge = 0;
+		u32Wait = btnService();
+		u8EventTail = u8EventHead; // drop them
+		if (!buttons[0].bDown && !buttons[1].bDown &&
+		    buttons[0].u8EdgeTail == buttons[0].u8EdgeHead && buttons[1].u8EdgeTail == buttons[1].u8EdgeHead)
+			return;
+		if (u32Wait > 0x40000000)
+			u32Wait = 0x40000000;
+		Delay_Wait(u32Wait, &u8NewEdge);
+	}
+} /* btnFlush() */
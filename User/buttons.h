@@ -0,0 +1,65 @@
+//
+// Interrupt-driven button events
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_BUTTONS_H_
+#define USER_BUTTONS_H_
+
+// Event types
+enum {
+	BTN_EVT_NONE = 0,
+	BTN_EVT_PRESS,
+	BTN_EVT_RELEASE,
+	BTN_EVT_LONG, // held for BTN_LONG_MS
+	BTN_EVT_DOUBLE, // second press within BTN_DOUBLE_MS of the last release
+	BTN_EVT_CHORD // both buttons down together
+};
+
+// Timing (milliseconds)
+#define BTN_DEBOUNCE_MS 20
+#define BTN_CHORD_MS 80 // a press is held back this long in case it becomes a chord
+#define BTN_LONG_MS 800
+#define BTN_DOUBLE_MS 350
+
+typedef struct tagBtnEvent
+{
+	uint8_t u8Type;
+	uint8_t u8Buttons; // bit 0 = button 0, bit 1 = button 1
+	uint32_t u32Time; // SysTick count of the (debounced) edge
+} BTN_EVENT;
+
+//
+// The two buttons are active low on pins 0-7 of any port (EXTI lines 0-7)
+// Edges are captured by the EXTI interrupt with a timestamp, so presses
+// made during a blocking operation are not lost. Debouncing and gestures
+// are resolved from the timestamps when events are read.
+//
+void btnInit(uint8_t u8Pin0, uint8_t u8Pin1);
+// re-apply the pull-ups after standby reset the GPIO ports
+void btnResync(void);
+// current (raw) state of the buttons, bit set = pressed
+int btnGetState(void);
+// non-blocking; returns 1 if an event was copied to pEvent
+int btnGetEvent(BTN_EVENT *pEvent);
+// sleep until an event arrives or iTimeoutMs passes (-1 = forever); returns 1 for an event
+int btnWaitEvent(BTN_EVENT *pEvent, int iTimeoutMs);
+// drop queued events and wait for all buttons to be released
+void btnFlush(void);
+
+#endif /* USER_BUTTONS_H_ */
@@ -0,0 +1,161 @@
+//
+// Reference-counted peripheral clock manager
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "clock.h"
+
+// Which bus enable register each clock lives in
+enum {
+	BUS_AHB = 0,
+	BUS_APB1,
+	BUS_APB2
+};
+
+static const uint8_t u8ClockBus[CLOCK_COUNT] = {
+	BUS_APB2, BUS_APB2, BUS_APB2, BUS_APB2, BUS_APB1, BUS_APB2,
+	BUS_APB2, BUS_APB2, BUS_APB2, BUS_APB1, BUS_APB1, BUS_AHB};
+static const uint32_t u32ClockBit[CLOCK_COUNT] = {
+	RCC_APB2Periph_GPIOA, RCC_APB2Periph_GPIOC, RCC_APB2Periph_GPIOD,
+	RCC_APB2Periph_AFIO, RCC_APB1Periph_I2C1, RCC_APB2Periph_SPI1,
+	RCC_APB2Periph_USART1, RCC_APB2Periph_ADC1, RCC_APB2Periph_TIM1,
+	RCC_APB1Periph_TIM2, RCC_APB1Periph_PWR, RCC_AHBPeriph_DMA1};
+
+static uint8_t u8RefCount[CLOCK_COUNT];
+static uint16_t u16On; // clocks with at least one user
+static uint16_t u16Awake; // clocks that were on since the last wake
+static uint16_t u16Asleep; // clocks clockSleep() gated until the next clockWake()
+// GPIO outputs (LEDs, motor) must hold their level while the core sleeps
+static uint16_t u16KeepAwake = (1 << CLOCK_GPIOA) | (1 << CLOCK_GPIOC) | (1 << CLOCK_GPIOD);
+static CLOCK_REPORT report;
+
+// The timer interrupts start and stop their own clocks, so the
+// bookkeeping is done with interrupts masked
+#define CLOCK_LOCK() uint32_t u32Status = __get_MSTATUS(); __disable_irq()
+#define CLOCK_UNLOCK() __set_MSTATUS(u32Status)
+
+static void clockSet(int iClock, FunctionalState bOn)
+{
+	switch (u8ClockBus[iClock]) {
+	case BUS_AHB:
+		RCC_AHBPeriphClockCmd(u32ClockBit[iClock], bOn);
+		break;
+	case BUS_APB1:
+		RCC_APB1PeriphClockCmd(u32ClockBit[iClock], bOn);
+		break;
+	case BUS_APB2:
+		RCC_APB2PeriphClockCmd(u32ClockBit[iClock], bOn);
+		break;
+	}
+} /* clockSet() */
+
+void clockAcquire(int iClock)
+{
+	CLOCK_LOCK();
+	// an interrupt handler can add a user while clockSleep() has the clock gated
+	if (u8RefCount[iClock]++ == 0 || (u16Asleep & (1 << iClock))) {
+		clockSet(iClock, ENABLE);
+		u16On |= (1 << iClock);
+		u16Awake |= (1 << iClock);
+		u16Asleep &= ~(1 << iClock);
+	}
+	CLOCK_UNLOCK();
+} /* clockAcquire() */
+
+void clockRelease(int iClock)
+{
+	CLOCK_LOCK();
+	if (u8RefCount[iClock] != 0 && --u8RefCount[iClock] == 0) { // ignore an unbalanced release
+		clockSet(iClock, DISABLE);
+		u16On &= ~(1 << iClock);
+		u16Asleep &= ~(1 << iClock);
+	}
+	CLOCK_UNLOCK();
+} /* clockRelease() */
+
+int clockIsOn(int iClock)
+{
+	return (u16On >> iClock) & 1;
+} /* clockIsOn() */
+
+void clockKeepAwake(int iClock, int bKeep)
+{
+	CLOCK_LOCK();
+	if (bKeep)
+		u16KeepAwake |= (1 << iClock);
+	else
+		u16KeepAwake &= ~(1 << iClock);
+	CLOCK_UNLOCK();
+} /* clockKeepAwake() */
+
+//
+// Log the clocks which were on while the core was awake
+//
+static void clockLogWake(void)
+{
+	int i;
+
+	report.u16Log[report.u32Wakes & (CLOCK_LOG_SIZE-1)] = u16Awake;
+	report.u32Wakes++;
+	for (i=0; i<CLOCK_COUNT; i++) {
+		if (u16Awake & (1 << i))
+			report.u16OnCount[i]++;
+	}
+	u16Awake = u16On;
+} /* clockLogWake() */
+
+uint16_t clockSleep(void)
+{
+	int i;
+	uint16_t u16Gated;
+	CLOCK_LOCK();
+
+	u16Gated = u16On & ~u16KeepAwake;
+	u16Asleep = u16Gated;
+	clockLogWake();
+	for (i=0; i<CLOCK_COUNT; i++) {
+		if (u16Gated & (1 << i))
+			clockSet(i, DISABLE);
+	}
+	CLOCK_UNLOCK();
+	return u16Gated;
+} /* clockSleep() */
+
+void clockWake(uint16_t u16Gated)
+{
+	int i;
+	CLOCK_LOCK();
+
+	u16Gated &= u16On; // an interrupt may have released one meanwhile
+	u16Asleep = 0;
+	for (i=0; i<CLOCK_COUNT; i++) {
+		if (u16Gated & (1 << i))
+			clockSet(i, ENABLE);
+	}
+	CLOCK_UNLOCK();
+} /* clockWake() */
+
+void clockStandby(void)
+{
+	clockLogWake();
+} /* clockStandby() */
+
+void clockGetReport(CLOCK_REPORT *pReport)
+{
+	*pReport = report;
+} /* clockGetReport() */
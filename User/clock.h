@@ -0,0 +1,66 @@
+//
+// Reference-counted peripheral clock manager
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_CLOCK_H_
+#define USER_CLOCK_H_
+
+// Peripherals with a gated clock
+enum {
+	CLOCK_GPIOA = 0,
+	CLOCK_GPIOC,
+	CLOCK_GPIOD,
+	CLOCK_AFIO,
+	CLOCK_I2C1,
+	CLOCK_SPI1,
+	CLOCK_USART1,
+	CLOCK_ADC1,
+	CLOCK_TIM1,
+	CLOCK_TIM2,
+	CLOCK_PWR,
+	CLOCK_DMA1,
+	CLOCK_COUNT
+};
+
+// Number of wakes kept in the log of the clock report
+#define CLOCK_LOG_SIZE 8
+
+typedef struct tagClockReport
+{
+	uint32_t u32Wakes; // number of sleep/standby periods ended
+	uint16_t u16OnCount[CLOCK_COUNT]; // wakes during which each clock was on
+	uint16_t u16Log[CLOCK_LOG_SIZE]; // masks of the clocks on during the latest wakes
+} CLOCK_REPORT;
+
+// A peripheral's clock runs while it has at least one user; acquiring one
+// that clockSleep() gated turns it back on
+void clockAcquire(int iClock);
+void clockRelease(int iClock);
+int clockIsOn(int iClock);
+// Keep a peripheral clocked while the core sleeps (e.g. a timer or DMA running)
+void clockKeepAwake(int iClock, int bKeep);
+// Gate the clocks that aren't needed while the core sleeps,
+// returns the mask to pass to clockWake()
+uint16_t clockSleep(void);
+void clockWake(uint16_t u16Gated);
+// Standby stops every clock; just log the wake
+void clockStandby(void);
+void clockGetReport(CLOCK_REPORT *pReport);
+
+#endif /* USER_CLOCK_H_ */
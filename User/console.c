@@ -0,0 +1,133 @@
+//
+// Serial command console
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "telemetry.h"
+#include "history.h"
+#include "console.h"
+#include "fmt.h"
+#include "scratch.h"
+
+#ifdef CONSOLE
+
+static char szLine[CONSOLE_LINE];
+static uint8_t u8LineLen;
+
+void consoleStart(void)
+{
+	u8LineLen = 0;
+	telemetryEnableRx(1);
+} /* consoleStart() */
+
+void consoleStop(void)
+{
+	telemetryEnableRx(0);
+} /* consoleStop() */
+
+char *consoleGetLine(void)
+{
+	int c;
+
+	while ((c = telemetryRead()) >= 0) {
+		if (c == '\r' || c == '\n') {
+			if (u8LineLen == 0)
+				continue; // empty line or the 2nd half of CR/LF
+			szLine[u8LineLen] = 0;
+			u8LineLen = 0;
+			return szLine;
+		}
+		if (u8LineLen < CONSOLE_LINE - 1) // overlong lines get truncated
+			szLine[u8LineLen++] = (char)c;
+	}
+	return NULL;
+} /* consoleGetLine() */
+
+void consolePuts(const char *szText)
+{
+	uint8_t *d;
+	int iLen;
+
+	while (*szText) {
+		d = telemetryGetBuffer();
+		for (iLen=0; iLen<TELEMETRY_TX_SIZE && *szText; iLen++)
+			*d++ = (uint8_t)*szText++;
+		telemetryWrite(iLen);
+	}
+} /* consolePuts() */
+
+void consolePrintf(const char *szFormat, ...)
+{
+	int iMark = scratchMark();
+	SCRATCH_ALLOC(char, szTemp, 2 * TELEMETRY_TX_SIZE, SCRATCH_LEAF);
+	va_list args;
+
+	va_start(args, szFormat);
+	fmtVString(szTemp, 2 * TELEMETRY_TX_SIZE, szFormat, args);
+	va_end(args);
+	consolePuts(szTemp);
+	scratchRelease(iMark);
+} /* consolePrintf() */
+
+int consoleGetInt(char **ppsz, int *pValue)
+{
+	char *s = *ppsz;
+	int iVal = 0;
+
+	while (*s == ' ')
+		s++;
+	if (*s < '0' || *s > '9')
+		return -1;
+	while (*s >= '0' && *s <= '9')
+		iVal = (iVal * 10) + (*s++ - '0');
+	*ppsz = s;
+	*pValue = iVal;
+	return 0;
+} /* consoleGetInt() */
+
+uint32_t consoleDump(uint32_t u32Seq)
+{
+	HISTORY_ENTRY entry;
+	uint8_t *pFrame, *d;
+	int iCount;
+
+	if (u32Seq < historyFirst())
+		u32Seq = historyFirst();
+	while (u32Seq < historyNext()) {
+		// DMA sends one buffer while the next one is filled
+		pFrame = telemetryGetBuffer();
+		d = &pFrame[3 + 8];
+		for (iCount=0; iCount < TELEMETRY_HISTORY_MAX && historyGet(u32Seq + iCount, &entry) == 0; iCount++) {
+			*d++ = entry.u8CO2;
+			*d++ = entry.u8Temperature;
+			*d++ = entry.u8Humidity;
+		}
+		pFrame[3] = TELEMETRY_TYPE_HISTORY;
+		pFrame[4] = (uint8_t)iCount;
+		pFrame[5] = (uint8_t)u32Seq;
+		pFrame[6] = (uint8_t)(u32Seq >> 8);
+		pFrame[7] = (uint8_t)(u32Seq >> 16);
+		pFrame[8] = (uint8_t)(u32Seq >> 24);
+		pFrame[9] = (uint8_t)HISTORY_INTERVAL_SECS;
+		pFrame[10] = (uint8_t)(HISTORY_INTERVAL_SECS >> 8);
+		telemetryWrite(telemetryWrap(pFrame, 8 + 3 * iCount));
+		u32Seq += iCount;
+	}
+	return u32Seq;
+} /* consoleDump() */
+#endif // CONSOLE
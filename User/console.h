@@ -0,0 +1,51 @@
+//
+// Serial command console
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_CONSOLE_H_
+#define USER_CONSOLE_H_
+
+//
+// Line based commands arrive on USART1 RX (interrupt ring buffer);
+// replies and history dumps go out through the telemetry DMA buffers.
+// Text lines end with CR/LF; dumps use TELEMETRY_TYPE_HISTORY frames.
+// The console is the "PC Link" mode; with the history it dumps and the
+// USART1 driver under it, it takes more FLASH and RAM than the 16K part has
+// to spare next to the other modes, so it's off unless CONSOLE is defined
+// here or by the build. DEBUG_MODE (main.c) prints on it and needs it too.
+//
+//#define CONSOLE
+#define CONSOLE_BAUD 230400
+#define CONSOLE_LINE 32
+
+void consoleStart(void);
+void consoleStop(void);
+// Returns a complete command line (without the line end) or NULL
+char *consoleGetLine(void);
+// Send text
+void consolePuts(const char *szText);
+// Send formatted text (see fmt.h; up to 2 lines worth)
+void consolePrintf(const char *szFormat, ...);
+// Parse a decimal number at *ppsz (skipping leading spaces); returns 0 on success
+int consoleGetInt(char **ppsz, int *pValue);
+// Stream the history from sequence number u32Seq on (older requests start
+// at the oldest entry held); returns the sequence number to resume from
+uint32_t consoleDump(uint32_t u32Seq);
+
+#endif /* USER_CONSOLE_H_ */
@@ -0,0 +1,76 @@
+//
+// Field diagnostics counters
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "clock.h"
+#include "fastmath.h"
+#include "diag.h"
+
+static DIAG_COUNTERS diag;
+static uint32_t u32AwakeTicks, u32LastTick;
+static uint16_t u16StandbyMs; // less than a second, not in diag yet
+
+void diagError(int iError)
+{
+	if (diag.u16Errors[iError] != 0xffff)
+		diag.u16Errors[iError]++;
+} /* diagError() */
+
+void diagAwake(void)
+{
+	uint32_t u32Tick = Delay_GetTick();
+	uint32_t u32Second = Delay_MsToTicks(1000);
+
+	u32AwakeTicks += u32Tick - u32LastTick; // the first call counts from reset
+	u32LastTick = u32Tick;
+	while (u32AwakeTicks >= u32Second) { // no divider; at most a wrap's worth of seconds
+		u32AwakeTicks -= u32Second;
+		diag.u32AwakeSecs++;
+	}
+} /* diagAwake() */
+
+void diagStandby(int iTicks)
+{
+	uint32_t u32Ms = u16StandbyMs + (iTicks << 6) + (iTicks << 4) + (iTicks << 1); // 82ms each
+
+	while (u32Ms >= 1000) {
+		u32Ms -= 1000;
+		diag.u32StandbySecs++;
+	}
+	u16StandbyMs = (uint16_t)u32Ms;
+} /* diagStandby() */
+
+uint32_t diagStandbyMs(void)
+{
+	return mul1000(diag.u32StandbySecs) + u16StandbyMs;
+} /* diagStandbyMs() */
+
+void diagGetCounters(DIAG_COUNTERS *pCounters)
+{
+	CLOCK_REPORT report;
+	uint32_t s;
+
+	diagAwake();
+	clockGetReport(&report);
+	diag.u32Wakes = report.u32Wakes;
+	// uAh = awake * 1800 / 3600 + standby * 10.5 / 3600
+	s = diag.u32StandbySecs;
+	diag.u32ChargeUAh = (diag.u32AwakeSecs >> 1) + (udiv60(udiv60((s << 4) + (s << 2) + s)) >> 1);
+	*pCounters = diag;
+} /* diagGetCounters() */
@@ -0,0 +1,63 @@
+//
+// Field diagnostics counters
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_DIAG_H_
+#define USER_DIAG_H_
+
+//
+// Always-on counters for the hidden diagnostics screen (a chord in the
+// menu): error counts and how long the MCU has been awake and in standby
+// since power-up. Awake time is the SysTick time between updates, which
+// leaves out standby because SysTick stops there; it has to be updated at
+// least once per SysTick wrap (12 minutes at 48MHz), which GetSample()
+// and Standby82ms() do. The charge is an estimate for the MCU alone
+// (1.8mA awake, 10.5uA in standby); the sensor and display are not in it.
+// The screen itself (benchmarks and pages in main.c) takes FLASH the 16K
+// part doesn't have to spare, so it's off unless DIAG_SCREEN is defined
+// here or by the build; the counters are kept either way.
+//
+//#define DIAG_SCREEN
+
+enum {
+	DIAG_ERR_I2C = 0, // bus error, lost arbitration or NACK after a transfer
+	DIAG_ERR_SENSOR, // SCD41 read failed (CRC)
+	DIAG_ERR_NOT_READY, // SCD41 had no new measurement when asked
+	DIAG_ERR_COUNT
+};
+
+typedef struct tagDiagCounters
+{
+	uint32_t u32AwakeSecs;
+	uint32_t u32StandbySecs;
+	uint32_t u32Wakes; // standby and sleep periods ended (clock.c)
+	uint32_t u32ChargeUAh; // MCU only
+	uint16_t u16Errors[DIAG_ERR_COUNT]; // stop counting at 0xffff
+} DIAG_COUNTERS;
+
+void diagError(int iError);
+// Add the SysTick time since the last update to the awake time
+void diagAwake(void);
+// Add iTicks standby periods of 82ms
+void diagStandby(int iTicks);
+// Standby time since power-up in ms (it wraps after 49 days)
+uint32_t diagStandbyMs(void);
+void diagGetCounters(DIAG_COUNTERS *pCounters);
+
+#endif /* USER_DIAG_H_ */
@@ -0,0 +1,127 @@
+//
+// Multiply and divide free arithmetic kernels
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_FASTMATH_H_
+#define USER_FASTMATH_H_
+
+//
+// The RV32EC core has no multiply or divide instructions, so every '*'
+// by a variable and every '/' or '%' is a libgcc call costing hundreds of
+// cycles. These kernels use shifts and adds for the constants we need.
+// Each one is exact over the range given and is checked exhaustively
+// over that range by tools/test_fastmath.c.
+// This header only depends on stdint, so the host tests can include it.
+//
+
+// Constant multipliers
+static inline __attribute__((always_inline)) uint32_t mul5(uint32_t n)
+{
+	return (n << 2) + n;
+} /* mul5() */
+
+static inline __attribute__((always_inline)) uint32_t mul7(uint32_t n)
+{
+	return (n << 3) - n;
+} /* mul7() */
+
+static inline __attribute__((always_inline)) uint32_t mul10(uint32_t n)
+{
+	return ((n << 2) + n) << 1;
+} /* mul10() */
+
+static inline __attribute__((always_inline)) uint32_t mul60(uint32_t n)
+{
+	return (n << 6) - (n << 2);
+} /* mul60() */
+
+static inline __attribute__((always_inline)) uint32_t mul500(uint32_t n)
+{
+	return (n << 9) - (n << 3) - (n << 2);
+} /* mul500() */
+
+// n * 1000 and n * 1750 for n < 65536 (the SCD41 RH and T scale factors)
+static inline __attribute__((always_inline)) uint32_t mul1000(uint32_t n)
+{
+	return (n << 10) - (n << 4) - (n << 3);
+} /* mul1000() */
+
+static inline __attribute__((always_inline)) uint32_t mul1750(uint32_t n)
+{
+	return (n << 11) - (n << 8) - (n << 5) - (n << 3) - (n << 1);
+} /* mul1750() */
+
+//
+// Reciprocal division: the quotient is built from a shifted series of the
+// reciprocal (which can come out one low) and fixed with the remainder
+//
+// n / 10, all 32-bit n
+static inline __attribute__((always_inline)) uint32_t udiv10(uint32_t n)
+{
+	uint32_t q;
+
+	q = (n >> 1) + (n >> 2); // 0.11b
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16; // 0.110011001100...b = 0.8
+	q >>= 3;
+	return q + ((n - mul10(q)) > 9);
+} /* udiv10() */
+
+// n / 60, all 32-bit n; n/4 is scaled by 16/15 = 1.000100010001...b
+static inline __attribute__((always_inline)) uint32_t udiv60(uint32_t n)
+{
+	uint32_t q;
+
+	q = n >> 2;
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16;
+	q >>= 4;
+	return q + ((n - mul60(q)) >= 60);
+} /* udiv60() */
+
+// n / 500, n < 65536; n * (2^22 / 500) rounded up can come out one high
+static inline __attribute__((always_inline)) uint32_t udiv500(uint32_t n)
+{
+	uint32_t q;
+
+	q = ((n << 13) + (n << 7) + (n << 6) + (n << 2) + n) >> 22; // n * 8389 >> 22
+	return q - (mul500(q) > n);
+} /* udiv500() */
+
+//
+// Binary to packed BCD (double dabble), n < 100000000
+// All nibbles which are >= 5 get 3 added in parallel before each shift
+//
+static inline uint32_t ubcd(uint32_t n)
+{
+	uint32_t u32BCD = 0, t;
+	int i;
+
+	for (i=26; i>0 && !(n >> i); i--) {}; // skip the leading zeros
+	for (; i>=0; i--) {
+		t = (u32BCD + 0x33333333) & 0x88888888;
+		u32BCD += (t >> 2) | (t >> 3);
+		u32BCD = (u32BCD << 1) | ((n >> i) & 1);
+	}
+	return u32BCD;
+} /* ubcd() */
+
+#endif /* USER_FASTMATH_H_ */
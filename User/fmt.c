@@ -0,0 +1,172 @@
+//
+// Tiny formatted output (a printf subset without multiply or divide)
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdint.h>
+#include "fmt.h"
+#include "fastmath.h"
+
+static const uint32_t u32Pow10[10] = {1000000000, 100000000, 10000000, 1000000,
+		100000, 10000, 1000, 100, 10, 1};
+
+// Unsigned to decimal digits (no terminator); returns the digit count
+static int fmtDecimal(char *d, uint32_t u32)
+{
+	int i, iLen = 0;
+	char c;
+
+	if (u32 < 100000000) { // convert to packed BCD and read out the nibbles
+		u32 = ubcd(u32);
+		for (i=28; i>0 && !(u32 >> i); i-=4) {};
+		for (; i>=0; i-=4)
+			d[iLen++] = (char)('0' + ((u32 >> i) & 0xf));
+		return iLen;
+	}
+	for (i=0; i<10; i++) {
+		c = '0';
+		while (u32 >= u32Pow10[i]) { // at most 9 subtractions per place
+			u32 -= u32Pow10[i];
+			c++;
+		}
+		if (c != '0' || iLen != 0 || i == 9)
+			d[iLen++] = c;
+	}
+	return iLen;
+} /* fmtDecimal() */
+
+static int fmtHex(char *d, uint32_t u32)
+{
+	int i, iLen = 0, iNibble;
+
+	for (i=28; i>=0; i-=4) {
+		iNibble = (u32 >> i) & 0xf;
+		if (iNibble || iLen || i == 0)
+			d[iLen++] = (char)((iNibble < 10) ? '0' + iNibble : 'a' - 10 + iNibble);
+	}
+	return iLen;
+} /* fmtHex() */
+
+int fmtVString(char *szDest, int iMax, const char *szFormat, va_list args)
+{
+	char szNum[24], c, cPad;
+	const char *s;
+	int i, n, iLen = 0, iWidth, iPrec, bLeft, bNeg;
+	int32_t i32;
+	uint32_t u32;
+
+	if (iMax <= 0)
+		return 0;
+	iMax--; // room for the terminator
+	while ((c = *szFormat++) != 0) {
+		if (c != '%') {
+			if (iLen < iMax) szDest[iLen++] = c;
+			continue;
+		}
+		bLeft = bNeg = 0;
+		cPad = ' ';
+		iWidth = iPrec = 0;
+		if (*szFormat == '-') {
+			bLeft = 1;
+			szFormat++;
+		}
+		if (*szFormat == '0') {
+			cPad = '0';
+			szFormat++;
+		}
+		while (*szFormat >= '0' && *szFormat <= '9')
+			iWidth = (iWidth << 3) + (iWidth << 1) + (*szFormat++ - '0');
+		if (*szFormat == '.' && szFormat[1] >= '0' && szFormat[1] <= '9') {
+			iPrec = szFormat[1] - '0';
+			szFormat += 2;
+		}
+		s = szNum;
+		switch (c = *szFormat++) {
+		case 'd':
+			i32 = va_arg(args, int32_t);
+			if (i32 < 0) {
+				bNeg = 1;
+				u32 = (uint32_t)0 - (uint32_t)i32;
+			} else {
+				u32 = (uint32_t)i32;
+			}
+			n = fmtDecimal(szNum, u32);
+			break;
+		case 'u':
+			n = fmtDecimal(szNum, va_arg(args, uint32_t));
+			break;
+		case 'x':
+			n = fmtHex(szNum, va_arg(args, uint32_t));
+			iPrec = 0;
+			break;
+		case 's':
+			s = va_arg(args, const char *);
+			for (n=0; s[n]; n++) {};
+			iPrec = 0;
+			break;
+		case 'c':
+			szNum[0] = (char)va_arg(args, int);
+			n = 1;
+			iPrec = 0;
+			break;
+		case 0: // format ends with '%'
+			szFormat--;
+			// fall through
+		default: // including %%
+			szNum[0] = '%';
+			n = 1;
+			iPrec = 0;
+			break;
+		}
+		if (iPrec) { // fixed point: at least one digit before the point
+			while (n <= iPrec) {
+				for (i=n; i>0; i--)
+					szNum[i] = szNum[i-1];
+				szNum[0] = '0';
+				n++;
+			}
+			for (i=n; i>n-iPrec; i--)
+				szNum[i] = szNum[i-1];
+			szNum[n-iPrec] = '.';
+			n++;
+		}
+		iWidth -= n + bNeg;
+		if (!bLeft && cPad == ' ')
+			for (; iWidth > 0 && iLen < iMax; iWidth--) szDest[iLen++] = ' ';
+		if (bNeg && iLen < iMax)
+			szDest[iLen++] = '-';
+		if (!bLeft)
+			for (; iWidth > 0 && iLen < iMax; iWidth--) szDest[iLen++] = cPad;
+		for (i=0; i<n && iLen < iMax; i++)
+			szDest[iLen++] = s[i];
+		for (; iWidth > 0 && iLen < iMax; iWidth--) // left justified
+			szDest[iLen++] = ' ';
+	}
+	szDest[iLen] = 0;
+	return iLen;
+} /* fmtVString() */
+
+int fmtString(char *szDest, int iMax, const char *szFormat, ...)
+{
+	va_list args;
+	int iLen;
+
+	va_start(args, szFormat);
+	iLen = fmtVString(szDest, iMax, szFormat, args);
+	va_end(args);
+	return iLen;
+} /* fmtString() */
@@ -0,0 +1,38 @@
+//
+// Tiny formatted output (a printf subset without multiply or divide)
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_FMT_H_
+#define USER_FMT_H_
+
+#include <stdarg.h>
+
+//
+// Conversions: %d %u %x %s %c %%
+// Flags and width: "-" left justify, "0" zero pad, then a width (e.g. %-5d, %04x)
+// Fixed point: a precision on %d/%u is the number of implied decimals,
+// so fmtString(sz, 8, "%.1dC", 234) gives "23.4C" and -5 gives "-0.5"
+// Numbers are converted by subtracting powers of 10; the CPU has no divider.
+//
+// Format into szDest (at most iMax bytes including the terminator)
+// returns the string length
+int fmtString(char *szDest, int iMax, const char *szFormat, ...);
+int fmtVString(char *szDest, int iMax, const char *szFormat, va_list args);
+
+#endif /* USER_FMT_H_ */
@@ -0,0 +1,87 @@
+//
+// 24 hour sample history kept in RAM
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdint.h>
+#include "history.h"
+#include "console.h"
+
+#ifdef CONSOLE // only the console reads it
+
+static HISTORY_ENTRY entries[HISTORY_SIZE];
+static uint32_t u32Next; // sequence number of the next entry
+static uint16_t u16Head; // ring index of the next entry
+static uint32_t u32SumCO2;
+static int32_t i32SumTemp, i32SumRH;
+static uint16_t u16Samples, u16Secs;
+
+static uint8_t historyClamp(int32_t i)
+{
+	if (i < 0) return 0;
+	if (i > 255) return 255;
+	return (uint8_t)i;
+} /* historyClamp() */
+
+void historyAdd(int iSecs, int iCO2, int iTemperature, int iHumidity)
+{
+	HISTORY_ENTRY *pEntry;
+
+	u32SumCO2 += iCO2;
+	i32SumTemp += iTemperature;
+	i32SumRH += iHumidity;
+	u16Samples++;
+	u16Secs += iSecs;
+	if (u16Secs < HISTORY_INTERVAL_SECS)
+		return;
+	// close the interval with its average
+	pEntry = &entries[u16Head];
+	pEntry->u8CO2 = historyClamp((u32SumCO2 / u16Samples + HISTORY_CO2_SCALE/2) / HISTORY_CO2_SCALE);
+	pEntry->u8Temperature = historyClamp((i32SumTemp / u16Samples + HISTORY_TEMP_OFFSET) / HISTORY_TEMP_SCALE);
+	pEntry->u8Humidity = historyClamp(i32SumRH / u16Samples / HISTORY_RH_SCALE);
+	if (++u16Head == HISTORY_SIZE)
+		u16Head = 0;
+	u32Next++;
+	u32SumCO2 = 0;
+	i32SumTemp = i32SumRH = 0;
+	u16Samples = 0;
+	u16Secs -= HISTORY_INTERVAL_SECS;
+} /* historyAdd() */
+
+uint32_t historyFirst(void)
+{
+	return (u32Next > HISTORY_SIZE) ? u32Next - HISTORY_SIZE : 0;
+} /* historyFirst() */
+
+uint32_t historyNext(void)
+{
+	return u32Next;
+} /* historyNext() */
+
+int historyGet(uint32_t u32Seq, HISTORY_ENTRY *pEntry)
+{
+	int i;
+
+	if (u32Seq < historyFirst() || u32Seq >= u32Next)
+		return -1;
+	i = (int)u16Head - (int)(u32Next - u32Seq); // entries back from the head
+	if (i < 0)
+		i += HISTORY_SIZE;
+	*pEntry = entries[i];
+	return 0;
+} /* historyGet() */
+#endif // CONSOLE
@@ -0,0 +1,55 @@
+//
+// 24 hour sample history kept in RAM
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_HISTORY_H_
+#define USER_HISTORY_H_
+
+//
+// Samples are averaged over HISTORY_INTERVAL_SECS and kept in a ring of
+// HISTORY_SIZE 3-byte entries. Every entry gets a sequence number (entries
+// added since power-up), so a reader can ask for "everything from N on".
+// Only the console reads it, so it's built with CONSOLE (console.h).
+//
+#define HISTORY_SIZE 240 // 720 bytes of .bss, the largest single use of the 2K RAM
+#define HISTORY_INTERVAL_SECS 360 // 240 x 6 minutes = 24 hours
+
+// Entry encoding (shared with the host tools)
+#define HISTORY_CO2_SCALE 20 // ppm per count, 0-5100ppm
+#define HISTORY_TEMP_OFFSET 400 // temperature = (0.1C + 400) / 5 (0.5C steps from -40C)
+#define HISTORY_TEMP_SCALE 5
+#define HISTORY_RH_SCALE 5 // humidity = 0.1% / 5 (0.5% steps)
+
+typedef struct tagHistoryEntry
+{
+	uint8_t u8CO2;
+	uint8_t u8Temperature;
+	uint8_t u8Humidity;
+} HISTORY_ENTRY;
+
+// Add a sample taken iSecs after the last one (0.1C and 0.1% units)
+void historyAdd(int iSecs, int iCO2, int iTemperature, int iHumidity);
+// Sequence number of the oldest entry held
+uint32_t historyFirst(void);
+// Sequence number the next entry will get
+uint32_t historyNext(void);
+// Returns 0 and the entry if u32Seq is still held, -1 otherwise
+int historyGet(uint32_t u32Seq, HISTORY_ENTRY *pEntry);
+
+#endif /* USER_HISTORY_H_ */
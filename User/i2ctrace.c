@@ -0,0 +1,115 @@
+//
+// I2C transaction trace
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <string.h>
+#include "debug.h"
+#include "i2ctrace.h"
+
+#ifdef I2C_TRACE
+#include "console.h"
+
+#ifdef CONSOLE
+static const char *szSite[TRACE_SITE_COUNT] = {"other", "ShowCurrent", "ShowScreen", "ShowMenu", "ShowTime", "GetSample"};
+#endif
+static I2C_TRACE_ENTRY entries[I2C_TRACE_SIZE];
+static I2C_TRACE_TOTAL totals[TRACE_SITE_COUNT];
+static uint16_t u16Count; // transfers recorded since the last clear
+static uint8_t u8Head; // ring index of the next entry
+static uint8_t u8Site;
+
+uint8_t i2cTraceEnter(uint8_t u8NewSite)
+{
+	uint8_t u8Old = u8Site;
+
+	u8Site = u8NewSite;
+	return u8Old;
+} /* i2cTraceEnter() */
+
+void i2cTraceLeave(uint8_t u8OldSite)
+{
+	u8Site = u8OldSite;
+} /* i2cTraceLeave() */
+
+void i2cTraceRecord(uint8_t u8Addr, int iLen, uint32_t u32StartTick)
+{
+	I2C_TRACE_ENTRY *pEntry = &entries[u8Head];
+	I2C_TRACE_TOTAL *pTotal = &totals[u8Site];
+	uint32_t u32Ticks = Delay_GetTick() - u32StartTick;
+
+	pEntry->u8Site = u8Site;
+	pEntry->u8Addr = u8Addr;
+	pEntry->u8Len = (iLen > 255) ? 255 : (uint8_t)iLen;
+	pEntry->u8Result = (uint8_t)((I2C1->STAR1 >> 8) & 7);
+	pEntry->u16Ticks = (u32Ticks > 0xffff) ? 0xffff : (uint16_t)u32Ticks;
+	if (++u8Head == I2C_TRACE_SIZE)
+		u8Head = 0;
+	if (u16Count != 0xffff)
+		u16Count++;
+	pTotal->u16Transfers++;
+	if (pEntry->u8Result)
+		pTotal->u16Errors++;
+	pTotal->u32Bytes += iLen;
+	pTotal->u32Ticks += u32Ticks;
+} /* i2cTraceRecord() */
+
+void i2cTraceClear(void)
+{
+	memset(totals, 0, sizeof(totals));
+	u16Count = 0;
+	u8Head = 0;
+} /* i2cTraceClear() */
+
+int i2cTraceGet(int i, I2C_TRACE_ENTRY *pEntry)
+{
+	int iHeld = (u16Count < I2C_TRACE_SIZE) ? u16Count : I2C_TRACE_SIZE;
+
+	if (i < 0 || i >= iHeld)
+		return -1;
+	i += u8Head - iHeld;
+	if (i < 0)
+		i += I2C_TRACE_SIZE;
+	*pEntry = entries[i];
+	return 0;
+} /* i2cTraceGet() */
+
+const I2C_TRACE_TOTAL *i2cTraceTotals(void)
+{
+	return totals;
+} /* i2cTraceTotals() */
+
+#ifdef CONSOLE
+void i2cTraceDump(void)
+{
+	I2C_TRACE_ENTRY entry;
+	int i;
+
+	consolePrintf("ticks/ms=%u\r\n", Delay_MsToTicks(1));
+	for (i=0; i<TRACE_SITE_COUNT; i++) {
+		if (totals[i].u16Transfers)
+			consolePrintf("%s xfers=%u bytes=%u ticks=%u err=%u\r\n", szSite[i], totals[i].u16Transfers,
+				totals[i].u32Bytes, totals[i].u32Ticks, totals[i].u16Errors);
+	}
+	for (i=0; i2cTraceGet(i, &entry) == 0; i++) {
+		consolePrintf("%s %c%x len=%u ticks=%u err=%u\r\n", szSite[entry.u8Site], (entry.u8Addr & I2C_TRACE_READ) ? 'r' : 'w',
+			entry.u8Addr & 0x7f, entry.u8Len, entry.u16Ticks, entry.u8Result);
+	}
+	consolePuts("end\r\n");
+} /* i2cTraceDump() */
+#endif // CONSOLE
+#endif // I2C_TRACE
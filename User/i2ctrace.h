@@ -0,0 +1,85 @@
+//
+// I2C transaction trace
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_I2CTRACE_H_
+#define USER_I2CTRACE_H_
+
+//
+// Optional record of every I2CWrite()/I2CRead(): which UI function asked
+// for it (the site), the device, the byte count, the SysTick ticks the
+// transfer took and the bus error flags afterwards. The latest
+// I2C_TRACE_SIZE transfers are kept in a ring and every site keeps totals,
+// so the cost of each screen can be read on the device (console "i2c").
+// It costs about 200 bytes of RAM, so it's off unless I2C_TRACE is defined
+// here or by the build.
+//
+//#define I2C_TRACE
+#define I2C_TRACE_SIZE 16
+#define I2C_TRACE_READ 0x80 // in u8Addr
+
+// Call sites (the UI functions in main.c); everything else is OTHER
+enum {
+	TRACE_SITE_OTHER = 0,
+	TRACE_SITE_SHOWCURRENT,
+	TRACE_SITE_SHOWSCREEN,
+	TRACE_SITE_SHOWMENU,
+	TRACE_SITE_SHOWTIME,
+	TRACE_SITE_GETSAMPLE,
+	TRACE_SITE_COUNT
+};
+
+typedef struct tagI2CTraceEntry
+{
+	uint8_t u8Site;
+	uint8_t u8Addr; // 7-bit address | I2C_TRACE_READ
+	uint8_t u8Len; // bytes (255 = 255 or more)
+	uint8_t u8Result; // I2C1 STAR1 error flags (BERR, ARLO, AF) after the transfer
+	uint16_t u16Ticks; // SysTick ticks, 0xffff = longer
+} I2C_TRACE_ENTRY;
+
+typedef struct tagI2CTraceTotal
+{
+	uint16_t u16Transfers;
+	uint16_t u16Errors;
+	uint32_t u32Bytes;
+	uint32_t u32Ticks;
+} I2C_TRACE_TOTAL;
+
+#ifdef I2C_TRACE
+// Make u8Site the current site; returns the previous one for i2cTraceLeave()
+uint8_t i2cTraceEnter(uint8_t u8Site);
+void i2cTraceLeave(uint8_t u8Site);
+// Called by the I2C functions when a transfer ends
+void i2cTraceRecord(uint8_t u8Addr, int iLen, uint32_t u32StartTick);
+void i2cTraceClear(void);
+// Entry i of the ring, 0 = oldest; returns -1 past the newest
+int i2cTraceGet(int i, I2C_TRACE_ENTRY *pEntry);
+const I2C_TRACE_TOTAL *i2cTraceTotals(void); // TRACE_SITE_COUNT of them
+// Totals and the ring as text on the console (built with CONSOLE)
+void i2cTraceDump(void);
+// Bracket the body of a UI function
+#define I2C_TRACE_ENTER(site) uint8_t u8TraceSite = i2cTraceEnter(site)
+#define I2C_TRACE_LEAVE() i2cTraceLeave(u8TraceSite)
+#else
+#define I2C_TRACE_ENTER(site)
+#define I2C_TRACE_LEAVE()
+#endif // I2C_TRACE
+
+#endif /* USER_I2CTRACE_H_ */
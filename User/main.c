@@ -23,12 +23,62 @@
 #include "scd41.h"
 #include "Arduino.h"
 #include "oled.h"
+#include "buttons.h"
+#include "pwm.h"
+#include "pattern.h"
+#include "telemetry.h"
+#include "history.h"
+#include "console.h"
+#include "fmt.h"
+#include "fastmath.h"
+#include "i2ctrace.h"
+#include "profile.h"
+#include "ram.h"
+#include "diag.h"
+#include "scratch.h"
 #include "Roboto_Black_40.h"
 #include "Roboto_Black_13.h"
 #include "co2_emojis.h"
 
-// end of 16k FLASH is at 0x08004000
-#define FLASH_START 0x08003c00
+// end of 16k FLASH is at 0x08004000; Ld/Link.ld keeps the last 1k out of the image
+#define FLASH_START (FLASH_BASE + 0x3c00)
+// the next 64-byte page is erased and written by the diagnostics benchmark
+#define FLASH_BENCH (FLASH_START + 64)
+// and the rest is a ring of pages for the runtime checkpoint used to resume
+// after a power loss. Each checkpoint goes into the next erased page and the
+// ring is only erased when it wraps, so a page sees one erase per
+// RESUME_SLOTS checkpoints
+#define FLASH_RESUME (FLASH_START + 128)
+#define RESUME_SLOTS 14
+#define RESUME_SLOT(i) (FLASH_RESUME + ((i) << 6))
+#define RESUME_MAGIC 0x52324f43 // "CO2R", changed with the layout of RESUME
+// checkpoint once an hour of sampling; with the ring a page is erased every
+// 14 hours, about 16 years of continuous sampling for 10k cycles
+#define CHECKPOINT_SECS 3600
+// CO2 levels where the status LEDs change (green, green+red, red)
+#define CO2_LEVEL_HIGH 1000
+#define CO2_LEVEL_VERY_HIGH 2000
+// Adaptive mode: 30s low power sampling while the air is stable, 5s sampling
+// while CO2 is changing quickly or could reach one of the levels above
+// before the next slow sample. Leaving fast sampling takes a lower rate, a
+// larger distance and some calm time, so a reading which hovers around a
+// limit doesn't restart the sensor often
+#define ADAPT_SLOW_TICKS 123 // Standby82ms(3) periods between low power samples (30s)
+#define ADAPT_FAST_TICKS 21 // ... and between 5s samples
+#define ADAPT_RATE_SECS 30 // the rate is the change over this time
+#define ADAPT_RATE_UP 40 // ppm per ADAPT_RATE_SECS which starts fast sampling
+#define ADAPT_RATE_DOWN 20 // ppm per ADAPT_RATE_SECS to stay under to go back
+#define ADAPT_NEAR 25 // ppm from a level which starts fast sampling (sensor noise)...
+#define ADAPT_AHEAD 2 // ... plus the change this many ADAPT_RATE_SECS would bring
+#define ADAPT_MARGIN 25 // extra distance needed to go back
+#define ADAPT_CALM_SECS 120 // how long the readings must stay calm to go back
+// Stealth mode: standby ticks are 80ms with the 128kHz LSI. A single shot
+// is given 5.5s, so it is finished (the SCD41 NACKs until then, which hangs
+// the driver) even with an LSI 10% fast
+#define STEALTH_SHOT_TICKS 69
+#define STEALTH_SETTLE_MS 500 // awake after a button wake until the buttons are quiet this long
+// formatted text for the screens, held in the scratch arena
+#define TEXT_LEN 32
 
 #define DC_PIN 0xd3
 #define CS_PIN 0xd2
@@ -38,8 +88,18 @@
 #define LED_GREEN 0xc3
 #define LED_RED 0xc4
 #define MOTOR_PIN 0xc5
+// PWM duty (of PWM_MAX) for the LEDs; full brightness isn't needed indoors
+#define LED_BRIGHTNESS 96
 
 //#define DEBUG_MODE
+#if defined(DEBUG_MODE) && !defined(CONSOLE)
+#error "DEBUG_MODE prints with consolePrintf(); define CONSOLE in console.h too"
+#endif
+// TELEMETRY (telemetry.h) streams a binary record of each sample on PD5;
+// consolePrintf() (debug output) goes out on the same port
+#define TELEMETRY_BAUD 115200
+// the battery voltage in the records is measured this often
+#define TELEMETRY_VDD_SECS 300
 
 typedef struct tagState
 {
@@ -49,6 +109,17 @@ typedef struct tagState
 	int iPeriod;
 } STATE;
 
+// Runtime state of the active mode, checkpointed to FLASH
+typedef struct tagResume
+{
+	uint32_t u32Magic; // RESUME_MAGIC in a written slot
+	uint32_t u32Seq; // the slot with the highest one is the latest
+	int iMode; // MODE_COUNT when no mode was running
+	int iSample; // number of CO2 samples captured
+	uint16_t u16MinCO2, u16MaxCO2;
+	int16_t i16MinTemp, i16MaxTemp;
+} RESUME;
+
 enum
 {
 	MODE_CONTINUOUS=0,
@@ -57,6 +128,8 @@ enum
 	MODE_STEALTH,
 	MODE_CALIBRATE,
 	MODE_TIMER,
+	MODE_CONSOLE,
+	MODE_ADAPTIVE, // last, so the saved settings of older versions keep their mode
 	MODE_COUNT
 };
 
@@ -78,16 +151,76 @@ enum
 	MENU_COUNT
 };
 
+#ifdef DIAG_SCREEN
+// Results of the diagnostics benchmarks in microseconds
+typedef struct tagDiagBench
+{
+	uint32_t u32Fill[3]; // oledFill() at each of iDiagSpeed[]
+	uint32_t u32Current; // ShowCurrent()
+	uint32_t u32Wake; // time awake around a Standby82ms(1); SysTick stops in standby
+	uint32_t u32Sensor; // SCD41 data ready status read, DIAG_NONE if it failed
+	uint32_t u32Flash; // erase and program of a settings sized write to FLASH_BENCH
+} DIAG_BENCH;
+#define DIAG_NONE 0xffffffff
+// bytes on the bus for an oledFill(): 8 position commands of 4 and 64 writes of 17
+#define DIAG_FILL_BYTES (8 * (4 + 8 * 17))
+#endif // DIAG_SCREEN
+
+// Sampling rate state of the adaptive mode
+typedef struct tagAdapt
+{
+	int bFast; // 5s periodic, else 30s low power periodic
+	int iRefCO2; // reading the rate is measured from, -1 = none yet
+	int iRefSecs; // time since that reading
+	int iRate; // ppm change over the last ADAPT_RATE_SECS
+	int iCalmSecs; // time in fast mode with a low rate, away from the levels
+} ADAPT;
+
+// fixed text screens drawn by ShowScreen()
+enum
+{
+	SCREEN_STARTING=0,
+	SCREEN_RESUMING,
+	SCREEN_TIMER,
+	SCREEN_STEALTH,
+	SCREEN_CONSOLE,
+	SCREEN_CALIBRATE,
+	SCREEN_CALIBRATING,
+	SCREEN_CAL_SUCCESS,
+	SCREEN_CAL_FAILED,
+	SCREEN_COUNT
+};
+
 int GetButtons(void);
 void ShowAlert(void);
 void ShowTime(int iSecs);
-void BlinkLED(uint8_t u8LED, int iDuration);
 
-const char *szMode[] = {"Continuous", "Low Power ", /*"On Demand ", */ "Stealth   ", "Calibrate ", "Timer     "};
+const char *szMode[] = {"Continuous", "Low Power ", /*"On Demand ", */ "Stealth   ", "Calibrate ", "Timer     ", "PC Link   ", "Adaptive  "};
 const char *szAlert[] = {"Vibration", "LEDs     ", "Vib+LEDs "};
+// Output patterns ({outputs, 10ms ticks}, ended by a 0 tick step)
+const PATTERN_STEP stepsVibration[] = {{PAT_MOTOR, 15}, {PAT_OFF, 82}, {0, 0}};
+const PATTERN_STEP stepsLED[] = {{PAT_GREEN, 30}, {PAT_RED, 30}, {0, 0}};
+const PATTERN_STEP stepsBoth[] = {{PAT_MOTOR, 15}, {PAT_GREEN, 40}, {PAT_RED, 40}, {0, 0}};
+const PATTERN_STEP stepsPulse[] = {{PAT_MOTOR, 10}, {PAT_OFF, 40}, {0, 0}};
+const PATTERN_STEP stepsGreen[] = {{PAT_GREEN, 1}, {0, 0}};
+const PATTERN_STEP stepsRed[] = {{PAT_RED, 1}, {0, 0}};
+const PATTERN_STEP stepsGreenRed[] = {{PAT_GREEN, 1}, {PAT_RED, 1}, {0, 0}};
+const PATTERN patAlert[ALERT_COUNT] = {
+		{stepsVibration, 3, PATTERN_PRI_ALERT},
+		{stepsLED, 4, PATTERN_PRI_ALERT},
+		{stepsBoth, 3, PATTERN_PRI_ALERT}};
+const PATTERN patPulse = {stepsPulse, 1, PATTERN_PRI_STATUS}; // stealth level, repeated 1-6 times
+const PATTERN patGreen = {stepsGreen, 1, PATTERN_PRI_STATUS};
+const PATTERN patRed = {stepsRed, 1, PATTERN_PRI_STATUS};
+const PATTERN patGreenRed = {stepsGreenRed, 1, PATTERN_PRI_STATUS};
 STATE state;
-
-static int iSample = 0; // number of CO2 samples captured
+RESUME resume;
+static int iResumeSlot = -1; // the slot of the latest checkpoint, -1 = none
+static int iCheckpointSecs = 0; // seconds of sampling since the last checkpoint
+int iBootMs = 0; // time from mode start (or power-up when resuming) to the first valid reading
+static uint32_t u32BootTick, u32BootStandbyMs; // when that timer started
+static int bBootTimer = 0; // waiting for the first reading
+static uint32_t u32SampleSecs = 0; // telemetry timestamp
 #ifdef FUTURE
 #define MAX_SAMPLES 540
 static uint8_t ucLast32[32]; // holds top 8 bits of last 32 samples
@@ -98,48 +231,33 @@ static int iMaxTemp = 0, iMinTemp = 1000;
 static uint8_t ucMaxHumid = 0, ucMinHumid = 100;
 #endif // FUTURE
 
-// Convert a number into a zero-terminated string
-int i2str(char *pDest, int iVal)
-{
-	char *d = pDest;
-	int i, iPlaceVal = 10000;
-	int iDigits = 0;
-
-	if (iVal < 0) {
-		iDigits++;
-		*d++ = '-';
-		iVal = -iVal;
-	}
-	while (iPlaceVal) {
-		if (iVal >= iPlaceVal) {
-			i = iVal / iPlaceVal;
-			*d++ = '0' + (char)i;
-			iVal -= (i*iPlaceVal);
-			iDigits++;
-		} else if (iDigits != 0) {
-			*d++ = '0'; // non-zeros were already displayed
-		}
-		iPlaceVal /= 10;
-	}
-	if (d == pDest) // must be zero
-		*d++ = '0';
-	*d++ = 0; // terminator
-	return (int)(d - pDest - 1); // string length
-} /* i2str() */
-
-// Write the state variables to the 64-byte user FLASH memory area
-void WriteFlash(void) {
+// Write up to 16 words into an erased 64-byte FLASH page
+void ProgramFlashPage(uint32_t u32Addr, uint32_t *s, int iWords) {
 int i;
-uint32_t *s = (uint32_t *)&state;
 
     FLASH_Unlock_Fast();
-    FLASH_ErasePage_Fast(FLASH_START);
     FLASH_BufReset();
-    for(i=0; i<sizeof(state)/4; i++){
-	    FLASH_BufLoad(FLASH_START+(4*i), s[i]);
+    for(i=0; i<iWords; i++){
+        FLASH_BufLoad(u32Addr+(4*i), s[i]);
     }
-    FLASH_ProgramPage_Fast(FLASH_START);
+    FLASH_ProgramPage_Fast(u32Addr);
+    FLASH_Lock_Fast();
+} /* ProgramFlashPage() */
+
+// Erase a 64-byte FLASH page and write up to 16 words into it
+// (iWords == 0 leaves the page erased)
+void WriteFlashPage(uint32_t u32Addr, uint32_t *s, int iWords) {
+
+    FLASH_Unlock_Fast();
+    FLASH_ErasePage_Fast(u32Addr);
     FLASH_Lock_Fast();
+    if (iWords)
+        ProgramFlashPage(u32Addr, s, iWords);
+} /* WriteFlashPage() */
+
+// Write the state variables to the 64-byte user FLASH memory area
+void WriteFlash(void) {
+    WriteFlashPage(FLASH_START, (uint32_t *)&state, sizeof(state)/4);
 } /* WriteFlash() */
 
 // Read the state variables from FLASH memory
@@ -148,7 +266,7 @@ int i;
 uint32_t *d = (uint32_t *)&state;
 
 	for (i=0; i<sizeof(state)/4; i++) {
-		d[i] = *(uint32_t *)(FLASH_START + (4 * i));
+		d[i] = *(uint32_t *)(uintptr_t)(FLASH_START + (4 * i));
 	}
 	if (state.iPeriod < 5 || state.iPeriod > 60) {
 	// Data is not valid, set default values
@@ -160,6 +278,183 @@ uint32_t *d = (uint32_t *)&state;
 	}
 } /* ReadFlash() */
 
+// A slot can be programmed without an erase if all of a RESUME in it is erased
+static int ResumeSlotErased(int iSlot) {
+int i;
+const uint32_t *p = (const uint32_t *)(uintptr_t)RESUME_SLOT(iSlot);
+
+	for (i=0; i<sizeof(resume)/4; i++) {
+		if (p[i] != 0xffffffff)
+			return 0;
+	}
+	return 1;
+} /* ResumeSlotErased() */
+
+//
+// Save the runtime state of the active mode in the slot after the latest one.
+// When the ring wraps, every other slot is erased before the new record goes
+// in and the previous one after it, so a power loss always leaves a record
+//
+void WriteResume(void) {
+int i, iSlot = iResumeSlot + 1;
+int bWrapped;
+
+	if (iSlot == RESUME_SLOTS)
+		iSlot = 0;
+	bWrapped = !ResumeSlotErased(iSlot); // (or a write was cut short)
+	if (bWrapped) {
+		for (i=0; i<RESUME_SLOTS; i++) {
+			if (i != iResumeSlot)
+				WriteFlashPage(RESUME_SLOT(i), NULL, 0);
+		}
+	}
+	resume.u32Magic = RESUME_MAGIC;
+	resume.u32Seq++;
+	ProgramFlashPage(RESUME_SLOT(iSlot), (uint32_t *)&resume, sizeof(resume)/4);
+	if (bWrapped && iResumeSlot >= 0)
+		WriteFlashPage(RESUME_SLOT(iResumeSlot), NULL, 0);
+	iResumeSlot = iSlot;
+	iCheckpointSecs = 0;
+} /* WriteResume() */
+
+// The user left the mode on purpose; don't resume it at the next power-up
+void ClearResume(void) {
+	resume.iMode = MODE_COUNT; // no mode running
+	WriteResume();
+} /* ClearResume() */
+
+//
+// Find the latest runtime checkpoint in FLASH
+// returns 1 if a sampling mode was running when power was lost
+//
+int ReadResume(void) {
+int i;
+const RESUME *p;
+
+	iResumeSlot = -1;
+	resume.u32Seq = 0;
+	resume.iMode = MODE_COUNT;
+	for (i=0; i<RESUME_SLOTS; i++) {
+		p = (const RESUME *)(uintptr_t)RESUME_SLOT(i);
+		if (p->u32Magic == RESUME_MAGIC && p->u32Seq != 0xffffffff && (iResumeSlot < 0 || p->u32Seq > resume.u32Seq)) {
+			memcpy(&resume, p, sizeof(resume));
+			iResumeSlot = i;
+		}
+	}
+	if (resume.iMode != MODE_CONTINUOUS && resume.iMode != MODE_LOW_POWER && resume.iMode != MODE_STEALTH &&
+		resume.iMode != MODE_ADAPTIVE)
+		return 0; // cleared, or a timer or calibration run which isn't worth resuming
+	state.iMode = resume.iMode;
+	return 1;
+} /* ReadResume() */
+
+// A mode was started from the menu; reset the runtime state and checkpoint it
+void StartResume(int iMode) {
+	resume.iMode = iMode;
+	resume.iSample = 0;
+	resume.u16MinCO2 = 0xffff; resume.u16MaxCO2 = 0;
+	resume.i16MinTemp = 0x7fff; resume.i16MaxTemp = -0x8000;
+	WriteResume();
+} /* StartResume() */
+
+//
+// Accumulate the stats for a new sample which was taken iSecs after the last one
+// and checkpoint them periodically
+//
+void UpdateResume(int iSecs) {
+	resume.iSample++;
+	if (_iCO2 < resume.u16MinCO2) resume.u16MinCO2 = _iCO2;
+	if (_iCO2 > resume.u16MaxCO2) resume.u16MaxCO2 = _iCO2;
+	if (_iTemperature < resume.i16MinTemp) resume.i16MinTemp = (int16_t)_iTemperature;
+	if (_iTemperature > resume.i16MaxTemp) resume.i16MaxTemp = (int16_t)_iTemperature;
+	iCheckpointSecs += iSecs;
+	if (iCheckpointSecs >= CHECKPOINT_SECS)
+		WriteResume();
+} /* UpdateResume() */
+
+#ifdef TELEMETRY
+void SendTelemetry(int rc)
+{
+	static uint16_t u16Battery = 0;
+	static uint32_t u32BatterySecs = 0;
+	TELEMETRY_RECORD rec;
+
+	rec.u32Time = u32SampleSecs;
+	rec.u16CO2 = _iCO2;
+	rec.i16Temperature = (int16_t)_iTemperature;
+	rec.u16Humidity = (uint16_t)_iHumidity;
+	rec.u8Status = (uint8_t)rc;
+	rec.u8Mode = (uint8_t)state.iMode;
+	if (u16Battery == 0 || u32SampleSecs - u32BatterySecs >= TELEMETRY_VDD_SECS) { // it changes slowly
+		u16Battery = (uint16_t)readVDD();
+		u32BatterySecs = u32SampleSecs;
+	}
+	rec.u16Battery = u16Battery;
+	telemetrySend(&rec); // a frame still in flight means this one is dropped
+} /* SendTelemetry() */
+#endif // TELEMETRY
+
+//
+// Time from the start of a mode (or from reset when resuming) to its first
+// valid reading. SysTick stops in standby, so the standby time comes from
+// the diagnostics counters. Every mode starts it again and GetSample()
+// stops it, so the modes without a display are timed too; iBootMs is 0
+// until then
+//
+void BootTimerStart(void)
+{
+	u32BootTick = Delay_GetTick();
+	u32BootStandbyMs = diagStandbyMs();
+	iBootMs = 0;
+	bBootTimer = 1;
+} /* BootTimerStart() */
+
+void BootTimerStop(void)
+{
+	uint32_t u32Us = Delay_TicksToUs(Delay_GetTick() - u32BootTick); // it divides, but only once per mode
+
+	iBootMs = (int)(udiv10(udiv10(udiv10(u32Us))) + diagStandbyMs() - u32BootStandbyMs);
+	bBootTimer = 0;
+#ifdef DEBUG_MODE
+	consolePrintf("First reading after %d ms\r\n", iBootMs);
+#endif
+} /* BootTimerStop() */
+
+//
+// Read the sensor, update the stats of the running mode and stream the result
+// iSecs is the time since the last call. A single shot has to be started
+// (and finished) by the caller; this doesn't wait 5 seconds for one
+//
+int GetSample(int iSecs)
+{
+	int rc;
+	I2C_TRACE_ENTER(TRACE_SITE_GETSAMPLE);
+	PROFILE_BEGIN(PROF_GETSAMPLE);
+
+	rc = scd41_readSample();
+	PROFILE_END(PROF_GETSAMPLE);
+	I2C_TRACE_LEAVE();
+
+	diagAwake();
+	if (rc == SCD_ERROR)
+		diagError(DIAG_ERR_SENSOR);
+	else if (rc == SCD_NOT_READY)
+		diagError(DIAG_ERR_NOT_READY);
+	u32SampleSecs += iSecs;
+	if (rc == SCD_SUCCESS) {
+		if (bBootTimer)
+			BootTimerStop();
+		UpdateResume(iSecs);
+#ifdef CONSOLE
+		historyAdd(iSecs, _iCO2, _iTemperature, _iHumidity);
+#endif
+	}
+#ifdef TELEMETRY
+	SendTelemetry(rc);
+#endif
+	return rc;
+} /* GetSample() */
+
 #ifdef FUTURE
 //
 // Add a sample to the collected statistics
@@ -188,25 +483,6 @@ void AddSample(int i)
 } /* AddSample() */
 #endif // FUTURE
 
-void EXTI7_0_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
-
-/*********************************************************************
- * @fn      EXTI0_IRQHandler
- *
- * @brief   This function handles EXTI0 Handler.
- *
- * @return  none
- */
-void EXTI7_0_IRQHandler(void)
-{
-  if(EXTI_GetITStatus(EXTI_Line0)!=RESET)
-  {
-//    printf("EXTI0 Wake_up\r\n");
-	  oledFill(0);
-    EXTI_ClearITPendingBit(EXTI_Line0);     /* Clear Flag */
-  }
-}
-
 void Option_Byte_CFG(void)
 {
     FLASH_Unlock();
@@ -218,61 +494,54 @@ void Option_Byte_CFG(void)
 #ifdef FUTURE
 void ShowGraph(void)
 {
-	char szTemp[32];
-	int i;
+	int i, iMark = scratchMark();
+	SCRATCH_ALLOC(char, szTemp, TEXT_LEN, SCRATCH_CALLER);
 
 	I2CInit(400000);
 	oledFill(0);
 
-	i2str(szTemp, iHead*32);
+	fmtString(szTemp, TEXT_LEN, "%d Samples", iHead*32);
     oledWriteString(0,0, szTemp, FONT_8x8, 0);
-    oledWriteString(-1, 0, " Samples", FONT_8x8, 0);
     i = (iHead*32*5)/60; // number of minutes
-    oledWriteString(0,8, "(", FONT_8x8, 0);
-	i2str(szTemp, i);
-    oledWriteString(-1,8, szTemp, FONT_8x8, 0);
-    oledWriteString(-1,8, " minutes)", FONT_8x8, 0);
+	fmtString(szTemp, TEXT_LEN, "(%d minutes)", i);
+    oledWriteString(0,8, szTemp, FONT_8x8, 0);
 	oledWriteString(0,16,"CO2 level:",FONT_12x16, 0);
 	oledWriteString(0,32,"Min:",FONT_8x8, 0);
 	oledWriteString(0,40,"Max:",FONT_8x8, 0);
 	oledWriteString(0,48,"Temp min/max: ",FONT_6x8, 0);
 	oledWriteString(0,56,"Humi min/max: ", FONT_6x8, 0);
 
-	i2str(szTemp, iMinCO2);
+	fmtString(szTemp, TEXT_LEN, "%d", iMinCO2);
     oledWriteString(40, 32, szTemp, FONT_8x8, 0);
-    i2str(szTemp, iMaxCO2);
+	fmtString(szTemp, TEXT_LEN, "%d", iMaxCO2);
     oledWriteString(40, 40, szTemp, FONT_8x8, 0);
 
-	i2str(szTemp, iMinTemp/10); // whole part
+	fmtString(szTemp, TEXT_LEN, "%d/%dC", iMinTemp/10, iMaxTemp/10); // whole part
     oledWriteString(84, 48, szTemp, FONT_6x8, 0);
-    oledWriteString(-1, 48, "/", FONT_6x8, 0);
-    i2str(szTemp, iMaxTemp/10);
-    oledWriteString(-1, 48, szTemp, FONT_6x8, 0);
-    oledWriteString(-1, 48, "C", FONT_6x8, 0);
 
-    i2str(szTemp, ucMinHumid);
+	fmtString(szTemp, TEXT_LEN, "%d/%d%%", ucMinHumid, ucMaxHumid);
     oledWriteString(84, 56, szTemp, FONT_6x8, 0);
-    oledWriteString(-1, 56, "/", FONT_6x8, 0);
-    i2str(szTemp, ucMaxHumid);
-    oledWriteString(-1, 56, szTemp, FONT_6x8, 0);
-    oledWriteString(-1, 56, "%", FONT_6x8, 0);
 
     while (digitalRead(BUTTON0_PIN) == 0) {}; // wait for button to release
 	while (digitalRead(BUTTON0_PIN) == 1) {}; // wait for button to press
 	oledFill(0);
 	while (digitalRead(BUTTON0_PIN) == 0) {}; // wait for button to release to exit
+	scratchRelease(iMark);
 } /* ShowGraph() */
 #endif // FUTURE
+
 //
 // Display the current conditions on the OLED
 //
 void ShowCurrent(void)
 {
-int i, x;
-char szTemp[32];
+int i, x, iMark = scratchMark();
+SCRATCH_ALLOC(char, szTemp, TEXT_LEN, SCRATCH_CALLER);
+	I2C_TRACE_ENTER(TRACE_SITE_SHOWCURRENT);
+	PROFILE_BEGIN(PROF_SHOWCURRENT);
 
 	I2CSetSpeed(400000); // OLED can handle 400k
-	i = i2str(szTemp, (int)_iCO2);
+	i = fmtString(szTemp, TEXT_LEN, "%d", (int)_iCO2);
 	oledWriteStringCustom(&Roboto_Black_40, 0, 32, szTemp, 1);
 	x = oledGetCursorX();
 	if (i < 4) {
@@ -283,40 +552,96 @@ char szTemp[32];
 	oledWriteString(x, 8, "ppm", FONT_8x8, 0);
     oledWriteStringCustom(&Roboto_Black_13, 0, 45, (char *)"Temp", 1);
     oledWriteStringCustom(&Roboto_Black_13, 0, 63, (char *)"Humidity", 1);
-    i2str(szTemp, _iTemperature/10); // whole part
+    fmtString(szTemp, TEXT_LEN, "%.1dC ", _iTemperature); // 0.1C units
     oledWriteStringCustom(&Roboto_Black_13, 44, 45, szTemp, 1);
-    oledWriteStringCustom(&Roboto_Black_13, -1, -1, ".", 1);
-    i2str(szTemp, _iTemperature % 10); // fraction
-    oledWriteStringCustom(&Roboto_Black_13, -1, -1, szTemp, 1);
-    oledWriteStringCustom(&Roboto_Black_13, -1, -1, "C ", 1);
-    i2str(szTemp, _iHumidity/10); // throw away fraction since it's not accurate
+    fmtString(szTemp, TEXT_LEN, "%d%%", (int)udiv10(_iHumidity)); // throw away fraction since it's not accurate
     oledWriteStringCustom(&Roboto_Black_13, 64, 63, szTemp, 1);
-    oledWriteStringCustom(&Roboto_Black_13, -1, -1, "%", 1);
     // Display an emoji indicating the CO2 level
     // There are 5 which go from happy to angry, so divide the values into
     // 5 categories: 0-999, 1000-1499, 1500-1999, 2000-2499, 2500+
-    x = (_iCO2 - 500)/500;
-    if (x < 0) x = 0;
-    else if (x > 4) x = 4;
-    oledDrawSprite(96, 16, 31, 32, (uint8_t *)&co2_emojis[x * 4], 20, 1);
+    x = (_iCO2 < 500) ? 0 : (int)udiv500(_iCO2 - 500);
+    if (x > 4) x = 4;
+    oledDrawSprite(96, 24, 31, 32, (uint8_t *)&co2_emojis[x * 4], 20, 1);
+	scratchRelease(iMark);
+	PROFILE_END(PROF_SHOWCURRENT);
+	I2C_TRACE_LEAVE();
 } /* ShowCurrent() */
 
+//
+// Draw one of the fixed text screens
+//
+void ShowScreen(int iScreen)
+{
+	I2C_TRACE_ENTER(TRACE_SITE_SHOWSCREEN);
+
+	if (iScreen != SCREEN_CAL_SUCCESS && iScreen != SCREEN_CAL_FAILED)
+		oledFill(0);
+	switch (iScreen) {
+	case SCREEN_STARTING:
+	case SCREEN_RESUMING:
+		oledWriteString(0,0,szMode[state.iMode], FONT_8x8, 0);
+		oledWriteString(0,8,(iScreen == SCREEN_RESUMING) ? "Resuming..." : "Starting...", FONT_8x8, 0);
+		break;
+	case SCREEN_TIMER:
+		oledWriteString(0,0, "Timer Mode", FONT_12x16, 0);
+		break;
+	case SCREEN_STEALTH:
+		oledWriteString(22,0,"Stealth", FONT_12x16, 0);
+		oledWriteString(0,16,"CO2 measurements will", FONT_6x8, 0);
+		oledWriteString(0,24,"be converted to 1-6", FONT_6x8, 0);
+		oledWriteString(0,32,"pulses. 1=good, 6=bad", FONT_6x8, 0);
+		oledWriteString(0,56,"press button to start", FONT_6x8, 0);
+		break;
+#ifdef CONSOLE
+	case SCREEN_CONSOLE:
+		oledWriteString(16,0,"PC Link", FONT_12x16, 0);
+		oledWriteString(0,16,"230400 baud 8N1", FONT_6x8, 0);
+		oledWriteString(0,24,"TX=PD5 RX=PD6", FONT_6x8, 0);
+		oledWriteString(0,56,"both buttons to exit", FONT_6x8, 0);
+		break;
+#endif
+	case SCREEN_CALIBRATE:
+		oledWriteString(10,0,"Calibrate", FONT_12x16, 0);
+		oledWriteString(0,16,"Place device in a", FONT_6x8, 0);
+		oledWriteString(0,24,"free air environment.", FONT_6x8, 0);
+		oledWriteString(0,32,"Press either button", FONT_6x8, 0);
+		oledWriteString(0,40,"to start. When timer", FONT_6x8, 0);
+		oledWriteString(0,48,"finishes, result will", FONT_6x8, 0);
+		oledWriteString(0,56,"show success or fail", FONT_6x8, 0);
+		break;
+	case SCREEN_CALIBRATING:
+		oledWriteString(0,0,"Calibration running", FONT_6x8, 0);
+		break;
+	case SCREEN_CAL_SUCCESS:
+	case SCREEN_CAL_FAILED: // replaces the countdown below the title
+		oledClearLine(24);
+		oledClearLine(32);
+		oledClearLine(40);
+		oledClearLine(48);
+		oledWriteString(0,32, (iScreen == SCREEN_CAL_SUCCESS) ? "Success!" : "Failed", FONT_12x16, 0);
+		oledWriteString(0,56, "Press button to exit", FONT_6x8, 0);
+		break;
+	}
+	I2C_TRACE_LEAVE();
+} /* ShowScreen() */
+
 void RunTimer(void)
 {
-  int i, j, iTicks = 5;
-  oledFill(0);
+  int i, iTicks = 5;
+  BTN_EVENT event;
+  ShowScreen(SCREEN_TIMER);
 //  oledContrast(20);
-  oledWriteString(0,0, "Timer Mode", FONT_12x16, 0);
   for (i=state.iPeriod*60; i>=0; i--) { // count down seconds
 	  ShowTime(i);
 //	  Standby82ms(10); // sleep about 820ms
-	  j = GetButtons();
-	  if (j == 3) { // both buttons cancels timer mode
-		  return;
-	  }
-	  if (j && iTicks == 0) { // a single button press turns on the display
-		  iTicks = 5;
-		  oledPower(1);
+	  while (btnGetEvent(&event)) {
+		  if (event.u8Type == BTN_EVT_CHORD) { // both buttons cancels timer mode
+			  return;
+		  }
+		  if (event.u8Type == BTN_EVT_PRESS && iTicks == 0) { // a single button press turns on the display
+			  iTicks = 5;
+			  oledPower(1);
+		  }
 	  }
 	  if (i == 10) { // turn on the display for the last 10 seconds
 		  if (iTicks == 0) {
@@ -330,56 +655,225 @@ void RunTimer(void)
 			  oledPower(0); // turn off the display
 		  }
 	  }
-	  BlinkLED((i & 1) ? LED_GREEN : LED_RED, 10);
+	  patternPlay((i & 1) ? &patGreen : &patRed, 0);
 	  Delay_Ms(990);
   }
   ShowAlert();
 } /* RunTimer() */
 
+//
+// Draw the settings menu with iSelItem highlighted
+// (bFull = clear the screen and draw the title too)
+//
+void ShowMenu(int iSelItem, int bFull)
+{
+int y, iMark = scratchMark();
+SCRATCH_ALLOC(char, szTemp, TEXT_LEN, SCRATCH_CALLER);
+	I2C_TRACE_ENTER(TRACE_SITE_SHOWMENU);
+	PROFILE_BEGIN(PROF_SHOWMENU);
+
+	if (bFull) {
+		oledFill(0);
+		oledWriteString(4,0,"Pocket CO2", FONT_12x16, 0);
+//		oledWriteString(0,16,"================", FONT_8x8, 0);
+	}
+	y = 24;
+	oledWriteString(0,y,"Start", FONT_8x8, (iSelItem == MENU_START));
+	y += 8;
+	oledWriteString(0,y, "Mode", FONT_8x8, (iSelItem == MENU_MODE));
+	oledWriteString(40,y, szMode[state.iMode], FONT_8x8, 0);
+	y += 8;
+	oledWriteString(0,y,"Update", FONT_8x8, (iSelItem == MENU_FREQ));
+	fmtString(szTemp, TEXT_LEN, "%d secs", state.iFreq);
+	oledWriteString(56,y, szTemp, FONT_8x8, 0);
+	y += 8;
+	oledWriteString(0,y,"Alert", FONT_8x8, (iSelItem == MENU_ALERT));
+	oledWriteString(48,y,szAlert[state.iAlert], FONT_8x8, 0);
+	y += 8;
+	oledWriteString(0,y,"Timer", FONT_8x8, (iSelItem == MENU_TIME));
+	fmtString(szTemp, TEXT_LEN, "%d Mins ", state.iPeriod); // trailing space erases the old value
+	oledWriteString(48, y, szTemp, FONT_8x8, 0);
+	scratchRelease(iMark);
+	PROFILE_END(PROF_SHOWMENU);
+	I2C_TRACE_LEAVE();
+} /* ShowMenu() */
+
+#ifdef DIAG_SCREEN
+static const int iDiagSpeed[3] = {50000, 100000, 400000};
+
+//
+// Time the bus, display, sensor, standby and FLASH operations
+// The display is overwritten; the FLASH write goes to a spare page so
+// the settings aren't worn or put at risk for a timing
+//
+void DiagBenchmark(DIAG_BENCH *pBench)
+{
+	uint32_t u32Start, u32Page[sizeof(state)/4];
+	uint16_t u16Status;
+	int i;
+
+	for (i=0; i<3; i++) {
+		I2CSetSpeed(iDiagSpeed[i]);
+		u32Start = Delay_GetTick();
+		oledFill(0);
+		pBench->u32Fill[i] = Delay_TicksToUs(Delay_GetTick() - u32Start);
+	}
+	u32Start = Delay_GetTick();
+	ShowCurrent();
+	pBench->u32Current = Delay_TicksToUs(Delay_GetTick() - u32Start);
+	I2CSetSpeed(50000); // the speed the modes talk to the sensor at
+	u32Start = Delay_GetTick();
+	i = scd41_readRegister(SCD41_CMD_GET_DATA_READY_STATUS, &u16Status);
+	pBench->u32Sensor = (i == SCD_SUCCESS) ? Delay_TicksToUs(Delay_GetTick() - u32Start) : DIAG_NONE;
+	memcpy(u32Page, (void *)FLASH_START, sizeof(u32Page)); // as much as a settings save
+	u32Start = Delay_GetTick();
+	WriteFlashPage(FLASH_BENCH, u32Page, sizeof(u32Page)/4);
+	pBench->u32Flash = Delay_TicksToUs(Delay_GetTick() - u32Start);
+#ifdef DEBUG_MODE
+	pBench->u32Wake = DIAG_NONE; // standby would drop the debugger
+#else
+	u32Start = Delay_GetTick();
+	Standby82ms(1);
+	pBench->u32Wake = Delay_TicksToUs(Delay_GetTick() - u32Start); // entry and wake-up, not the 82ms
+	I2CInit(400000);
+	btnResync();
+#endif
+	I2CSetSpeed(400000);
+} /* DiagBenchmark() */
+
+// One line of the diagnostics screen: a label and a time in us or ms
+static void ShowDiagTime(int y, const char *szLabel, uint32_t u32Us)
+{
+	char szTemp[24];
+
+	if (u32Us == DIAG_NONE)
+		fmtString(szTemp, sizeof(szTemp), "%-12s%8s", szLabel, "--");
+	else if (u32Us < 10000)
+		fmtString(szTemp, sizeof(szTemp), "%-12s%6uus", szLabel, u32Us);
+	else
+		fmtString(szTemp, sizeof(szTemp), "%-12s%6.1ums", szLabel, udiv10(udiv10(u32Us)));
+	oledWriteString(0, y, szTemp, FONT_6x8, 0);
+} /* ShowDiagTime() */
+
+// Seconds as hours and minutes
+static void ShowDiagHours(int y, const char *szLabel, uint32_t u32Secs)
+{
+	char szTemp[24];
+	uint32_t u32Mins = udiv60(u32Secs);
+	uint32_t u32Hours = udiv60(u32Mins);
+
+	fmtString(szTemp, sizeof(szTemp), "%-12s%5uh%02um", szLabel, u32Hours, u32Mins - mul60(u32Hours));
+	oledWriteString(0, y, szTemp, FONT_6x8, 0);
+} /* ShowDiagHours() */
+
+//
+// Draw a page of the diagnostics screen
+// page 0: benchmark results, page 1: counters since power-up
+//
+void ShowDiagnostics(DIAG_BENCH *pBench, int iPage)
+{
+	DIAG_COUNTERS counters;
+	RAM_USAGE ram;
+	char szTemp[24];
+	int i;
+
+	oledFill(0);
+	if (iPage == 0) {
+		for (i=0; i<3; i++) { // throughput in 0.1kB/s; this is the only divide and it's not a hot path
+			if (pBench->u32Fill[i] == 0) // faster than the tick; nothing to divide by
+				fmtString(szTemp, sizeof(szTemp), "I2C %3uk     %8s", udiv10(udiv10(udiv10((uint32_t)iDiagSpeed[i]))), "-");
+			else
+				fmtString(szTemp, sizeof(szTemp), "I2C %3uk     %4.1ukB/s", udiv10(udiv10(udiv10((uint32_t)iDiagSpeed[i]))),
+						(uint32_t)DIAG_FILL_BYTES * 10000 / pBench->u32Fill[i]);
+			oledWriteString(0, i*8, szTemp, FONT_6x8, 0);
+		}
+		ShowDiagTime(24, "Fill 400k", pBench->u32Fill[2]);
+		ShowDiagTime(32, "ShowCurrent", pBench->u32Current);
+		ShowDiagTime(40, "Wake cost", pBench->u32Wake);
+		ShowDiagTime(48, "SCD41 cmd", pBench->u32Sensor);
+		ShowDiagTime(56, "FLASH page", pBench->u32Flash);
+	} else {
+		diagGetCounters(&counters);
+		ramGetUsage(&ram);
+		ShowDiagHours(0, "Up", counters.u32AwakeSecs + counters.u32StandbySecs);
+		ShowDiagHours(8, "Awake", counters.u32AwakeSecs);
+		ShowDiagHours(16, "Standby", counters.u32StandbySecs);
+		fmtString(szTemp, sizeof(szTemp), "%-12s%8u", "Wakes", counters.u32Wakes);
+		oledWriteString(0, 24, szTemp, FONT_6x8, 0);
+		fmtString(szTemp, sizeof(szTemp), "%-12s%6.3umAh", "MCU charge", counters.u32ChargeUAh);
+		oledWriteString(0, 32, szTemp, FONT_6x8, 0);
+		fmtString(szTemp, sizeof(szTemp), "%-12s%8u", "I2C errors", counters.u16Errors[DIAG_ERR_I2C]);
+		oledWriteString(0, 40, szTemp, FONT_6x8, 0);
+		fmtString(szTemp, sizeof(szTemp), "%-12s%4u/%-3u", "SCD41 err/nr", counters.u16Errors[DIAG_ERR_SENSOR],
+				counters.u16Errors[DIAG_ERR_NOT_READY]);
+		oledWriteString(0, 48, szTemp, FONT_6x8, 0);
+		fmtString(szTemp, sizeof(szTemp), "%-12s%4u/%-3u", "Stack/scr pk", ram.u16StackPeak, scratchPeak());
+		oledWriteString(0, 56, szTemp, FONT_6x8, 0);
+	}
+} /* ShowDiagnostics() */
+
+//
+// Hidden diagnostics screen, entered with both buttons in the menu
+// Button 0 flips between the pages, button 1 runs the benchmarks again
+// and both buttons go back to the menu
+//
+void RunDiagnostics(void)
+{
+	DIAG_BENCH bench;
+	BTN_EVENT event;
+	int iPage = 0;
+
+	DiagBenchmark(&bench);
+	ShowDiagnostics(&bench, iPage);
+	while (1) {
+		btnWaitEvent(&event, -1);
+		if (event.u8Type == BTN_EVT_CHORD)
+			break;
+		if (event.u8Type != BTN_EVT_PRESS)
+			continue;
+		if (event.u8Buttons & 1) {
+			iPage ^= 1;
+		} else {
+			DiagBenchmark(&bench);
+			iPage = 0;
+		}
+		ShowDiagnostics(&bench, iPage);
+	}
+	btnFlush();
+} /* RunDiagnostics() */
+#endif // DIAG_SCREEN
+
 void RunMenu(void)
 {
 int iSelItem = 0;
 int y, bDone = 0;
-char szTemp[16];
+BTN_EVENT event;
 STATE oldstate = state;
-pinMode(MOTOR_PIN, OUTPUT);
+	   btnFlush(); // wait for the buttons which left the last mode to be released
 	   oledInit(0x3c, 400000);
-	   oledFill(0);
 	   oledContrast(150);
-	   oledWriteString(4,0,"Pocket CO2", FONT_12x16, 0);
-//	   oledWriteString(0,16,"================", FONT_8x8, 0);
+	   ShowMenu(iSelItem, 1);
 	   while (!bDone) {
-		   // draw the menu items and highlight the currently selected one
-		   y = 24;
-		   oledWriteString(0,y,"Start", FONT_8x8, (iSelItem == MENU_START));
-		   y += 8;
-		   oledWriteString(0,y, "Mode", FONT_8x8, (iSelItem == MENU_MODE));
-		   oledWriteString(40,y, szMode[state.iMode], FONT_8x8, 0);
-		   y += 8;
-		   oledWriteString(0,y,"Update", FONT_8x8, (iSelItem == MENU_FREQ));
-  		   i2str(szTemp, state.iFreq);
-    	   oledWriteString(56,y, szTemp, FONT_8x8, 0);
-    	   oledWriteString(-1,y, " secs", FONT_8x8, 0);
-		   y += 8;
-		   oledWriteString(0,y,"Alert", FONT_8x8, (iSelItem == MENU_ALERT));
-		   oledWriteString(48,y,szAlert[state.iAlert], FONT_8x8, 0);
-		   y += 8;
-		   oledWriteString(0,y,"Timer", FONT_8x8, (iSelItem == MENU_TIME));
-		   i2str(szTemp, state.iPeriod); // time in minutes
-		   oledWriteString(48, y, szTemp, FONT_8x8, 0);
-		   oledWriteString(-1,y, " Mins ", FONT_8x8, 0); // erase old value
-		   // wait for button releases
-		   while (GetButtons() != 0) {
-			   Delay_Ms(20);
-		   }
 		   // wait for a button press
-		   while (GetButtons() == 0) {
-			   Delay_Ms(20);
+		   do {
+			   btnWaitEvent(&event, -1);
+		   } while (event.u8Type != BTN_EVT_PRESS && event.u8Type != BTN_EVT_CHORD);
+		   patternStop(); // a press silences the alert
+#ifdef DIAG_SCREEN
+		   if (event.u8Type == BTN_EVT_CHORD) { // hidden diagnostics screen
+			   RunDiagnostics();
+			   ShowMenu(iSelItem, 1);
+			   continue;
 		   }
-		   y = GetButtons();
+#else
+		   if (event.u8Type == BTN_EVT_CHORD)
+			   continue;
+#endif
+		   y = event.u8Buttons;
 		   if (y & 1) { // button 0
 		      iSelItem++;
 		      if (iSelItem == MENU_COUNT) iSelItem = 0;
+		      ShowMenu(iSelItem, 0);
 		      continue;
 		   }
 		   if (y & 2) { // button 1 - action on an item
@@ -389,6 +883,9 @@ pinMode(MOTOR_PIN, OUTPUT);
 				   break;
 			   case MENU_MODE: // mode
 				   state.iMode++;
+#ifndef CONSOLE
+				   if (state.iMode == MODE_CONSOLE) state.iMode++; // not in this build
+#endif
 				   if (state.iMode >= MODE_COUNT) state.iMode = 0;
 				   break;
 			   case MENU_FREQ: // stealth update frequency
@@ -404,6 +901,7 @@ pinMode(MOTOR_PIN, OUTPUT);
 				   if (state.iPeriod > 60) state.iPeriod = 5;
 				   break;
 			   }
+			   ShowMenu(iSelItem, 0);
 			   continue;
 		   }
 	   }; // while (!bDone)
@@ -413,85 +911,75 @@ pinMode(MOTOR_PIN, OUTPUT);
 	   }
 } /* RunMenu() */
 
-void BlinkLED(uint8_t u8LED, int iDuration)
-{
-	pinMode(u8LED, OUTPUT);
-    digitalWrite(u8LED, 1);
-    Delay_Ms(iDuration);
-    digitalWrite(u8LED, 0);
-} /* BlinkLED() */
-
 //
-// Run the vibration motor
-// for N milliseconds
-// 50ms is a practical minimum
+// Start the chosen alert pattern; it plays in the background
 //
-void Vibrate(int iDuration)
-{
-	pinMode(MOTOR_PIN, OUTPUT);
-	digitalWrite(MOTOR_PIN, 1);
-	Delay_Ms(iDuration);
-	digitalWrite(MOTOR_PIN, 0);
-} /* Vibrate() */
-
 void ShowAlert(void)
 {
-int i;
-
-	switch (state.iAlert)
-	{
-	case ALERT_VIBRATION:
-		for (i=0; i<3; i++) {
-		    Vibrate(150);
-		//    Standby82ms(10);
-		    Delay_Ms(820);
-		  }
-		break;
-	case ALERT_LED:
-		for (i=0; i<4; i++) {
-		    BlinkLED(LED_GREEN, 300);
-		    BlinkLED(LED_RED, 300);
-		  }
-		break;
-	case ALERT_BOTH:
-		for (i=0; i<3; i++) {
-		    Vibrate(150);
-		    BlinkLED(LED_GREEN, 400);
-		    BlinkLED(LED_RED, 400);
-		  }
-		break;
-	}
+	patternPlay(&patAlert[state.iAlert], 0);
 } /* ShowAlert() */
 
 void ShowTime(int iSecs)
 {
-	char szTemp[8];
-    szTemp[0] = '0';
-	szTemp[1] = (iSecs/60)+'0';
-	szTemp[2] = ':';
-	szTemp[3] = ((iSecs % 60) / 10) + '0';
-	szTemp[4] = (iSecs % 10) + '0';
-	szTemp[5] = 0;
+	int iMark = scratchMark();
+	SCRATCH_ALLOC(char, szTemp, 8, SCRATCH_CALLER);
+	int iMins = (int)udiv60((uint32_t)iSecs);
+	I2C_TRACE_ENTER(TRACE_SITE_SHOWTIME);
+
+	fmtString(szTemp, 8, "%02d:%02d", iMins, iSecs - (int)mul60(iMins));
 	oledWriteStringCustom(&Roboto_Black_40, 10, 56, szTemp, 1);
 //	oledWriteString(34,24,szTemp, FONT_12x16, 0);
+	scratchRelease(iMark);
+	I2C_TRACE_LEAVE();
 } /* ShowTime() */
 
+//
+// Read the button levels after waking from standby
+// (edges can't be captured while the pins are pulled down in standby)
+//
 int GetButtons(void)
 {
-	int i = 0;
-	pinMode(BUTTON0_PIN, INPUT_PULLUP); // re-enable gpio in case it got disabled by standby mode
-	pinMode(BUTTON1_PIN, INPUT_PULLUP);
-	if (digitalRead(BUTTON0_PIN) == 0) i|=1;
-	if (digitalRead(BUTTON1_PIN) == 0) i|=2;
-	return i;
-
+	btnResync(); // re-enable gpio in case it got disabled by standby mode
+	return btnGetState();
 } /* GetButtons() */
 
-void RunLowPower(void)
+//
+// Wait for a single button press or both buttons
+// returns the event type
+//
+int WaitButton(void)
+{
+	BTN_EVENT event;
+
+	do {
+		btnWaitEvent(&event, -1);
+	} while (event.u8Type != BTN_EVT_PRESS && event.u8Type != BTN_EVT_CHORD);
+	return event.u8Type;
+} /* WaitButton() */
+
+//
+// Read the queued button events
+// returns 1 if both buttons were pressed (leave the mode)
+//
+int CheckExit(void)
+{
+	BTN_EVENT event;
+	int bExit = 0;
+
+	while (btnGetEvent(&event)) {
+		if (event.u8Type == BTN_EVT_CHORD)
+			bExit = 1;
+	}
+	return bExit;
+} /* CheckExit() */
+
+void RunLowPower(int bResume)
 {
 	int i, iUITick = 20, iSampleTick = 0;
 	int bWasSuspended = 0;
 
+	if (!bResume)
+		StartResume(MODE_LOW_POWER);
     I2CSetSpeed(50000);
     scd41_start(SCD_POWERMODE_LOW); // start low power mode (available on SCD40 & SCD41)
 
@@ -502,6 +990,7 @@ void RunLowPower(void)
 				I2CInit(50000);
 			}
 			scd41_stop(); // stop collecting samples
+			ClearResume();
 			return;
 		} else if (i && iUITick == 0) { // one button pressed, show the current data
 			if (bWasSuspended == 1) {
@@ -526,14 +1015,13 @@ void RunLowPower(void)
 			} else {
 				I2CSetSpeed(50000);
 			}
-	       scd41_getSample();
+	       GetSample(30);
 	       if(_iCO2 < 1000){ // show state by LEDs
-               BlinkLED(LED_GREEN, 2);
+               patternPlay(&patGreen, 0);
            } else if(_iCO2 > 1000 && _iCO2 < 2000){
-               BlinkLED(LED_GREEN, 2);
-               BlinkLED(LED_RED, 3);
+               patternPlay(&patGreenRed, 0);
            } else {
-               BlinkLED(LED_RED, 3);
+               patternPlay(&patRed, 0);
            }
 	       iSampleTick = 0; // restart the 30 second timer for the next sample
 		}
@@ -552,52 +1040,217 @@ void RunLowPower(void)
 	}
 } /* RunLowPower() */
 
-void RunStealth(void)
+//
+// LED status level of a CO2 reading: 0 = green, 1 = green+red, 2 = red
+//
+int CO2Level(int iCO2)
 {
-	int iTick=0, j, iLevel = 1;
-	int iUpdate = state.iFreq * 4; // how many quarter seconds to update vibration result
-  oledFill(0);
-  oledWriteString(22,0,"Stealth", FONT_12x16, 0);
-  oledWriteString(0,16,"CO2 measurements will", FONT_6x8, 0);
-  oledWriteString(0,24,"be converted to 1-6", FONT_6x8, 0);
-  oledWriteString(0,32,"pulses. 1=good, 6=bad", FONT_6x8, 0);
-  oledWriteString(0,56,"press button to start", FONT_6x8, 0);
-  while (GetButtons() != 0) {
-	  Delay_Ms(20); // wait for user to release all buttons
-  }
-  while (j = GetButtons() == 0) {
-	  Delay_Ms(20);
-  }
+	if (iCO2 < CO2_LEVEL_HIGH)
+		return 0;
+	return (iCO2 < CO2_LEVEL_VERY_HIGH) ? 1 : 2;
+} /* CO2Level() */
+
+//
+// Update the adaptive mode with a new reading taken iSecs after the last one
+// returns 1 if the sampling rate has to change
+//
+int AdaptUpdate(ADAPT *pAdapt, int iSecs)
+{
+	int iDist, iNear, i;
+	int bFast = pAdapt->bFast;
+
+	// distance to the nearest LED level
+	iDist = (int)_iCO2 - CO2_LEVEL_HIGH;
+	if (iDist < 0) iDist = -iDist;
+	i = (int)_iCO2 - CO2_LEVEL_VERY_HIGH;
+	if (i < 0) i = -i;
+	if (i < iDist) iDist = i;
+	// change over the last ADAPT_RATE_SECS (every sample in low power mode)
+	pAdapt->iRefSecs += iSecs;
+	if (pAdapt->iRefCO2 < 0) {
+		pAdapt->iRefCO2 = _iCO2;
+		pAdapt->iRefSecs = 0;
+	} else if (pAdapt->iRefSecs >= ADAPT_RATE_SECS) {
+		i = (int)_iCO2 - pAdapt->iRefCO2;
+		pAdapt->iRate = (i < 0) ? -i : i;
+		pAdapt->iRefCO2 = _iCO2;
+		pAdapt->iRefSecs = 0;
+	}
+	// near enough that the next slow sample could be past the level
+	iNear = ADAPT_NEAR + ADAPT_AHEAD * pAdapt->iRate;
+	if (!bFast) {
+		if (iDist < iNear || pAdapt->iRate >= ADAPT_RATE_UP) {
+			pAdapt->bFast = 1;
+			pAdapt->iCalmSecs = 0;
+		}
+	} else if (iDist < iNear + ADAPT_MARGIN || pAdapt->iRate >= ADAPT_RATE_DOWN) {
+		pAdapt->iCalmSecs = 0;
+	} else {
+		pAdapt->iCalmSecs += iSecs;
+		if (pAdapt->iCalmSecs >= ADAPT_CALM_SECS)
+			pAdapt->bFast = 0;
+	}
+	return (pAdapt->bFast != bFast);
+} /* AdaptUpdate() */
+
+//
+// Sample every 30s in low power mode while the readings are stable and
+// every 5s while they change quickly or are near a level where the LEDs
+// change. It starts fast, so the first reading comes after 5 seconds.
+// The LEDs show the level of every reading, as in low power mode.
+//
+void RunAdaptive(int bResume)
+{
+	ADAPT adapt;
+	int i, iSecs, iUITick = 20, iSampleTick = 0;
+	int iPeriod = ADAPT_FAST_TICKS;
+	int bWasSuspended = 0;
+
+	if (!bResume)
+		StartResume(MODE_ADAPTIVE);
+	adapt.bFast = 1;
+	adapt.iRefCO2 = -1;
+	adapt.iRefSecs = adapt.iRate = adapt.iCalmSecs = 0;
+	I2CSetSpeed(50000);
+	scd41_start(SCD_POWERMODE_NORMAL);
+
+	while (1) {
+		i = GetButtons();
+		if (i == 3) { // both buttons pressed, return to menu
+			if (bWasSuspended == 1)
+				I2CInit(50000);
+			scd41_stop();
+			ClearResume();
+			return;
+		} else if (i && iUITick == 0) { // one button pressed, show the current data
+			if (bWasSuspended == 1) {
+				I2CInit(400000);
+				bWasSuspended = 0;
+			}
+			oledPower(1);
+			ShowCurrent();
+			iUITick = 20; // number of 250ms periods before turning off the display
+		}
+#ifdef DEBUG_MODE
+		Delay_Ms(3*82);
+#else
+		Standby82ms(3); // conserve power (1.8mA running, 10uA standby)
+		bWasSuspended = 1;
+#endif
+		if (++iSampleTick >= iPeriod) {
+			if (bWasSuspended == 1) {
+				I2CInit(50000);
+				bWasSuspended = 0;
+			} else {
+				I2CSetSpeed(50000);
+			}
+			iSecs = (adapt.bFast) ? 5 : 30;
+			iSampleTick = 0;
+			if (GetSample(iSecs) == SCD_SUCCESS) {
+				i = CO2Level(_iCO2); // show the level by LEDs
+				patternPlay((i == 0) ? &patGreen : (i == 1) ? &patGreenRed : &patRed, 0);
+				if (AdaptUpdate(&adapt, iSecs)) { // restart the sensor at the new rate
+					scd41_stop();
+					scd41_start((adapt.bFast) ? SCD_POWERMODE_NORMAL : SCD_POWERMODE_LOW);
+					iPeriod = (adapt.bFast) ? ADAPT_FAST_TICKS : ADAPT_SLOW_TICKS;
+				}
+			}
+		}
+		if (iUITick > 0) {
+			iUITick--;
+			if (iUITick == 0) { // shut off the display after 5 seconds
+				if (bWasSuspended) {
+					I2CInit(400000);
+					bWasSuspended = 0;
+				} else {
+					I2CSetSpeed(400000);
+				}
+				oledPower(0);
+			}
+		}
+	}
+} /* RunAdaptive() */
+
+//
+// Sleep in standby for iTicks x 82ms; a button press wakes it early and it
+// stays awake until the buttons have settled (SysTick stops in standby, so
+// the button timing can't run there). The rest of that standby is lost, so
+// with bFull set the wait starts over after a press; it can't end before
+// iTicks have passed (the sensor is measuring and doesn't answer until then)
+// returns 1 if both buttons were pressed (leave the mode)
+//
+int StealthSleep(int iTicks, int bFull)
+{
+	BTN_EVENT event;
+	int n, iLeft = iTicks;
+
+	while (iLeft > 0) {
+		n = (iLeft > 63) ? 63 : iLeft;
+		iLeft -= n;
+#ifdef DEBUG_MODE
+		Delay_Ms(n * 82);
+		if (CheckExit())
+			return 1;
+#else
+		if (Standby82msWake((uint8_t)n, BUTTON0_PIN, BUTTON1_PIN)) {
+			while (btnWaitEvent(&event, STEALTH_SETTLE_MS)) {
+				if (event.u8Type == BTN_EVT_CHORD)
+					return 1;
+			}
+			if (bFull)
+				iLeft = iTicks;
+		}
+#endif
+	}
+	return 0;
+} /* StealthSleep() */
+
+//
+// Report the CO2 level every state.iFreq seconds as 1-6 vibration pulses
+// The MCU spends the time in between in standby and the sensor takes one
+// single shot measurement per report, started 5.5 seconds before it. For
+// the 15-60s settings that costs less than the 30s low power periodic mode
+// and the reading is never older than the report.
+//
+void RunStealth(int bResume)
+{
+	int iLevel = 0, iPeriod, bShot = 0;
+
+  if (bResume) // power was lost while running; don't wait for the user again
+	  goto start_sampling;
+  ShowScreen(SCREEN_STEALTH);
+  btnFlush(); // wait for user to release all buttons
+  WaitButton();
+  StartResume(MODE_STEALTH);
+start_sampling:
   oledFill(0);
   oledPower(0);
-  // start fast CO2 sampling
+  // iFreq x 12.5 standby ticks
+  iPeriod = (state.iFreq << 3) + (state.iFreq << 2) + (state.iFreq >> 1);
   I2CSetSpeed(50000);
-  scd41_start(SCD_POWERMODE_NORMAL);
+  scd41_start(SCD_POWERMODE_ONESHOT);
 
   while (1) {
-	  j = GetButtons();
-	  if (j == 3) { // return to menu
-		  oledFill(0);
-		  scd41_stop();
-		  return;
-	  }
-	  Delay_Ms(250);
-	  if ((iTick % 20) == 19) { // get new sample every 5 seconds
-		  scd41_getSample();
-		  iLevel = 1 + (_iCO2/500); // 0-499 = perfect, 500-999 = good, 1000-1499=so-so, 1500-1999=not great, 2000-2499=bad, 2500+ = very bad
-		  if (iLevel < 1) iLevel = 1;
-		  else if (iLevel > 6) iLevel = 6;
+	  if (StealthSleep(iPeriod - STEALTH_SHOT_TICKS, 0))
+		  break;
+	  I2CInit(50000);
+	  scd41_singleShot(); // in time for the report
+	  bShot = 1;
+	  if (StealthSleep(STEALTH_SHOT_TICKS, 1))
+		  break;
+	  bShot = 0;
+	  I2CInit(50000);
+	  if (GetSample(state.iFreq) == SCD_SUCCESS) {
+		  iLevel = 1 + (int)udiv500(_iCO2); // 0-499 = perfect, 500-999 = good, 1000-1499=so-so, 1500-1999=not great, 2000-2499=bad, 2500+ = very bad
+		  if (iLevel > 6) iLevel = 6;
 	  }
-	  if ((iTick % iUpdate) == (iUpdate-1)) { // time to buzz
-		  for (j=0; j<iLevel; j++) {
-			  Vibrate(100);
-			  Delay_Ms(395);
-//			  BlinkLED(LED_GREEN, 5);
-			  iTick += 2; // we delayed it 500ms
-		  }
-	  }
-	  iTick++;
+	  if (iLevel) // no pulses until there is a reading
+		  patternPlay(&patPulse, iLevel); // the TIM1 sequencer plays them, then the next standby starts
   } // while (1)
+  // return to menu
+  if (bShot) // the sensor doesn't answer until the single shot is done; stay awake so the buttons see the release
+	  Delay_Ms(SCD41_SINGLE_SHOT_MS + STEALTH_SETTLE_MS);
+  ClearResume();
 } /* RunStealth() */
 #ifdef FUTURE
 //
@@ -650,110 +1303,275 @@ void RunOnDemand(void)
 } /* RunOnDemand() */
 #endif // FUTURE
 
-void RunCalibrate(void)
+#ifdef CONSOLE
+// settings the console can change, in the order of the STATE fields
+const char *szSetting[] = {"mode", "alert", "freq", "period"};
+const uint8_t u8SettingMin[] = {0, 0, 15, 5};
+const uint8_t u8SettingMax[] = {MODE_COUNT-1, ALERT_COUNT-1, 60, 60};
+
+//
+// Execute one console command line
+// get                  - settings, last reading and the history range
+// set <name> <value>   - change a setting (mode, alert, freq, period)
+// cal [ppm]            - forced recalibration (run 3+ minutes in free air first)
+// dump [seq]           - history frames from seq on, then "end <next seq>"
+// i2c [clear]          - I2C totals per UI function and the latest transfers, then "end" (I2C_TRACE)
+// prof [clear]         - time per profiled scope with log2 histograms, then "end" (PROFILE)
+// ram                  - RAM use in bytes, the deepest the stack has been and the scratch arena peak
+//
+void ConsoleCommand(char *szCmd)
 {
-	int i, j;
+	int i, iVal, rc;
+	RAM_USAGE ram;
 
-	oledFill(0);
-	oledWriteString(10,0,"Calibrate", FONT_12x16, 0);
-    oledWriteString(0,16,"Place device in a", FONT_6x8, 0);
-    oledWriteString(0,24,"free air environment.", FONT_6x8, 0);
-    oledWriteString(0,32,"Press either button", FONT_6x8, 0);
-    oledWriteString(0,40,"to start. When timer", FONT_6x8, 0);
-    oledWriteString(0,48,"finishes, result will", FONT_6x8, 0);
-    oledWriteString(0,56,"show success or fail", FONT_6x8, 0);
-    while (GetButtons()) {
-    	Delay_Ms(20); // wait for user to release button(s)
-    }
-	while ((j = GetButtons()) == 0) {
-		Delay_Ms(20);
+	if (memcmp(szCmd, "get", 3) == 0) {
+		consolePrintf("mode=%d alert=%d freq=%d period=%d co2=%d temp=%d rh=%d first=%u next=%u\r\n",
+				state.iMode, state.iAlert, state.iFreq, state.iPeriod, _iCO2, _iTemperature, _iHumidity,
+				historyFirst(), historyNext());
+	} else if (memcmp(szCmd, "set ", 4) == 0) {
+		szCmd += 4;
+		for (i=0; i<4; i++) {
+			if (memcmp(szCmd, szSetting[i], strlen(szSetting[i])) == 0)
+				break;
+		}
+		if (i < 4) {
+			szCmd += strlen(szSetting[i]);
+			if (consoleGetInt(&szCmd, &iVal) != 0 || iVal < u8SettingMin[i] || iVal > u8SettingMax[i] ||
+			   (i == 0 && iVal == MODE_CALIBRATE)) // not saved, like in the menu
+				i = 4;
+		}
+		if (i < 4) {
+			((int *)&state)[i] = iVal;
+			WriteFlash();
+			consolePuts("ok\r\n");
+		} else {
+			consolePuts("err\r\n");
+		}
+	} else if (memcmp(szCmd, "cal", 3) == 0) {
+		szCmd += 3;
+		if (consoleGetInt(&szCmd, &iVal) != 0)
+			iVal = 423; // same reference as the Calibrate mode
+		scd41_stop();
+		rc = scd41_recalibrate((uint16_t)iVal);
+		scd41_start(SCD_POWERMODE_NORMAL);
+		consolePuts((rc == SCD_SUCCESS) ? "ok\r\n" : "err\r\n");
+	} else if (memcmp(szCmd, "dump", 4) == 0) {
+		szCmd += 4;
+		if (consoleGetInt(&szCmd, &iVal) != 0)
+			iVal = 0;
+		consolePrintf("end %u\r\n", consoleDump((uint32_t)iVal));
+#ifdef I2C_TRACE
+	} else if (memcmp(szCmd, "i2c", 3) == 0) {
+		i2cTraceDump();
+		if (memcmp(szCmd + 3, " clear", 6) == 0)
+			i2cTraceClear();
+#endif
+	} else if (memcmp(szCmd, "ram", 3) == 0) {
+		ramGetUsage(&ram);
+		consolePrintf("code=%d data=%d bss=%d heap=%d stack=%d peak=%d free=%d scratch=%d/%d\r\n", ram.u16Code, ram.u16Data,
+				ram.u16Bss, ram.u16Heap, ram.u16Stack, ram.u16StackPeak, ram.u16Free, scratchPeak(), SCRATCH_SIZE);
+#ifdef PROFILE
+	} else if (memcmp(szCmd, "prof", 4) == 0) {
+		profileDump();
+		if (memcmp(szCmd + 4, " clear", 6) == 0)
+			profileClear();
+#endif
+	} else {
+		consolePuts("err\r\n");
 	}
-	if (j == 3) { // both buttons, exit
-		return;
+} /* ConsoleCommand() */
+
+//
+// Keep sampling while serving the serial console
+// The device stays awake (no standby) so USART1 can receive
+//
+void RunConsole(void)
+{
+	char *szCmd;
+	uint32_t u32Last;
+
+	ShowScreen(SCREEN_CONSOLE);
+	I2CSetSpeed(50000);
+	scd41_start(SCD_POWERMODE_NORMAL);
+	while (telemetryBusy())
+		Delay_Ms(1);
+	telemetryInit(CONSOLE_BAUD);
+	consoleStart();
+	consolePuts("Pocket CO2 ready\r\n");
+	u32Last = Delay_GetTick();
+	while (!CheckExit()) {
+		// sleep until a character arrives or it's time for the next poll
+		Delay_Wait(Delay_MsToTicks(50), &u8TelemetryRx);
+		while ((szCmd = consoleGetLine()) != NULL)
+			ConsoleCommand(szCmd);
+		if (Delay_GetTick() - u32Last >= Delay_MsToTicks(5000)) {
+			u32Last += Delay_MsToTicks(5000);
+			I2CSetSpeed(50000);
+			GetSample(5);
+		}
 	}
+	consoleStop();
+	scd41_stop();
+	while (telemetryBusy())
+		Delay_Ms(1);
+#if defined(TELEMETRY) || defined(DEBUG_MODE)
+	telemetryInit(TELEMETRY_BAUD);
+#endif
 	oledFill(0);
-	oledWriteString(0,0,"Calibration running", FONT_6x8, 0);
+} /* RunConsole() */
+#endif // CONSOLE
+
+void RunCalibrate(void)
+{
+	int i;
+
+	ShowScreen(SCREEN_CALIBRATE);
+    btnFlush(); // wait for user to release button(s)
+	if (WaitButton() == BTN_EVT_CHORD) { // both buttons, exit
+		return;
+	}
+	ShowScreen(SCREEN_CALIBRATING);
    I2CSetSpeed(50000);
    scd41_start(SCD_POWERMODE_NORMAL);
    // allow 3 minutes of normal collection
    for (i=210; i>=0; i--) {
 	  ShowTime(i);
-	  j = GetButtons();
-	  if (j == 3) { // user quit
+	  if (CheckExit()) { // user quit
 		  scd41_stop();
 		  return;
 	  }
 	  Delay_Ms(1000);
    }
-   oledClearLine(24);
-   oledClearLine(32);
-   oledClearLine(40);
-   oledClearLine(48);
    scd41_stop(); // stop periodic measurement
    i = scd41_recalibrate(423); // force recalibration
-   if (i == SCD_SUCCESS)
-	   oledWriteString(0,32, "Success!", FONT_12x16, 0);
-   else
-	   oledWriteString(0,32, "Failed", FONT_12x16, 0);
-   oledWriteString(0,56, "Press button to exit", FONT_6x8, 0);
-   while (GetButtons() == 0) {
-	   Delay_Ms(20);
-   }
+   ShowScreen((i == SCD_SUCCESS) ? SCREEN_CAL_SUCCESS : SCREEN_CAL_FAILED);
+   WaitButton();
 } /* RunCalibrate() */
 
-int main(void)
+#ifdef DEBUG_MODE
+//
+// Measure the CPU cycles per pin toggle of the generic and fast GPIO paths
+// SysTick counts HCLK/8, so toggle enough times for a good resolution
+// (the loop overhead is included in both numbers)
+//
+void BenchmarkGPIO(void)
 {
-    int bWasSuspended = 0;
-    Delay_Init();
-    ReadFlash(); // get the user settings from FLASH
-//    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
-//    Option_Byte_CFG(); // allow PD7 to be used as GPIO
-//    Delay_Ms(5000); //100); // give time for power to settle
-//    USART_Printf_Init(460800);
-//    printf("SystemClk:%d\r\n",SystemCoreClock);
-    pinMode(MOTOR_PIN, OUTPUT);
-    digitalWrite(MOTOR_PIN, 0);
-    state.iAlert = ALERT_LED;
-    ShowAlert(); // blink LEDs
-menu_top:
-   RunMenu();
-   // Display the chosen mode
-	oledFill(0);
-	oledWriteString(0,0,szMode[state.iMode], FONT_8x8, 0);
-    oledWriteString(0,8,"Starting...", FONT_8x8, 0);
-   if (state.iMode == MODE_TIMER) {
-	   RunTimer();
-	   goto menu_top;
-   } else if (state.iMode == MODE_CALIBRATE) {
-	   RunCalibrate();
-	   goto menu_top;
-   } else if (state.iMode == MODE_LOW_POWER) {
-	   RunLowPower();
-	   goto menu_top;
-//   } else if (state.iMode == MODE_ON_DEMAND) {
-//	   RunOnDemand();
-//	   goto menu_top;
-   } else if (state.iMode == MODE_STEALTH) {
-	   RunStealth();
-	   goto menu_top;
-   } else { // continuous mode
-	   I2CSetSpeed(50000);
-	   scd41_start(SCD_POWERMODE_NORMAL);
+	int i;
+	uint32_t u32Start, u32Generic, u32Fast;
+
+	u32Start = Delay_GetTick();
+	for (i=0; i<1000; i++) {
+		digitalWrite(LED_GREEN, 1);
+		digitalWrite(LED_GREEN, 0);
+	}
+	u32Generic = Delay_GetTick() - u32Start;
+	u32Start = Delay_GetTick();
+	for (i=0; i<1000; i++) {
+		digitalWriteFast(LED_GREEN, 1);
+		digitalWriteFast(LED_GREEN, 0);
+	}
+	u32Fast = Delay_GetTick() - u32Start;
+	consolePrintf("GPIO cycles/toggle: generic %d, fast %d\r\n", (int)(u32Generic * 8 / 2000), (int)(u32Fast * 8 / 2000));
+} /* BenchmarkGPIO() */
+
+//
+// Compare fmtString() with newlib's snprintf() on a typical readout
+// (snprintf is only linked in debug builds)
+//
+void BenchmarkFormat(void)
+{
+	int i;
+	char szTemp[32];
+	uint32_t u32Start, u32Fmt, u32Newlib;
+
+	u32Start = Delay_GetTick();
+	for (i=0; i<100; i++)
+		fmtString(szTemp, sizeof(szTemp), "%.1dC %d%%", -234, 456); // same output as below
+	u32Fmt = Delay_GetTick() - u32Start;
+	u32Start = Delay_GetTick();
+	for (i=0; i<100; i++)
+		snprintf(szTemp, sizeof(szTemp), "%d.%dC %d%%", -23, 4, 456);
+	u32Newlib = Delay_GetTick() - u32Start;
+	consolePrintf("format cycles: fmt %d, newlib %d\r\n", (int)(u32Fmt * 8 / 100), (int)(u32Newlib * 8 / 100));
+} /* BenchmarkFormat() */
+
+//
+// Cycles per call for each divide/multiply site, first with the C operators
+// (libgcc __udivsi3/__umodsi3/__mulsi3) and then with the fastmath.h kernels
+// The input is read from a volatile so nothing gets constant folded
+//
+static volatile uint32_t u32BenchIn = 3599, u32BenchOut;
+#define BENCH_SITES 6
+#define BENCH(site, op, fast) \
+	u32Start = Delay_GetTick(); \
+	for (i=0; i<100; i++) { n = u32BenchIn; u32BenchOut = (op); } \
+	u32Before[site] = Delay_GetTick() - u32Start; \
+	u32Start = Delay_GetTick(); \
+	for (i=0; i<100; i++) { n = u32BenchIn; u32BenchOut = (fast); } \
+	u32After[site] = Delay_GetTick() - u32Start;
+
+void BenchmarkMath(void)
+{
+	static const char *szSite[BENCH_SITES] = {"time /60 %60", "RH /10", "CO2 /500", "SCD41 T", "SCD41 RH", "font *7"};
+	uint32_t u32Start, u32Before[BENCH_SITES], u32After[BENCH_SITES], n, q;
+	int i;
+
+	BENCH(0, n/60 + n%60, (q = udiv60(n), q + n - mul60(q)))
+	BENCH(1, n/10, udiv10(n))
+	BENCH(2, n/500, udiv500(n))
+	BENCH(3, (uint32_t)(-450 + ((int32_t)n * 1750L / 65536L)), (uint32_t)(-450 + (int)(mul1750(n) >> 16)))
+	BENCH(4, (uint32_t)((int32_t)n * 1000L / 65536L), mul1000(n) >> 16)
+	BENCH(5, (int)(n & 0x7f) * 7, mul7(n & 0x7f))
+	for (i=0; i<BENCH_SITES; i++)
+		consolePrintf("%s cycles: %d -> %d\r\n", szSite[i], (int)(u32Before[i] * 8 / 100), (int)(u32After[i] * 8 / 100));
+} /* BenchmarkMath() */
+#endif // DEBUG_MODE
+
+//
+// Wait for the first measurement after starting periodic mode
+// The SCD41 needs 5 seconds to produce it, so sleep most of that time
+// and then poll the data ready flag instead of waiting a fixed (longer) time
+//
+void WaitFirstSample(void)
+{
+	int i;
+	uint16_t u16Status;
+
+#ifdef DEBUG_MODE
+	Delay_Ms(59*82);
+#else
+	Standby82ms(59);
+#endif
+	for (i=0; i<25; i++) { // give up after 2 more seconds
+		I2CInit(50000);
+		if (scd41_readRegister(SCD41_CMD_GET_DATA_READY_STATUS, &u16Status) == SCD_SUCCESS && (u16Status & 0x07ff) != 0)
+			return;
 #ifdef DEBUG_MODE
-	   Delay_Ms(5000); // allow time for first sample to capture
+		Delay_Ms(82);
 #else
-	   Standby82ms(59);
+		Standby82ms(1);
 #endif
+	}
+} /* WaitFirstSample() */
+
+void RunContinuous(int bResume)
+{
+	int i, j;
+	int bWasSuspended = 0;
+
+	if (!bResume)
+		StartResume(MODE_CONTINUOUS);
+	I2CSetSpeed(50000);
+	scd41_start(SCD_POWERMODE_NORMAL);
+	WaitFirstSample();
     while(1) {
-    	int i, j;
         I2CInit(50000); // SCD40 can't handle 400k
     	//I2CSetSpeed(50000); // SCD40 can't handle 400k
-    	scd41_getSample();
-    	iSample++;
+    	GetSample(5);
 #ifdef FUTURE
-    	if (iSample > 3) AddSample(iSample); // add it to collected stats
+    	if (resume.iSample > 3) AddSample(resume.iSample); // add it to collected stats
 #endif // FUTURE
-    	if (iSample == 16 && state.iMode != MODE_CONTINUOUS ) { // after 1 minute, turn off the display
+    	if (resume.iSample == 16 && state.iMode != MODE_CONTINUOUS ) { // after 1 minute, turn off the display
     		oledPower(0); // turn off display
     	}
     	ShowCurrent(); // display the current conditions on the OLED
@@ -771,7 +1589,8 @@ menu_top:
 			                    bWasSuspended = 0;
 			    }
  			    scd41_stop(); // stop periodic measurement
-				goto menu_top;
+ 			    ClearResume();
+				return;
 			}
 //				if (iMode == 0) {
 					// OLED is off, turn it back on
@@ -787,5 +1606,67 @@ menu_top:
 //			}
 		} // for i
     } // while (1)
-   } // not timer mode
+} /* RunContinuous() */
+
+int main(void)
+{
+    int bResume;
+    Delay_Init();
+    BootTimerStart(); // for a resume, the first reading is timed from reset
+    btnInit(BUTTON0_PIN, BUTTON1_PIN);
+    ReadFlash(); // get the user settings from FLASH
+//    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
+//    Option_Byte_CFG(); // allow PD7 to be used as GPIO
+//    Delay_Ms(5000); //100); // give time for power to settle
+//    USART_Printf_Init(460800);
+//    consolePrintf("SystemClk:%u\r\n",SystemCoreClock);
+    pinMode(MOTOR_PIN, OUTPUT);
+    digitalWrite(MOTOR_PIN, 0);
+    pinMode(LED_GREEN, OUTPUT);
+    pinMode(LED_RED, OUTPUT);
+    patternInit(MOTOR_PIN, LED_RED, LED_GREEN, LED_BRIGHTNESS);
+#if defined(TELEMETRY) || defined(DEBUG_MODE) // consolePrintf() needs the port too
+    telemetryInit(TELEMETRY_BAUD);
+#endif
+#ifdef DEBUG_MODE
+    BenchmarkGPIO();
+    BenchmarkFormat();
+    BenchmarkMath();
+#endif
+    bResume = ReadResume();
+    if (bResume) { // power was lost while a mode was running, go straight back to it
+    	oledInit(0x3c, 400000);
+    	oledContrast(150);
+    	goto run_mode;
+    }
+    bBootTimer = 0; // no mode running
+    state.iAlert = ALERT_LED;
+    ShowAlert(); // blink LEDs
+menu_top:
+   RunMenu();
+   bResume = 0;
+   BootTimerStart();
+run_mode:
+   // Display the chosen mode
+   ShowScreen((bResume) ? SCREEN_RESUMING : SCREEN_STARTING);
+   if (state.iMode == MODE_TIMER) {
+	   RunTimer();
+   } else if (state.iMode == MODE_CALIBRATE) {
+	   RunCalibrate();
+   } else if (state.iMode == MODE_LOW_POWER) {
+	   RunLowPower(bResume);
+//   } else if (state.iMode == MODE_ON_DEMAND) {
+//	   RunOnDemand();
+   } else if (state.iMode == MODE_STEALTH) {
+	   RunStealth(bResume);
+#ifdef CONSOLE
+   } else if (state.iMode == MODE_CONSOLE) {
+	   RunConsole();
+#endif
+   } else if (state.iMode == MODE_ADAPTIVE) {
+	   RunAdaptive(bResume);
+   } else { // continuous mode
+	   RunContinuous(bResume);
+   }
+   goto menu_top;
 } /* main() */
@@ -21,10 +21,13 @@
 #include <string.h>
 #include "oled.h"
 #include "Arduino.h"
+#include "fastmath.h"
+#include "scratch.h"
+
+#define OLED_CACHE_SIZE (OLED_WIDTH + 2) // one page row and the data introducer (scratch)
 
 static int cursor_x, cursor_y;
 static uint8_t oledAddr;
-static uint8_t u8Cache[130];
 
 const unsigned char oled64_initbuf[]={0x00,0xae,0xa8,0x3f,0xd3,0x00,0x40,0xa1,0xc8,
       0xda,0x12,0x81,0xff,0xa4,0xa6,0xd5,0x80,0x8d,0x14,
@@ -197,68 +200,108 @@ uint8_t buf[4];
   I2CWrite(oledAddr, buf, 4);
 } /* oledSetPosition() */
 
+//
+// The inner loops of oledDrawSprite() and oledWriteStringCustom(): where
+// the drawing time goes, so they run from RAM
+//
+// One row of a 1-bpp sprite (MSB first, starting at ucSrcMask of *s) into
+// the column bytes at d; ucDstMask is the bit of the row in them
+static RAMFUNC void oledSpriteRow(uint8_t *d, const uint8_t *s, uint8_t ucSrcMask, int cx, uint8_t ucDstMask, int bInvert)
+{
+    uint8_t pix = *s++;
+
+    while (cx--)
+    {
+        if (pix & ucSrcMask) { // set pixel in source, set it in dest
+            if (bInvert)
+                d[0] &= ~ucDstMask;
+            else
+                d[0] |= ucDstMask;
+        }
+        d++; // next pixel column
+        ucSrcMask >>= 1;
+        if (ucSrcMask == 0 && cx) // read next byte (not past the end of the row)
+        {
+            ucSrcMask = 0x80;
+            pix = *s++;
+        }
+    }
+} /* oledSpriteRow() */
+
+// One row of a glyph: iWidth pixels from bit iBitOff of the packed bitmap
+// (each row continues where the last one ended); ucColor 0 draws inverted
+static RAMFUNC void oledGlyphRow(uint8_t *d, const uint8_t *s, int iBitOff, int iWidth, uint8_t ucMask, uint8_t ucColor)
+{
+    uint8_t uc = 0, bits = 0, ucFlip = (ucColor == 1) ? 0 : 0x80;
+
+    s += iBitOff >> 3;
+    iBitOff &= 7;
+    if (iBitOff) { // not on a byte boundary
+        uc = *s++ << iBitOff;
+        bits = 8 - iBitOff;
+    }
+    while (iWidth--) {
+        if (bits == 0) { // need to read more font data
+            uc = *s++;
+            bits = 8;
+        }
+        if ((uc ^ ucFlip) & 0x80)
+            *d |= ucMask;
+        else
+            *d &= ~ucMask;
+        d++;
+        bits--; // next bit
+        uc <<= 1;
+    }
+} /* oledGlyphRow() */
+
 void oledDrawSprite(int x, int y, int cx, int cy, uint8_t *pSprite, int iPitch, int bInvert)
 {
-    int tx, ty, dx, dy, iStartX;
-    uint8_t *s, *d, pix, ucSrcMask, ucDstMask, ucFill;
+    int ty, dx, dy, iStartX, iMark;
+    uint8_t *s, *d, ucSrcMask, ucDstMask, ucFill;
 
-    if (x+cx < 0 || y+cy < 0 || x >= OLED_WIDTH || y >= OLED_HEIGHT)
-        return; // out of bounds
+    if (cx <= 0 || cy <= 0 || x+cx <= 0 || y+cy <= 0 || x >= OLED_WIDTH || y >= OLED_HEIGHT)
+        return; // empty or out of bounds
+    iMark = scratchMark();
+    SCRATCH_ALLOC(uint8_t, u8Cache, OLED_CACHE_SIZE, SCRATCH_LEAF);
     ucFill = (bInvert) ? 0xff : 0x00;
     dy = y; // destination y
     if (y < 0) // skip the invisible parts
     {
         cy += y;
-        y = -y;
-        pSprite += (y * iPitch);
+        pSprite += (-y * iPitch);
         dy = 0;
     }
-    if (y + cy > 64)
-        cy = OLED_HEIGHT - y;
+    if (dy + cy > OLED_HEIGHT)
+        cy = OLED_HEIGHT - dy;
     iStartX = 0;
     dx = x;
     if (x < 0)
     {
         cx += x;
-        x = -x;
-        iStartX = x;
+        iStartX = -x;
         dx = 0;
     }
-    if (x + cx > OLED_WIDTH)
-        cx = OLED_WIDTH - x;
+    if (dx + cx > OLED_WIDTH)
+        cx = OLED_WIDTH - dx;
     u8Cache[0] = 0x40; // data block
-    memset(&u8Cache[1], ucFill, sizeof(u8Cache)-1); // start with black
+    memset(&u8Cache[1], ucFill, OLED_CACHE_SIZE-1); // start with black
     for (ty=0; ty<cy; ty++)
     {
         s = &pSprite[(iStartX >> 3)];
         d = &u8Cache[1];
         ucSrcMask = 0x80 >> (iStartX & 7);
-        pix = *s++;
         ucDstMask = 1 << (dy & 7);
-		  for (tx=0; tx<cx; tx++)
-		  {
-			if (pix & ucSrcMask) { // set pixel in source, set it in dest
-				if (bInvert)
-					d[0] &= ~ucDstMask;
-				else
-					d[0] |= ucDstMask;
-			}
-			d++; // next pixel column
-			ucSrcMask >>= 1;
-			if (ucSrcMask == 0) // read next byte
-			{
-				ucSrcMask = 0x80;
-				pix = *s++;
-			}
-		  } // for tx
-        dy++;
+        oledSpriteRow(d, s, ucSrcMask, cx, ucDstMask, bInvert);
         pSprite += iPitch;
-        if (ucDstMask == 0x80) { // last row of byte, time to write to the display
+        if (ucDstMask == 0x80 || ty == cy-1) { // last row of byte or of the sprite, time to write to the display
         	oledSetPosition(dx, dy);
         	I2CWrite(oledAddr, u8Cache, cx+1);
-        	memset(&u8Cache[1], ucFill, sizeof(u8Cache)-1);
+        	memset(&u8Cache[1], ucFill, OLED_CACHE_SIZE-1);
         }
+        dy++;
     } // for ty
+    scratchRelease(iMark);
 } /* oledDrawSprite() */
 
 //
@@ -328,30 +371,41 @@ void oledContrast(uint8_t cont)
 	ucTemp[2] = cont; // value
 	I2CWrite(oledAddr, ucTemp, 3);
 } /* oledContrast() */
+// Characters missing from the 6x8 and 8x8 fonts (32-127) are drawn as spaces
+static unsigned char oledFontChar(char c)
+{
+    unsigned char uc = (unsigned char)c;
+
+    return (uc < 32 || uc > 127) ? ' ' : uc;
+} /* oledFontChar() */
+
 //
 // Draw a string of normal (8x8), small (6x8) or large (16x32) characters
 // At the given col+row
 //
 int oledWriteString(int x, int y, const char *szMsg, int iSize, int bInvert)
 {
-int i, iFontOff, iLen;
-unsigned char c, *s, ucTemp[40];
-
-    if (x >= 128 || y >= 64)
-       return -1; // can't draw off the display
+int i, iFontOff, iLen, iMark;
+unsigned char c, *s, *ucTemp, *ucTemp2;
 
     if (x == -1)
     	x = cursor_x;
     if (y == -1)
     	y = cursor_y;
+    if (x < 0 || x >= 128 || y < 0 || y >= 64)
+       return -1; // can't draw off the display
+    iMark = scratchMark();
+    SCRATCH_ALLOC(unsigned char, ucBuf, 40 + 16, SCRATCH_LEAF);
+    ucTemp = ucBuf; // glyph and the stretched 12x16 pattern
+    ucTemp2 = &ucBuf[40]; // one 12x16 half with the data introducer
     oledSetPosition(x, y);
     if (iSize == FONT_8x8) // 8x8 font
     {
        i = 0;
        while (x < 128 && szMsg[i] != 0 && y < 64)
        {
-             c = (unsigned char)szMsg[i];
-             iFontOff = (int)(c-32) * 7;
+             c = oledFontChar(szMsg[i]);
+             iFontOff = (int)mul7(c-32);
              // we can't directly use the pointer to FLASH memory, so copy to a local buffer
              ucTemp[0] = 0x40; // data introducer
              ucTemp[1] = 0; // space
@@ -366,12 +420,14 @@ unsigned char c, *s, ucTemp[40];
              {
                x = 0; // start at the beginning of the next line
                y += 8;
-               oledSetPosition(x, y);
+               if (y < 64)
+                   oledSetPosition(x, y);
              }
          i++;
        } // while
        cursor_x = x;
        cursor_y = y;
+       scratchRelease(iMark);
        return 0;
     } // 8x8
     else if (iSize == FONT_12x16) // 6x8 stretched to 12x16
@@ -381,12 +437,11 @@ unsigned char c, *s, ucTemp[40];
       {
 // stretch the 'normal' font instead of using the big font
               int tx, ty;
-              uint8_t ucTemp2[16];
 
               ucTemp2[0] = 0x40; // data introducer
-              c = szMsg[i] - 32;
+              c = oledFontChar(szMsg[i]) - 32;
               unsigned char uc1, uc2, ucMask, *pDest;
-              s = (unsigned char *)&ucSmallFont[(int)c*5];
+              s = (unsigned char *)&ucSmallFont[mul5(c)];
               ucTemp[0] = 0; // first column is blank
               memcpy(&ucTemp[1], s, 5);
               if (bInvert)
@@ -467,20 +522,24 @@ unsigned char c, *s, ucTemp[40];
               oledSetPosition(x, y);
               memcpy(&ucTemp2[1], &ucTemp[6], iLen);
               I2CWrite(oledAddr, ucTemp2, iLen+1);
-              oledSetPosition(x, y+8);
-              memcpy(&ucTemp2[1], &ucTemp[18], iLen);
-              I2CWrite(oledAddr, ucTemp2, iLen+1);
+              if (y+8 < 64) { // bottom half not off the display
+                  oledSetPosition(x, y+8);
+                  memcpy(&ucTemp2[1], &ucTemp[18], iLen);
+                  I2CWrite(oledAddr, ucTemp2, iLen+1);
+              }
               x += iLen;
               if (x >= 128-11) // word wrap enabled?
               {
                   x = 0; // start at the beginning of the next line
                   y += 16;
-                  oledSetPosition(x, y);
+                  if (y < 64)
+                      oledSetPosition(x, y);
               }
           i++;
       } // while
       cursor_x = x;
       cursor_y = y;
+      scratchRelease(iMark);
       return 0;
     } // 12x16
     else if (iSize == FONT_6x8) // 6x8 font
@@ -488,11 +547,11 @@ unsigned char c, *s, ucTemp[40];
        i = 0;
        while (x < 128 && y < 64 && szMsg[i] != 0)
        {
-               c = szMsg[i] - 32;
+               c = oledFontChar(szMsg[i]) - 32;
                // we can't directly use the pointer to FLASH memory, so copy to a local buffer
                ucTemp[0] = 0x40;
                ucTemp[1] = 0;
-               memcpy(&ucTemp[2], &ucSmallFont[(int)c*5], 5);
+               memcpy(&ucTemp[2], &ucSmallFont[mul5(c)], 5);
                if (bInvert) InvertBytes(&ucTemp[1], 6);
                iLen = 6;
                if (x + iLen > 128) // clip right edge
@@ -503,23 +562,33 @@ unsigned char c, *s, ucTemp[40];
                {
                  x = 0; // start at the beginning of the next line
                  y += 8;
-                 oledSetPosition(x, y);
+                 if (y < 64)
+                     oledSetPosition(x, y);
                }
          i++;
        }
        cursor_x = x;
        cursor_y = y;
+      scratchRelease(iMark);
       return 0;
     } // 6x8
+  scratchRelease(iMark);
   return -1; // invalid size
 } /* oledWriteString() */
 
 void oledClearLine(int y)
 {
+int iMark;
+
+   if (y < 0 || y >= OLED_HEIGHT)
+      return;
+   iMark = scratchMark();
+   SCRATCH_ALLOC(uint8_t, u8Cache, OLED_CACHE_SIZE, SCRATCH_LEAF);
    u8Cache[0] = 0x40; // start of data
    memset(&u8Cache[1], 0, OLED_WIDTH);
    oledSetPosition(0, y);
    I2CWrite(oledAddr, u8Cache, OLED_WIDTH + 1);
+   scratchRelease(iMark);
 } /* oledClearLine() */
 
 //
@@ -528,11 +597,13 @@ void oledClearLine(int y)
 //
 void oledWriteStringCustom(const GFXfont *pFont, int x, int y, const char *szMsg, uint8_t ucColor)
 {
-int i, end_y, dx, dy, tx, ty, iBitOff;
+int i, end_y, dx, dy, ty, iBitOff, iWidth, iLeft, iRight, iFirst;
 unsigned int c;
-uint8_t *s, *d, bits, ucFill=0, ucMask, uc;
+uint8_t *s, ucFill=0, ucMask;
 GFXfont font;
 GFXglyph glyph, *pGlyph;
+int iMark = scratchMark();
+SCRATCH_ALLOC(uint8_t, u8Cache, OLED_CACHE_SIZE, SCRATCH_LEAF);
 
    u8Cache[0] = 0x40; // start of data
     if (x == -1)
@@ -551,53 +622,49 @@ GFXglyph glyph, *pGlyph;
          continue; // skip it
       c -= font.first; // first char of font defined
       memcpy_P(&glyph, &font.glyph[c], sizeof(glyph));
-      dx = x; // + pGlyph->xOffset; // offset from character UL to start drawing
+      dx = x; // the cell is xAdvance wide from here, xOffset places the bitmap in it
       dy = y + pGlyph->yOffset;
       s = font.bitmap + pGlyph->bitmapOffset; // start of bitmap data
       // Bitmap drawing loop. Image is MSB first and each pixel is packed next
       // to the next (continuing on to the next character line)
       iBitOff = 0; // bitmap offset (in bits)
-      bits = uc = 0; // bits left in this font byte
       end_y = dy + pGlyph->height;
       if (dy < 0) { // skip these lines
           iBitOff += (pGlyph->width * (-dy));
           dy = 0;
       }
-      memset(&u8Cache[1], ucFill, sizeof(u8Cache)-1);
+      // clip the cell to the display and the bitmap to the cell
+      iLeft = (dx < 0) ? 0 : dx;
+      iRight = dx + pGlyph->xAdvance;
+      if (iRight > OLED_WIDTH)
+          iRight = OLED_WIDTH;
+      iFirst = dx + pGlyph->xOffset; // display column of the first bitmap column
+      iWidth = pGlyph->width;
+      if (iFirst < iLeft) {
+          iWidth -= iLeft - iFirst;
+          iBitOff += iLeft - iFirst;
+          iFirst = iLeft;
+      }
+      if (iFirst + iWidth > iRight)
+          iWidth = iRight - iFirst;
+      if (iRight <= iLeft) // nothing of the cell is on the display
+          end_y = dy;
+      memset(&u8Cache[1], ucFill, OLED_CACHE_SIZE-1);
       for (ty=dy; ty<end_y && ty < OLED_HEIGHT; ty++) {
           ucMask = 1<<(ty & 7); // destination bit number for this line
-          d = &u8Cache[1+pGlyph->xOffset]; // no backing ram; buffer 8 lines at a time
-         for (tx=0; tx<pGlyph->width; tx++) {
-            if (bits == 0) { // need to read more font data
-               uc = pgm_read_byte(&s[iBitOff>>3]); // get more font bitmap data
-               bits = 8 - (iBitOff & 7); // we might not be on a byte boundary
-               iBitOff += bits; // because of a clipped line
-               uc <<= (8-bits);
-            } // if we ran out of bits
-            if ((dx+tx) < OLED_WIDTH) { // foreground pixel
-                if (uc & 0x80) {
-                   if (ucColor == 1)
-                      d[tx] |= ucMask;
-                   else
-                      d[tx] &= ~ucMask;
-                } else {
-                    if (ucColor == 1)
-                       d[tx] &= ~ucMask;
-                    else
-                       d[tx] |= ucMask;
-                }
-            }
-            bits--; // next bit
-            uc <<= 1;
-         } // for x
+          // no backing ram; buffer 8 lines at a time
+          if (iWidth > 0)
+              oledGlyphRow(&u8Cache[1+iFirst-iLeft], s, iBitOff, iWidth, ucMask, ucColor);
+          iBitOff += pGlyph->width;
           if ((ucMask == 0x80 || ty == end_y-1)) { // dump this line
-              oledSetPosition(dx, (ty & 0xfff8));
-              I2CWrite(oledAddr, u8Cache, pGlyph->xAdvance+1);
-              memset(&u8Cache[1], ucFill, sizeof(u8Cache)-1); // NB: assume no DMA
+              oledSetPosition(iLeft, (ty & 0xfff8));
+              I2CWrite(oledAddr, u8Cache, iRight-iLeft+1);
+              memset(&u8Cache[1], ucFill, OLED_CACHE_SIZE-1); // NB: assume no DMA
           }
       } // for y
       x += pGlyph->xAdvance; // width of this character
    } // while drawing characters
    cursor_x = x;
    cursor_y = y;
+   scratchRelease(iMark);
 } /* oledWriteStringCustom() */
@@ -0,0 +1,109 @@
+//
+// Alert pattern sequencer for the motor and LEDs
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "pwm.h"
+#include "pattern.h"
+
+static const PATTERN * volatile pPlaying;
+static const PATTERN_STEP *pStep;
+static uint16_t u16RepeatsLeft;
+static uint8_t u8TicksLeft, u8Outputs;
+static uint8_t u8MotorPin, u8RedPin, u8GreenPin, u8Level;
+
+void patternInit(uint8_t u8Motor, uint8_t u8Red, uint8_t u8Green, uint8_t u8LedLevel)
+{
+	u8MotorPin = u8Motor;
+	u8RedPin = u8Red;
+	u8GreenPin = u8Green;
+	u8Level = u8LedLevel;
+} /* patternInit() */
+
+//
+// Change only the outputs which differ from the last step
+//
+static void patternOutputs(uint8_t u8New)
+{
+	uint8_t u8Changed = u8New ^ u8Outputs;
+
+	if (u8Changed & PAT_MOTOR) {
+		if (u8New & PAT_MOTOR)
+			pwmRamp(u8MotorPin, PWM_MAX, PATTERN_SOFTSTART_MS);
+		else
+			pwmSet(u8MotorPin, 0);
+	}
+	if (u8Changed & PAT_RED)
+		pwmSet(u8RedPin, (u8New & PAT_RED) ? u8Level : 0);
+	if (u8Changed & PAT_GREEN)
+		pwmSet(u8GreenPin, (u8New & PAT_GREEN) ? u8Level : 0);
+	u8Outputs = u8New;
+} /* patternOutputs() */
+
+static void patternEnd(void)
+{
+	patternOutputs(PAT_OFF);
+	pPlaying = NULL;
+	pwmSetTick(NULL); // lets TIM1 stop
+} /* patternEnd() */
+
+//
+// Called from the TIM1 interrupt every PWM_TICK_MS
+//
+static void patternTick(void)
+{
+	if (pPlaying == NULL || --u8TicksLeft)
+		return;
+	pStep++;
+	if (pStep->u8Ticks == 0) { // end of the table
+		if (u16RepeatsLeft != PATTERN_FOREVER && --u16RepeatsLeft == 0) {
+			patternEnd();
+			return;
+		}
+		pStep = pPlaying->pSteps;
+	}
+	patternOutputs(pStep->u8Outputs);
+	u8TicksLeft = pStep->u8Ticks;
+} /* patternTick() */
+
+int patternPlay(const PATTERN *pPattern, int iRepeat)
+{
+	int rc = 0;
+
+	pwmLock(); // held across the pwmSet() calls
+	if (pPlaying && pPlaying->u8Priority > pPattern->u8Priority) {
+		rc = -1;
+	} else if (pPattern->pSteps[0].u8Ticks) {
+		pPlaying = pPattern;
+		pStep = pPattern->pSteps;
+		u16RepeatsLeft = (iRepeat > 0) ? iRepeat : pPattern->u16Repeat;
+		u8TicksLeft = pStep->u8Ticks;
+		patternOutputs(pStep->u8Outputs);
+		pwmSetTick(patternTick);
+	}
+	pwmUnlock();
+	return rc;
+} /* patternPlay() */
+
+void patternStop(void)
+{
+	pwmLock();
+	if (pPlaying)
+		patternEnd();
+	pwmUnlock();
+} /* patternStop() */
@@ -0,0 +1,67 @@
+//
+// Alert pattern sequencer for the motor and LEDs
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_PATTERN_H_
+#define USER_PATTERN_H_
+
+//
+// A pattern is a table of steps, each turning a set of outputs on for a
+// number of PWM_TICK_MS ticks, terminated by a step with u8Ticks = 0.
+// Patterns play from the TIM1 tick interrupt, so the caller carries on
+// (or sleeps) while they run.
+//
+// outputs
+#define PAT_MOTOR 1
+#define PAT_RED 2
+#define PAT_GREEN 4
+#define PAT_OFF 0
+
+#define PATTERN_FOREVER 0xffff
+// the motor ramps up over this time to cut its inrush current
+#define PATTERN_SOFTSTART_MS 40
+
+enum {
+	PATTERN_PRI_STATUS=0, // routine indications
+	PATTERN_PRI_ALERT, // the user needs to notice
+	PATTERN_PRI_COUNT
+};
+
+typedef struct tagPatternStep
+{
+	uint8_t u8Outputs;
+	uint8_t u8Ticks;
+} PATTERN_STEP;
+
+typedef struct tagPattern
+{
+	const PATTERN_STEP *pSteps;
+	uint16_t u16Repeat; // default play count (PATTERN_FOREVER = until stopped)
+	uint8_t u8Priority;
+} PATTERN;
+
+// Set the output pins and LED duty (0-PWM_MAX)
+void patternInit(uint8_t u8Motor, uint8_t u8Red, uint8_t u8Green, uint8_t u8LedLevel);
+// Start a pattern; iRepeat = 0 uses the pattern's default count
+// returns -1 if a higher priority pattern is playing
+int patternPlay(const PATTERN *pPattern, int iRepeat);
+// Stop the current pattern and turn its outputs off
+void patternStop(void);
+
+#endif /* USER_PATTERN_H_ */
@@ -0,0 +1,98 @@
+//
+// SysTick scope profiler
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <string.h>
+#include "debug.h"
+#include "profile.h"
+
+#ifdef PROFILE
+#include "console.h"
+
+static const char *szScope[PROF_COUNT] = {"ShowCurrent", "GetSample", "ShowMenu", "Wake"};
+static PROF_SCOPE scopes[PROF_COUNT];
+
+int profileBucket(uint32_t u32Ticks)
+{
+	int i = 0;
+
+	while (u32Ticks && i < PROFILE_BUCKETS-1) { // no CLZ on the V2A
+		u32Ticks >>= 1;
+		i++;
+	}
+	return i;
+} /* profileBucket() */
+
+void profileRecord(int iScope, uint32_t u32StartTick)
+{
+	PROF_SCOPE *pScope = &scopes[iScope];
+	uint32_t u32Ticks = Delay_GetTick() - u32StartTick;
+	uint16_t *pBucket = &pScope->u16Hist[profileBucket(u32Ticks)];
+
+	if (pScope->u32Count == 0 || u32Ticks < pScope->u32Min)
+		pScope->u32Min = u32Ticks;
+	if (u32Ticks > pScope->u32Max)
+		pScope->u32Max = u32Ticks;
+	pScope->u32Count++;
+	pScope->u32Total += u32Ticks;
+	if (*pBucket != 0xffff)
+		(*pBucket)++;
+} /* profileRecord() */
+
+void profileClear(void)
+{
+	memset(scopes, 0, sizeof(scopes));
+} /* profileClear() */
+
+const PROF_SCOPE *profileGet(int iScope)
+{
+	return &scopes[iScope];
+} /* profileGet() */
+
+const char *profileName(int iScope)
+{
+	return szScope[iScope];
+} /* profileName() */
+
+#ifdef CONSOLE
+//
+// One line per scope that ran:
+// name n=count min=ticks max=ticks total=ticks hist=bucket:count,...
+//
+void profileDump(void)
+{
+	PROF_SCOPE *pScope;
+	int i, j;
+
+	consolePrintf("ticks/ms=%u\r\n", Delay_MsToTicks(1));
+	for (i=0; i<PROF_COUNT; i++) {
+		pScope = &scopes[i];
+		if (pScope->u32Count == 0)
+			continue;
+		consolePrintf("%s n=%u min=%u max=%u total=%u hist=", szScope[i], pScope->u32Count,
+			pScope->u32Min, pScope->u32Max, pScope->u32Total);
+		for (j=0; j<PROFILE_BUCKETS; j++) {
+			if (pScope->u16Hist[j])
+				consolePrintf("%d:%u,", j, pScope->u16Hist[j]);
+		}
+		consolePuts("\r\n");
+	}
+	consolePuts("end\r\n");
+} /* profileDump() */
+#endif // CONSOLE
+#endif // PROFILE
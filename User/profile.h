@@ -0,0 +1,72 @@
+//
+// SysTick scope profiler
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_PROFILE_H_
+#define USER_PROFILE_H_
+
+//
+// Optional timing of a few code paths (scopes) with the free-running
+// SysTick count (HCLK/8). Each scope keeps its count, min, max and total
+// ticks and a histogram with one bucket per power of 2 (bucket n holds
+// 2^(n-1)..2^n-1 ticks, the last one everything longer), so a rare slow
+// pass shows up next to the usual time. SysTick stops in standby, so a
+// scope never includes the time spent there. It costs about 230 bytes of
+// RAM and a SysTick read per begin/end, so it compiles out unless PROFILE
+// is defined here or by the build.
+//
+//#define PROFILE
+#define PROFILE_BUCKETS 20
+
+// The scopes; their names are in profile.c
+enum {
+	PROF_SHOWCURRENT = 0,
+	PROF_GETSAMPLE,
+	PROF_SHOWMENU, // menu redraws
+	PROF_WAKE, // standby wake-up until the pins are restored
+	PROF_COUNT
+};
+
+typedef struct tagProfScope
+{
+	uint32_t u32Count;
+	uint32_t u32Min, u32Max; // ticks
+	uint32_t u32Total;
+	uint16_t u16Hist[PROFILE_BUCKETS]; // stop counting at 0xffff
+} PROF_SCOPE;
+
+#ifdef PROFILE
+// Called by PROFILE_END() with the tick count of PROFILE_BEGIN()
+void profileRecord(int iScope, uint32_t u32StartTick);
+void profileClear(void);
+const PROF_SCOPE *profileGet(int iScope);
+const char *profileName(int iScope);
+// Histogram bucket of a duration in ticks
+int profileBucket(uint32_t u32Ticks);
+// Every scope as text on the console (built with CONSOLE)
+void profileDump(void);
+// Bracket a scope in one function; id is a PROF_xxx constant
+#define PROFILE_BEGIN(id) uint32_t u32Prof_##id = Delay_GetTick()
+#define PROFILE_END(id) profileRecord(id, u32Prof_##id)
+#else
+#define PROFILE_BEGIN(id)
+#define PROFILE_END(id)
+#endif // PROFILE
+
+#endif /* USER_PROFILE_H_ */
@@ -0,0 +1,295 @@
+//
+// Timer PWM outputs with interrupt-driven duty ramps
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "Arduino.h"
+#include "clock.h"
+#include "pwm.h"
+
+#define PWM_CHANNELS 3
+#define PWM_LED_FREQ 1000
+#define PWM_MOTOR_FREQ 31250
+#define BREATHE_FOREVER 0xffff
+
+typedef struct tagPwmChannel
+{
+	uint16_t u16Duty; // 8.8 fixed point
+	int16_t i16Step; // change per tick (8.8)
+	uint16_t u16Ticks; // ticks left in the current ramp
+	uint8_t u8Target;
+	uint8_t u8Peak; // breathing peak duty (0 = not breathing)
+	uint16_t u16Cycles; // breathing cycles left
+	uint16_t u16HalfTicks; // ticks per half cycle
+} PWM_CHANNEL;
+
+static const uint8_t u8PwmPins[PWM_CHANNELS] = {0xc3, 0xc4, 0xc5};
+static volatile PWM_CHANNEL channels[PWM_CHANNELS];
+static uint8_t bTimerOn[2]; // TIM1, TIM2
+static void (*pfnTickHandler)(void);
+static uint8_t u8Locks; // pwmLock() depth
+
+void TIM1_UP_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+
+static int pwmFind(uint8_t u8Pin)
+{
+	int i;
+
+	for (i=0; i<PWM_CHANNELS; i++) {
+		if (u8PwmPins[i] == u8Pin)
+			return i;
+	}
+	return -1;
+} /* pwmFind() */
+
+static void pwmWrite(int i, uint8_t u8Duty)
+{
+	switch (i) {
+	case 0:
+		TIM1->CH3CVR = u8Duty;
+		break;
+	case 1:
+		TIM1->CH4CVR = u8Duty;
+		break;
+	case 2:
+		TIM2->CH1CVR = u8Duty;
+		break;
+	}
+} /* pwmWrite() */
+
+static void pwmTimer(int iTimer, int bOn)
+{
+	TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure = {0};
+	TIM_OCInitTypeDef TIM_OCInitStructure = {0};
+
+	if (bTimerOn[iTimer] == bOn)
+		return;
+	bTimerOn[iTimer] = bOn;
+	if (!bOn) {
+		// The compare registers are preloaded, so the 0 just written isn't in
+		// effect until an update event, and a stopped timer holds its outputs
+		// where they are. Force the update so they go low before the stop
+		if (iTimer == 0) {
+			TIM_ITConfig(TIM1, TIM_IT_Update, DISABLE);
+			TIM_GenerateEvent(TIM1, TIM_EventSource_Update);
+			TIM_Cmd(TIM1, DISABLE);
+			TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+		} else {
+			TIM_GenerateEvent(TIM2, TIM_EventSource_Update);
+			TIM_Cmd(TIM2, DISABLE);
+		}
+		clockKeepAwake(CLOCK_TIM1 + iTimer, 0);
+		clockRelease(CLOCK_TIM1 + iTimer);
+		return;
+	}
+	clockAcquire(CLOCK_TIM1 + iTimer);
+	clockKeepAwake(CLOCK_TIM1 + iTimer, 1); // keeps running in Delay_Ms() sleeps
+	TIM_TimeBaseInitStructure.TIM_Period = PWM_MAX;
+	TIM_TimeBaseInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+	TIM_TimeBaseInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+	TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
+	TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
+	if (iTimer == 0) { // LEDs, also the ramp tick
+		TIM_TimeBaseInitStructure.TIM_Prescaler = SystemCoreClock / ((PWM_MAX+1) * PWM_LED_FREQ) - 1;
+		TIM_TimeBaseInitStructure.TIM_RepetitionCounter = (PWM_LED_FREQ * PWM_TICK_MS / 1000) - 1; // update event every tick
+		TIM_TimeBaseInit(TIM1, &TIM_TimeBaseInitStructure);
+		TIM_OC3Init(TIM1, &TIM_OCInitStructure);
+		TIM_OC4Init(TIM1, &TIM_OCInitStructure);
+		TIM_OC3PreloadConfig(TIM1, TIM_OCPreload_Enable);
+		TIM_OC4PreloadConfig(TIM1, TIM_OCPreload_Enable);
+		TIM1->CH3CVR = channels[0].u16Duty >> 8;
+		TIM1->CH4CVR = channels[1].u16Duty >> 8;
+		TIM_CtrlPWMOutputs(TIM1, ENABLE);
+		TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+		TIM_ITConfig(TIM1, TIM_IT_Update, ENABLE); // the caller's pwmUnlock() lets it in
+		TIM_Cmd(TIM1, ENABLE);
+	} else { // motor
+		clockAcquire(CLOCK_AFIO);
+		GPIO_PinRemapConfig(GPIO_PartialRemap1_TIM2, ENABLE); // CH1 on PC5
+		clockRelease(CLOCK_AFIO);
+		TIM_TimeBaseInitStructure.TIM_Prescaler = SystemCoreClock / ((PWM_MAX+1) * PWM_MOTOR_FREQ) - 1;
+		TIM_TimeBaseInit(TIM2, &TIM_TimeBaseInitStructure);
+		TIM_OC1Init(TIM2, &TIM_OCInitStructure);
+		TIM_OC1PreloadConfig(TIM2, TIM_OCPreload_Enable);
+		TIM2->CH1CVR = channels[2].u16Duty >> 8;
+		TIM_Cmd(TIM2, ENABLE);
+	}
+} /* pwmTimer() */
+
+//
+// Start or stop the timers to match what the channels need
+//
+static void pwmRefresh(void)
+{
+	int i, bRamp = 0, bTimer[2] = {0, 0};
+
+	for (i=0; i<PWM_CHANNELS; i++) {
+		if (channels[i].u16Ticks)
+			bRamp = 1;
+		if (channels[i].u16Duty || channels[i].u16Ticks)
+			bTimer[i >> 1] = 1;
+	}
+	pwmTimer(0, bTimer[0] | bRamp | (pfnTickHandler != NULL));
+	pwmTimer(1, bTimer[1]);
+} /* pwmRefresh() */
+
+static void pwmStartRamp(int i, uint8_t u8Target, uint16_t u16Ticks)
+{
+	volatile PWM_CHANNEL *pChan = &channels[i];
+
+	if (u16Ticks == 0)
+		u16Ticks = 1;
+	pChan->u8Target = u8Target;
+	pChan->i16Step = (int16_t)((((int32_t)u8Target << 8) - pChan->u16Duty) / u16Ticks);
+	pChan->u16Ticks = u16Ticks;
+} /* pwmStartRamp() */
+
+//
+// Step the ramps; runs every PWM_TICK_MS
+//
+void TIM1_UP_IRQHandler(void)
+{
+	int i;
+	volatile PWM_CHANNEL *pChan;
+
+	TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+	for (i=0; i<PWM_CHANNELS; i++) {
+		pChan = &channels[i];
+		if (pChan->u16Ticks == 0)
+			continue;
+		if (--pChan->u16Ticks == 0)
+			pChan->u16Duty = pChan->u8Target << 8; // no rounding error at the end
+		else
+			pChan->u16Duty += pChan->i16Step;
+		pwmWrite(i, pChan->u16Duty >> 8);
+		if (pChan->u16Ticks == 0 && pChan->u8Peak) { // breathing: next half cycle
+			if (pChan->u8Target) {
+				pwmStartRamp(i, 0, pChan->u16HalfTicks);
+			} else {
+				if (pChan->u16Cycles != BREATHE_FOREVER)
+					pChan->u16Cycles--;
+				if (pChan->u16Cycles)
+					pwmStartRamp(i, pChan->u8Peak, pChan->u16HalfTicks);
+				else
+					pChan->u8Peak = 0;
+			}
+		}
+	}
+	if (pfnTickHandler)
+		(*pfnTickHandler)();
+	pwmRefresh(); // stop the timers once everything is off
+} /* TIM1_UP_IRQHandler() */
+
+int pwmSet(uint8_t u8Pin, int iDuty)
+{
+	int i = pwmFind(u8Pin);
+
+	if (i < 0)
+		return -1;
+	if (iDuty > PWM_MAX) iDuty = PWM_MAX;
+	else if (iDuty < 0) iDuty = 0;
+	pwmLock();
+	channels[i].u16Ticks = 0;
+	channels[i].u8Peak = 0;
+	channels[i].u16Duty = iDuty << 8;
+	pwmWrite(i, iDuty);
+	if (iDuty)
+		pinModeFast(u8Pin, OUTPUT_AF); // standby resets the port, so do it every time
+	pwmRefresh();
+	pwmUnlock();
+	return 0;
+} /* pwmSet() */
+
+int pwmRamp(uint8_t u8Pin, int iDuty, int iMs)
+{
+	int i = pwmFind(u8Pin);
+
+	if (i < 0)
+		return -1;
+	if (iDuty > PWM_MAX) iDuty = PWM_MAX;
+	else if (iDuty < 0) iDuty = 0;
+	pwmLock();
+	channels[i].u8Peak = 0;
+	pwmStartRamp(i, (uint8_t)iDuty, iMs / PWM_TICK_MS);
+	pinModeFast(u8Pin, OUTPUT_AF);
+	pwmRefresh();
+	pwmUnlock();
+	return 0;
+} /* pwmRamp() */
+
+int pwmBreathe(uint8_t u8Pin, int iPeak, int iPeriodMs, int iCount)
+{
+	int i = pwmFind(u8Pin);
+
+	if (i < 0)
+		return -1;
+	if (iPeak > PWM_MAX) iPeak = PWM_MAX;
+	else if (iPeak < 1) iPeak = 1;
+	pwmLock();
+	channels[i].u16Duty = 0;
+	pwmWrite(i, 0);
+	channels[i].u8Peak = (uint8_t)iPeak;
+	channels[i].u16Cycles = (iCount <= 0) ? BREATHE_FOREVER : iCount;
+	channels[i].u16HalfTicks = iPeriodMs / (2 * PWM_TICK_MS);
+	pwmStartRamp(i, (uint8_t)iPeak, channels[i].u16HalfTicks);
+	pinModeFast(u8Pin, OUTPUT_AF);
+	pwmRefresh();
+	pwmUnlock();
+	return 0;
+} /* pwmBreathe() */
+
+int pwmBusy(uint8_t u8Pin)
+{
+	int i = pwmFind(u8Pin);
+
+	if (i < 0)
+		return 0;
+	return (channels[i].u16Ticks != 0 || channels[i].u8Peak != 0);
+} /* pwmBusy() */
+
+void pwmSetTick(void (*pfnTick)(void))
+{
+	pwmLock();
+	pfnTickHandler = pfnTick;
+	pwmRefresh();
+	pwmUnlock();
+} /* pwmSetTick() */
+
+void pwmLock(void)
+{
+	NVIC_DisableIRQ(TIM1_UP_IRQn);
+	u8Locks++;
+} /* pwmLock() */
+
+void pwmUnlock(void)
+{
+	if (--u8Locks == 0)
+		NVIC_EnableIRQ(TIM1_UP_IRQn);
+} /* pwmUnlock() */
+
+int pwmActive(void)
+{
+	return (bTimerOn[0] | bTimerOn[1]);
+} /* pwmActive() */
+
+void pwmWait(uint8_t u8Pin)
+{
+	while (pwmBusy(u8Pin))
+		Delay_Ms(PWM_TICK_MS); // the core sleeps; the timer does the work
+} /* pwmWait() */
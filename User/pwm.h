@@ -0,0 +1,56 @@
+//
+// Timer PWM outputs with interrupt-driven duty ramps
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_PWM_H_
+#define USER_PWM_H_
+
+//
+// Pins with a PWM output (pin numbers as used by pinMode)
+// 0xC3 = TIM1 CH3, 0xC4 = TIM1 CH4 (~1kHz, LEDs)
+// 0xC5 = TIM2 CH1 on partial remap 1 (~31kHz, vibration motor)
+// TIM1's update interrupt steps the ramps every PWM_TICK_MS, so they
+// run while the core sleeps in Delay_Ms(). Timers stop (standby is then
+// possible again) once every output is off and no ramp is running.
+//
+#define PWM_MAX 255
+#define PWM_TICK_MS 10
+
+// Set a constant duty cycle (0-PWM_MAX); cancels a ramp
+// returns -1 if the pin has no PWM output
+int pwmSet(uint8_t u8Pin, int iDuty);
+// Ramp from the current duty to iDuty over iMs
+int pwmRamp(uint8_t u8Pin, int iDuty, int iMs);
+// Ramp 0 -> iPeak -> 0 over iPeriodMs, iCount times (0 = until pwmSet)
+int pwmBreathe(uint8_t u8Pin, int iPeak, int iPeriodMs, int iCount);
+// Returns 1 while a ramp or breathing cycle is running on the pin
+int pwmBusy(uint8_t u8Pin);
+// Sleep until the pin's ramp is done
+void pwmWait(uint8_t u8Pin);
+// Call pfnTick from the TIM1 interrupt every PWM_TICK_MS (NULL to stop)
+// can be called from the tick handler itself
+void pwmSetTick(void (*pfnTick)(void));
+// Returns 1 while either timer is running (standby would freeze the outputs)
+int pwmActive(void);
+// Keep the TIM1 interrupt out; the calls nest, so a caller can hold it
+// across several of the calls above (which take it themselves)
+void pwmLock(void);
+void pwmUnlock(void);
+
+#endif /* USER_PWM_H_ */
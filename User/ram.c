@@ -0,0 +1,52 @@
+//
+// RAM budget and stack high-water mark
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdint.h>
+#include "ram.h"
+
+// from Ld/Link.ld
+extern uint32_t _ramfunc_vma[], _eramfunc[], _data_vma[], _sbss[], _ebss[], _heap_end[], _susrstack[], _eusrstack[];
+
+// lowest word above .bss which isn't the paint any more
+static uint32_t *ramLowestTouched(void)
+{
+	uint32_t *p = _ebss; // = _end
+
+	while (p < _eusrstack && *p == RAM_PAINT)
+		p++;
+	return p;
+} /* ramLowestTouched() */
+
+int ramStackPeak(void)
+{
+	return (int)((uint8_t *)_eusrstack - (uint8_t *)ramLowestTouched());
+} /* ramStackPeak() */
+
+void ramGetUsage(RAM_USAGE *pUsage)
+{
+	uint32_t *pLowest = ramLowestTouched();
+
+	pUsage->u16Code = (uint16_t)((uint8_t *)_eramfunc - (uint8_t *)_ramfunc_vma);
+	pUsage->u16Data = (uint16_t)((uint8_t *)_sbss - (uint8_t *)_data_vma); // .bss follows it
+	pUsage->u16Bss = (uint16_t)((uint8_t *)_ebss - (uint8_t *)_sbss);
+	pUsage->u16Heap = (uint16_t)((uint8_t *)_heap_end - (uint8_t *)_ebss);
+	pUsage->u16Stack = (uint16_t)((uint8_t *)_eusrstack - (uint8_t *)_susrstack);
+	pUsage->u16StackPeak = (uint16_t)((uint8_t *)_eusrstack - (uint8_t *)pLowest);
+	pUsage->u16Free = (uint16_t)((uint8_t *)pLowest - (uint8_t *)_ebss);
+} /* ramGetUsage() */
@@ -0,0 +1,48 @@
+//
+// RAM budget and stack high-water mark
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_RAM_H_
+#define USER_RAM_H_
+
+//
+// The startup code fills everything between the end of .bss and the top
+// of the stack with RAM_PAINT before main() runs. Words that still hold
+// it were never written, so the lowest one that doesn't is as deep as
+// the stack has been (nothing here calls malloc(), so the heap area is
+// only stack overflow room). The sizes come from the Ld/Link.ld symbols.
+//
+#define RAM_PAINT 0xa5a5a5a5 // also in Startup/startup_ch32v00x.S
+
+typedef struct tagRamUsage
+{
+	uint16_t u16Code; // .ramfunc (RAMFUNC code, copied from FLASH)
+	uint16_t u16Data; // .data (initialized, copied from FLASH)
+	uint16_t u16Bss; // .bss (zeroed)
+	uint16_t u16Heap; // between .bss and the stack (_end to _heap_end)
+	uint16_t u16Stack; // reserved for the stack (__stack_size)
+	uint16_t u16StackPeak; // deepest use since power-up; more than u16Stack = it overflowed
+	uint16_t u16Free; // never written, the real margin
+} RAM_USAGE;
+
+void ramGetUsage(RAM_USAGE *pUsage);
+// Bytes of stack used at the deepest point since power-up
+int ramStackPeak(void);
+
+#endif /* USER_RAM_H_ */
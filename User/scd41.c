@@ -19,23 +19,32 @@
 //
 #include <stdint.h>
 #include "scd41.h"
+#include "Arduino.h"
+#include "fastmath.h"
+#include "scratch.h"
 
-extern void Delay_Ms(int delay);
-extern void I2CWrite(uint8_t addr, uint8_t *pData, int iLen);
-extern void I2CRead(uint8_t addr, uint8_t *pData, int iLen);
 int _iPowerMode, _iTemperature, _iHumidity;
 uint16_t _iCO2;
 
 int scd41_getSample(void)
 {
-uint8_t ucTemp[16];
-uint16_t u16Status;
-int rc;
-
     if (_iPowerMode == SCD_POWERMODE_ONESHOT) {
-        scd41_sendCMD(SCD41_CMD_SINGLE_SHOT_MEASUREMENT);
-        Delay_Ms(5000); // wait for measurement to occur
+        scd41_singleShot();
+        Delay_Ms(SCD41_SINGLE_SHOT_MS); // wait for measurement to occur
     }
+    return scd41_readSample();
+} /* scd41_getSample() */
+
+int scd41_singleShot(void)
+{
+    return scd41_sendCMD(SCD41_CMD_SINGLE_SHOT_MEASUREMENT);
+} /* scd41_singleShot() */
+
+int scd41_readSample(void)
+{
+uint16_t u16Status;
+int rc, iMark;
+
     rc = scd41_readRegister(SCD41_CMD_GET_DATA_READY_STATUS, &u16Status);
 //Serial.print("status = 0x"); Serial.println(u16Status, HEX);
     if (rc != SCD_SUCCESS)
@@ -47,15 +56,18 @@ int rc;
     }
     scd41_sendCMD(SCD41_CMD_READ_MEASUREMENT);
     Delay_Ms(5);
+    iMark = scratchMark();
+    SCRATCH_ALLOC(uint8_t, ucTemp, 9, SCRATCH_LEAF);
     I2CRead(0x62, ucTemp, 9); // 9 bytes of data for the 3 fields
 //Serial.println("Got 9 bytes from sensor");
     _iCO2 = ((uint16_t)ucTemp[0] << 8) | ucTemp[1];
     _iTemperature = (ucTemp[3] << 8) | ucTemp[4];
     _iHumidity = ((uint16_t)ucTemp[6] << 8) | ucTemp[7];
-    _iTemperature = -450 + ((_iTemperature) * 1750L / 65536L);
-    _iHumidity = (_iHumidity * 1000L) / 65536L;
+    _iTemperature = -450 + (int)(mul1750((uint16_t)_iTemperature) >> 16);
+    _iHumidity = (int)(mul1000((uint16_t)_iHumidity) >> 16);
+    scratchRelease(iMark);
     return SCD_SUCCESS;
-} /* scd41_getSample() */
+} /* scd41_readSample() */
 
 void scd41_wakeup(void)
 {
@@ -74,15 +86,19 @@ int scd41_stop(void)
 
 int scd41_recalibrate(uint16_t u16CO2)
 {
-uint8_t ucTemp[4];
+int rc, iMark;
 
 	scd41_sendCMD2(SCD41_CMD_FORCE_RECALIBRATE, u16CO2); // set the reference CO2 level
 	Delay_Ms(400); // wait to complete
+    iMark = scratchMark();
+    SCRATCH_ALLOC(uint8_t, ucTemp, 3, SCRATCH_LEAF);
     I2CRead(0x62, ucTemp, 3); // 3 byte response. 0xFFFF = failed
     if (ucTemp[0] == 0xff && ucTemp[1] == 0xff)
-    	return SCD_ERROR;
+    	rc = SCD_ERROR;
     else
-    	return SCD_SUCCESS;
+    	rc = SCD_SUCCESS;
+    scratchRelease(iMark);
+    return rc;
 } /* scd41_recalibrate() */
 
 int scd41_start(int iPowerMode)
@@ -98,7 +114,7 @@ int scd41_start(int iPowerMode)
         scd41_sendCMD(SCD41_CMD_START_LP_PERIODIC_MEASUREMENT);
      else // single shot is essentially "stopped"
         scd41_sendCMD(SCD41_CMD_STOP_PERIODIC_MEASUREMENT);
-     Delay_Ms(1);
+     Delay_Ms((iPowerMode == SCD_POWERMODE_ONESHOT) ? 500 : 1); // stop takes 500ms to execute
      return SCD_SUCCESS;
 } /* scd41_start() */
 
@@ -149,7 +165,7 @@ uint8_t ucTemp[8];
 //From: http://www.sunshine2k.de/articles/coding/crc/understanding_crc.html
 //Tested with: http://www.sunshine2k.de/coding/javascript/crc/crc_js.html
 //x^8+x^5+x^4+1 = 0x31
-uint8_t scd41_computeCRC8(uint8_t *data, uint8_t len)
+RAMFUNC uint8_t scd41_computeCRC8(uint8_t *data, uint8_t len)
 {
   uint8_t crc = 0xFF; //Init with 0xFF
 
@@ -45,6 +45,7 @@ enum {
 #define SCD41_CMD_POWERDOWN                               0x36e0 // execution time: 1ms
 #define SCD41_CMD_WAKEUP                                  0x36f6 // execution time: 20ms
 #define SCD41_CMD_FORCE_RECALIBRATE                       0x362f // execution time: 400ms
+#define SCD41_SINGLE_SHOT_MS 5000 // measurement time of a single shot
 int scd41_readRegister(uint16_t u16Register, uint16_t *pOut);
 void scd41_wakeup(void); // SCD41 only
 int scd41_sendCMD(uint16_t u16Cmd);
@@ -52,6 +53,10 @@ int scd41_sendCMD2(uint16_t u16Cmd, uint16_t u16Parameter);
 uint8_t scd41_computeCRC8(uint8_t *data, uint8_t len);
 int scd41_start(int iPowerMode);
 int scd41_getSample(void);
+// single shot without the wait in scd41_getSample(): start one, then read it
+// with scd41_readSample() SCD41_SINGLE_SHOT_MS later (e.g. after a standby)
+int scd41_singleShot(void);
+int scd41_readSample(void);
 int scd41_shutdown(void); // SCD41 only
 int scd41_stop(void);
 int scd41_recalibrate(uint16_t u16CO2);
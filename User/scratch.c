@@ -0,0 +1,72 @@
+//
+// Scratch arena for transient buffers
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdint.h>
+#ifndef __riscv
+#include <stdlib.h>
+#endif
+#include "scratch.h"
+
+// Host builds with AddressSanitizer only let the allocated part be touched
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define SCRATCH_POISON(iFrom) ASAN_POISON_MEMORY_REGION((uint8_t *)u32Arena + (iFrom), SCRATCH_SIZE - (iFrom))
+#define SCRATCH_UNPOISON(iFrom, iLen) ASAN_UNPOISON_MEMORY_REGION((uint8_t *)u32Arena + (iFrom), (iLen))
+#else
+#define SCRATCH_POISON(iFrom)
+#define SCRATCH_UNPOISON(iFrom, iLen)
+#endif
+
+static uint32_t u32Arena[SCRATCH_SIZE / 4];
+static uint16_t u16Top, u16Peak;
+
+void *scratchAlloc(int iSize)
+{
+	int iTop = u16Top;
+	int iEnd = iTop + SCRATCH_ROUND(iSize);
+
+	if (iEnd > SCRATCH_SIZE) { // out of room, see scratch.h
+#ifdef __riscv
+		__builtin_trap();
+#else
+		abort();
+#endif
+	}
+	if (iEnd > u16Peak)
+		u16Peak = (uint16_t)iEnd;
+	u16Top = (uint16_t)iEnd;
+	SCRATCH_UNPOISON(iTop, iSize);
+	return (uint8_t *)u32Arena + iTop;
+} /* scratchAlloc() */
+
+int scratchMark(void)
+{
+	return u16Top;
+} /* scratchMark() */
+
+void scratchRelease(int iMark)
+{
+	u16Top = (uint16_t)iMark;
+	SCRATCH_POISON(iMark);
+} /* scratchRelease() */
+
+int scratchPeak(void)
+{
+	return u16Peak;
+} /* scratchPeak() */
@@ -0,0 +1,53 @@
+//
+// Scratch arena for transient buffers
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_SCRATCH_H_
+#define USER_SCRATCH_H_
+
+//
+// One static arena for the buffers which are only needed during a call
+// (the display line cache, text being formatted, sensor replies), handed
+// out last-in first-out: a function takes scratchMark(), allocates and
+// calls scratchRelease() with the mark before it returns. The arena is
+// sized for two levels, a SCRATCH_CALLER buffer held by a UI function
+// while it calls a driver which allocates up to SCRATCH_LEAF (and calls
+// nothing that allocates); SCRATCH_ALLOC checks each buffer against its
+// level at compile time. SCRATCH_SPARE is headroom for a call chain nobody
+// measured; if the arena runs out anyway, scratchAlloc() traps (abort()
+// in the host build) rather than hand out memory which is in use.
+//
+#define SCRATCH_CALLER 32 // text lines in main.c
+#define SCRATCH_LEAF 132 // display line cache (oled.c), consolePrintf()
+#define SCRATCH_SPARE 32
+#define SCRATCH_SIZE (SCRATCH_CALLER + SCRATCH_LEAF + SCRATCH_SPARE)
+#define SCRATCH_ROUND(n) (((n) + 3) & ~3) // keep every buffer word aligned
+
+#define SCRATCH_ALLOC(type, name, count, level) \
+	_Static_assert(SCRATCH_ROUND(sizeof(type) * (count)) <= (level), #name " is too big for " #level); \
+	type *name = (type *)scratchAlloc(sizeof(type) * (count))
+
+void *scratchAlloc(int iSize);
+// Current top of the arena; pass it to scratchRelease() to free what was allocated after it
+int scratchMark(void);
+void scratchRelease(int iMark);
+// Most bytes in use at once since power-up
+int scratchPeak(void);
+
+#endif /* USER_SCRATCH_H_ */
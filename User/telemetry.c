@@ -0,0 +1,279 @@
+//
+// Binary telemetry frames sent by DMA on USART1
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "debug.h"
+#include "Arduino.h"
+#include "clock.h"
+#include "telemetry.h"
+#include "console.h"
+
+//
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xffff)
+// bitwise, since the CPU has no table space to spare and no multiplier
+//
+uint16_t telemetryCRC16(const uint8_t *pData, int iLen)
+{
+	uint16_t u16CRC = 0xffff;
+	int i;
+
+	while (iLen--) {
+		u16CRC ^= (uint16_t)(*pData++) << 8;
+		for (i=0; i<8; i++) {
+			if (u16CRC & 0x8000)
+				u16CRC = (u16CRC << 1) ^ 0x1021;
+			else
+				u16CRC <<= 1;
+		}
+	}
+	return u16CRC;
+} /* telemetryCRC16() */
+
+static uint8_t *telemetryPut16(uint8_t *d, uint16_t u16)
+{
+	*d++ = (uint8_t)u16;
+	*d++ = (uint8_t)(u16 >> 8);
+	return d;
+} /* telemetryPut16() */
+
+int telemetryWrap(uint8_t *pFrame, int iPayloadLen)
+{
+	pFrame[0] = TELEMETRY_SYNC0;
+	pFrame[1] = TELEMETRY_SYNC1;
+	pFrame[2] = (uint8_t)iPayloadLen;
+	telemetryPut16(&pFrame[3 + iPayloadLen], telemetryCRC16(&pFrame[2], 1 + iPayloadLen));
+	return 3 + iPayloadLen + 2;
+} /* telemetryWrap() */
+
+int telemetryEncode(uint8_t *pFrame, const TELEMETRY_RECORD *pRec, uint8_t u8Seq)
+{
+	uint8_t *d = &pFrame[3];
+
+	*d++ = TELEMETRY_TYPE_SAMPLE;
+	*d++ = u8Seq;
+	d = telemetryPut16(d, (uint16_t)pRec->u32Time);
+	d = telemetryPut16(d, (uint16_t)(pRec->u32Time >> 16));
+	d = telemetryPut16(d, pRec->u16CO2);
+	d = telemetryPut16(d, (uint16_t)pRec->i16Temperature);
+	d = telemetryPut16(d, pRec->u16Humidity);
+	*d++ = pRec->u8Status;
+	*d++ = pRec->u8Mode;
+	telemetryPut16(d, pRec->u16Battery);
+	return telemetryWrap(pFrame, TELEMETRY_PAYLOAD_LEN);
+} /* telemetryEncode() */
+
+// the USART1 driver, for the stream or the console
+#if defined(TELEMETRY) || defined(CONSOLE)
+#define RX_SIZE 32 // power of 2
+
+static uint8_t u8TxBuf[2][TELEMETRY_TX_SIZE];
+static volatile uint8_t u8TxLen[2]; // queued length, 0 = free
+static uint8_t u8Fill; // the buffer handed out next
+static volatile int8_t i8Active = -1; // the buffer DMA is feeding
+static volatile uint8_t bSending; // TX clocks are on
+static uint8_t bRxOn;
+static uint8_t u8RxBuf[RX_SIZE];
+static volatile uint8_t u8RxHead, u8RxTail;
+volatile uint8_t u8TelemetryRx;
+static uint8_t u8Seq;
+static uint32_t u32Baud;
+
+void USART1_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+void DMA1_Channel4_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+
+void telemetryInit(uint32_t u32NewBaud)
+{
+	u32Baud = u32NewBaud;
+	pinMode(TELEMETRY_TX_PIN, OUTPUT_AF); // idles high between frames
+	NVIC_EnableIRQ(USART1_IRQn);
+	NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+} /* telemetryInit() */
+
+//
+// Turn the USART on for the first user (TX or RX)
+//
+static void telemetryUsartOn(void)
+{
+	USART_InitTypeDef USART_InitStructure = {0};
+
+	clockAcquire(CLOCK_USART1);
+	clockKeepAwake(CLOCK_USART1, 1); // keeps running while Delay_Ms() sleeps
+	if (bSending || bRxOn) // already running
+		return;
+	USART_InitStructure.USART_BaudRate = u32Baud;
+	USART_InitStructure.USART_WordLength = USART_WordLength_8b;
+	USART_InitStructure.USART_StopBits = USART_StopBits_1;
+	USART_InitStructure.USART_Parity = USART_Parity_No;
+	USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+	USART_InitStructure.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
+	USART_Init(USART1, &USART_InitStructure);
+	USART_DMACmd(USART1, USART_DMAReq_Tx, ENABLE);
+	USART_Cmd(USART1, ENABLE);
+} /* telemetryUsartOn() */
+
+static void telemetryUsartOff(void)
+{
+	if (!bSending && !bRxOn) {
+		USART_Cmd(USART1, DISABLE);
+		clockKeepAwake(CLOCK_USART1, 0);
+	}
+	clockRelease(CLOCK_USART1);
+} /* telemetryUsartOff() */
+
+static void telemetryKick(int i)
+{
+	i8Active = (int8_t)i;
+	DMA1_Channel4->MADDR = (uint32_t)(uintptr_t)u8TxBuf[i];
+	DMA1_Channel4->CNTR = u8TxLen[i];
+	DMA_Cmd(DMA1_Channel4, ENABLE);
+} /* telemetryKick() */
+
+static void telemetryStartTx(void)
+{
+	DMA_InitTypeDef DMA_InitStructure = {0};
+
+	pinModeFast(TELEMETRY_TX_PIN, OUTPUT_AF); // standby resets the port
+	telemetryUsartOn();
+	bSending = 1;
+	clockAcquire(CLOCK_DMA1);
+	clockKeepAwake(CLOCK_DMA1, 1);
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(uintptr_t)&USART1->DATAR;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+	DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+	DMA_DeInit(DMA1_Channel4); // USART1_TX request
+	DMA_Init(DMA1_Channel4, &DMA_InitStructure);
+	DMA_ITConfig(DMA1_Channel4, DMA_IT_TC, ENABLE);
+} /* telemetryStartTx() */
+
+//
+// DMA has handed the last byte of a buffer to the USART
+// start the other one if it's queued, else wait for the USART to finish
+//
+void DMA1_Channel4_IRQHandler(void)
+{
+	DMA_ClearITPendingBit(DMA1_IT_TC4);
+	DMA_Cmd(DMA1_Channel4, DISABLE);
+	u8TxLen[i8Active] = 0;
+	if (u8TxLen[i8Active ^ 1]) {
+		telemetryKick(i8Active ^ 1);
+	} else {
+		i8Active = -1;
+		USART_ITConfig(USART1, USART_IT_TC, ENABLE);
+	}
+} /* DMA1_Channel4_IRQHandler() */
+
+void USART1_IRQHandler(void)
+{
+	if (USART_GetITStatus(USART1, USART_IT_RXNE) != RESET) {
+		u8RxBuf[u8RxHead] = (uint8_t)USART_ReceiveData(USART1);
+		if (((u8RxHead + 1) & (RX_SIZE-1)) != u8RxTail) // drop on overflow
+			u8RxHead = (u8RxHead + 1) & (RX_SIZE-1);
+		u8TelemetryRx = 1;
+	}
+	if (USART_GetITStatus(USART1, USART_IT_TC) != RESET) {
+		// the last byte has left the shift register; shut TX down
+		USART_ITConfig(USART1, USART_IT_TC, DISABLE);
+		USART_ClearFlag(USART1, USART_FLAG_TC);
+		bSending = 0;
+		clockKeepAwake(CLOCK_DMA1, 0);
+		clockRelease(CLOCK_DMA1);
+		telemetryUsartOff();
+	}
+} /* USART1_IRQHandler() */
+
+uint8_t *telemetryGetBuffer(void)
+{
+	while (u8TxLen[u8Fill])
+		Delay_Ms(1); // sleeps until DMA frees it
+	return u8TxBuf[u8Fill];
+} /* telemetryGetBuffer() */
+
+void telemetryWrite(int iLen)
+{
+	if (u32Baud == 0 || iLen <= 0)
+		return;
+	NVIC_DisableIRQ(DMA1_Channel4_IRQn);
+	NVIC_DisableIRQ(USART1_IRQn);
+	u8TxLen[u8Fill] = (uint8_t)iLen;
+	if (!bSending)
+		telemetryStartTx();
+	if (i8Active < 0) { // DMA is idle; cancel a pending shutdown and start
+		USART_ITConfig(USART1, USART_IT_TC, DISABLE);
+		telemetryKick(u8Fill);
+	}
+	u8Fill ^= 1;
+	NVIC_EnableIRQ(USART1_IRQn);
+	NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+} /* telemetryWrite() */
+
+int telemetrySend(const TELEMETRY_RECORD *pRec)
+{
+	if (u8TxLen[u8Fill] || u32Baud == 0)
+		return -1;
+	telemetryWrite(telemetryEncode(u8TxBuf[u8Fill], pRec, u8Seq++));
+	return 0;
+} /* telemetrySend() */
+
+int telemetryBusy(void)
+{
+	return bSending;
+} /* telemetryBusy() */
+
+void telemetryEnableRx(int bEnable)
+{
+	if (bEnable == bRxOn || u32Baud == 0)
+		return;
+	NVIC_DisableIRQ(USART1_IRQn);
+	if (bEnable) {
+		pinMode(TELEMETRY_RX_PIN, INPUT_PULLUP);
+		telemetryUsartOn();
+		bRxOn = 1;
+		u8RxHead = u8RxTail = 0;
+		USART_ITConfig(USART1, USART_IT_RXNE, ENABLE);
+	} else {
+		USART_ITConfig(USART1, USART_IT_RXNE, DISABLE);
+		bRxOn = 0;
+		telemetryUsartOff();
+	}
+	NVIC_EnableIRQ(USART1_IRQn);
+} /* telemetryEnableRx() */
+
+int telemetryRead(void)
+{
+	int c;
+
+	u8TelemetryRx = 0;
+	if (u8RxHead == u8RxTail)
+		return -1;
+	c = u8RxBuf[u8RxTail];
+	u8RxTail = (u8RxTail + 1) & (RX_SIZE-1);
+	return c;
+} /* telemetryRead() */
+#else
+// nothing is ever sent; Standby82msWake() waits for it
+int telemetryBusy(void)
+{
+	return 0;
+} /* telemetryBusy() */
+#endif // TELEMETRY || CONSOLE
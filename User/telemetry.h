@@ -0,0 +1,107 @@
+//
+// Binary telemetry frames sent by DMA on USART1
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef USER_TELEMETRY_H_
+#define USER_TELEMETRY_H_
+
+//
+// Frame layout (multi-byte fields are little endian)
+//  0 0xA5 0x5A sync
+//  2 payload length (up to TELEMETRY_MAX_PAYLOAD)
+//  3 payload, starting with a record type
+//  n CRC-16/CCITT-FALSE of the length and payload bytes
+//
+// TELEMETRY_TYPE_SAMPLE payload (one per sensor reading):
+//     0 u8  type
+//     1 u8  sequence number (wraps; gaps show dropped frames)
+//     2 u32 seconds of sampling since power-up
+//     6 u16 CO2 in ppm
+//     8 i16 temperature in 0.1C
+//    10 u16 relative humidity in 0.1%
+//    12 u8  status (scd41_getSample() return code)
+//    13 u8  mode
+//    14 u16 battery in mV
+// TELEMETRY_TYPE_HISTORY payload (console dump, see history.h):
+//     0 u8  type
+//     1 u8  entry count
+//     2 u32 sequence number of the first entry
+//     6 u16 seconds per entry
+//     8 3 bytes per entry (CO2, temperature, humidity)
+//
+// Text (console replies) can be mixed with the frames; it never contains
+// the first sync byte.
+// This header is shared with the host tools in tools/, so it only uses stdint types
+//
+#define TELEMETRY_SYNC0 0xa5
+#define TELEMETRY_SYNC1 0x5a
+#define TELEMETRY_TYPE_SAMPLE 1
+#define TELEMETRY_TYPE_HISTORY 2
+#define TELEMETRY_PAYLOAD_LEN 16 // sample record
+#define TELEMETRY_FRAME_LEN (3 + TELEMETRY_PAYLOAD_LEN + 2)
+#define TELEMETRY_TX_SIZE 64 // bytes per DMA buffer
+#define TELEMETRY_MAX_PAYLOAD (TELEMETRY_TX_SIZE - 5)
+#define TELEMETRY_HISTORY_MAX ((TELEMETRY_MAX_PAYLOAD - 8) / 3) // entries per frame
+#define TELEMETRY_TX_PIN 0xd5
+#define TELEMETRY_RX_PIN 0xd6
+
+// Stream a sample record on TX after every reading (main.c). It powers up
+// USART1 and DMA for every sample, so it is off unless TELEMETRY is defined
+// here or by the build. The driver functions below are built for it or for
+// the console (CONSOLE in console.h); the frame functions always are
+//#define TELEMETRY
+
+typedef struct tagTelemetryRecord
+{
+	uint32_t u32Time;
+	uint16_t u16CO2;
+	int16_t i16Temperature;
+	uint16_t u16Humidity;
+	uint8_t u8Status;
+	uint8_t u8Mode;
+	uint16_t u16Battery;
+} TELEMETRY_RECORD;
+
+uint16_t telemetryCRC16(const uint8_t *pData, int iLen);
+// Add the sync, length and CRC around a payload already at &pFrame[3]
+// returns the frame length
+int telemetryWrap(uint8_t *pFrame, int iPayloadLen);
+// Build a sample frame in pFrame (TELEMETRY_FRAME_LEN bytes); returns the length
+int telemetryEncode(uint8_t *pFrame, const TELEMETRY_RECORD *pRec, uint8_t u8Seq);
+
+// USART1 on PD5 (TX) and PD6 (RX), 8N1
+void telemetryInit(uint32_t u32Baud);
+// Queue a record; it is sent by DMA while the caller carries on
+// returns -1 if both buffers are still going out (the sequence number shows the gap)
+int telemetrySend(const TELEMETRY_RECORD *pRec);
+// Get the next free TX buffer (TELEMETRY_TX_SIZE bytes), sleeping until one is
+// free, then queue it with telemetryWrite(). Two buffers alternate, so the next
+// one can be filled while the last is sent.
+uint8_t *telemetryGetBuffer(void);
+void telemetryWrite(int iLen);
+// Returns 1 while anything is being sent
+int telemetryBusy(void);
+// The receiver keeps USART1 clocked (no standby) while it's on
+void telemetryEnableRx(int bEnable);
+// Next received byte or -1
+int telemetryRead(void);
+// Set by every received byte; a wake flag for Delay_Wait()
+extern volatile uint8_t u8TelemetryRx;
+
+#endif /* USER_TELEMETRY_H_ */
@@ -0,0 +1,59 @@
+//
+// Host stand-in for the CH32V00x device header
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Pulls in the real register map from Peripheral/inc, then moves the
+// peripheral space and FLASH into host arrays (see host.c). The build
+// links without PIE so these addresses fit in the uint32_t casts the
+// firmware and the WCH headers use.
+// EXTI and the GPIO ports are reached through functions so that their
+// write-1-to-clear and set/reset registers behave like the hardware.
+//
+#ifndef HOST_CH32V00X_H_
+#define HOST_CH32V00X_H_
+
+#include <stdint.h>
+#include <stddef.h> // newlib headers bring this in on the target
+
+extern uint32_t u32HostPeriph[];
+extern uint8_t u8HostFlash[];
+extern uint16_t u16HostOB[];
+
+#include_next <ch32v00x.h>
+
+#undef PERIPH_BASE
+#define PERIPH_BASE ((uint32_t)(uintptr_t)u32HostPeriph)
+#undef FLASH_BASE
+#define FLASH_BASE ((uint32_t)(uintptr_t)u8HostFlash)
+#undef OB_BASE
+#define OB_BASE ((uint32_t)(uintptr_t)u16HostOB)
+
+uintptr_t hostGPIOSync(void);
+EXTI_TypeDef *hostEXTI(void);
+
+#undef GPIOA_BASE
+#define GPIOA_BASE (hostGPIOSync() + 0x0000)
+#undef GPIOC_BASE
+#define GPIOC_BASE (hostGPIOSync() + 0x0800)
+#undef GPIOD_BASE
+#define GPIOD_BASE (hostGPIOSync() + 0x0c00)
+#undef EXTI
+#define EXTI (hostEXTI())
+
+#endif /* HOST_CH32V00X_H_ */
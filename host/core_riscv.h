@@ -0,0 +1,160 @@
+//
+// Host stand-in for the WCH RISC-V core header
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Same types and names as Core/core_riscv.h, but the CSR and WFI
+// instructions become calls into host.c and SysTick/PFIC are host structures.
+// Every SysTick access goes through hostSysTick(), which lets simulated time
+// move on while the firmware polls the counter.
+//
+#ifndef __CORE_RISCV_H__
+#define __CORE_RISCV_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define     __I     volatile const
+#define     __O     volatile
+#define     __IO    volatile
+
+typedef __I uint32_t vuc32;
+typedef __I uint16_t vuc16;
+typedef __I uint8_t vuc8;
+typedef const uint32_t uc32;
+typedef const uint16_t uc16;
+typedef const uint8_t uc8;
+typedef __I int32_t vsc32;
+typedef __I int16_t vsc16;
+typedef __I int8_t vsc8;
+typedef const int32_t sc32;
+typedef const int16_t sc16;
+typedef const int8_t sc8;
+typedef __IO uint32_t  vu32;
+typedef __IO uint16_t vu16;
+typedef __IO uint8_t  vu8;
+typedef uint32_t  u32;
+typedef uint16_t u16;
+typedef uint8_t  u8;
+typedef __IO int32_t  vs32;
+typedef __IO int16_t  vs16;
+typedef __IO int8_t   vs8;
+typedef int32_t  s32;
+typedef int16_t s16;
+typedef int8_t  s8;
+
+typedef enum {NoREADY = 0, READY = !NoREADY} ErrorStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+
+#define   RV_STATIC_INLINE  static  inline
+
+// the handlers are plain functions called by the host interrupt dispatcher
+#define interrupt(x) used
+
+typedef struct
+{
+    __IO uint32_t CTLR;
+    __IO uint32_t SR;
+    __IO uint32_t CNT;
+    uint32_t RESERVED0;
+    __IO uint32_t CMP;
+    uint32_t RESERVED1;
+} SysTick_Type;
+
+SysTick_Type *hostSysTick(void);
+#define SysTick         (hostSysTick())
+
+void hostEnableIRQ(int iIRQ, int bEnable);
+int hostIRQEnabled(int iIRQ);
+void hostSetPendingIRQ(int iIRQ, int bPending);
+void hostGlobalIRQ(int bEnable);
+void hostWFI(void);
+void hostSystemReset(void);
+
+RV_STATIC_INLINE void __enable_irq(void)
+{
+  hostGlobalIRQ(1);
+}
+
+RV_STATIC_INLINE void __disable_irq(void)
+{
+  hostGlobalIRQ(0);
+}
+
+RV_STATIC_INLINE void __NOP(void)
+{
+}
+
+RV_STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+  hostEnableIRQ((int)IRQn, 1);
+}
+
+RV_STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+  hostEnableIRQ((int)IRQn, 0);
+}
+
+RV_STATIC_INLINE uint32_t NVIC_GetStatusIRQ(IRQn_Type IRQn)
+{
+  return (uint32_t)hostIRQEnabled((int)IRQn);
+}
+
+RV_STATIC_INLINE void NVIC_SetPendingIRQ(IRQn_Type IRQn)
+{
+  hostSetPendingIRQ((int)IRQn, 1);
+}
+
+RV_STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+  hostSetPendingIRQ((int)IRQn, 0);
+}
+
+RV_STATIC_INLINE void NVIC_SetPriority(IRQn_Type IRQn, uint8_t priority)
+{
+  (void)IRQn; (void)priority;
+}
+
+RV_STATIC_INLINE void __WFI(void)
+{
+  hostWFI();
+}
+
+RV_STATIC_INLINE void __WFE(void)
+{
+  hostWFI();
+}
+
+RV_STATIC_INLINE void NVIC_SystemReset(void)
+{
+  hostSystemReset();
+}
+
+extern uint32_t __get_MSTATUS(void);
+extern void __set_MSTATUS(uint32_t value);
+extern uint32_t __get_SP(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CORE_RISCV_H__ */
@@ -0,0 +1,517 @@
+//
+// Pocket CO2 display drawing fuzz and property test
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Every input is a sequence of calls to the drawing functions in oled.c,
+// decoded from bytes (coordinates on and off the display, any characters,
+// made-up GFX fonts and sprites). After each call the SSD1306 model has to
+// hold what a per-pixel reference of the drawing rules below says, the
+// model must not have seen an unknown command or a page write running
+// past the last column, the GDDRAM bytes on the bus must be exactly the
+// ones the call rewrites, and the scratch arena must be given back. The
+// firmware is built with AddressSanitizer and UBSan for this test, so a
+// stray access in oled.c (the scratch arena included) stops the run.
+//
+// Drawing rules (what the reference does):
+//  text      cells of 6 or 8 columns (blank column + font) in page y/8,
+//            clipped at the right edge, wrapping after the cell that
+//            reaches within a cell of it; 12x16 is the 6x8 font doubled
+//            plus diagonal smoothing, which only adds pixels next to the
+//            doubled ones; x/y of -1 are the cursor
+//  custom    the cell of each glyph (xAdvance columns) is rewritten in the
+//            pages its rows touch: bitmap pixels in ucColor (0 = inverted
+//            inside the bitmap), the rest of the cell cleared
+//  sprite    every page the sprite touches is rewritten over its width:
+//            set pixels lit (cleared when inverted), the rest the opposite
+//
+// fuzz_oled [-runs n] [-seed n] [file...]
+//  -runs  random inputs to try (default 2000, ctest runs 500)
+//  -seed  for the random inputs
+//  file   inputs to replay (a failure is saved as fuzz_oled.fail)
+// With -DFUZZ_LIBFUZZER=ON (clang) this is a libFuzzer target instead.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "oled.h"
+#include "scratch.h"
+#include "ssd1306.h"
+
+#define OLED_ADDR 0x3c
+#define MAX_TEXT 24
+
+// from oled.c and main.c
+extern const uint8_t ucFont[], ucSmallFont[];
+extern const GFXfont Roboto_Black_13, Roboto_Black_40;
+
+enum {
+	OP_FILL = 0,
+	OP_CLEARLINE,
+	OP_STRING,
+	OP_CUSTOM,
+	OP_SPRITE,
+	OP_CONTRAST,
+	OP_POWER,
+	OP_COUNT
+};
+
+typedef struct tagInput
+{
+	const uint8_t *p;
+	size_t iLen;
+} FUZZ_INPUT;
+
+static SSD1306 oled;
+static uint8_t u8Ref[SSD1306_PAGES][SSD1306_WIDTH]; // expected GDDRAM
+static uint8_t u8May[SSD1306_PAGES][SSD1306_WIDTH]; // bits allowed to differ (12x16 smoothing)
+static uint8_t u8Touched[SSD1306_PAGES][SSD1306_WIDTH]; // bytes the call rewrites
+static int iRefX, iRefY, iWrites; // cursor after the call, data transfers it takes
+static char szOp[160];
+static const uint8_t *pInput; // for saving a failure
+static size_t iInputLen;
+
+static int GetByte(FUZZ_INPUT *pIn)
+{
+	if (pIn->iLen == 0)
+		return 0;
+	pIn->iLen--;
+	return *pIn->p++;
+} /* GetByte() */
+
+static void Fail(const char *szWhat)
+{
+	FILE *f;
+
+	fprintf(stderr, "fuzz_oled: %s: %s\n", szOp, szWhat);
+#ifndef FUZZ_LIBFUZZER
+	if ((f = fopen("fuzz_oled.fail", "wb")) != NULL) {
+		fwrite(pInput, 1, iInputLen, f);
+		fclose(f);
+		fprintf(stderr, "fuzz_oled: input saved as fuzz_oled.fail\n");
+	}
+#else
+	(void)f;
+#endif
+	abort();
+} /* Fail() */
+
+// set one byte of the reference as rewritten by the call
+static void RefByte(int x, int iPage, uint8_t u8)
+{
+	if (x < 0 || x >= SSD1306_WIDTH || iPage < 0 || iPage >= SSD1306_PAGES)
+		return;
+	u8Ref[iPage][x] = u8;
+	u8Touched[iPage][x] = 1;
+} /* RefByte() */
+
+static int RefGet(int x, int y)
+{
+	return (u8Ref[y >> 3][x] >> (y & 7)) & 1;
+} /* RefGet() */
+
+static void RefFill(uint8_t u8)
+{
+	int x, p;
+
+	for (p=0; p<SSD1306_PAGES; p++)
+		for (x=0; x<SSD1306_WIDTH; x++)
+			RefByte(x, p, u8);
+	iWrites = SSD1306_PAGES * 8;
+	iRefX = iRefY = 0;
+} /* RefFill() */
+
+static void RefClearLine(int y)
+{
+	int x;
+
+	if (y < 0 || y >= SSD1306_HEIGHT)
+		return;
+	for (x=0; x<SSD1306_WIDTH; x++)
+		RefByte(x, y >> 3, 0);
+	iWrites = 1;
+} /* RefClearLine() */
+
+// one column of a 6x8 or 8x8 cell; column 0 is blank
+static uint8_t RefCellColumn(int iSize, int c, int iCol)
+{
+	if (c < 32 || c > 127)
+		c = ' ';
+	if (iCol == 0)
+		return 0;
+	return (iSize == FONT_8x8) ? ucFont[(c-32)*7 + iCol-1] : ucSmallFont[(c-32)*5 + iCol-1];
+} /* RefCellColumn() */
+
+// 6x8 glyph doubled into a 12x16 cell at column x of page iPage, and the
+// pixels around it which the smoothing may add
+static void RefStretched(int x, int iPage, int c, int iCols, int bInvert)
+{
+	uint8_t u8Glyph[6];
+	int i, tx, ty, dx, dy, iPages = (iPage + 1 < SSD1306_PAGES) ? 2 : 1;
+	int bOn[12][16];
+
+	for (i=0; i<6; i++)
+		u8Glyph[i] = RefCellColumn(FONT_6x8, c, i) ^ (bInvert ? 0xff : 0);
+	for (tx=0; tx<12; tx++)
+		for (ty=0; ty<16; ty++)
+			bOn[tx][ty] = (u8Glyph[tx >> 1] >> (ty >> 1)) & 1;
+	for (tx=0; tx<iCols; tx++) {
+		for (i=0; i<iPages; i++) {
+			uint8_t u8 = 0, u8Near = 0;
+
+			for (ty=0; ty<8; ty++) {
+				if (bOn[tx][i*8 + ty]) {
+					u8 |= 1 << ty;
+					continue;
+				}
+				for (dx=-1; dx<=1; dx++) // next to a doubled pixel?
+					for (dy=-1; dy<=1; dy++)
+						if (tx+dx >= 0 && tx+dx < 12 && i*8+ty+dy >= 0 && i*8+ty+dy < 16 && bOn[tx+dx][i*8+ty+dy])
+							u8Near |= 1 << ty;
+			}
+			RefByte(x + tx, iPage + i, u8);
+			u8May[iPage + i][x + tx] = u8Near;
+		}
+	}
+	iWrites += iPages;
+} /* RefStretched() */
+
+static int RefString(int x, int y, const char *szMsg, int iSize, int bInvert)
+{
+	int i, iCell, iCols;
+
+	if (x == -1)
+		x = iRefX;
+	if (y == -1)
+		y = iRefY;
+	if (x < 0 || x >= SSD1306_WIDTH || y < 0 || y >= SSD1306_HEIGHT)
+		return -1;
+	if (iSize != FONT_6x8 && iSize != FONT_8x8 && iSize != FONT_12x16)
+		return -1;
+	iCell = (iSize == FONT_8x8) ? 8 : (iSize == FONT_6x8) ? 6 : 12;
+	while (x < SSD1306_WIDTH && y < SSD1306_HEIGHT && *szMsg) {
+		iCols = (x + iCell > SSD1306_WIDTH) ? SSD1306_WIDTH - x : iCell;
+		if (iSize == FONT_12x16) {
+			RefStretched(x, y >> 3, (uint8_t)*szMsg, iCols, bInvert);
+		} else {
+			for (i=0; i<iCols; i++)
+				RefByte(x + i, y >> 3, RefCellColumn(iSize, (uint8_t)*szMsg, i) ^ (bInvert ? 0xff : 0));
+			iWrites++;
+		}
+		x += iCols;
+		if (x >= SSD1306_WIDTH - (iCell - 1)) {
+			x = 0;
+			y += (iSize == FONT_12x16) ? 16 : 8;
+		}
+		szMsg++;
+	}
+	iRefX = x;
+	iRefY = y;
+	return 0;
+} /* RefString() */
+
+static void RefCustom(const GFXfont *pFont, int x, int y, const char *szMsg, int iColor)
+{
+	const GFXglyph *pGlyph;
+	int c, dy, iLeft, iRight, iCol, iRow, iPage, iBit, iPix;
+	uint8_t u8;
+
+	if (x == -1)
+		x = iRefX;
+	if (y == -1)
+		y = iRefY;
+	while (*szMsg && x < SSD1306_WIDTH) {
+		c = (uint8_t)*szMsg++;
+		if (c > 127 || c < pFont->first || c > pFont->last)
+			continue;
+		pGlyph = &pFont->glyph[c - pFont->first];
+		dy = y + pGlyph->yOffset;
+		iLeft = (x < 0) ? 0 : x;
+		iRight = (x + pGlyph->xAdvance > SSD1306_WIDTH) ? SSD1306_WIDTH : x + pGlyph->xAdvance;
+		for (iPage=0; iPage<SSD1306_PAGES && iRight > iLeft; iPage++) {
+			if (pGlyph->height == 0 || dy >= (iPage+1)*8 || dy + pGlyph->height <= iPage*8) // no rows of the glyph in this page
+				continue;
+			for (iCol=iLeft; iCol<iRight; iCol++) {
+				u8 = 0;
+				for (iBit=0; iBit<8; iBit++) {
+					iRow = iPage*8 + iBit - dy;
+					iPix = iCol - x - pGlyph->xOffset;
+					if (iRow < 0 || iRow >= pGlyph->height || iPix < 0 || iPix >= pGlyph->width)
+						continue; // cell background
+					iPix += iRow * pGlyph->width;
+					if (((pFont->bitmap[pGlyph->bitmapOffset + (iPix >> 3)] << (iPix & 7)) & 0x80) ^ (iColor == 1 ? 0 : 0x80))
+						u8 |= 1 << iBit;
+				}
+				RefByte(iCol, iPage, u8);
+			}
+			iWrites++;
+		}
+		x += pGlyph->xAdvance;
+	}
+	iRefX = x;
+	iRefY = y;
+} /* RefCustom() */
+
+static void RefSprite(int x, int y, int cx, int cy, const uint8_t *pSprite, int iPitch, int bInvert)
+{
+	int iCol, iPage, iBit, sx, sy, iTop, iBottom, bSet;
+	uint8_t u8;
+
+	if (cx <= 0 || cy <= 0 || x+cx <= 0 || y+cy <= 0 || x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT)
+		return;
+	iTop = (y < 0) ? 0 : y;
+	iBottom = (y + cy > SSD1306_HEIGHT) ? SSD1306_HEIGHT : y + cy;
+	for (iPage=iTop >> 3; iPage<=(iBottom-1) >> 3; iPage++) {
+		for (iCol=(x < 0) ? 0 : x; iCol<x+cx && iCol<SSD1306_WIDTH; iCol++) {
+			u8 = 0;
+			for (iBit=0; iBit<8; iBit++) {
+				sx = iCol - x;
+				sy = iPage*8 + iBit - y;
+				bSet = (sy >= 0 && sy < cy && (pSprite[sy*iPitch + (sx >> 3)] & (0x80 >> (sx & 7))));
+				if (bSet != bInvert) // the rest of the page is the background
+					u8 |= 1 << iBit;
+			}
+			RefByte(iCol, iPage, u8);
+		}
+		iWrites++;
+	}
+} /* RefSprite() */
+
+// compare the model with the reference and the traffic with what the call should take
+static void CheckCall(void)
+{
+	const SSD1306_STATS *pStats = &oled.stats;
+	uint32_t u32Touched = 0;
+	int x, p, iBit;
+	char szMsg[128];
+
+	for (p=0; p<SSD1306_PAGES; p++) {
+		for (x=0; x<SSD1306_WIDTH; x++) {
+			u32Touched += u8Touched[p][x];
+			if ((oled.u8RAM[p][x] ^ u8Ref[p][x]) & ~u8May[p][x]) {
+				for (iBit=0; !(((oled.u8RAM[p][x] ^ u8Ref[p][x]) & ~u8May[p][x]) >> iBit & 1); iBit++) {};
+				snprintf(szMsg, sizeof(szMsg), "pixel (%d,%d) is %d, the reference has %d", x, p*8 + iBit,
+						(oled.u8RAM[p][x] >> iBit) & 1, RefGet(x, p*8 + iBit));
+				Fail(szMsg);
+			}
+		}
+	}
+	if (pStats->u32Unknown || pStats->u32Wraps) {
+		snprintf(szMsg, sizeof(szMsg), "%u unknown commands, %u writes past the last column", pStats->u32Unknown, pStats->u32Wraps);
+		Fail(szMsg);
+	}
+	if (pStats->u32DataBytes != u32Touched || pStats->u32Transactions > (uint32_t)(3*iWrites + 2) ||
+		pStats->u32Bytes > pStats->u32DataBytes + 6*pStats->u32Transactions) {
+		snprintf(szMsg, sizeof(szMsg), "%u data bytes in %u transfers (%u bus bytes), expected %u bytes in up to %d transfers",
+				pStats->u32DataBytes, pStats->u32Transactions, pStats->u32Bytes, u32Touched, 3*iWrites + 2);
+		Fail(szMsg);
+	}
+	if (oledGetCursorX() != iRefX || oledGetCursorY() != iRefY) {
+		snprintf(szMsg, sizeof(szMsg), "cursor at %d,%d, expected %d,%d", oledGetCursorX(), oledGetCursorY(), iRefX, iRefY);
+		Fail(szMsg);
+	}
+	if (scratchMark() != 0 || scratchPeak() > SCRATCH_SIZE)
+		Fail("scratch arena not given back or overflowed");
+} /* CheckCall() */
+
+// a made-up proportional font for 4 characters from 'A', with any metrics
+static const GFXfont *MakeFont(FUZZ_INPUT *pIn)
+{
+	static GFXfont font;
+	static GFXglyph glyphs[4];
+	static uint8_t *pBitmap;
+	int i, iBytes = 0;
+
+	for (i=0; i<4; i++) {
+		glyphs[i].bitmapOffset = (uint16_t)iBytes;
+		glyphs[i].width = (uint8_t)(GetByte(pIn) % 48);
+		glyphs[i].height = (uint8_t)(GetByte(pIn) % 40);
+		glyphs[i].xAdvance = (uint8_t)(GetByte(pIn) % 48);
+		glyphs[i].xOffset = (int8_t)(GetByte(pIn) % 24 - 8);
+		glyphs[i].yOffset = (int8_t)(8 - GetByte(pIn) % 48);
+		iBytes += (glyphs[i].width * glyphs[i].height + 7) / 8;
+	}
+	free(pBitmap);
+	pBitmap = malloc(iBytes ? iBytes : 1); // exactly the glyphs, so reading past them is caught
+	for (i=0; i<iBytes; i++)
+		pBitmap[i] = (uint8_t)GetByte(pIn);
+	font.bitmap = pBitmap;
+	font.glyph = glyphs;
+	font.first = 'A';
+	font.last = 'A' + 3;
+	font.yAdvance = 40;
+	return &font;
+} /* MakeFont() */
+
+static void RunCall(FUZZ_INPUT *pIn)
+{
+	static const char *szFont[3] = {"Roboto_Black_13", "Roboto_Black_40", "fuzzed"};
+	char szText[MAX_TEXT + 1];
+	const GFXfont *pFont;
+	uint8_t *pSprite;
+	int i, iOp, x, y, cx, cy, iSize, iPitch, iFont, iLen, iVal, rc, iRef;
+
+	memcpy(u8Ref, oled.u8RAM, sizeof(u8Ref));
+	memset(u8May, 0, sizeof(u8May));
+	memset(u8Touched, 0, sizeof(u8Touched));
+	iRefX = oledGetCursorX();
+	iRefY = oledGetCursorY();
+	iWrites = 0;
+	ssd1306ResetStats(&oled);
+	iOp = GetByte(pIn) % OP_COUNT;
+	switch (iOp) {
+	case OP_FILL:
+		iVal = GetByte(pIn);
+		snprintf(szOp, sizeof(szOp), "oledFill(0x%02x)", iVal);
+		RefFill((uint8_t)iVal);
+		oledFill((uint8_t)iVal);
+		break;
+	case OP_CLEARLINE:
+		y = GetByte(pIn) % 96 - 16;
+		snprintf(szOp, sizeof(szOp), "oledClearLine(%d)", y);
+		RefClearLine(y);
+		oledClearLine(y);
+		break;
+	case OP_STRING:
+		x = GetByte(pIn) % 144 - 8;
+		y = GetByte(pIn) % 80 - 8;
+		iSize = GetByte(pIn) % 4; // FONT_16x16 isn't drawn
+		iVal = GetByte(pIn) & 1;
+		iLen = GetByte(pIn) % (MAX_TEXT + 1);
+		for (i=0; i<iLen; i++)
+			szText[i] = (char)GetByte(pIn);
+		szText[iLen] = 0;
+		snprintf(szOp, sizeof(szOp), "oledWriteString(%d, %d, %d chars, size %d, invert %d)", x, y, (int)strlen(szText), iSize, iVal);
+		iRef = RefString(x, y, szText, iSize, iVal);
+		rc = oledWriteString(x, y, szText, iSize, iVal);
+		if (rc != iRef)
+			Fail("wrong return code");
+		break;
+	case OP_CUSTOM:
+		iFont = GetByte(pIn) % 3;
+		pFont = (iFont == 0) ? &Roboto_Black_13 : (iFont == 1) ? &Roboto_Black_40 : MakeFont(pIn);
+		x = GetByte(pIn) % 160 - 16;
+		y = GetByte(pIn) % 112 - 16; // the baseline
+		iVal = GetByte(pIn) & 1;
+		iLen = GetByte(pIn) % 8;
+		for (i=0; i<iLen; i++)
+			szText[i] = (char)((iFont == 2) ? 'A' + GetByte(pIn) % 5 : 31 + GetByte(pIn) % 100);
+		szText[iLen] = 0;
+		snprintf(szOp, sizeof(szOp), "oledWriteStringCustom(%s, %d, %d, \"%s\", %d)", szFont[iFont], x, y, szText, iVal);
+		RefCustom(pFont, x, y, szText, iVal);
+		oledWriteStringCustom(pFont, x, y, szText, (uint8_t)iVal);
+		break;
+	case OP_SPRITE:
+		x = GetByte(pIn) % 160 - 16;
+		y = GetByte(pIn) % 88 - 12;
+		cx = GetByte(pIn) % 48;
+		cy = GetByte(pIn) % 48;
+		iPitch = (cx + 7) / 8 + GetByte(pIn) % 3;
+		iVal = GetByte(pIn) & 1;
+		pSprite = malloc((iPitch * cy > 0) ? iPitch * cy : 1); // exactly the sprite, so reading past it is caught
+		for (i=0; i<iPitch * cy; i++)
+			pSprite[i] = (uint8_t)GetByte(pIn);
+		snprintf(szOp, sizeof(szOp), "oledDrawSprite(%d, %d, %d, %d, pitch %d, invert %d)", x, y, cx, cy, iPitch, iVal);
+		RefSprite(x, y, cx, cy, pSprite, iPitch, iVal);
+		oledDrawSprite(x, y, cx, cy, pSprite, iPitch, iVal);
+		free(pSprite);
+		break;
+	case OP_CONTRAST:
+		iVal = GetByte(pIn);
+		snprintf(szOp, sizeof(szOp), "oledContrast(%d)", iVal);
+		oledContrast((uint8_t)iVal);
+		if (oled.u8Contrast != iVal)
+			Fail("contrast not set");
+		break;
+	case OP_POWER:
+		iVal = GetByte(pIn) & 1;
+		snprintf(szOp, sizeof(szOp), "oledPower(%d)", iVal);
+		oledPower(iVal);
+		if (oled.bOn != iVal)
+			Fail("power not set");
+		break;
+	}
+	CheckCall();
+} /* RunCall() */
+
+int LLVMFuzzerTestOneInput(const uint8_t *pData, size_t iLen)
+{
+	static int bAttached;
+	FUZZ_INPUT in;
+
+	if (!bAttached) {
+		Delay_Init();
+		ssd1306Attach(&oled, OLED_ADDR);
+		oledInit(OLED_ADDR, 400000);
+		bAttached = 1;
+	}
+	pInput = pData;
+	iInputLen = iLen;
+	in.p = pData;
+	in.iLen = iLen;
+	while (in.iLen)
+		RunCall(&in);
+	return 0;
+} /* LLVMFuzzerTestOneInput() */
+
+#ifndef FUZZ_LIBFUZZER
+static uint32_t u32Seed = 0x2545f491;
+
+static uint32_t Random(void)
+{
+	u32Seed ^= u32Seed << 13;
+	u32Seed ^= u32Seed >> 17;
+	u32Seed ^= u32Seed << 5;
+	return u32Seed;
+} /* Random() */
+
+int main(int argc, char *argv[])
+{
+	static uint8_t u8Buf[4096];
+	int i, j, iRuns = 2000, iLen, iFiles = 0;
+	FILE *f;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-runs") == 0 && i+1 < argc)
+			iRuns = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-seed") == 0 && i+1 < argc)
+			u32Seed = (uint32_t)strtoul(argv[++i], NULL, 0) | 1;
+		else {
+			if ((f = fopen(argv[i], "rb")) == NULL) {
+				fprintf(stderr, "fuzz_oled: can't open %s\n", argv[i]);
+				return 2;
+			}
+			iLen = (int)fread(u8Buf, 1, sizeof(u8Buf), f);
+			fclose(f);
+			LLVMFuzzerTestOneInput(u8Buf, iLen);
+			iFiles++;
+		}
+	}
+	if (iFiles)
+		return 0;
+	for (i=0; i<iRuns; i++) {
+		iLen = 1 + Random() % 512;
+		for (j=0; j<iLen; j++)
+			u8Buf[j] = (uint8_t)Random();
+		LLVMFuzzerTestOneInput(u8Buf, iLen);
+	}
+	printf("fuzz_oled: %d inputs, every call matched the reference\n", iRuns);
+	return 0;
+} /* main() */
+#endif // FUZZ_LIBFUZZER
@@ -0,0 +1,1545 @@
+//
+// Host (Linux) simulation of the CH32V003 peripherals
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Replaces the WCH peripheral library (Peripheral/src) and the core CSR
+// accessors for host builds. Time only moves when the firmware polls
+// SysTick, talks on a bus, sleeps (WFI/standby) or the test calls
+// hostAdvance(); everything else runs in zero simulated time.
+// Interrupt sources are level-sensitive: after each event the handlers of
+// the enabled sources whose flags are set run until they clear them.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "host.h"
+#include "ram.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define HOST_POLL_CYCLES 8 // a SysTick poll loop iteration
+#define HOST_HANG_POLLS 1000000 // polls of a flag that can't change any more
+#define HOST_IRQ_LOOP 10000 // handler calls without the flag being cleared
+#define HOST_FLASH_ERASE_NS 3000000ULL // nominal fast page erase time
+#define HOST_FLASH_WRITE_NS 3000000ULL // nominal fast page program time
+#define HOST_LSI_HZ 128000
+#define HOST_RX_SIZE 1024
+#define HOST_PIN_EVENTS 64
+#define EXTI_UNTOUCHED 0x80000000 // unused INTFR bit, marks the value handed out
+#define AWUCSR_AWUEN 0x02 // PWR_AWUCSR auto-wakeup enable
+#define IRQ_COUNT 40
+
+// Register space; PERIPH_BASE and FLASH_BASE point here (see ch32v00x.h)
+uint32_t u32HostPeriph[HOST_PERIPH_SIZE/4];
+uint8_t u8HostFlash[HOST_FLASH_SIZE] __attribute__((aligned(64))); // page aligned like the real one
+uint16_t u16HostOB[8];
+uint32_t SystemCoreClock = 8000000;
+// Stand-in for the RAM of Ld/Link.ld, for ram.c: .data, .bss, the heap gap
+// and the stack at the top. The firmware's own variables live in the host
+// process; this only gives the linker symbols a layout and the paint.
+uint32_t u32HostRAM[HOST_RAM_SIZE/4];
+__asm__(".globl _ramfunc_vma, _eramfunc, _data_vma, _sbss, _ebss, _heap_end, _susrstack, _eusrstack\n"
+	".set _ramfunc_vma, u32HostRAM\n" // RAMFUNC is empty on the host
+	".set _eramfunc, u32HostRAM\n"
+	".set _data_vma, u32HostRAM\n"
+	".set _sbss, u32HostRAM + 0x40\n"
+	".set _ebss, u32HostRAM + 0x500\n"
+	".set _heap_end, u32HostRAM + 0x700\n" // also used by _sbrk() in debug.c (not called here)
+	".set _susrstack, u32HostRAM + 0x700\n"
+	".set _eusrstack, u32HostRAM + 0x800\n"); // HOST_RAM_SIZE
+
+// The real register blocks; the firmware reaches GPIO and EXTI through the
+// sync functions below instead
+#define HOST_GPIO(i) ((GPIO_TypeDef *)(uintptr_t)(APB2PERIPH_BASE + 0x0800 + 0x400 * (i)))
+#define HOST_EXTI ((EXTI_TypeDef *)(uintptr_t)(APB2PERIPH_BASE + 0x0400))
+
+static const uint8_t u8PortIndex[3] = {0, 2, 3}; // A, C, D
+
+static HOST_HOOKS hooks;
+static HOST_STATS stats;
+static HOST_I2C_DEVICE *pI2CDevices;
+
+// time
+static uint64_t u64Now; // wall clock ns
+static uint64_t u64RunNs; // ns the core clock was running (not standby)
+static int iPower = HOST_RUN;
+// SysTick
+static SysTick_Type systick;
+static uint32_t u32SysTickPublished;
+static int64_t i64SysTickOffset;
+// interrupts
+static int bMIE = 1, bInISR, bTaken;
+static uint64_t u64IRQEnabled, u64IRQPending;
+// GPIO
+static uint8_t u8Driven[4], u8DriveLevel[4], u8LastIn[4];
+static struct {
+	uint64_t u64At;
+	uint8_t u8Pin, u8Level;
+} pinEvents[HOST_PIN_EVENTS];
+static int iPinEvents;
+static EXTI_TypeDef extiShadow;
+static uint32_t u32Remap;
+static int bWakeEvent;
+// I2C1
+static HOST_I2C_DEVICE *pI2CCur;
+static int bI2CRead, iI2CSpeed = 100000;
+static uint32_t u32Polls;
+// TIM1 / TIM2
+static uint64_t u64Tim1Cycles, u64Tim2Cycles;
+// the compare values in effect (TIM1 CH3, CH4, TIM2 CH1); with preload on,
+// a write to CHxCVR only gets here at the next update event
+static uint16_t u16Shadow[3];
+// USART1 / DMA1 channel 4
+static uint32_t u32Baud = 115200;
+static uint64_t u64TxNs; // progress of the current DMA block
+static uint8_t u8Rx[HOST_RX_SIZE];
+static int iRxHead, iRxTail;
+static uint64_t u64RxNs; // progress of the byte being received
+// ADC, FLASH, PWR
+static int iVDD = 3300;
+static int bFlashLocked = 1, bFastLocked = 1;
+static uint32_t u32FlashBuf[16];
+
+static void hostFault(const char *szMsg)
+{
+	if (hooks.pfnFault) {
+		hooks.pfnFault(szMsg);
+		return;
+	}
+	fprintf(stderr, "host: %s (at %llu us)\n", szMsg, (unsigned long long)(u64Now / 1000));
+	abort();
+} /* hostFault() */
+
+static int hostClockOn(volatile uint32_t *pReg, uint32_t u32Bit)
+{
+	return (*pReg & u32Bit) != 0;
+} /* hostClockOn() */
+
+#define RCC_ON(reg, bit) hostClockOn(&RCC->reg, bit)
+
+static uint64_t hostCyclesToNs(uint64_t u64Cycles)
+{
+	// in two parts, so hours of simulated time don't overflow
+	return (u64Cycles / SystemCoreClock) * NS_PER_SEC +
+		((u64Cycles % SystemCoreClock) * NS_PER_SEC + SystemCoreClock - 1) / SystemCoreClock;
+} /* hostCyclesToNs() */
+
+static uint64_t hostNsToCycles(uint64_t u64Ns)
+{
+	return (u64Ns / NS_PER_SEC) * SystemCoreClock + ((u64Ns % NS_PER_SEC) * SystemCoreClock) / NS_PER_SEC;
+} /* hostNsToCycles() */
+
+static uint64_t hostByteNs(void)
+{
+	return (10 * NS_PER_SEC) / u32Baud; // start + 8 data + stop
+} /* hostByteNs() */
+
+//
+// SysTick counts HCLK/8 while the core clock runs
+//
+static uint32_t hostSysTickCount(void)
+{
+	return (uint32_t)((int64_t)(hostNsToCycles(u64RunNs) >> 3) + i64SysTickOffset);
+} /* hostSysTickCount() */
+
+static uint64_t hostTim1Period(void)
+{
+	return (uint64_t)(TIM1->PSC + 1) * (TIM1->ATRLR + 1) * ((TIM1->RPTCR & 0xff) + 1);
+} /* hostTim1Period() */
+
+// An update event: the preloaded compare values take effect
+static void hostTimUpdate(TIM_TypeDef *TIMx)
+{
+	if (TIMx == TIM1) {
+		u16Shadow[0] = (uint16_t)TIM1->CH3CVR;
+		u16Shadow[1] = (uint16_t)TIM1->CH4CVR;
+	} else {
+		u16Shadow[2] = (uint16_t)TIM2->CH1CVR;
+	}
+} /* hostTimUpdate() */
+
+static int hostTxActive(void)
+{
+	return (DMA1_Channel4->CFGR & DMA_CFG4_EN) && DMA1_Channel4->CNTR &&
+		RCC_ON(AHBPCENR, RCC_AHBPeriph_DMA1) && RCC_ON(APB2PCENR, RCC_APB2Periph_USART1) &&
+		(USART1->CTLR1 & USART_CTLR1_UE) && (USART1->CTLR1 & USART_Mode_Tx) &&
+		(USART1->CTLR3 & USART_DMAReq_Tx);
+} /* hostTxActive() */
+
+static int hostRxActive(void)
+{
+	return iRxHead != iRxTail && RCC_ON(APB2PCENR, RCC_APB2Periph_USART1) &&
+		(USART1->CTLR1 & USART_CTLR1_UE) && (USART1->CTLR1 & USART_Mode_Rx);
+} /* hostRxActive() */
+
+//
+// EXTI: INTFR is write-1-to-clear on the chip. The copy handed to the
+// firmware carries an extra (unused) bit, so a store to it can be told
+// from a value that was only read.
+//
+static void hostEXTICommit(void)
+{
+	EXTI_TypeDef *pExti = HOST_EXTI;
+
+	pExti->INTENR = extiShadow.INTENR;
+	pExti->EVENR = extiShadow.EVENR;
+	pExti->RTENR = extiShadow.RTENR;
+	pExti->FTENR = extiShadow.FTENR;
+	if (!(extiShadow.INTFR & EXTI_UNTOUCHED))
+		pExti->INTFR &= ~extiShadow.INTFR;
+} /* hostEXTICommit() */
+
+static void hostEXTIPublish(void)
+{
+	EXTI_TypeDef *pExti = HOST_EXTI;
+
+	extiShadow.INTENR = pExti->INTENR;
+	extiShadow.EVENR = pExti->EVENR;
+	extiShadow.RTENR = pExti->RTENR;
+	extiShadow.FTENR = pExti->FTENR;
+	extiShadow.INTFR = pExti->INTFR | EXTI_UNTOUCHED;
+} /* hostEXTIPublish() */
+
+//
+// Interrupt request lines, from the peripheral flags
+//
+static int hostIRQLine(int iIRQ)
+{
+	switch (iIRQ) {
+	case SysTicK_IRQn:
+		return (systick.SR & 1) && (systick.CTLR & 2);
+	case EXTI7_0_IRQn:
+		hostEXTICommit(); // the last stores to the firmware's copy take effect now, as on the chip
+		hostEXTIPublish();
+		return (HOST_EXTI->INTFR & HOST_EXTI->INTENR & 0xff) != 0;
+	case DMA1_Channel4_IRQn:
+		return (DMA1->INTFR & DMA1_IT_TC4) && (DMA1_Channel4->CFGR & DMA_IT_TC);
+	case USART1_IRQn:
+		return (USART1->STATR & USART1->CTLR1 & (USART_STATR_TC | USART_STATR_RXNE)) != 0;
+	case TIM1_UP_IRQn:
+		return (TIM1->INTFR & TIM1->DMAINTENR & TIM_IT_Update) != 0;
+	}
+	return 0;
+} /* hostIRQLine() */
+
+extern void SysTick_Handler(void) __attribute__((weak));
+extern void EXTI7_0_IRQHandler(void) __attribute__((weak));
+extern void DMA1_Channel4_IRQHandler(void) __attribute__((weak));
+extern void USART1_IRQHandler(void) __attribute__((weak));
+extern void TIM1_UP_IRQHandler(void) __attribute__((weak));
+
+static void (*hostHandler(int iIRQ))(void)
+{
+	switch (iIRQ) {
+	case SysTicK_IRQn: return SysTick_Handler;
+	case EXTI7_0_IRQn: return EXTI7_0_IRQHandler;
+	case DMA1_Channel4_IRQn: return DMA1_Channel4_IRQHandler;
+	case USART1_IRQn: return USART1_IRQHandler;
+	case TIM1_UP_IRQn: return TIM1_UP_IRQHandler;
+	}
+	return NULL;
+} /* hostHandler() */
+
+// lowest numbered enabled request, or -1
+static int hostNextIRQ(void)
+{
+	int i;
+
+	for (i=0; i<IRQ_COUNT; i++) {
+		if (!(u64IRQEnabled & (1ULL << i)))
+			continue;
+		if ((u64IRQPending & (1ULL << i)) || hostIRQLine(i))
+			return i;
+	}
+	return -1;
+} /* hostNextIRQ() */
+
+static void hostDispatch(void)
+{
+	int i, iCount = 0;
+	void (*pfn)(void);
+	char szMsg[64];
+
+	if (!bMIE || bInISR)
+		return;
+	while ((i = hostNextIRQ()) >= 0) {
+		u64IRQPending &= ~(1ULL << i);
+		pfn = hostHandler(i);
+		if (++iCount > HOST_IRQ_LOOP || pfn == NULL) {
+			snprintf(szMsg, sizeof(szMsg), "IRQ %d %s", i, pfn ? "never clears its flag" : "has no handler");
+			hostFault(szMsg);
+			return;
+		}
+		bInISR = 1;
+		bMIE = 0;
+		pfn();
+		bMIE = 1;
+		bInISR = 0;
+		bTaken = 1;
+	}
+} /* hostDispatch() */
+
+//
+// GPIO: fold the set/reset register writes into OUTDR, then work out
+// the input levels and the EXTI edges
+//
+static int hostPinLevel(GPIO_TypeDef *pPort, int iPort, int iBit)
+{
+	uint32_t u32Cfg = (pPort->CFGLR >> (iBit * 4)) & 0xf;
+
+	if (u32Cfg & 3) // output
+		return (pPort->OUTDR >> iBit) & 1;
+	if (u8Driven[iPort] & (1 << iBit))
+		return (u8DriveLevel[iPort] >> iBit) & 1;
+	if ((u32Cfg >> 2) == 2) // pull-up/down
+		return (pPort->OUTDR >> iBit) & 1;
+	return (u8LastIn[iPort] >> iBit) & 1; // floating; keeps its last level
+} /* hostPinLevel() */
+
+static void hostPinEdges(int iPort, uint8_t u8Old, uint8_t u8New)
+{
+	EXTI_TypeDef *pExti = HOST_EXTI;
+	uint32_t u32Line;
+	int i;
+
+	for (i=0; i<8; i++) {
+		u32Line = 1 << i;
+		if (!((u8Old ^ u8New) & u32Line) || ((AFIO->EXTICR >> (i * 2)) & 3) != (uint32_t)iPort)
+			continue;
+		if (((u8New & u32Line) && (pExti->RTENR & u32Line)) || (!(u8New & u32Line) && (pExti->FTENR & u32Line))) {
+			pExti->INTFR |= u32Line;
+			if (pExti->EVENR & u32Line)
+				bWakeEvent = 1; // ends standby
+		}
+	}
+} /* hostPinEdges() */
+
+uintptr_t hostGPIOSync(void)
+{
+	GPIO_TypeDef *pPort;
+	uint8_t u8In;
+	int i, j, iPort;
+
+	for (i=0; i<3; i++) {
+		iPort = u8PortIndex[i];
+		pPort = HOST_GPIO(iPort);
+		if (pPort->BSHR) {
+			pPort->OUTDR = (pPort->OUTDR | (pPort->BSHR & 0xffff)) & ~(pPort->BSHR >> 16);
+			pPort->BSHR = 0;
+		}
+		if (pPort->BCR) {
+			pPort->OUTDR &= ~pPort->BCR;
+			pPort->BCR = 0;
+		}
+		u8In = 0;
+		for (j=0; j<8; j++)
+			u8In |= hostPinLevel(pPort, iPort, j) << j;
+		pPort->INDR = u8In;
+		if (u8In != u8LastIn[iPort]) {
+			hostEXTICommit(); // a flag the firmware cleared must not take the new edge with it
+			hostPinEdges(iPort, u8LastIn[iPort], u8In);
+			hostEXTIPublish();
+			u8LastIn[iPort] = u8In;
+		}
+	}
+	return APB2PERIPH_BASE + 0x0800;
+} /* hostGPIOSync() */
+
+static GPIO_TypeDef *hostPort(uint8_t u8Pin)
+{
+	hostGPIOSync();
+	return HOST_GPIO((u8Pin >> 4) - 0xa);
+} /* hostPort() */
+
+EXTI_TypeDef *hostEXTI(void)
+{
+	hostEXTICommit();
+	hostGPIOSync();
+	hostEXTIPublish();
+	return &extiShadow;
+} /* hostEXTI() */
+
+//
+// Time
+//
+static void hostSetPower(int iState)
+{
+	if (iState == iPower)
+		return;
+	if (iPower != HOST_RUN && iState == HOST_RUN)
+		stats.u32Wakes++;
+	iPower = iState;
+	if (hooks.pfnPower)
+		hooks.pfnPower(iState, u64Now);
+} /* hostSetPower() */
+
+// let u64Ns pass with nothing happening in between
+static void hostElapse(uint64_t u64Ns)
+{
+	uint64_t u64Period;
+	uint32_t u32Before, u32Ticks;
+
+	if (u64Ns == 0)
+		return;
+	u64Now += u64Ns;
+	if (iPower == HOST_STANDBY) {
+		stats.u64StandbyNs += u64Ns;
+		return; // the clocks are stopped
+	}
+	if (iPower == HOST_SLEEP)
+		stats.u64SleepNs += u64Ns;
+	else
+		stats.u64RunNs += u64Ns;
+	u32Before = hostSysTickCount();
+	u64RunNs += u64Ns;
+	if ((systick.CTLR & 3) == 3 && !(systick.SR & 1)) { // compare match on the way?
+		u32Ticks = systick.CMP - u32Before;
+		if (u32Ticks != 0 && u32Ticks <= hostSysTickCount() - u32Before)
+			systick.SR |= 1;
+	}
+	if (RCC_ON(APB2PCENR, RCC_APB2Periph_TIM1) && (TIM1->CTLR1 & TIM_CEN)) {
+		u64Tim1Cycles += hostNsToCycles(u64Ns);
+		u64Period = hostTim1Period();
+		if (u64Tim1Cycles >= u64Period) {
+			TIM1->INTFR |= TIM_IT_Update;
+			hostTimUpdate(TIM1);
+			u64Tim1Cycles %= u64Period;
+		}
+	}
+	if (RCC_ON(APB1PCENR, RCC_APB1Periph_TIM2) && (TIM2->CTLR1 & TIM_CEN)) {
+		u64Tim2Cycles += hostNsToCycles(u64Ns);
+		u64Period = (uint64_t)(TIM2->PSC + 1) * (TIM2->ATRLR + 1);
+		if (u64Tim2Cycles >= u64Period) {
+			hostTimUpdate(TIM2);
+			u64Tim2Cycles %= u64Period;
+		}
+	}
+	if (hostTxActive())
+		u64TxNs += u64Ns;
+	if (hostRxActive())
+		u64RxNs += u64Ns;
+	else if (iRxHead != iRxTail) { // the USART is off; the bytes are lost
+		iRxTail = iRxHead;
+		u64RxNs = 0;
+	}
+} /* hostElapse() */
+
+//
+// Time until the next thing that can set an interrupt flag, or 0 if none
+//
+static uint64_t hostNextEvent(void)
+{
+	uint64_t u64Best = 0, u64Ns, u64Ticks;
+	int i;
+
+#define CANDIDATE(t) { u64Ns = (t); if (u64Ns == 0) u64Ns = 1; if (u64Best == 0 || u64Ns < u64Best) u64Best = u64Ns; }
+	for (i=0; i<iPinEvents; i++)
+		CANDIDATE(pinEvents[i].u64At > u64Now ? pinEvents[i].u64At - u64Now : 1);
+	if (iPower == HOST_STANDBY)
+		return u64Best;
+	if ((systick.CTLR & 3) == 3 && !(systick.SR & 1)) {
+		u64Ticks = (uint32_t)(systick.CMP - hostSysTickCount());
+		if (u64Ticks == 0)
+			u64Ticks = 1ULL << 32;
+		// to the start of that tick
+		CANDIDATE(hostCyclesToNs(((hostNsToCycles(u64RunNs) >> 3) + u64Ticks) << 3) - u64RunNs);
+	}
+	if (RCC_ON(APB2PCENR, RCC_APB2Periph_TIM1) && (TIM1->CTLR1 & TIM_CEN) && (TIM1->DMAINTENR & TIM_IT_Update))
+		CANDIDATE(hostCyclesToNs(hostTim1Period() - u64Tim1Cycles));
+	if (hostTxActive()) {
+		u64Ns = DMA1_Channel4->CNTR * hostByteNs();
+		CANDIDATE(u64Ns > u64TxNs ? u64Ns - u64TxNs : 1);
+	}
+	if (hostRxActive())
+		CANDIDATE(hostByteNs() > u64RxNs ? hostByteNs() - u64RxNs : 1);
+	return u64Best;
+#undef CANDIDATE
+} /* hostNextEvent() */
+
+// complete whatever is due now
+static void hostEvents(void)
+{
+	uint8_t *pSrc;
+	int i, n;
+
+	for (i=0; i<iPinEvents; i++) {
+		if (pinEvents[i].u64At <= u64Now) {
+			hostSetPin(pinEvents[i].u8Pin, pinEvents[i].u8Level);
+			pinEvents[i] = pinEvents[--iPinEvents];
+			i--;
+		}
+	}
+	if (iPower == HOST_STANDBY)
+		return;
+	if (hostTxActive() && u64TxNs >= DMA1_Channel4->CNTR * hostByteNs()) {
+		pSrc = (uint8_t *)(uintptr_t)DMA1_Channel4->MADDR;
+		n = (int)DMA1_Channel4->CNTR;
+		for (i=0; i<n; i++) {
+			stats.u32UartBytes++;
+			if (hooks.pfnUart)
+				hooks.pfnUart(pSrc[i]);
+		}
+		DMA1_Channel4->CNTR = 0;
+		DMA1->INTFR |= DMA1_IT_TC4 | DMA1_IT_GL4;
+		USART1->STATR |= USART_FLAG_TC | USART_FLAG_TXE; // the last byte has left too
+		u64TxNs = 0;
+	}
+	if (hostRxActive() && u64RxNs >= hostByteNs()) {
+		if (USART1->STATR & USART_FLAG_RXNE)
+			USART1->STATR |= USART_FLAG_ORE; // the previous one wasn't read; drop this one
+		else {
+			USART1->DATAR = u8Rx[iRxTail];
+			USART1->STATR |= USART_FLAG_RXNE;
+		}
+		iRxTail = (iRxTail + 1) & (HOST_RX_SIZE-1);
+		u64RxNs = 0;
+	}
+} /* hostEvents() */
+
+//
+// Move time forward by u64Ns, completing the events on the way and
+// running the interrupt handlers (if enabled)
+//
+static void hostRun(uint64_t u64Ns)
+{
+	uint64_t u64Next;
+
+	while (1) {
+		hostGPIOSync();
+		hostEvents();
+		hostDispatch();
+		u64Next = hostNextEvent();
+		if (u64Next == 0 || u64Next > u64Ns)
+			break;
+		hostElapse(u64Next);
+		u64Ns -= u64Next;
+	}
+	hostElapse(u64Ns);
+	hostEvents();
+	hostDispatch();
+} /* hostRun() */
+
+void hostAdvance(uint64_t u64Ns)
+{
+	int iOld = iPower;
+
+	hostSetPower(HOST_SLEEP);
+	hostRun(u64Ns);
+	hostSetPower(iOld);
+} /* hostAdvance() */
+
+uint64_t hostNanos(void)
+{
+	return u64Now;
+} /* hostNanos() */
+
+SysTick_Type *hostSysTick(void)
+{
+	if (systick.CNT != u32SysTickPublished) // the firmware wrote the counter
+		i64SysTickOffset += (int64_t)systick.CNT - (int64_t)hostSysTickCount();
+	hostRun(hostCyclesToNs(HOST_POLL_CYCLES));
+	systick.CNT = u32SysTickPublished = hostSysTickCount();
+	return &systick;
+} /* hostSysTick() */
+
+//
+// Core
+//
+void hostEnableIRQ(int iIRQ, int bEnable)
+{
+	if (bEnable) {
+		u64IRQEnabled |= (1ULL << iIRQ);
+		hostDispatch();
+	} else {
+		u64IRQEnabled &= ~(1ULL << iIRQ);
+	}
+} /* hostEnableIRQ() */
+
+int hostIRQEnabled(int iIRQ)
+{
+	return (u64IRQEnabled >> iIRQ) & 1;
+} /* hostIRQEnabled() */
+
+void hostSetPendingIRQ(int iIRQ, int bPending)
+{
+	if (bPending) {
+		u64IRQPending |= (1ULL << iIRQ);
+		hostDispatch();
+	} else {
+		u64IRQPending &= ~(1ULL << iIRQ);
+	}
+} /* hostSetPendingIRQ() */
+
+void hostGlobalIRQ(int bEnable)
+{
+	if (bInISR) // handlers run with interrupts masked and return to that
+		return;
+	bMIE = bEnable;
+	hostDispatch();
+} /* hostGlobalIRQ() */
+
+uint32_t __get_MSTATUS(void)
+{
+	return bMIE ? 0x88 : 0;
+} /* __get_MSTATUS() */
+
+void __set_MSTATUS(uint32_t value)
+{
+	hostGlobalIRQ((value & 0x8) != 0);
+} /* __set_MSTATUS() */
+
+uint32_t __get_SP(void)
+{
+	return 0;
+} /* __get_SP() */
+
+//
+// Sleep until an enabled interrupt is requested (it may be masked)
+//
+void hostWFI(void)
+{
+	uint64_t u64Next;
+
+	if (bInISR)
+		return;
+	hostSetPower(HOST_SLEEP);
+	bTaken = 0;
+	while (hostNextIRQ() < 0 && !bTaken) {
+		u64Next = hostNextEvent();
+		if (u64Next == 0) {
+			hostFault("WFI with nothing left to wake the core");
+			break;
+		}
+		hostRun(u64Next);
+	}
+	hostSetPower(HOST_RUN);
+} /* hostWFI() */
+
+void hostSystemReset(void)
+{
+	hostFault("NVIC_SystemReset()");
+} /* hostSystemReset() */
+
+void SystemInit(void)
+{
+} /* SystemInit() */
+
+void SystemCoreClockUpdate(void)
+{
+} /* SystemCoreClockUpdate() */
+
+//
+// Test side
+//
+void hostSetHooks(const HOST_HOOKS *pHooks)
+{
+	if (pHooks)
+		hooks = *pHooks;
+	else
+		memset(&hooks, 0, sizeof(hooks));
+} /* hostSetHooks() */
+
+void hostGetStats(HOST_STATS *pStats)
+{
+	*pStats = stats;
+} /* hostGetStats() */
+
+void hostReset(void)
+{
+	int i;
+
+	memset(u32HostPeriph, 0, sizeof(u32HostPeriph));
+	for (i=0; i<4; i++)
+		HOST_GPIO(i)->CFGLR = 0x44444444; // floating inputs
+	memset(&systick, 0, sizeof(systick));
+	memset(&stats, 0, sizeof(stats));
+	memset(&extiShadow, 0, sizeof(extiShadow));
+	memset(u8Driven, 0, sizeof(u8Driven));
+	memset(u8DriveLevel, 0, sizeof(u8DriveLevel));
+	memset(u8LastIn, 0, sizeof(u8LastIn));
+	u32SysTickPublished = 0;
+	i64SysTickOffset = 0;
+	u64Now = u64RunNs = 0;
+	iPower = HOST_RUN;
+	bMIE = 1;
+	bInISR = bTaken = 0;
+	u64IRQEnabled = u64IRQPending = 0;
+	iPinEvents = 0;
+	u32Remap = 0;
+	pI2CCur = NULL;
+	iI2CSpeed = 100000;
+	u32Polls = 0;
+	u64Tim1Cycles = 0;
+	u32Baud = 115200;
+	u64TxNs = u64RxNs = 0;
+	iRxHead = iRxTail = 0;
+	iVDD = 3300;
+	bFlashLocked = bFastLocked = 1;
+	RCC->CTLR = 0x00000083; // HSI on and ready
+	for (i=0x500/4; i<HOST_RAM_SIZE/4; i++) // painted above .bss like the startup code does
+		u32HostRAM[i] = RAM_PAINT;
+} /* hostReset() */
+
+// power-on state before the first test calls hostReset()
+__attribute__((constructor)) static void hostPowerOn(void)
+{
+	memset(u8HostFlash, 0xff, sizeof(u8HostFlash));
+	hostReset();
+} /* hostPowerOn() */
+
+uint8_t *hostFlash(void)
+{
+	return u8HostFlash;
+} /* hostFlash() */
+
+uint32_t *hostRAM(void)
+{
+	return u32HostRAM;
+} /* hostRAM() */
+
+void hostSetPin(uint8_t u8Pin, int iLevel)
+{
+	int iPort = (u8Pin >> 4) - 0xa;
+
+	u8Driven[iPort] |= (1 << (u8Pin & 7));
+	if (iLevel)
+		u8DriveLevel[iPort] |= (1 << (u8Pin & 7));
+	else
+		u8DriveLevel[iPort] &= ~(1 << (u8Pin & 7));
+	hostGPIOSync();
+	hostDispatch();
+} /* hostSetPin() */
+
+void hostReleasePin(uint8_t u8Pin)
+{
+	u8Driven[(u8Pin >> 4) - 0xa] &= ~(1 << (u8Pin & 7));
+	hostGPIOSync();
+	hostDispatch();
+} /* hostReleasePin() */
+
+void hostSchedulePin(uint8_t u8Pin, int iLevel, uint64_t u64AtNs)
+{
+	if (iPinEvents >= HOST_PIN_EVENTS) {
+		hostFault("too many scheduled pin changes");
+		return;
+	}
+	pinEvents[iPinEvents].u8Pin = u8Pin;
+	pinEvents[iPinEvents].u8Level = (uint8_t)iLevel;
+	pinEvents[iPinEvents].u64At = u64AtNs;
+	iPinEvents++;
+} /* hostSchedulePin() */
+
+int hostGetPin(uint8_t u8Pin)
+{
+	return (hostPort(u8Pin)->INDR >> (u8Pin & 7)) & 1;
+} /* hostGetPin() */
+
+int hostGetPwm(uint8_t u8Pin)
+{
+	TIM_TypeDef *pTim;
+	volatile uint32_t *pCompare;
+	uint16_t u16Enable, u16Preload;
+	int iCompare, bOn, bClock;
+
+	switch (u8Pin) {
+	case 0xc3: // TIM1 CH3
+		pTim = TIM1; pCompare = &TIM1->CH3CVR; u16Enable = TIM_CC3E;
+		u16Preload = TIM1->CHCTLR2 & 0x0008; iCompare = u16Shadow[0];
+		bOn = (TIM1->BDTR & TIM_MOE) != 0;
+		bClock = RCC_ON(APB2PCENR, RCC_APB2Periph_TIM1);
+		break;
+	case 0xc4: // TIM1 CH4
+		pTim = TIM1; pCompare = &TIM1->CH4CVR; u16Enable = TIM_CC4E;
+		u16Preload = TIM1->CHCTLR2 & 0x0800; iCompare = u16Shadow[1];
+		bOn = (TIM1->BDTR & TIM_MOE) != 0;
+		bClock = RCC_ON(APB2PCENR, RCC_APB2Periph_TIM1);
+		break;
+	case 0xc5: // TIM2 CH1 with partial remap 1
+		pTim = TIM2; pCompare = &TIM2->CH1CVR; u16Enable = TIM_CC1E;
+		u16Preload = TIM2->CHCTLR1 & 0x0008; iCompare = u16Shadow[2];
+		bOn = (u32Remap & GPIO_PartialRemap1_TIM2) == GPIO_PartialRemap1_TIM2;
+		bClock = RCC_ON(APB1PCENR, RCC_APB1Periph_TIM2);
+		break;
+	default:
+		return -1;
+	}
+	if (!bOn || !(pTim->CCER & u16Enable) ||
+		((hostPort(u8Pin)->CFGLR >> ((u8Pin & 7) * 4)) & 0xc) != 0x8) // not an AF output
+		return -1;
+	if (!u16Preload)
+		iCompare = (int)*pCompare;
+	if (bClock && (pTim->CTLR1 & TIM_CEN))
+		return iCompare;
+	// a stopped (or unclocked) timer holds its output where it was; the
+	// counter isn't modelled, so anything but a 0 compare is taken as stuck on
+	return iCompare ? (int)pTim->ATRLR : 0;
+} /* hostGetPwm() */
+
+void hostI2CAttach(HOST_I2C_DEVICE *pDev)
+{
+	pDev->pNext = pI2CDevices;
+	pI2CDevices = pDev;
+} /* hostI2CAttach() */
+
+void hostI2CDetach(HOST_I2C_DEVICE *pDev)
+{
+	HOST_I2C_DEVICE **pp;
+
+	for (pp = &pI2CDevices; *pp; pp = &(*pp)->pNext) {
+		if (*pp == pDev) {
+			*pp = pDev->pNext;
+			break;
+		}
+	}
+	if (pI2CCur == pDev)
+		pI2CCur = NULL;
+} /* hostI2CDetach() */
+
+int hostI2CSpeed(void)
+{
+	return iI2CSpeed;
+} /* hostI2CSpeed() */
+
+void hostUartReceive(const uint8_t *pData, int iLen)
+{
+	while (iLen-- > 0) {
+		if (((iRxHead + 1) & (HOST_RX_SIZE-1)) == iRxTail)
+			break;
+		u8Rx[iRxHead] = *pData++;
+		iRxHead = (iRxHead + 1) & (HOST_RX_SIZE-1);
+	}
+} /* hostUartReceive() */
+
+void hostSetVDD(int iMilliVolts)
+{
+	iVDD = iMilliVolts;
+} /* hostSetVDD() */
+
+//
+// The peripheral library calls used by the firmware
+//
+
+// GPIO / AFIO / EXTI
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_InitStruct)
+{
+	uint32_t u32Cfg = GPIO_InitStruct->GPIO_Mode & 0xf;
+	int i;
+
+	hostGPIOSync();
+	if (GPIO_InitStruct->GPIO_Mode & 0x10) // output
+		u32Cfg |= GPIO_InitStruct->GPIO_Speed;
+	for (i=0; i<8; i++) {
+		if (!(GPIO_InitStruct->GPIO_Pin & (1 << i)))
+			continue;
+		GPIOx->CFGLR = (GPIOx->CFGLR & ~(0xf << (i * 4))) | (u32Cfg << (i * 4));
+		if (GPIO_InitStruct->GPIO_Mode == GPIO_Mode_IPD)
+			GPIOx->OUTDR &= ~(1 << i);
+		else if (GPIO_InitStruct->GPIO_Mode == GPIO_Mode_IPU)
+			GPIOx->OUTDR |= (1 << i);
+	}
+	hostGPIOSync();
+} /* GPIO_Init() */
+
+void GPIO_DeInit(GPIO_TypeDef *GPIOx)
+{
+	hostGPIOSync();
+	GPIOx->CFGLR = 0x44444444;
+	GPIOx->OUTDR = 0;
+	hostGPIOSync();
+} /* GPIO_DeInit() */
+
+void GPIO_EXTILineConfig(uint8_t GPIO_PortSource, uint8_t GPIO_PinSource)
+{
+	AFIO->EXTICR = (AFIO->EXTICR & ~(3 << (GPIO_PinSource * 2))) | ((uint32_t)GPIO_PortSource << (GPIO_PinSource * 2));
+} /* GPIO_EXTILineConfig() */
+
+void GPIO_PinRemapConfig(uint32_t GPIO_Remap, FunctionalState NewState)
+{
+	if (NewState)
+		u32Remap |= GPIO_Remap;
+	else
+		u32Remap &= ~GPIO_Remap;
+} /* GPIO_PinRemapConfig() */
+
+void EXTI_Init(EXTI_InitTypeDef *EXTI_InitStruct)
+{
+	EXTI_TypeDef *pExti = HOST_EXTI;
+	uint32_t u32Line = EXTI_InitStruct->EXTI_Line;
+
+	hostEXTICommit();
+	pExti->INTENR &= ~u32Line;
+	pExti->EVENR &= ~u32Line;
+	if (EXTI_InitStruct->EXTI_LineCmd) {
+		if (EXTI_InitStruct->EXTI_Mode == EXTI_Mode_Interrupt)
+			pExti->INTENR |= u32Line;
+		else
+			pExti->EVENR |= u32Line;
+		pExti->RTENR &= ~u32Line;
+		pExti->FTENR &= ~u32Line;
+		if (EXTI_InitStruct->EXTI_Trigger != EXTI_Trigger_Falling)
+			pExti->RTENR |= u32Line;
+		if (EXTI_InitStruct->EXTI_Trigger != EXTI_Trigger_Rising)
+			pExti->FTENR |= u32Line;
+	}
+	hostEXTIPublish();
+} /* EXTI_Init() */
+
+// RCC / misc
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState)
+{
+	if (NewState)
+		RCC->AHBPCENR |= RCC_AHBPeriph;
+	else
+		RCC->AHBPCENR &= ~RCC_AHBPeriph;
+} /* RCC_AHBPeriphClockCmd() */
+
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState)
+{
+	if (NewState)
+		RCC->APB1PCENR |= RCC_APB1Periph;
+	else
+		RCC->APB1PCENR &= ~RCC_APB1Periph;
+} /* RCC_APB1PeriphClockCmd() */
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+	if (NewState)
+		RCC->APB2PCENR |= RCC_APB2Periph;
+	else
+		RCC->APB2PCENR &= ~RCC_APB2Periph;
+} /* RCC_APB2PeriphClockCmd() */
+
+void RCC_LSICmd(FunctionalState NewState)
+{
+	if (NewState)
+		RCC->RSTSCKR |= 3; // on and ready
+	else
+		RCC->RSTSCKR &= ~3;
+} /* RCC_LSICmd() */
+
+FlagStatus RCC_GetFlagStatus(uint8_t RCC_FLAG)
+{
+	(void)RCC_FLAG;
+	return SET; // the oscillators are ready at once
+} /* RCC_GetFlagStatus() */
+
+void RCC_ADCCLKConfig(uint32_t RCC_PCLK2)
+{
+	RCC->CFGR0 = (RCC->CFGR0 & ~0xf800) | RCC_PCLK2;
+} /* RCC_ADCCLKConfig() */
+
+void NVIC_PriorityGroupConfig(uint32_t NVIC_PriorityGroup)
+{
+	(void)NVIC_PriorityGroup;
+} /* NVIC_PriorityGroupConfig() */
+
+// I2C1: a transaction is run against the attached devices byte by byte
+static void hostI2CBus(int iEvent, uint8_t u8Data, int bAck, int iBits)
+{
+	uint64_t u64Ns = ((uint64_t)iBits * NS_PER_SEC) / iI2CSpeed;
+
+	if (!RCC_ON(APB1PCENR, RCC_APB1Periph_I2C1) || !(I2C1->CTLR1 & I2C_CTLR1_PE))
+		hostFault("I2C1 used while its clock or the peripheral is off");
+	if (hooks.pfnI2C)
+		hooks.pfnI2C(iEvent, u8Data, bAck, u64Now);
+	if (iEvent == HOST_I2C_START)
+		stats.u32I2CTransactions++;
+	else if (iEvent != HOST_I2C_STOP)
+		stats.u32I2CBytes++;
+	stats.u64I2CNs += u64Ns;
+	hostRun(u64Ns);
+} /* hostI2CBus() */
+
+// the firmware polls until a flag changes; catch the ones that never will
+static void hostI2CPoll(int bMatch)
+{
+	if (bMatch) {
+		u32Polls = 0;
+	} else if (++u32Polls == HOST_HANG_POLLS) {
+		hostFault("I2C1 status never changes (no ACK?)");
+		u32Polls = 0;
+	}
+} /* hostI2CPoll() */
+
+void I2C_Init(I2C_TypeDef *I2Cx, I2C_InitTypeDef *I2C_InitStruct)
+{
+	iI2CSpeed = (int)I2C_InitStruct->I2C_ClockSpeed;
+	if (iI2CSpeed <= 0)
+		iI2CSpeed = 100000;
+	I2Cx->OADDR1 = I2C_InitStruct->I2C_OwnAddress1;
+} /* I2C_Init() */
+
+void I2C_Cmd(I2C_TypeDef *I2Cx, FunctionalState NewState)
+{
+	if (NewState)
+		I2Cx->CTLR1 |= I2C_CTLR1_PE;
+	else
+		I2Cx->CTLR1 &= ~I2C_CTLR1_PE;
+} /* I2C_Cmd() */
+
+void I2C_AcknowledgeConfig(I2C_TypeDef *I2Cx, FunctionalState NewState)
+{
+	if (NewState)
+		I2Cx->CTLR1 |= I2C_CTLR1_ACK;
+	else
+		I2Cx->CTLR1 &= ~I2C_CTLR1_ACK;
+} /* I2C_AcknowledgeConfig() */
+
+void I2C_GenerateSTART(I2C_TypeDef *I2Cx, FunctionalState NewState)
+{
+	if (!NewState)
+		return;
+	hostI2CBus(HOST_I2C_START, 0, 1, 1);
+	pI2CCur = NULL;
+	I2Cx->STAR1 = I2C_STAR1_SB;
+	I2Cx->STAR2 = I2C_STAR2_BUSY | I2C_STAR2_MSL;
+} /* I2C_GenerateSTART() */
+
+void I2C_GenerateSTOP(I2C_TypeDef *I2Cx, FunctionalState NewState)
+{
+	if (!NewState)
+		return;
+	if (pI2CCur && pI2CCur->pfnStop)
+		pI2CCur->pfnStop(pI2CCur);
+	pI2CCur = NULL;
+	hostI2CBus(HOST_I2C_STOP, 0, 1, 1);
+	I2Cx->STAR1 &= I2C_STAR1_TXE; // I2CTest() looks at it after the STOP
+	I2Cx->STAR2 = 0;
+} /* I2C_GenerateSTOP() */
+
+void I2C_Send7bitAddress(I2C_TypeDef *I2Cx, uint8_t Address, uint8_t I2C_Direction)
+{
+	HOST_I2C_DEVICE *pDev;
+	int bAck = 0;
+
+	Address = (Address & 0xfe) | I2C_Direction;
+	for (pDev = pI2CDevices; pDev; pDev = pDev->pNext) {
+		if (pDev->u8Addr == (Address >> 1))
+			break;
+	}
+	if (pDev)
+		bAck = pDev->pfnStart ? pDev->pfnStart(pDev, I2C_Direction) : 1;
+	hostI2CBus(HOST_I2C_ADDR, Address, bAck, 9);
+	bI2CRead = I2C_Direction;
+	if (bAck) {
+		pI2CCur = pDev;
+		I2Cx->STAR1 = I2C_STAR1_ADDR | (bI2CRead ? 0 : I2C_STAR1_TXE);
+		I2Cx->STAR2 = I2C_STAR2_BUSY | I2C_STAR2_MSL | (bI2CRead ? 0 : I2C_STAR2_TRA);
+	} else {
+		I2Cx->STAR1 = I2C_STAR1_AF;
+	}
+} /* I2C_Send7bitAddress() */
+
+void I2C_SendData(I2C_TypeDef *I2Cx, uint8_t Data)
+{
+	int bAck = 0;
+
+	if (pI2CCur)
+		bAck = pI2CCur->pfnWrite ? pI2CCur->pfnWrite(pI2CCur, Data) : 1;
+	hostI2CBus(HOST_I2C_WRITE, Data, bAck, 9);
+	I2Cx->STAR1 = bAck ? (I2C_STAR1_TXE | I2C_STAR1_BTF) : I2C_STAR1_AF;
+} /* I2C_SendData() */
+
+uint8_t I2C_ReceiveData(I2C_TypeDef *I2Cx)
+{
+	I2Cx->STAR1 &= ~I2C_STAR1_RXNE;
+	return (uint8_t)I2Cx->DATAR;
+} /* I2C_ReceiveData() */
+
+// a receiver clocks the next byte in once the last one was taken
+static void hostI2CFetch(I2C_TypeDef *I2Cx)
+{
+	uint8_t u8Data;
+
+	if (!bI2CRead || pI2CCur == NULL || (I2Cx->STAR1 & I2C_STAR1_RXNE))
+		return;
+	u8Data = pI2CCur->pfnRead ? pI2CCur->pfnRead(pI2CCur) : 0xff;
+	hostI2CBus(HOST_I2C_READ, u8Data, (I2Cx->CTLR1 & I2C_CTLR1_ACK) != 0, 9);
+	I2Cx->DATAR = u8Data;
+	I2Cx->STAR1 |= I2C_STAR1_RXNE;
+} /* hostI2CFetch() */
+
+FlagStatus I2C_GetFlagStatus(I2C_TypeDef *I2Cx, uint32_t I2C_FLAG)
+{
+	FlagStatus bSet;
+
+	if (I2C_FLAG == I2C_FLAG_RXNE)
+		hostI2CFetch(I2Cx);
+	if (I2C_FLAG & 0x10000000)
+		bSet = (I2Cx->STAR1 & I2C_FLAG & 0xffff) ? SET : RESET;
+	else
+		bSet = (I2Cx->STAR2 & (I2C_FLAG >> 16)) ? SET : RESET;
+	if (I2C_FLAG != I2C_FLAG_BUSY)
+		hostI2CPoll(bSet == SET);
+	return bSet;
+} /* I2C_GetFlagStatus() */
+
+ErrorStatus I2C_CheckEvent(I2C_TypeDef *I2Cx, uint32_t I2C_EVENT)
+{
+	uint32_t u32Status = (((uint32_t)I2Cx->STAR2 << 16) | I2Cx->STAR1) & 0x00ffffff;
+	int bMatch = (u32Status & I2C_EVENT) == I2C_EVENT;
+
+	hostI2CPoll(bMatch);
+	return bMatch ? READY : NoREADY;
+} /* I2C_CheckEvent() */
+
+// TIM1 / TIM2
+void TIM_TimeBaseInit(TIM_TypeDef *TIMx, TIM_TimeBaseInitTypeDef *TIM_TimeBaseInitStruct)
+{
+	TIMx->PSC = TIM_TimeBaseInitStruct->TIM_Prescaler;
+	TIMx->ATRLR = TIM_TimeBaseInitStruct->TIM_Period;
+	TIMx->CTLR1 = (TIMx->CTLR1 & ~0x370) | TIM_TimeBaseInitStruct->TIM_CounterMode | TIM_TimeBaseInitStruct->TIM_ClockDivision;
+	if (TIMx == TIM1)
+		TIMx->RPTCR = TIM_TimeBaseInitStruct->TIM_RepetitionCounter;
+	TIM_GenerateEvent(TIMx, TIM_EventSource_Update); // as the library does, to load the prescaler
+} /* TIM_TimeBaseInit() */
+
+void TIM_GenerateEvent(TIM_TypeDef *TIMx, uint16_t TIM_EventSource)
+{
+	if (TIM_EventSource & TIM_EventSource_Update) { // the count restarts
+		TIMx->INTFR |= TIM_IT_Update;
+		hostTimUpdate(TIMx);
+		if (TIMx == TIM1)
+			u64Tim1Cycles = 0;
+		else
+			u64Tim2Cycles = 0;
+	}
+} /* TIM_GenerateEvent() */
+
+void TIM_Cmd(TIM_TypeDef *TIMx, FunctionalState NewState)
+{
+	if (NewState) {
+		if (TIMx == TIM1 && !(TIMx->CTLR1 & TIM_CEN))
+			u64Tim1Cycles = 0;
+		else if (TIMx == TIM2 && !(TIMx->CTLR1 & TIM_CEN))
+			u64Tim2Cycles = 0;
+		TIMx->CTLR1 |= TIM_CEN;
+	} else {
+		TIMx->CTLR1 &= ~TIM_CEN;
+	}
+} /* TIM_Cmd() */
+
+void TIM_ITConfig(TIM_TypeDef *TIMx, uint16_t TIM_IT, FunctionalState NewState)
+{
+	if (NewState)
+		TIMx->DMAINTENR |= TIM_IT;
+	else
+		TIMx->DMAINTENR &= ~TIM_IT;
+	hostDispatch();
+} /* TIM_ITConfig() */
+
+void TIM_ClearITPendingBit(TIM_TypeDef *TIMx, uint16_t TIM_IT)
+{
+	TIMx->INTFR &= ~TIM_IT;
+} /* TIM_ClearITPendingBit() */
+
+void TIM_CtrlPWMOutputs(TIM_TypeDef *TIMx, FunctionalState NewState)
+{
+	if (NewState)
+		TIMx->BDTR |= TIM_MOE;
+	else
+		TIMx->BDTR &= ~TIM_MOE;
+} /* TIM_CtrlPWMOutputs() */
+
+static void hostOCInit(TIM_TypeDef *TIMx, TIM_OCInitTypeDef *pInit, int iChannel)
+{
+	volatile uint16_t *pMode = (iChannel < 2) ? &TIMx->CHCTLR1 : &TIMx->CHCTLR2;
+	int iShift = (iChannel & 1) * 8;
+
+	*pMode = (*pMode & ~(0xff << iShift)) | (pInit->TIM_OCMode << iShift);
+	TIMx->CCER &= ~(0xf << (iChannel * 4));
+	TIMx->CCER |= (pInit->TIM_OutputState | pInit->TIM_OCPolarity) << (iChannel * 4);
+} /* hostOCInit() */
+
+void TIM_OC1Init(TIM_TypeDef *TIMx, TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+	hostOCInit(TIMx, TIM_OCInitStruct, 0);
+} /* TIM_OC1Init() */
+
+void TIM_OC3Init(TIM_TypeDef *TIMx, TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+	hostOCInit(TIMx, TIM_OCInitStruct, 2);
+} /* TIM_OC3Init() */
+
+void TIM_OC4Init(TIM_TypeDef *TIMx, TIM_OCInitTypeDef *TIM_OCInitStruct)
+{
+	hostOCInit(TIMx, TIM_OCInitStruct, 3);
+} /* TIM_OC4Init() */
+
+void TIM_OC1PreloadConfig(TIM_TypeDef *TIMx, uint16_t TIM_OCPreload)
+{
+	TIMx->CHCTLR1 = (TIMx->CHCTLR1 & ~0x0008) | TIM_OCPreload;
+} /* TIM_OC1PreloadConfig() */
+
+void TIM_OC3PreloadConfig(TIM_TypeDef *TIMx, uint16_t TIM_OCPreload)
+{
+	TIMx->CHCTLR2 = (TIMx->CHCTLR2 & ~0x0008) | TIM_OCPreload;
+} /* TIM_OC3PreloadConfig() */
+
+void TIM_OC4PreloadConfig(TIM_TypeDef *TIMx, uint16_t TIM_OCPreload)
+{
+	TIMx->CHCTLR2 = (TIMx->CHCTLR2 & ~0x0800) | (TIM_OCPreload << 8);
+} /* TIM_OC4PreloadConfig() */
+
+// USART1 and its TX DMA channel
+void USART_Init(USART_TypeDef *USARTx, USART_InitTypeDef *USART_InitStruct)
+{
+	u32Baud = USART_InitStruct->USART_BaudRate ? USART_InitStruct->USART_BaudRate : 115200;
+	USARTx->BRR = (uint16_t)(SystemCoreClock / u32Baud);
+	USARTx->CTLR1 = (USARTx->CTLR1 & ~(USART_Mode_Rx | USART_Mode_Tx)) | USART_InitStruct->USART_Mode;
+	USARTx->STATR |= USART_FLAG_TC | USART_FLAG_TXE;
+} /* USART_Init() */
+
+void USART_Cmd(USART_TypeDef *USARTx, FunctionalState NewState)
+{
+	if (NewState)
+		USARTx->CTLR1 |= USART_CTLR1_UE;
+	else
+		USARTx->CTLR1 &= ~USART_CTLR1_UE;
+} /* USART_Cmd() */
+
+void USART_DMACmd(USART_TypeDef *USARTx, uint16_t USART_DMAReq, FunctionalState NewState)
+{
+	if (NewState)
+		USARTx->CTLR3 |= USART_DMAReq;
+	else
+		USARTx->CTLR3 &= ~USART_DMAReq;
+} /* USART_DMACmd() */
+
+void USART_ITConfig(USART_TypeDef *USARTx, uint16_t USART_IT, FunctionalState NewState)
+{
+	volatile uint16_t *pReg;
+	uint16_t u16Bit = 1 << (USART_IT & 0x1f);
+
+	switch ((USART_IT >> 5) & 7) {
+	case 1: pReg = &USARTx->CTLR1; break;
+	case 2: pReg = &USARTx->CTLR2; break;
+	default: pReg = &USARTx->CTLR3; break;
+	}
+	if (NewState)
+		*pReg |= u16Bit;
+	else
+		*pReg &= ~u16Bit;
+	hostDispatch();
+} /* USART_ITConfig() */
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef *USARTx, uint16_t USART_FLAG)
+{
+	return (USARTx->STATR & USART_FLAG) ? SET : RESET;
+} /* USART_GetFlagStatus() */
+
+void USART_ClearFlag(USART_TypeDef *USARTx, uint16_t USART_FLAG)
+{
+	USARTx->STATR &= ~USART_FLAG;
+} /* USART_ClearFlag() */
+
+ITStatus USART_GetITStatus(USART_TypeDef *USARTx, uint16_t USART_IT)
+{
+	uint16_t u16Enable = 1 << (USART_IT & 0x1f);
+	uint16_t u16Flag = 1 << (USART_IT >> 8);
+	uint16_t u16Reg = (((USART_IT >> 5) & 7) == 1) ? USARTx->CTLR1 : (((USART_IT >> 5) & 7) == 2) ? USARTx->CTLR2 : USARTx->CTLR3;
+
+	return ((u16Reg & u16Enable) && (USARTx->STATR & u16Flag)) ? SET : RESET;
+} /* USART_GetITStatus() */
+
+uint16_t USART_ReceiveData(USART_TypeDef *USARTx)
+{
+	USARTx->STATR &= ~USART_FLAG_RXNE;
+	return USARTx->DATAR & 0xff;
+} /* USART_ReceiveData() */
+
+// polled transmit (printf); the byte is gone before this returns
+void USART_SendData(USART_TypeDef *USARTx, uint16_t Data)
+{
+	if (!RCC_ON(APB2PCENR, RCC_APB2Periph_USART1) || !(USARTx->CTLR1 & USART_CTLR1_UE) || !(USARTx->CTLR1 & USART_Mode_Tx))
+		return; // nothing is clocked out
+	USARTx->STATR &= ~USART_FLAG_TC;
+	hostRun(hostByteNs());
+	stats.u32UartBytes++;
+	if (hooks.pfnUart)
+		hooks.pfnUart((uint8_t)Data);
+	USARTx->STATR |= USART_FLAG_TC | USART_FLAG_TXE;
+} /* USART_SendData() */
+
+void DMA_DeInit(DMA_Channel_TypeDef *DMAy_Channelx)
+{
+	DMAy_Channelx->CFGR = 0;
+	DMAy_Channelx->CNTR = 0;
+	DMAy_Channelx->PADDR = 0;
+	DMAy_Channelx->MADDR = 0;
+	if (DMAy_Channelx == DMA1_Channel4)
+		DMA1->INTFR &= ~(DMA1_IT_GL4 | DMA1_IT_TC4 | DMA1_IT_HT4 | DMA1_IT_TE4);
+} /* DMA_DeInit() */
+
+void DMA_Init(DMA_Channel_TypeDef *DMAy_Channelx, DMA_InitTypeDef *DMA_InitStruct)
+{
+	DMAy_Channelx->CFGR = DMA_InitStruct->DMA_DIR | DMA_InitStruct->DMA_Mode | DMA_InitStruct->DMA_PeripheralInc |
+		DMA_InitStruct->DMA_MemoryInc | DMA_InitStruct->DMA_PeripheralDataSize | DMA_InitStruct->DMA_MemoryDataSize |
+		DMA_InitStruct->DMA_Priority | DMA_InitStruct->DMA_M2M;
+	DMAy_Channelx->CNTR = DMA_InitStruct->DMA_BufferSize;
+	DMAy_Channelx->PADDR = DMA_InitStruct->DMA_PeripheralBaseAddr;
+	DMAy_Channelx->MADDR = DMA_InitStruct->DMA_MemoryBaseAddr;
+} /* DMA_Init() */
+
+void DMA_Cmd(DMA_Channel_TypeDef *DMAy_Channelx, FunctionalState NewState)
+{
+	if (NewState) {
+		if (!(DMAy_Channelx->CFGR & DMA_CFG4_EN) && DMAy_Channelx == DMA1_Channel4) {
+			u64TxNs = 0;
+			USART1->STATR &= ~USART_FLAG_TC;
+		}
+		DMAy_Channelx->CFGR |= DMA_CFG4_EN;
+	} else {
+		DMAy_Channelx->CFGR &= ~DMA_CFG4_EN;
+	}
+} /* DMA_Cmd() */
+
+void DMA_ITConfig(DMA_Channel_TypeDef *DMAy_Channelx, uint32_t DMA_IT, FunctionalState NewState)
+{
+	if (NewState)
+		DMAy_Channelx->CFGR |= DMA_IT;
+	else
+		DMAy_Channelx->CFGR &= ~DMA_IT;
+} /* DMA_ITConfig() */
+
+void DMA_ClearITPendingBit(uint32_t DMAy_IT)
+{
+	DMA1->INTFR &= ~DMAy_IT;
+} /* DMA_ClearITPendingBit() */
+
+// SPI1 (transmit only)
+void SPI_Init(SPI_TypeDef *SPIx, SPI_InitTypeDef *SPI_InitStruct)
+{
+	SPIx->CTLR1 = SPI_InitStruct->SPI_Direction | SPI_InitStruct->SPI_Mode | SPI_InitStruct->SPI_DataSize |
+		SPI_InitStruct->SPI_CPOL | SPI_InitStruct->SPI_CPHA | SPI_InitStruct->SPI_NSS |
+		SPI_InitStruct->SPI_BaudRatePrescaler | SPI_InitStruct->SPI_FirstBit;
+} /* SPI_Init() */
+
+void SPI_Cmd(SPI_TypeDef *SPIx, FunctionalState NewState)
+{
+	if (NewState)
+		SPIx->CTLR1 |= SPI_CTLR1_SPE;
+	else
+		SPIx->CTLR1 &= ~SPI_CTLR1_SPE;
+} /* SPI_Cmd() */
+
+void SPI_I2S_SendData(SPI_TypeDef *SPIx, uint16_t Data)
+{
+	(void)SPIx;
+	if (hooks.pfnSpi)
+		hooks.pfnSpi((uint8_t)Data);
+} /* SPI_I2S_SendData() */
+
+FlagStatus SPI_I2S_GetFlagStatus(SPI_TypeDef *SPIx, uint16_t SPI_I2S_FLAG)
+{
+	(void)SPIx;
+	return (SPI_I2S_FLAG == SPI_I2S_FLAG_TXE) ? SET : RESET; // never busy
+} /* SPI_I2S_GetFlagStatus() */
+
+// ADC1: converts the internal 1.2V reference against the simulated VDD
+void ADC_Init(ADC_TypeDef *ADCx, ADC_InitTypeDef *ADC_InitStruct)
+{
+	(void)ADCx; (void)ADC_InitStruct;
+} /* ADC_Init() */
+
+void ADC_RegularChannelConfig(ADC_TypeDef *ADCx, uint8_t ADC_Channel, uint8_t Rank, uint8_t ADC_SampleTime)
+{
+	(void)Rank; (void)ADC_SampleTime;
+	ADCx->RSQR3 = ADC_Channel;
+} /* ADC_RegularChannelConfig() */
+
+void ADC_Cmd(ADC_TypeDef *ADCx, FunctionalState NewState)
+{
+	if (NewState)
+		ADCx->CTLR2 |= ADC_ADON;
+	else
+		ADCx->CTLR2 &= ~ADC_ADON;
+} /* ADC_Cmd() */
+
+void ADC_ResetCalibration(ADC_TypeDef *ADCx)
+{
+	(void)ADCx;
+} /* ADC_ResetCalibration() */
+
+FlagStatus ADC_GetResetCalibrationStatus(ADC_TypeDef *ADCx)
+{
+	(void)ADCx;
+	return RESET;
+} /* ADC_GetResetCalibrationStatus() */
+
+void ADC_StartCalibration(ADC_TypeDef *ADCx)
+{
+	(void)ADCx;
+} /* ADC_StartCalibration() */
+
+FlagStatus ADC_GetCalibrationStatus(ADC_TypeDef *ADCx)
+{
+	(void)ADCx;
+	return RESET;
+} /* ADC_GetCalibrationStatus() */
+
+void ADC_SoftwareStartConvCmd(ADC_TypeDef *ADCx, FunctionalState NewState)
+{
+	int iRaw;
+
+	if (!NewState || !RCC_ON(APB2PCENR, RCC_APB2Periph_ADC1) || !(ADCx->CTLR2 & ADC_ADON))
+		return;
+	iRaw = (ADCx->RSQR3 == ADC_Channel_Vrefint && iVDD > 0) ? (1200 * 1023) / iVDD : 0;
+	ADCx->RDATAR = (iRaw > 1023) ? 1023 : iRaw;
+	ADCx->STATR |= ADC_FLAG_EOC;
+} /* ADC_SoftwareStartConvCmd() */
+
+FlagStatus ADC_GetFlagStatus(ADC_TypeDef *ADCx, uint8_t ADC_FLAG)
+{
+	return (ADCx->STATR & ADC_FLAG) ? SET : RESET;
+} /* ADC_GetFlagStatus() */
+
+uint16_t ADC_GetConversionValue(ADC_TypeDef *ADCx)
+{
+	ADCx->STATR &= ~ADC_FLAG_EOC;
+	return (uint16_t)ADCx->RDATAR;
+} /* ADC_GetConversionValue() */
+
+// FLASH: fast (64-byte page) erase and program of the host image
+static uint8_t *hostFlashPage(uint32_t u32Addr)
+{
+	uint32_t u32Offset = u32Addr - FLASH_BASE;
+
+	if (u32Offset >= HOST_FLASH_SIZE) {
+		hostFault("FLASH address out of range");
+		return NULL;
+	}
+	if (bFastLocked)
+		hostFault("FLASH fast programming while locked");
+	return &u8HostFlash[u32Offset & ~63];
+} /* hostFlashPage() */
+
+void FLASH_Unlock(void)
+{
+	bFlashLocked = 0;
+} /* FLASH_Unlock() */
+
+void FLASH_Lock(void)
+{
+	bFlashLocked = 1;
+} /* FLASH_Lock() */
+
+void FLASH_Unlock_Fast(void)
+{
+	bFastLocked = 0;
+} /* FLASH_Unlock_Fast() */
+
+void FLASH_Lock_Fast(void)
+{
+	bFastLocked = 1;
+} /* FLASH_Lock_Fast() */
+
+void FLASH_ErasePage_Fast(uint32_t Page_Address)
+{
+	uint8_t *pPage = hostFlashPage(Page_Address);
+
+	if (pPage)
+		memset(pPage, 0xff, 64);
+	stats.u32FlashErases++;
+	hostRun(HOST_FLASH_ERASE_NS);
+} /* FLASH_ErasePage_Fast() */
+
+void FLASH_BufReset(void)
+{
+	memset(u32FlashBuf, 0xff, sizeof(u32FlashBuf));
+} /* FLASH_BufReset() */
+
+void FLASH_BufLoad(uint32_t Address, uint32_t Data0)
+{
+	u32FlashBuf[(Address >> 2) & 15] = Data0;
+} /* FLASH_BufLoad() */
+
+void FLASH_ProgramPage_Fast(uint32_t Page_Address)
+{
+	uint8_t *pPage = hostFlashPage(Page_Address);
+	uint8_t *pBuf = (uint8_t *)u32FlashBuf;
+	int i;
+
+	if (pPage) {
+		for (i=0; i<64; i++)
+			pPage[i] &= pBuf[i]; // programming only clears bits; a page has to be erased first
+	}
+	stats.u32FlashWrites++;
+	hostRun(HOST_FLASH_WRITE_NS);
+} /* FLASH_ProgramPage_Fast() */
+
+FLASH_Status FLASH_EraseOptionBytes(void)
+{
+	if (bFlashLocked)
+		hostFault("option bytes erased while FLASH is locked");
+	memset(u16HostOB, 0xff, sizeof(u16HostOB));
+	return FLASH_COMPLETE;
+} /* FLASH_EraseOptionBytes() */
+
+FLASH_Status FLASH_UserOptionByteConfig(uint16_t OB_IWDG, uint16_t OB_STOP, uint16_t OB_STDBY, uint16_t OB_RST)
+{
+	if (bFlashLocked)
+		hostFault("option bytes written while FLASH is locked");
+	u16HostOB[1] = OB_IWDG | OB_STOP | OB_STDBY | OB_RST | 0xe0;
+	return FLASH_COMPLETE;
+} /* FLASH_UserOptionByteConfig() */
+
+// PWR: standby until the auto-wakeup timer (or an EXTI event) fires
+void PWR_AWU_SetPrescaler(uint32_t AWU_Prescaler)
+{
+	PWR->AWUPSC = AWU_Prescaler;
+} /* PWR_AWU_SetPrescaler() */
+
+void PWR_AWU_SetWindowValue(uint8_t WindowValue)
+{
+	PWR->AWUWR = WindowValue & 0x3f;
+} /* PWR_AWU_SetWindowValue() */
+
+void PWR_AutoWakeUpCmd(FunctionalState NewState)
+{
+	if (NewState)
+		PWR->AWUCSR |= AWUCSR_AWUEN;
+	else
+		PWR->AWUCSR &= ~AWUCSR_AWUEN;
+} /* PWR_AutoWakeUpCmd() */
+
+void PWR_EnterSTANDBYMode(uint8_t PWR_STANDBYEntry)
+{
+	static const uint16_t u16Div[16] = {1, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 10240, 61440};
+	uint64_t u64Wake = 0, u64Next;
+
+	(void)PWR_STANDBYEntry;
+	if ((PWR->AWUCSR & AWUCSR_AWUEN) && (RCC->RSTSCKR & 2)) // the AWU runs from the LSI
+		u64Wake = u64Now + ((uint64_t)PWR->AWUWR * u16Div[PWR->AWUPSC & 0xf] * NS_PER_SEC) / HOST_LSI_HZ;
+	stats.u32Standbys++;
+	hostSetPower(HOST_STANDBY);
+	bWakeEvent = 0;
+	while (!bWakeEvent && (u64Wake == 0 || u64Now < u64Wake)) {
+		u64Next = hostNextEvent(); // scheduled pin changes
+		if (u64Wake && (u64Next == 0 || u64Now + u64Next > u64Wake))
+			u64Next = u64Wake - u64Now;
+		if (u64Next == 0) {
+			hostFault("standby with nothing to wake up the chip");
+			break;
+		}
+		hostElapse(u64Next);
+		hostEvents();
+	}
+	hostSetPower(HOST_RUN);
+} /* PWR_EnterSTANDBYMode() */
@@ -0,0 +1,119 @@
+//
+// Host (Linux) simulation of the CH32V003 peripherals
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// The firmware in User/ is compiled for the PC against the mock
+// ch32v00x.h / core_riscv.h in this directory. The register blocks live in
+// host memory and the peripheral library calls are replaced by host.c,
+// which keeps simulated time and runs the peripherals the firmware uses
+// (GPIO, EXTI, I2C1, SysTick, TIM1/TIM2, USART1 + DMA, ADC, FLASH, PWR).
+// Tests drive it through the functions below.
+//
+#ifndef HOST_HOST_H_
+#define HOST_HOST_H_
+
+#include <stdint.h>
+
+#define HOST_FLASH_SIZE 16384
+#define HOST_PERIPH_SIZE 0x24000 // APB1 + APB2 + AHB register space
+#define HOST_RAM_SIZE 2048
+
+// I2C bus events passed to the trace hook
+enum {
+	HOST_I2C_START = 0,
+	HOST_I2C_ADDR, // u8Data = address byte (addr << 1 | R/W)
+	HOST_I2C_WRITE,
+	HOST_I2C_READ,
+	HOST_I2C_STOP
+};
+
+// Simulated I2C slave; return 0 from pfnStart/pfnWrite to NACK
+typedef struct tagHostI2CDevice
+{
+	uint8_t u8Addr; // 7-bit
+	void *pUser;
+	int (*pfnStart)(struct tagHostI2CDevice *pDev, int bRead);
+	int (*pfnWrite)(struct tagHostI2CDevice *pDev, uint8_t u8Data);
+	uint8_t (*pfnRead)(struct tagHostI2CDevice *pDev);
+	void (*pfnStop)(struct tagHostI2CDevice *pDev);
+	struct tagHostI2CDevice *pNext;
+} HOST_I2C_DEVICE;
+
+// Optional callbacks; any of them can be NULL
+typedef struct tagHostHooks
+{
+	void (*pfnI2C)(int iEvent, uint8_t u8Data, int bAck, uint64_t u64Ns); // every bus event
+	void (*pfnUart)(uint8_t u8Data); // each byte sent on USART1
+	void (*pfnSpi)(uint8_t u8Data); // each byte sent on SPI1
+	void (*pfnPower)(int iState, uint64_t u64Ns); // HOST_RUN/SLEEP/STANDBY entered at u64Ns
+	void (*pfnFault)(const char *szMsg); // firmware would hang; default prints and aborts
+} HOST_HOOKS;
+
+// Power states
+enum {
+	HOST_RUN = 0,
+	HOST_SLEEP, // WFI
+	HOST_STANDBY
+};
+
+typedef struct tagHostStats
+{
+	uint64_t u64RunNs, u64SleepNs, u64StandbyNs;
+	uint32_t u32Wakes; // WFI or standby exits
+	uint32_t u32Standbys;
+	uint32_t u32I2CTransactions; // START conditions
+	uint32_t u32I2CBytes; // address and data bytes
+	uint64_t u64I2CNs; // time the bus was busy
+	uint32_t u32UartBytes;
+	uint32_t u32FlashErases, u32FlashWrites;
+} HOST_STATS;
+
+// Power-on state: clears the peripherals, time, stats and pins; keeps FLASH
+void hostReset(void);
+void hostSetHooks(const HOST_HOOKS *pHooks);
+// Simulated time in ns since hostReset(), including standby
+uint64_t hostNanos(void);
+// Run the peripherals (and interrupt handlers) forward as if the core idled
+void hostAdvance(uint64_t u64Ns);
+void hostGetStats(HOST_STATS *pStats);
+
+// GPIO; pins use the 0xPN numbering of Arduino.h
+void hostSetPin(uint8_t u8Pin, int iLevel); // drive an input from outside
+void hostReleasePin(uint8_t u8Pin);
+void hostSchedulePin(uint8_t u8Pin, int iLevel, uint64_t u64AtNs); // later, e.g. a button press
+int hostGetPin(uint8_t u8Pin); // level of the pin (output or input)
+int hostGetPwm(uint8_t u8Pin); // compare value in effect on a PWM pin, -1 if no timer drives it (a stopped one holds its level)
+
+// I2C1
+void hostI2CAttach(HOST_I2C_DEVICE *pDev);
+void hostI2CDetach(HOST_I2C_DEVICE *pDev);
+int hostI2CSpeed(void); // bus clock set by the firmware
+
+// USART1 receive, delivered at the configured baud rate
+void hostUartReceive(const uint8_t *pData, int iLen);
+
+// Supply voltage seen by the ADC (Vrefint conversion)
+void hostSetVDD(int iMilliVolts);
+
+// FLASH image (0x08000000 on the chip)
+uint8_t *hostFlash(void);
+// The RAM layout ram.c sees (.bss ends at 0x500, the stack is the top 0x100)
+uint32_t *hostRAM(void);
+
+#endif /* HOST_HOST_H_ */
@@ -0,0 +1,245 @@
+//
+// Firmware RAM report
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Build-time RAM budget of a firmware image: .ramfunc, .data, .bss, the gap left
+// for the heap (stack overflow room, since nothing calls malloc()) and
+// the stack from the Ld/Link.ld symbols, the largest variables, and the
+// largest stack frames when the build wrote GCC's -fstack-usage files.
+// The FLASH used by the image is shown against the end of the FLASH region
+// (the settings pages come after it).
+// With -min it fails when the gap is smaller, so it can guard a build
+// that grows the history buffer or adds a big static.
+//
+// ramreport <firmware .elf> [-min bytes] [-top n] [file.su ...]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_ITEMS 512
+
+typedef struct tagItem
+{
+	char szName[40];
+	uint32_t u32Addr, u32Size;
+	char szNote[16]; // section, or the -fstack-usage qualifier
+} ITEM;
+
+// Ld/Link.ld symbols, in RAM order
+enum {
+	SYM_RAMFUNC = 0, // _ramfunc_vma (older builds have no .ramfunc)
+	SYM_RAMFUNC_END, // _eramfunc
+	SYM_DATA, // _data_vma
+	SYM_BSS, // _sbss
+	SYM_END, // _ebss (= _end)
+	SYM_HEAP_END,
+	SYM_STACK, // _susrstack
+	SYM_STACK_END, // _eusrstack
+	SYM_COUNT
+};
+static const char *szLinkSym[SYM_COUNT] = {"_ramfunc_vma", "_eramfunc", "_data_vma", "_sbss", "_ebss", "_heap_end", "_susrstack", "_eusrstack"};
+static uint32_t u32Link[SYM_COUNT];
+// end of the image in FLASH and of the FLASH region (older builds have neither)
+enum {
+	FSYM_END = 0, // _eflash
+	FSYM_LIMIT, // _flash_limit
+	FSYM_COUNT
+};
+static const char *szFlashSym[FSYM_COUNT] = {"_eflash", "_flash_limit"};
+static uint32_t u32Flash[FSYM_COUNT];
+static int iFlashFound;
+static ITEM objects[MAX_ITEMS], frames[MAX_ITEMS];
+static int iObjects, iFrames;
+
+static uint32_t Get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t Get32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static int CompareSize(const void *p1, const void *p2)
+{
+	const ITEM *pi1 = (const ITEM *)p1, *pi2 = (const ITEM *)p2;
+
+	if (pi1->u32Size != pi2->u32Size) // largest first
+		return (pi1->u32Size < pi2->u32Size) ? 1 : -1;
+	return strcmp(pi1->szName, pi2->szName);
+} /* CompareSize() */
+
+static void AddItem(ITEM *pItems, int *piCount, const char *szName, uint32_t u32Addr, uint32_t u32Size, const char *szNote)
+{
+	ITEM *pItem;
+
+	if (*piCount >= MAX_ITEMS)
+		return;
+	pItem = &pItems[(*piCount)++];
+	memset(pItem, 0, sizeof(ITEM));
+	strncpy(pItem->szName, szName, sizeof(pItem->szName) - 1);
+	strncpy(pItem->szNote, szNote, sizeof(pItem->szNote) - 1);
+	pItem->u32Addr = u32Addr;
+	pItem->u32Size = u32Size;
+} /* AddItem() */
+
+// the linker symbols and the variables (and RAM code) between _ramfunc_vma and _ebss
+static int ReadELF(const char *szFile)
+{
+	uint8_t *pELF;
+	uint32_t u32ShOff, i, j;
+	int iShEntSize, iShNum, k, iFound = 0;
+	long lSize;
+	FILE *f;
+
+	f = fopen(szFile, "rb");
+	if (!f)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	lSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	pELF = (uint8_t *)malloc(lSize);
+	if (!pELF || fread(pELF, 1, lSize, f) != (size_t)lSize || lSize < 52 ||
+		memcmp(pELF, "\177ELF\001\001", 6) != 0 || Get16(&pELF[18]) != 243) { // ELF32 LE RISC-V
+		fclose(f);
+		free(pELF);
+		return -1;
+	}
+	fclose(f);
+	u32ShOff = Get32(&pELF[32]);
+	iShEntSize = Get16(&pELF[46]);
+	iShNum = Get16(&pELF[48]);
+	for (i=0; i<(uint32_t)iShNum && u32ShOff + iShEntSize * (i + 1) <= (uint32_t)lSize; i++) {
+		const uint8_t *sh = &pELF[u32ShOff + iShEntSize * i], *shStr;
+		uint32_t u32SymOff, u32SymSize, u32StrOff;
+		if (Get32(&sh[4]) != 2) // SHT_SYMTAB
+			continue;
+		u32SymOff = Get32(&sh[16]);
+		u32SymSize = Get32(&sh[20]);
+		shStr = &pELF[u32ShOff + iShEntSize * Get32(&sh[24])]; // linked string table
+		u32StrOff = Get32(&shStr[16]);
+		for (j=0; j + 16 <= u32SymSize; j += 16) {
+			const uint8_t *sym = &pELF[u32SymOff + j];
+			const char *szName = (const char *)&pELF[u32StrOff + Get32(sym)];
+			for (k=0; k<SYM_COUNT; k++) {
+				if (strcmp(szName, szLinkSym[k]) == 0) {
+					u32Link[k] = Get32(&sym[4]);
+					iFound |= 1 << k;
+				}
+			}
+			for (k=0; k<FSYM_COUNT; k++) {
+				if (strcmp(szName, szFlashSym[k]) == 0) {
+					u32Flash[k] = Get32(&sym[4]);
+					iFlashFound |= 1 << k;
+				}
+			}
+			if (((sym[12] & 0xf) == 1 || (sym[12] & 0xf) == 2) && Get32(&sym[8])) // STT_OBJECT, STT_FUNC
+				AddItem(objects, &iObjects, szName, Get32(&sym[4]), Get32(&sym[8]), "");
+		}
+	}
+	free(pELF);
+	if ((iFound | (1 << SYM_RAMFUNC) | (1 << SYM_RAMFUNC_END)) != (1 << SYM_COUNT) - 1)
+		return -1; // not linked with Ld/Link.ld
+	if (!(iFound & (1 << SYM_RAMFUNC)))
+		u32Link[SYM_RAMFUNC] = u32Link[SYM_RAMFUNC_END] = u32Link[SYM_DATA];
+	for (k=0; k<iObjects; k++) { // keep the ones in RAM, named by their section
+		if (objects[k].u32Addr < u32Link[SYM_RAMFUNC] || objects[k].u32Addr >= u32Link[SYM_END]) {
+			objects[k--] = objects[--iObjects];
+			continue;
+		}
+		if (objects[k].u32Addr < u32Link[SYM_RAMFUNC_END])
+			strcpy(objects[k].szNote, ".ramfunc");
+		else
+			strcpy(objects[k].szNote, (objects[k].u32Addr < u32Link[SYM_BSS]) ? ".data" : ".bss");
+	}
+	return 0;
+} /* ReadELF() */
+
+// GCC -fstack-usage lines: "file.c:line:col:function<tab>bytes<tab>static|dynamic|dynamic,bounded"
+static int ReadStackUsage(const char *szFile)
+{
+	char szLine[256], szFunc[128], szQual[32];
+	unsigned int uBytes;
+	char *p;
+	FILE *f;
+
+	f = fopen(szFile, "r");
+	if (!f)
+		return -1;
+	while (fgets(szLine, sizeof(szLine), f)) {
+		if (sscanf(szLine, "%127[^\t]\t%u\t%31s", szFunc, &uBytes, szQual) != 3)
+			continue;
+		p = strrchr(szFunc, ':'); // the name follows the last colon
+		AddItem(frames, &iFrames, p ? p + 1 : szFunc, 0, uBytes, szQual);
+	}
+	fclose(f);
+	return 0;
+} /* ReadStackUsage() */
+
+int main(int argc, char *argv[])
+{
+	const char *szELF = NULL;
+	int i, iMin = -1, iTop = 10;
+	uint32_t u32Code, u32Data, u32Bss, u32Gap, u32Stack, u32Total;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-min") == 0 && i+1 < argc) {
+			iMin = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-top") == 0 && i+1 < argc) {
+			iTop = atoi(argv[++i]);
+		} else if (!szELF) {
+			szELF = argv[i];
+		} else if (ReadStackUsage(argv[i]) != 0) {
+			fprintf(stderr, "ramreport: can't read %s\n", argv[i]);
+			return 2;
+		}
+	}
+	if (!szELF) {
+		fprintf(stderr, "usage: ramreport <firmware .elf> [-min bytes] [-top n] [file.su ...]\n");
+		return 2;
+	}
+	if (ReadELF(szELF) != 0) {
+		fprintf(stderr, "ramreport: %s is not a RISC-V ELF linked with Ld/Link.ld\n", szELF);
+		return 2;
+	}
+	u32Code = u32Link[SYM_RAMFUNC_END] - u32Link[SYM_RAMFUNC];
+	u32Data = u32Link[SYM_BSS] - u32Link[SYM_DATA];
+	u32Bss = u32Link[SYM_END] - u32Link[SYM_BSS];
+	u32Gap = u32Link[SYM_HEAP_END] - u32Link[SYM_END];
+	u32Stack = u32Link[SYM_STACK_END] - u32Link[SYM_STACK];
+	u32Total = u32Link[SYM_STACK_END] - u32Link[SYM_RAMFUNC];
+	if (iFlashFound == (1 << FSYM_COUNT) - 1)
+		printf("FLASH image %u of %u bytes, %u free\n\n", u32Flash[FSYM_END], u32Flash[FSYM_LIMIT], u32Flash[FSYM_LIMIT] - u32Flash[FSYM_END]);
+	printf("%-10s %6s %6s\n", "section", "bytes", "%");
+	printf("%-10s %6u %6.1f\n", ".ramfunc", u32Code, 100.0 * u32Code / u32Total);
+	printf("%-10s %6u %6.1f\n", ".data", u32Data, 100.0 * u32Data / u32Total);
+	printf("%-10s %6u %6.1f\n", ".bss", u32Bss, 100.0 * u32Bss / u32Total);
+	printf("%-10s %6u %6.1f\n", "heap/free", u32Gap, 100.0 * u32Gap / u32Total);
+	printf("%-10s %6u %6.1f\n", "stack", u32Stack, 100.0 * u32Stack / u32Total);
+	qsort(objects, iObjects, sizeof(ITEM), CompareSize);
+	printf("\n%-32s %6s %s\n", "largest variables (and RAM code)", "bytes", "section");
+	for (i=0; i<iObjects && i<iTop; i++)
+		printf("%-32s %6u %s\n", objects[i].szName, objects[i].u32Size, objects[i].szNote);
+	if (iFrames) {
+		qsort(frames, iFrames, sizeof(ITEM), CompareSize);
+		printf("\n%-32s %6s %s\n", "largest stack frames", "bytes", "kind");
+		for (i=0; i<iFrames && i<iTop; i++)
+			printf("%-32s %6u %s\n", frames[i].szName, frames[i].u32Size, frames[i].szNote);
+	}
+	if (iMin >= 0 && u32Gap < (uint32_t)iMin) {
+		fprintf(stderr, "ramreport: only %u bytes between .bss and the stack, %d wanted\n", u32Gap, iMin);
+		return 1;
+	}
+	return 0;
+} /* main() */
@@ -0,0 +1,399 @@
+//
+// Pocket CO2 24 hour replay
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Runs the firmware (main.c from power-up, through the menu into a mode)
+// in simulated time against a CO2 waveform and scripted button presses,
+// then reports what the day cost: wakes, time awake, sensor and display
+// on time, I2C traffic, the estimated charge used and how long it took
+// for the user to be told that the CO2 level crossed a threshold.
+// Each mode runs in its own process, so every run starts from power-up.
+//
+// replay <waveform> [-hours n] [-threshold ppm] [-freq secs] [-buttons file] [mode ...]
+//  modes: continuous lowpower stealth adaptive (default: all of them)
+//  -freq    the stealth update setting, 15-60 seconds (default 30)
+//  button file lines: <seconds> <buttons: 1, 2 or 3 = both> [hold ms]
+//
+// An alert is the first sign the user gets after the crossing: the red
+// LED, a stealth burst of 3+ pulses (1000ppm+) or the display showing a
+// reading at or above the threshold. Crossings which end before any of
+// these are counted as missed.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "Arduino.h"
+#include "scd41.h"
+#include "pwm.h"
+#include "ssd1306.h"
+#include "scd41sim.h"
+
+// from main.c (its main() is renamed to FirmwareMain() in this build)
+int FirmwareMain(void);
+
+#define SEC(n) ((uint64_t)(n) * 1000000000ULL)
+#define SETTINGS_OFFSET 0x3c00 // FLASH_START in main.c
+#define BUTTON0_PIN 0xd2
+#define BUTTON1_PIN 0xd3
+#define LED_GREEN 0xc3
+#define LED_RED 0xc4
+#define MOTOR_PIN 0xc5
+#define OLED_ADDR 0x3c
+#define MAX_PRESSES 256
+#define MAX_EPISODES 64
+#define BURST_GAP_NS SEC(1) // motor pulses closer than this belong to one burst
+
+// Supply current estimates (mA at 3.3V) for the charge figure; they are
+// for comparing strategies, not a measurement. CH32V003 at 8MHz from its
+// datasheet, SCD41 averages from its datasheet, display and outputs typical.
+#define MA_MCU_RUN 1.8
+#define MA_MCU_SLEEP 0.7
+#define MA_MCU_STANDBY 0.0105
+#define MA_SCD41_PERIODIC 15.0
+#define MA_SCD41_LOW_POWER 3.2
+#define MA_SCD41_IDLE 0.2
+#define MA_SCD41_SLEEP 0.0005
+#define MA_OLED_ON 8.0
+#define MA_LED 10.0 // at full duty
+#define MA_MOTOR 60.0
+
+typedef struct tagMode
+{
+	const char *szName;
+	int iMode; // main.c MODE_xxx
+	int bWaitsForButton; // shows a screen and waits for a press before it starts
+} MODE;
+
+static const MODE modes[] = {
+	{"continuous", 0, 0},
+	{"lowpower", 1, 0},
+	{"stealth", 2, 1},
+	{"adaptive", 6, 0}};
+#define MODE_COUNT (int)(sizeof(modes) / sizeof(modes[0]))
+
+typedef struct tagPress
+{
+	uint64_t u64At;
+	uint32_t u32HoldMs;
+	uint8_t u8Buttons;
+} PRESS;
+
+// a stretch of time with the waveform at or above the threshold
+typedef struct tagEpisode
+{
+	uint64_t u64Start, u64End;
+	uint64_t u64AlertNs; // 0 = no alert yet
+} EPISODE;
+
+static SSD1306 oled;
+static SCD41SIM sensor;
+static PRESS presses[MAX_PRESSES];
+static int iPresses, iNextPress;
+static EPISODE episodes[MAX_EPISODES];
+static int iEpisodes;
+static const char *szWaveform;
+static int iThreshold = 1000;
+static int iFreq = 30;
+static uint64_t u64EndNs;
+static jmp_buf jbEnd;
+static char szFault[128];
+// accounting, sampled at every power state change
+static uint64_t u64LastNs, u64SensorNs, u64OledNs;
+static double dSensorMAs, dOledMAs, dOutputMAs; // mA x seconds
+static int iSensorState, bSensorSingle, bOledOn, iRedDuty, iGreenDuty, bMotorOn;
+static uint64_t u64LastPulseNs;
+static int iBurst;
+
+static int OutputDuty(uint8_t u8Pin)
+{
+	int iPwm = hostGetPwm(u8Pin);
+
+	if (iPwm < 0)
+		return hostGetPin(u8Pin) ? PWM_MAX : 0;
+	return iPwm;
+} /* OutputDuty() */
+
+// add the time since the last call with the outputs as they were, then take their new state
+static void Account(uint64_t u64Now)
+{
+	double dSecs = (u64Now - u64LastNs) / 1e9;
+	uint64_t u64Busy;
+
+	if (iSensorState == SCD41SIM_PERIODIC) {
+		u64SensorNs += u64Now - u64LastNs;
+		dSensorMAs += dSecs * MA_SCD41_PERIODIC;
+	} else if (bSensorSingle) { // measuring until the shot is done (u64Next), then idle
+		u64Busy = (sensor.u64Next < u64Now) ? ((sensor.u64Next > u64LastNs) ? sensor.u64Next - u64LastNs : 0) : u64Now - u64LastNs;
+		u64SensorNs += u64Busy;
+		dSensorMAs += u64Busy / 1e9 * MA_SCD41_PERIODIC + (dSecs - u64Busy / 1e9) * MA_SCD41_IDLE;
+	} else if (iSensorState == SCD41SIM_LOW_POWER) {
+		u64SensorNs += u64Now - u64LastNs;
+		dSensorMAs += dSecs * MA_SCD41_LOW_POWER;
+	} else {
+		dSensorMAs += dSecs * ((iSensorState == SCD41SIM_SLEEP) ? MA_SCD41_SLEEP : MA_SCD41_IDLE);
+	}
+	if (bOledOn) {
+		u64OledNs += u64Now - u64LastNs;
+		dOledMAs += dSecs * MA_OLED_ON;
+	}
+	dOutputMAs += dSecs * (MA_LED * (iRedDuty + iGreenDuty) / PWM_MAX + (bMotorOn ? MA_MOTOR : 0));
+	u64LastNs = u64Now;
+	iSensorState = scd41simState(&sensor);
+	bSensorSingle = sensor.bSingleShot;
+	bOledOn = oled.bOn && oled.bChargePump;
+	iRedDuty = OutputDuty(LED_RED);
+	iGreenDuty = OutputDuty(LED_GREEN);
+	bMotorOn = (OutputDuty(MOTOR_PIN) != 0);
+} /* Account() */
+
+static void Alert(uint64_t u64Now)
+{
+	int i;
+
+	for (i=0; i<iEpisodes; i++) {
+		if (u64Now >= episodes[i].u64Start && u64Now < episodes[i].u64End && episodes[i].u64AlertNs == 0)
+			episodes[i].u64AlertNs = u64Now;
+	}
+} /* Alert() */
+
+static void SchedulePresses(uint64_t u64Until)
+{
+	PRESS *p;
+
+	while (iNextPress < iPresses && presses[iNextPress].u64At <= u64Until) {
+		p = &presses[iNextPress++];
+		if (p->u8Buttons & 1) {
+			hostSchedulePin(BUTTON0_PIN, 0, p->u64At);
+			hostSchedulePin(BUTTON0_PIN, 1, p->u64At + (uint64_t)p->u32HoldMs * 1000000);
+		}
+		if (p->u8Buttons & 2) {
+			hostSchedulePin(BUTTON1_PIN, 0, p->u64At);
+			hostSchedulePin(BUTTON1_PIN, 1, p->u64At + (uint64_t)p->u32HoldMs * 1000000);
+		}
+	}
+} /* SchedulePresses() */
+
+static void OnPower(int iState, uint64_t u64Ns)
+{
+	int bWasOn = bMotorOn;
+
+	Account(u64Ns);
+	if (bMotorOn && !bWasOn) { // count the pulses of a burst
+		iBurst = (u64Ns - u64LastPulseNs < BURST_GAP_NS) ? iBurst + 1 : 1;
+		u64LastPulseNs = u64Ns;
+	}
+	if (iRedDuty || (bMotorOn && iBurst >= 3) ||
+		(bOledOn && iState != HOST_RUN && _iCO2 >= iThreshold)) // drawn by now
+		Alert(u64Ns);
+	SchedulePresses(u64Ns + SEC(60));
+	if (u64Ns >= u64EndNs)
+		longjmp(jbEnd, 1);
+} /* OnPower() */
+
+static void OnFault(const char *szMsg)
+{
+	strncpy(szFault, szMsg, sizeof(szFault)-1);
+	longjmp(jbEnd, 2);
+} /* OnFault() */
+
+static int ComparePress(const void *p1, const void *p2)
+{
+	const PRESS *pp1 = (const PRESS *)p1, *pp2 = (const PRESS *)p2;
+
+	return (pp1->u64At > pp2->u64At) - (pp1->u64At < pp2->u64At);
+} /* ComparePress() */
+
+static int AddPress(double dSecs, int iButtons, int iHoldMs)
+{
+	if (iPresses >= MAX_PRESSES || iButtons < 1 || iButtons > 3 || iHoldMs <= 0)
+		return -1;
+	presses[iPresses].u64At = (uint64_t)(dSecs * 1e9);
+	presses[iPresses].u8Buttons = (uint8_t)iButtons;
+	presses[iPresses].u32HoldMs = (uint32_t)iHoldMs;
+	iPresses++;
+	return 0;
+} /* AddPress() */
+
+static int LoadPresses(const char *szFile)
+{
+	char szLine[128];
+	double dSecs;
+	int iButtons, iHoldMs;
+	FILE *f;
+
+	f = fopen(szFile, "r");
+	if (!f)
+		return -1;
+	while (fgets(szLine, sizeof(szLine), f)) {
+		iHoldMs = 500; // longer than a standby period, so it is seen
+		if (szLine[0] == '#' || sscanf(szLine, "%lf %d %d", &dSecs, &iButtons, &iHoldMs) < 2)
+			continue;
+		if (AddPress(dSecs, iButtons, iHoldMs)) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+} /* LoadPresses() */
+
+// times where the waveform goes up through the threshold and back down
+static void FindEpisodes(void)
+{
+	const SCD41SIM_POINT *p = sensor.points;
+	double dT;
+	int i;
+
+	iEpisodes = 0;
+	if (sensor.iPoints && p[0].fCO2 >= iThreshold) { // starts above
+		episodes[0].u64Start = 0;
+		episodes[0].u64End = u64EndNs;
+		iEpisodes = 1;
+	}
+	for (i=1; i<sensor.iPoints; i++) {
+		if ((p[i-1].fCO2 < iThreshold) == (p[i].fCO2 < iThreshold))
+			continue;
+		dT = p[i-1].u32Secs + (p[i].u32Secs - p[i-1].u32Secs) * (iThreshold - p[i-1].fCO2) / (p[i].fCO2 - p[i-1].fCO2);
+		if (SEC(dT) >= u64EndNs)
+			break;
+		if (p[i].fCO2 >= iThreshold) {
+			if (iEpisodes == MAX_EPISODES)
+				break;
+			episodes[iEpisodes].u64Start = (uint64_t)(dT * 1e9);
+			episodes[iEpisodes].u64End = u64EndNs;
+			episodes[iEpisodes].u64AlertNs = 0;
+			iEpisodes++;
+		} else if (iEpisodes) {
+			episodes[iEpisodes-1].u64End = (uint64_t)(dT * 1e9);
+		}
+	}
+} /* FindEpisodes() */
+
+// power up with iMode saved as the setting, press Start (and the button
+// the mode waits for), then let it run until u64EndNs
+static int RunMode(const MODE *pMode)
+{
+	HOST_HOOKS hooks = {0};
+	HOST_STATS stats;
+	uint32_t *pSettings = (uint32_t *)&hostFlash()[SETTINGS_OFFSET];
+	double dMCUMAs, dLatency = 0, dMaxLatency = 0;
+	int i, iAlerted = 0;
+
+	pSettings[0] = (uint32_t)pMode->iMode;
+	pSettings[1] = 0; // vibration
+	pSettings[2] = (uint32_t)iFreq; // stealth update period
+	pSettings[3] = 5; // timer minutes
+	hostReset();
+	ssd1306Attach(&oled, OLED_ADDR);
+	scd41simAttach(&sensor);
+	scd41simLoadWaveform(&sensor, szWaveform); // attaching clears it
+	AddPress(2.0, 2, 500); // Start in the menu
+	if (pMode->bWaitsForButton)
+		AddPress(5.0, 1, 500);
+	qsort(presses, iPresses, sizeof(PRESS), ComparePress);
+	SchedulePresses(SEC(60));
+	hooks.pfnPower = OnPower;
+	hooks.pfnFault = OnFault;
+	hostSetHooks(&hooks);
+	if (setjmp(jbEnd) == 0)
+		FirmwareMain();
+	hostSetHooks(NULL);
+	if (szFault[0]) {
+		fprintf(stderr, "%s: firmware fault after %.1fs: %s\n", pMode->szName, hostNanos() / 1e9, szFault);
+		return 1;
+	}
+	hostGetStats(&stats);
+	dMCUMAs = stats.u64RunNs / 1e9 * MA_MCU_RUN + stats.u64SleepNs / 1e9 * MA_MCU_SLEEP +
+		stats.u64StandbyNs / 1e9 * MA_MCU_STANDBY;
+	for (i=0; i<iEpisodes; i++) {
+		if (episodes[i].u64AlertNs) {
+			double d = (episodes[i].u64AlertNs - episodes[i].u64Start) / 1e9;
+			iAlerted++;
+			dLatency += d;
+			if (d > dMaxLatency)
+				dMaxLatency = d;
+		}
+	}
+	printf("%-11s %7u %10.0f %9.0f %9.0f %9u %8.2f %8.2f %5d/%-3d %8.1f %8.1f\n", pMode->szName, stats.u32Wakes,
+		stats.u64RunNs / 1e6, u64SensorNs / 1e9, u64OledNs / 1e9, stats.u32I2CBytes,
+		(dMCUMAs + dSensorMAs + dOledMAs + dOutputMAs) / 3600.0, dSensorMAs / 3600.0,
+		iAlerted, iEpisodes, iAlerted ? dLatency / iAlerted : 0.0, dMaxLatency);
+	return 0;
+} /* RunMode() */
+
+int main(int argc, char *argv[])
+{
+	const char *szButtons = NULL;
+	int i, j, iStatus, iRuns = 0, iFailed = 0, iRun[MODE_COUNT];
+	double dHours = 24.0;
+	pid_t pid;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-hours") == 0 && i+1 < argc) {
+			dHours = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-threshold") == 0 && i+1 < argc) {
+			iThreshold = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-freq") == 0 && i+1 < argc) {
+			iFreq = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-buttons") == 0 && i+1 < argc) {
+			szButtons = argv[++i];
+		} else if (!szWaveform && argv[i][0] != '-') {
+			szWaveform = argv[i];
+		} else {
+			for (j=0; j<MODE_COUNT && strcmp(argv[i], modes[j].szName) != 0; j++) {}
+			if (j == MODE_COUNT || iRuns == MODE_COUNT) {
+				fprintf(stderr, "replay: unknown option or mode %s\n", argv[i]);
+				return 2;
+			}
+			iRun[iRuns++] = j;
+		}
+	}
+	if (!szWaveform || dHours <= 0 || iFreq < 15 || iFreq > 60) {
+		fprintf(stderr, "usage: replay <waveform> [-hours n] [-threshold ppm] [-freq secs] [-buttons file] [continuous|lowpower|stealth|adaptive ...]\n");
+		return 2;
+	}
+	if (scd41simLoadWaveform(&sensor, szWaveform) < 2) {
+		fprintf(stderr, "replay: can't read the waveform %s\n", szWaveform);
+		return 2;
+	}
+	if (szButtons && LoadPresses(szButtons)) {
+		fprintf(stderr, "replay: bad button script %s\n", szButtons);
+		return 2;
+	}
+	if (iRuns == 0) {
+		for (iRuns=0; iRuns<MODE_COUNT; iRuns++)
+			iRun[iRuns] = iRuns;
+	}
+	u64EndNs = (uint64_t)(dHours * 3600.0 * 1e9);
+	FindEpisodes();
+	printf("%s, %.1f hours, alert at %d ppm, stealth update %ds\n", szWaveform, dHours, iThreshold, iFreq);
+	printf("%-11s %7s %10s %9s %9s %9s %8s %8s %9s %8s %8s\n", "mode", "wakes", "active_ms", "sensor_s", "oled_s",
+		"i2c_bytes", "mAh", "sens_mAh", "alerts", "lat_avg", "lat_max");
+	fflush(stdout);
+	for (i=0; i<iRuns; i++) {
+		pid = fork(); // the firmware's statics start from power-up in every run
+		if (pid == 0)
+			_exit(RunMode(&modes[iRun[i]]) | (fflush(stdout) != 0));
+		if (pid < 0 || waitpid(pid, &iStatus, 0) != pid || !WIFEXITED(iStatus) || WEXITSTATUS(iStatus) != 0)
+			iFailed++;
+	}
+	return iFailed ? 1 : 0;
+} /* main() */
@@ -0,0 +1,727 @@
+//
+// RV32EC instruction set simulator
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rv32sim.h"
+
+// cycles (see rv32sim.h)
+#define CYC_BASE 1
+#define CYC_MEM 2
+#define CYC_JUMP 3
+#define CYC_SPLIT_FETCH 1
+
+#define CSR_MSTATUS 0x300
+#define CSR_MTVEC 0x305
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define MSTATUS_MIE 0x08
+#define MSTATUS_MPIE 0x80
+
+static const char *szReasons[] = {"returned", "wfi", "instruction limit", "illegal instruction", "bus error", "ecall/ebreak"};
+
+const char *rv32simStopReason(int iReason)
+{
+	if (iReason < 0 || iReason > RV32SIM_BREAK)
+		return "?";
+	return szReasons[iReason];
+} /* rv32simStopReason() */
+
+void rv32simInit(RV32SIM *pSim)
+{
+	memset(pSim, 0, sizeof(RV32SIM));
+	memset(pSim->u8Flash, 0xff, sizeof(pSim->u8Flash));
+	pSim->u32Entry = RV32SIM_FLASH_BASE;
+	pSim->iLastSymbol = -1;
+} /* rv32simInit() */
+
+// host pointer for an address range, NULL if it isn't plain memory
+static uint8_t *rv32simMap(RV32SIM *pSim, uint32_t u32Addr, int iSize, int bWrite)
+{
+	if (u32Addr < RV32SIM_FLASH_SIZE && u32Addr + iSize <= RV32SIM_FLASH_SIZE) // boot alias
+		return bWrite ? NULL : &pSim->u8Flash[u32Addr];
+	if (u32Addr - RV32SIM_FLASH_BASE < RV32SIM_FLASH_SIZE && u32Addr - RV32SIM_FLASH_BASE + iSize <= RV32SIM_FLASH_SIZE)
+		return &pSim->u8Flash[u32Addr - RV32SIM_FLASH_BASE]; // stores are the buffer loads of FLASH_BufLoad()
+	if (u32Addr - RV32SIM_RAM_BASE < RV32SIM_RAM_SIZE && u32Addr - RV32SIM_RAM_BASE + iSize <= RV32SIM_RAM_SIZE)
+		return &pSim->u8RAM[u32Addr - RV32SIM_RAM_BASE];
+	if (u32Addr - RV32SIM_SCRATCH_BASE < RV32SIM_SCRATCH_SIZE && u32Addr - RV32SIM_SCRATCH_BASE + iSize <= RV32SIM_SCRATCH_SIZE)
+		return &pSim->u8Scratch[u32Addr - RV32SIM_SCRATCH_BASE];
+	if (u32Addr - RV32SIM_PERIPH_BASE < RV32SIM_PERIPH_SIZE && u32Addr - RV32SIM_PERIPH_BASE + iSize <= RV32SIM_PERIPH_SIZE)
+		return &pSim->u8Periph[u32Addr - RV32SIM_PERIPH_BASE];
+	if (u32Addr - RV32SIM_CORE_BASE < RV32SIM_CORE_SIZE && u32Addr - RV32SIM_CORE_BASE + iSize <= RV32SIM_CORE_SIZE)
+		return &pSim->u8Core[u32Addr - RV32SIM_CORE_BASE];
+	return NULL;
+} /* rv32simMap() */
+
+static int rv32simIsIO(uint32_t u32Addr)
+{
+	return (u32Addr - RV32SIM_PERIPH_BASE < RV32SIM_PERIPH_SIZE) || (u32Addr - RV32SIM_CORE_BASE < RV32SIM_CORE_SIZE);
+} /* rv32simIsIO() */
+
+int rv32simRead(RV32SIM *pSim, uint32_t u32Addr, int iSize, uint32_t *pValue)
+{
+	uint8_t *p;
+
+	if (u32Addr & (iSize - 1))
+		return -1; // misaligned
+	if (pSim->pfnIO && rv32simIsIO(u32Addr) && pSim->pfnIO(pSim, u32Addr, iSize, 0, pValue))
+		return 0;
+	if (u32Addr - 0x1ffff700 < 0x200) { // vendor bytes, option bytes: erased
+		*pValue = 0xffffffff >> (32 - 8 * iSize);
+		return 0;
+	}
+	p = rv32simMap(pSim, u32Addr, iSize, 0);
+	if (!p)
+		return -1;
+	*pValue = p[0];
+	if (iSize > 1) *pValue |= (uint32_t)p[1] << 8;
+	if (iSize > 2) *pValue |= ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	return 0;
+} /* rv32simRead() */
+
+int rv32simWrite(RV32SIM *pSim, uint32_t u32Addr, int iSize, uint32_t u32Value)
+{
+	uint8_t *p;
+
+	if (u32Addr & (iSize - 1))
+		return -1;
+	if (pSim->pfnIO && rv32simIsIO(u32Addr) && pSim->pfnIO(pSim, u32Addr, iSize, 1, &u32Value))
+		return 0;
+	p = rv32simMap(pSim, u32Addr, iSize, 1);
+	if (!p)
+		return -1;
+	p[0] = (uint8_t)u32Value;
+	if (iSize > 1) p[1] = (uint8_t)(u32Value >> 8);
+	if (iSize > 2) { p[2] = (uint8_t)(u32Value >> 16); p[3] = (uint8_t)(u32Value >> 24); }
+	return 0;
+} /* rv32simWrite() */
+
+// Peripherals which are always ready: the status bits the drivers poll
+// read as done, everything else is plain memory. Enough to run the
+// firmware without a model behind it (see host.c for a real one).
+int rv32simStubIO(RV32SIM *pSim, uint32_t u32Addr, int iSize, int bWrite, uint32_t *pValue)
+{
+	uint32_t u32Reg;
+	uint8_t *p;
+
+	(void)iSize;
+	p = rv32simMap(pSim, u32Addr & ~3u, 4, 1);
+	if (!p)
+		return 0;
+	u32Reg = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	if (bWrite) {
+		if (u32Addr == 0x40005400) { // I2C1 CTLR1: START and STOP end each other
+			u32Reg = *pValue;
+			if (u32Reg & 0x100) u32Reg &= ~0x200u;
+			else if (u32Reg & 0x200) u32Reg &= ~0x100u;
+			p[0] = (uint8_t)u32Reg;
+			p[1] = (uint8_t)(u32Reg >> 8);
+			return 1;
+		}
+		return 0;
+	}
+	switch (u32Addr) {
+	case 0x40021000: // RCC CTLR: HSIRDY and PLLRDY follow HSION and PLLON
+		*pValue = u32Reg | ((u32Reg & 0x01000001) << 1);
+		return 1;
+	case 0x40021004: // RCC CFGR0: SWS follows SW
+		*pValue = (u32Reg & ~0xcu) | ((u32Reg & 3) << 2);
+		return 1;
+	case 0x40021024: // RCC RSTSCKR: LSIRDY follows LSION
+		*pValue = u32Reg | ((u32Reg & 1) << 1);
+		return 1;
+	case 0x40005414: // I2C1 STAR1: SB, ADDR, BTF, RXNE, TXE
+		*pValue = 0x00c7;
+		return 1;
+	case 0x40005418: // I2C1 STAR2: MSL and TRA, BUSY between START and STOP
+		*pValue = 0x0005 | ((p[-0x18 + 1] & 1) << 1);
+		return 1;
+	case 0x40012400: // ADC1 STATR: EOC
+		*pValue = 0x02;
+		return 1;
+	case 0x40012408: // ADC1 CTLR2: calibration done at once
+		*pValue = u32Reg & ~0x0cu;
+		return 1;
+	case 0x40013008: // SPI1 STATR: TXE, not busy
+		*pValue = 0x02;
+		return 1;
+	case 0x40013800: // USART1 STATR: TXE, TC
+		*pValue = 0xc0;
+		return 1;
+	case 0xe000f004: // SysTick SR: the compare is always reached
+		*pValue = 1;
+		return 1;
+	}
+	return 0;
+} /* rv32simStubIO() */
+
+// image bytes go to FLASH, or to the RAM image for initialized data
+static int rv32simPoke(RV32SIM *pSim, uint32_t u32Addr, uint8_t u8Data)
+{
+	if (u32Addr < RV32SIM_FLASH_SIZE)
+		u32Addr += RV32SIM_FLASH_BASE;
+	if (u32Addr - RV32SIM_FLASH_BASE < RV32SIM_FLASH_SIZE)
+		pSim->u8Flash[u32Addr - RV32SIM_FLASH_BASE] = u8Data;
+	else if (u32Addr - RV32SIM_RAM_BASE < RV32SIM_RAM_SIZE)
+		pSim->u8RAMImage[u32Addr - RV32SIM_RAM_BASE] = u8Data;
+	else
+		return -1;
+	return 0;
+} /* rv32simPoke() */
+
+static int SymbolCompare(const void *p1, const void *p2)
+{
+	const RV32SIM_SYMBOL *s1 = (const RV32SIM_SYMBOL *)p1, *s2 = (const RV32SIM_SYMBOL *)p2;
+
+	return (s1->u32Addr > s2->u32Addr) - (s1->u32Addr < s2->u32Addr);
+} /* SymbolCompare() */
+
+static uint32_t Get32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t Get16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+int rv32simLoadELF(RV32SIM *pSim, const char *szFile)
+{
+	uint8_t *pELF;
+	FILE *f;
+	long lSize;
+	uint32_t u32PhOff, u32ShOff, i, j;
+	int iPhNum, iShNum, iShEntSize;
+
+	f = fopen(szFile, "rb");
+	if (!f)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	lSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	pELF = (uint8_t *)malloc(lSize);
+	if (!pELF || fread(pELF, 1, lSize, f) != (size_t)lSize || lSize < 52 ||
+		memcmp(pELF, "\177ELF\001\001", 6) != 0 || Get16(&pELF[18]) != 243) { // ELF32 LE RISC-V
+		fclose(f);
+		free(pELF);
+		return -1;
+	}
+	fclose(f);
+	pSim->u32Entry = Get32(&pELF[24]);
+	u32PhOff = Get32(&pELF[28]);
+	u32ShOff = Get32(&pELF[32]);
+	iPhNum = Get16(&pELF[44]);
+	iShEntSize = Get16(&pELF[46]);
+	iShNum = Get16(&pELF[48]);
+	// loadable segments: code and .data at their load (FLASH) address,
+	// .data and .bss at their run (RAM) address too
+	for (i=0; i<(uint32_t)iPhNum && u32PhOff + 32 * (i + 1) <= (uint32_t)lSize; i++) {
+		const uint8_t *ph = &pELF[u32PhOff + 32 * i];
+		uint32_t u32Off = Get32(&ph[4]), u32VAddr = Get32(&ph[8]), u32PAddr = Get32(&ph[12]);
+		uint32_t u32FileSz = Get32(&ph[16]);
+		if (Get32(ph) != 1 || u32Off + u32FileSz > (uint32_t)lSize) // PT_LOAD
+			continue;
+		for (j=0; j<u32FileSz; j++) {
+			rv32simPoke(pSim, u32PAddr + j, pELF[u32Off + j]);
+			if (u32VAddr != u32PAddr)
+				rv32simPoke(pSim, u32VAddr + j, pELF[u32Off + j]);
+		}
+	}
+	// function symbols for the profile
+	pSim->iSymbols = 0;
+	for (i=0; i<(uint32_t)iShNum && u32ShOff + iShEntSize * (i + 1) <= (uint32_t)lSize; i++) {
+		const uint8_t *sh = &pELF[u32ShOff + iShEntSize * i], *shStr;
+		uint32_t u32SymOff, u32SymSize, u32StrOff;
+		if (Get32(&sh[4]) != 2) // SHT_SYMTAB
+			continue;
+		u32SymOff = Get32(&sh[16]);
+		u32SymSize = Get32(&sh[20]);
+		shStr = &pELF[u32ShOff + iShEntSize * Get32(&sh[24])]; // linked string table
+		u32StrOff = Get32(&shStr[16]);
+		for (j=0; j + 16 <= u32SymSize && pSim->iSymbols < RV32SIM_MAX_SYMBOLS; j += 16) {
+			const uint8_t *sym = &pELF[u32SymOff + j];
+			RV32SIM_SYMBOL *pSym = &pSim->symbols[pSim->iSymbols];
+			int iType = sym[12] & 0xf;
+			if (strcmp((const char *)&pELF[u32StrOff + Get32(sym)], "__global_pointer$") == 0)
+				pSim->u32GP = Get32(&sym[4]);
+			if ((iType != 2 && iType != 1) || Get32(&sym[4]) == 0) // functions and objects with an address
+				continue;
+			memset(pSym, 0, sizeof(RV32SIM_SYMBOL));
+			strncpy(pSym->szName, (const char *)&pELF[u32StrOff + Get32(sym)], sizeof(pSym->szName) - 1);
+			pSym->u32Addr = Get32(&sym[4]);
+			if (pSym->u32Addr < RV32SIM_FLASH_SIZE) // Ld/Link.ld links at the boot alias
+				pSym->u32Addr += RV32SIM_FLASH_BASE;
+			pSym->u32Size = Get32(&sym[8]);
+			pSym->bFunction = (iType == 2);
+			pSim->iSymbols++;
+		}
+	}
+	qsort(pSim->symbols, pSim->iSymbols, sizeof(RV32SIM_SYMBOL), SymbolCompare);
+	free(pELF);
+	return 0;
+} /* rv32simLoadELF() */
+
+int rv32simLoadHex(RV32SIM *pSim, const char *szFile)
+{
+	char szLine[600];
+	uint32_t u32Base = 0, u32Addr;
+	unsigned int uLen, uAddr, uType, uByte, i;
+	FILE *f;
+
+	f = fopen(szFile, "r");
+	if (!f)
+		return -1;
+	while (fgets(szLine, sizeof(szLine), f)) {
+		if (szLine[0] != ':' || sscanf(szLine + 1, "%2x%4x%2x", &uLen, &uAddr, &uType) != 3)
+			continue;
+		if (uType == 0) {
+			for (i=0; i<uLen; i++) {
+				if (sscanf(szLine + 9 + 2 * i, "%2x", &uByte) != 1)
+					break;
+				u32Addr = u32Base + uAddr + i;
+				rv32simPoke(pSim, u32Addr, (uint8_t)uByte);
+			}
+		} else if (uType == 4 && sscanf(szLine + 9, "%4x", &uAddr) == 1) {
+			u32Base = uAddr << 16;
+		} else if (uType == 1) {
+			break;
+		}
+	}
+	fclose(f);
+	pSim->u32Entry = 0; // reset vector (boot alias of FLASH)
+	return 0;
+} /* rv32simLoadHex() */
+
+void rv32simReset(RV32SIM *pSim)
+{
+	memset(pSim->x, 0, sizeof(pSim->x));
+	memset(pSim->u32CSR, 0, sizeof(pSim->u32CSR));
+	memcpy(pSim->u8RAM, pSim->u8RAMImage, sizeof(pSim->u8RAM));
+	memset(pSim->u8Scratch, 0, sizeof(pSim->u8Scratch));
+	memset(pSim->u8Periph, 0, sizeof(pSim->u8Periph));
+	memset(pSim->u8Core, 0, sizeof(pSim->u8Core));
+	pSim->pc = pSim->u32Entry;
+	pSim->u32FetchWord = 0xffffffff;
+} /* rv32simReset() */
+
+RV32SIM_SYMBOL *rv32simFindSymbol(RV32SIM *pSim, const char *szName)
+{
+	int i;
+
+	for (i=0; i<pSim->iSymbols; i++) {
+		if (strcmp(pSim->symbols[i].szName, szName) == 0)
+			return &pSim->symbols[i];
+	}
+	return NULL;
+} /* rv32simFindSymbol() */
+
+void rv32simClearProfile(RV32SIM *pSim)
+{
+	int i;
+
+	for (i=0; i<pSim->iSymbols; i++) {
+		pSim->symbols[i].u64Cycles = pSim->symbols[i].u64Instructions = 0;
+		pSim->symbols[i].u32Calls = 0;
+	}
+	pSim->u64Cycles = pSim->u64Instructions = 0;
+} /* rv32simClearProfile() */
+
+static int rv32simIsFlash(uint32_t u32Addr)
+{
+	return (u32Addr < RV32SIM_FLASH_SIZE || u32Addr - RV32SIM_FLASH_BASE < RV32SIM_FLASH_SIZE);
+} /* rv32simIsFlash() */
+
+// wait states for fetching the words from u32Addr to u32Addr+iLen-1
+static int rv32simFetchWait(RV32SIM *pSim, uint32_t u32Addr, int iLen)
+{
+	uint32_t u32Word, u32Last = (u32Addr + iLen - 1) & ~3u;
+	int iWait = 0;
+
+	for (u32Word = u32Addr & ~3u; u32Word <= u32Last; u32Word += 4) {
+		if (u32Word == pSim->u32FetchWord)
+			continue;
+		pSim->u32FetchWord = u32Word;
+		if (rv32simIsFlash(u32Word) || pSim->bWaitRAM)
+			iWait += pSim->iFlashWait;
+	}
+	return iWait;
+} /* rv32simFetchWait() */
+
+// symbol containing pc, -1 if none
+static int rv32simSymbolAt(RV32SIM *pSim, uint32_t pc)
+{
+	int iLow = 0, iHigh = pSim->iSymbols - 1, i;
+	RV32SIM_SYMBOL *pSym;
+
+	if (pc < RV32SIM_FLASH_SIZE)
+		pc += RV32SIM_FLASH_BASE;
+	if (pSim->iLastSymbol >= 0) {
+		pSym = &pSim->symbols[pSim->iLastSymbol];
+		if (pc - pSym->u32Addr < pSym->u32Size)
+			return pSim->iLastSymbol;
+	}
+	while (iLow <= iHigh) { // last symbol starting at or below pc
+		i = (iLow + iHigh) / 2;
+		if (pSim->symbols[i].u32Addr <= pc)
+			iLow = i + 1;
+		else
+			iHigh = i - 1;
+	}
+	if (iHigh >= 0 && pc - pSim->symbols[iHigh].u32Addr < pSim->symbols[iHigh].u32Size) {
+		pSim->iLastSymbol = iHigh;
+		return iHigh;
+	}
+	return -1;
+} /* rv32simSymbolAt() */
+
+static int32_t SignExtend(uint32_t u32, int iBits)
+{
+	return (int32_t)(u32 << (32 - iBits)) >> (32 - iBits);
+} /* SignExtend() */
+
+#define BITS(v, hi, lo) (((v) >> (lo)) & ((1u << ((hi) - (lo) + 1)) - 1))
+
+// expand a compressed instruction to its 32-bit form (0 = illegal)
+static uint32_t rv32simExpand(uint16_t c)
+{
+	uint32_t rd = BITS(c, 11, 7), rs2 = BITS(c, 6, 2);
+	uint32_t rdp = 8 + BITS(c, 4, 2), rs1p = 8 + BITS(c, 9, 7);
+	uint32_t imm;
+	int32_t simm;
+
+	switch (((c & 3) << 3) | BITS(c, 15, 13)) {
+	case 0x00: // c.addi4spn
+		imm = (BITS(c, 10, 7) << 6) | (BITS(c, 12, 11) << 4) | (BITS(c, 5, 5) << 3) | (BITS(c, 6, 6) << 2);
+		if (imm == 0) return 0;
+		return (imm << 20) | (2 << 15) | (rdp << 7) | 0x13;
+	case 0x02: // c.lw
+		imm = (BITS(c, 5, 5) << 6) | (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2);
+		return (imm << 20) | (rs1p << 15) | (2 << 12) | (rdp << 7) | 0x03;
+	case 0x06: // c.sw
+		imm = (BITS(c, 5, 5) << 6) | (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2);
+		return (BITS(imm, 11, 5) << 25) | (rdp << 20) | (rs1p << 15) | (2 << 12) | (BITS(imm, 4, 0) << 7) | 0x23;
+	case 0x08: // c.addi / c.nop
+		simm = SignExtend((BITS(c, 12, 12) << 5) | rs2, 6);
+		return ((uint32_t)simm << 20) | (rd << 15) | (rd << 7) | 0x13;
+	case 0x09: // c.jal
+	case 0x0d: // c.j
+		simm = SignExtend((BITS(c, 12, 12) << 11) | (BITS(c, 8, 8) << 10) | (BITS(c, 10, 9) << 8) | (BITS(c, 6, 6) << 7) |
+			(BITS(c, 7, 7) << 6) | (BITS(c, 2, 2) << 5) | (BITS(c, 11, 11) << 4) | (BITS(c, 5, 3) << 1), 12);
+		imm = (uint32_t)simm;
+		return (BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) | (BITS(imm, 19, 12) << 12) |
+			((BITS(c, 15, 13) == 1 ? 1u : 0u) << 7) | 0x6f;
+	case 0x0a: // c.li
+		simm = SignExtend((BITS(c, 12, 12) << 5) | rs2, 6);
+		return ((uint32_t)simm << 20) | (rd << 7) | 0x13;
+	case 0x0b: // c.addi16sp / c.lui
+		if (rd == 2) {
+			simm = SignExtend((BITS(c, 12, 12) << 9) | (BITS(c, 4, 3) << 7) | (BITS(c, 5, 5) << 6) | (BITS(c, 2, 2) << 5) | (BITS(c, 6, 6) << 4), 10);
+			if (simm == 0) return 0;
+			return ((uint32_t)simm << 20) | (2 << 15) | (2 << 7) | 0x13;
+		}
+		simm = SignExtend((BITS(c, 12, 12) << 17) | (rs2 << 12), 18);
+		if (simm == 0) return 0;
+		return ((uint32_t)simm & 0xfffff000) | (rd << 7) | 0x37;
+	case 0x0c: // arithmetic on rs1'
+		imm = (BITS(c, 12, 12) << 5) | rs2;
+		switch (BITS(c, 11, 10)) {
+		case 0: // c.srli
+			return (imm << 20) | (rs1p << 15) | (5 << 12) | (rs1p << 7) | 0x13;
+		case 1: // c.srai
+			return (0x400u << 20) | (imm << 20) | (rs1p << 15) | (5 << 12) | (rs1p << 7) | 0x13;
+		case 2: // c.andi
+			return ((uint32_t)SignExtend(imm, 6) << 20) | (rs1p << 15) | (7 << 12) | (rs1p << 7) | 0x13;
+		default:
+			if (BITS(c, 12, 12))
+				return 0; // RV64 only
+			switch (BITS(c, 6, 5)) {
+			case 0: return (0x20u << 25) | (rdp << 20) | (rs1p << 15) | (rs1p << 7) | 0x33; // c.sub
+			case 1: return (rdp << 20) | (rs1p << 15) | (4 << 12) | (rs1p << 7) | 0x33; // c.xor
+			case 2: return (rdp << 20) | (rs1p << 15) | (6 << 12) | (rs1p << 7) | 0x33; // c.or
+			default: return (rdp << 20) | (rs1p << 15) | (7 << 12) | (rs1p << 7) | 0x33; // c.and
+			}
+		}
+	case 0x0e: // c.beqz
+	case 0x0f: // c.bnez
+		simm = SignExtend((BITS(c, 12, 12) << 8) | (BITS(c, 6, 5) << 6) | (BITS(c, 2, 2) << 5) | (BITS(c, 11, 10) << 3) | (BITS(c, 4, 3) << 1), 9);
+		imm = (uint32_t)simm;
+		return (BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | (rs1p << 15) | ((BITS(c, 13, 13)) << 12) |
+			(BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | 0x63;
+	case 0x10: // c.slli
+		if (BITS(c, 12, 12)) return 0;
+		return (rs2 << 20) | (rd << 15) | (1 << 12) | (rd << 7) | 0x13;
+	case 0x12: // c.lwsp
+		if (rd == 0) return 0;
+		imm = (BITS(c, 3, 2) << 6) | (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2);
+		return (imm << 20) | (2 << 15) | (2 << 12) | (rd << 7) | 0x03;
+	case 0x14:
+		if (BITS(c, 12, 12) == 0) {
+			if (rs2 == 0) { // c.jr
+				if (rd == 0) return 0;
+				return (rd << 15) | 0x67;
+			}
+			return (rs2 << 20) | (rd << 7) | 0x33; // c.mv
+		}
+		if (rs2 == 0) {
+			if (rd == 0) return 0x00100073; // c.ebreak
+			return (rd << 15) | (1 << 7) | 0x67; // c.jalr
+		}
+		return (rs2 << 20) | (rd << 15) | (rd << 7) | 0x33; // c.add
+	case 0x16: // c.swsp
+		imm = (BITS(c, 8, 7) << 6) | (BITS(c, 12, 9) << 2);
+		return (BITS(imm, 11, 5) << 25) | (rs2 << 20) | (2 << 15) | (2 << 12) | (BITS(imm, 4, 0) << 7) | 0x23;
+	default: // FP loads/stores (and WCH XW) and reserved encodings
+		return 0;
+	}
+} /* rv32simExpand() */
+
+// one instruction; returns -1 to keep going or a stop reason
+static int rv32simStep(RV32SIM *pSim)
+{
+	uint32_t pc = pSim->pc, insn, u32Half, next, rd, rs1, rs2, funct3, a, b, v = 0, addr, csr;
+	int iCycles = CYC_BASE, iSym, bCompressed;
+	int32_t imm;
+
+	if (rv32simRead(pSim, pc, 2, &u32Half))
+		return RV32SIM_BUS_ERROR;
+	bCompressed = ((u32Half & 3) != 3);
+	if (bCompressed) {
+		insn = rv32simExpand((uint16_t)u32Half);
+		next = pc + 2;
+	} else {
+		uint32_t u32Hi;
+		if (rv32simRead(pSim, pc + 2, 2, &u32Hi))
+			return RV32SIM_BUS_ERROR;
+		insn = u32Half | (u32Hi << 16);
+		next = pc + 4;
+		if (pc & 2)
+			iCycles += CYC_SPLIT_FETCH;
+	}
+	if (pSim->iFlashWait)
+		iCycles += rv32simFetchWait(pSim, pc, (int)(next - pc));
+	pSim->u32StopPC = pc;
+	pSim->u32StopInsn = bCompressed ? u32Half : insn;
+	if (insn == 0)
+		return RV32SIM_ILLEGAL;
+	rd = BITS(insn, 11, 7);
+	rs1 = BITS(insn, 19, 15);
+	rs2 = BITS(insn, 24, 20);
+	funct3 = BITS(insn, 14, 12);
+	if (rd > 15 || rs1 > 15 || rs2 > 15) { // RV32E has 16 registers
+		switch (insn & 0x7f) { // only check the fields each format uses
+		case 0x37: case 0x17: case 0x6f:
+			if (rd > 15) return RV32SIM_ILLEGAL;
+			break;
+		case 0x13: case 0x03: case 0x67:
+			if (rd > 15 || rs1 > 15) return RV32SIM_ILLEGAL;
+			break;
+		case 0x73:
+			if (rd > 15 || (funct3 < 4 && rs1 > 15)) return RV32SIM_ILLEGAL;
+			break;
+		case 0x23: case 0x63:
+			if (rs1 > 15 || rs2 > 15) return RV32SIM_ILLEGAL;
+			break;
+		case 0x0f:
+			break;
+		default:
+			return RV32SIM_ILLEGAL;
+		}
+	}
+	a = pSim->x[rs1 & 15];
+	b = pSim->x[rs2 & 15];
+	switch (insn & 0x7f) {
+	case 0x37: // lui
+		v = insn & 0xfffff000;
+		break;
+	case 0x17: // auipc
+		v = pc + (insn & 0xfffff000);
+		break;
+	case 0x6f: // jal
+		imm = SignExtend((BITS(insn, 31, 31) << 20) | (BITS(insn, 19, 12) << 12) | (BITS(insn, 20, 20) << 11) | (BITS(insn, 30, 21) << 1), 21);
+		v = next;
+		next = pc + imm;
+		iCycles = CYC_JUMP;
+		break;
+	case 0x67: // jalr
+		if (funct3) return RV32SIM_ILLEGAL;
+		v = next;
+		next = (a + SignExtend(insn >> 20, 12)) & ~1u;
+		iCycles = CYC_JUMP;
+		break;
+	case 0x63: // branches
+		imm = SignExtend((BITS(insn, 31, 31) << 12) | (BITS(insn, 7, 7) << 11) | (BITS(insn, 30, 25) << 5) | (BITS(insn, 11, 8) << 1), 13);
+		switch (funct3) {
+		case 0: v = (a == b); break;
+		case 1: v = (a != b); break;
+		case 4: v = ((int32_t)a < (int32_t)b); break;
+		case 5: v = ((int32_t)a >= (int32_t)b); break;
+		case 6: v = (a < b); break;
+		case 7: v = (a >= b); break;
+		default: return RV32SIM_ILLEGAL;
+		}
+		if (v) {
+			next = pc + imm;
+			iCycles = CYC_JUMP;
+		}
+		rd = 0; // no register written
+		break;
+	case 0x03: // loads
+		addr = a + SignExtend(insn >> 20, 12);
+		switch (funct3) {
+		case 0: if (rv32simRead(pSim, addr, 1, &v)) return RV32SIM_BUS_ERROR; v = (uint32_t)SignExtend(v, 8); break;
+		case 1: if (rv32simRead(pSim, addr, 2, &v)) return RV32SIM_BUS_ERROR; v = (uint32_t)SignExtend(v, 16); break;
+		case 2: if (rv32simRead(pSim, addr, 4, &v)) return RV32SIM_BUS_ERROR; break;
+		case 4: if (rv32simRead(pSim, addr, 1, &v)) return RV32SIM_BUS_ERROR; break;
+		case 5: if (rv32simRead(pSim, addr, 2, &v)) return RV32SIM_BUS_ERROR; break;
+		default: return RV32SIM_ILLEGAL;
+		}
+		iCycles += CYC_MEM - CYC_BASE;
+		if (rv32simIsFlash(addr)) // constant tables
+			iCycles += pSim->iFlashWait;
+		break;
+	case 0x23: // stores
+		addr = a + SignExtend((BITS(insn, 31, 25) << 5) | BITS(insn, 11, 7), 12);
+		if (funct3 > 2) return RV32SIM_ILLEGAL;
+		if (rv32simWrite(pSim, addr, 1 << funct3, b)) return RV32SIM_BUS_ERROR;
+		iCycles += CYC_MEM - CYC_BASE;
+		rd = 0;
+		break;
+	case 0x13: // immediate ALU
+		imm = SignExtend(insn >> 20, 12);
+		switch (funct3) {
+		case 0: v = a + imm; break;
+		case 1: if (BITS(insn, 31, 25)) return RV32SIM_ILLEGAL; v = a << rs2; break;
+		case 2: v = ((int32_t)a < imm); break;
+		case 3: v = (a < (uint32_t)imm); break;
+		case 4: v = a ^ imm; break;
+		case 5:
+			if (BITS(insn, 31, 25) == 0x20) v = (uint32_t)((int32_t)a >> rs2);
+			else if (BITS(insn, 31, 25) == 0) v = a >> rs2;
+			else return RV32SIM_ILLEGAL;
+			break;
+		case 6: v = a | imm; break;
+		default: v = a & imm; break;
+		}
+		break;
+	case 0x33: // register ALU (no M extension on the V2A)
+		switch ((BITS(insn, 31, 25) << 3) | funct3) {
+		case 0x000: v = a + b; break;
+		case 0x100: v = a - b; break;
+		case 0x001: v = a << (b & 31); break;
+		case 0x002: v = ((int32_t)a < (int32_t)b); break;
+		case 0x003: v = (a < b); break;
+		case 0x004: v = a ^ b; break;
+		case 0x005: v = a >> (b & 31); break;
+		case 0x105: v = (uint32_t)((int32_t)a >> (b & 31)); break;
+		case 0x006: v = a | b; break;
+		case 0x007: v = a & b; break;
+		default: return RV32SIM_ILLEGAL;
+		}
+		break;
+	case 0x0f: // fence
+		rd = 0;
+		break;
+	case 0x73: // system
+		if (funct3 == 0) {
+			rd = 0;
+			if (insn == 0x00000073 || insn == 0x00100073)
+				return RV32SIM_BREAK;
+			if (insn == 0x10500073) { // wfi
+				pSim->pc = next;
+				pSim->u64Cycles += iCycles;
+				pSim->u64Instructions++;
+				return RV32SIM_WFI;
+			}
+			if (insn == 0x30200073) { // mret
+				uint32_t u32Status = pSim->u32CSR[CSR_MSTATUS];
+				u32Status = (u32Status & ~MSTATUS_MIE) | ((u32Status & MSTATUS_MPIE) ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+				pSim->u32CSR[CSR_MSTATUS] = u32Status;
+				next = pSim->u32CSR[CSR_MEPC];
+				iCycles = CYC_JUMP;
+				break;
+			}
+			return RV32SIM_ILLEGAL;
+		}
+		csr = insn >> 20;
+		v = pSim->u32CSR[csr];
+		b = (funct3 & 4) ? rs1 : a; // immediate forms
+		switch (funct3 & 3) {
+		case 1: pSim->u32CSR[csr] = b; break;
+		case 2: if (rs1) pSim->u32CSR[csr] = v | b; break;
+		case 3: if (rs1) pSim->u32CSR[csr] = v & ~b; break;
+		default: return RV32SIM_ILLEGAL;
+		}
+		break;
+	default:
+		return RV32SIM_ILLEGAL;
+	}
+	if (rd)
+		pSim->x[rd] = v;
+	// profile: the instruction belongs to the function around pc
+	iSym = rv32simSymbolAt(pSim, pc);
+	if (iSym >= 0) {
+		pSim->symbols[iSym].u64Cycles += iCycles;
+		pSim->symbols[iSym].u64Instructions++;
+	}
+	if (rd == 1 && ((insn & 0x7f) == 0x6f || (insn & 0x7f) == 0x67)) { // a call
+		iSym = rv32simSymbolAt(pSim, next);
+		if (iSym >= 0 && (next < RV32SIM_FLASH_SIZE ? next + RV32SIM_FLASH_BASE : next) == pSim->symbols[iSym].u32Addr)
+			pSim->symbols[iSym].u32Calls++;
+	}
+	pSim->u64Cycles += iCycles;
+	pSim->u64Instructions++;
+	pSim->pc = next;
+	return -1;
+} /* rv32simStep() */
+
+int rv32simRun(RV32SIM *pSim, uint64_t u64MaxInstructions)
+{
+	uint64_t u64End = pSim->u64Instructions + u64MaxInstructions;
+	int rc;
+
+	while (1) {
+		if (pSim->pc == RV32SIM_RETURN)
+			return RV32SIM_RETURNED;
+		if (u64MaxInstructions && pSim->u64Instructions >= u64End)
+			return RV32SIM_LIMIT;
+		rc = rv32simStep(pSim);
+		if (rc >= 0)
+			return rc;
+	}
+} /* rv32simRun() */
+
+int rv32simCall(RV32SIM *pSim, uint32_t u32Addr, const uint32_t *pArgs, int iArgs, uint64_t u64MaxInstructions)
+{
+	int i;
+
+	pSim->x[1] = RV32SIM_RETURN;
+	pSim->x[2] = RV32SIM_RAM_BASE + RV32SIM_RAM_SIZE; // stack at the top of RAM
+	if (pSim->u32GP)
+		pSim->x[3] = pSim->u32GP;
+	if (iArgs > 6)
+		pSim->x[2] -= (iArgs - 6) * 4;
+	for (i=0; i<iArgs; i++) {
+		if (i < 6)
+			pSim->x[10 + i] = pArgs[i];
+		else
+			rv32simWrite(pSim, pSim->x[2] + (i - 6) * 4, 4, pArgs[i]);
+	}
+	if (u32Addr - RV32SIM_FLASH_BASE < RV32SIM_FLASH_SIZE && pSim->u32Entry < RV32SIM_FLASH_SIZE)
+		u32Addr -= RV32SIM_FLASH_BASE; // run it at the boot alias it was linked for, or calls into RAM miss
+	pSim->pc = u32Addr;
+	i = rv32simSymbolAt(pSim, u32Addr);
+	if (i >= 0)
+		pSim->symbols[i].u32Calls++;
+	return rv32simRun(pSim, u64MaxInstructions);
+} /* rv32simCall() */
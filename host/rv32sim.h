@@ -0,0 +1,128 @@
+//
+// RV32EC instruction set simulator
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Runs CH32V003 code (RV32E base + C + Zicsr, no M) from an ELF or
+// Intel HEX image and counts cycles, so the cost of a function can be
+// measured without the board. Peripheral registers are plain memory
+// unless the harness hooks them.
+//
+// The cycle model follows the QingKe V2A 2-stage pipeline with 0 wait
+// state flash (HCLK <= 24MHz): 1 cycle per instruction, 2 per load or
+// store, 3 for a taken branch or a jump (refill), +1 for a 32-bit
+// instruction split across two flash words. Above 24MHz the FLASH needs
+// a wait state (FLASH_ACTLR): iFlashWait is added for every new 32-bit
+// word the pipeline fetches from FLASH and for every data load from it;
+// code in RAM (the .ramfunc section) is fetched without. It is meant for
+// comparing changes, not as a datasheet figure.
+// WCH's XW compressed extension isn't decoded; the firmware is built
+// with -march=rv32ec, and anything else stops the run as illegal.
+//
+#ifndef HOST_RV32SIM_H_
+#define HOST_RV32SIM_H_
+
+#include <stdint.h>
+
+#define RV32SIM_FLASH_BASE 0x08000000
+#define RV32SIM_FLASH_SIZE 16384
+#define RV32SIM_RAM_BASE 0x20000000
+#define RV32SIM_RAM_SIZE 2048
+// host-only memory after the RAM for benchmark arguments (strings, buffers)
+#define RV32SIM_SCRATCH_BASE 0x20010000
+#define RV32SIM_SCRATCH_SIZE 4096
+#define RV32SIM_PERIPH_BASE 0x40000000
+#define RV32SIM_PERIPH_SIZE 0x24000
+#define RV32SIM_CORE_BASE 0xe000e000 // PFIC and SysTick
+#define RV32SIM_CORE_SIZE 0x2000
+#define RV32SIM_RETURN 0xfffffff0 // ra of a called function; reaching it ends the run
+#define RV32SIM_MAX_SYMBOLS 512
+// wait states for a clock in MHz
+#define RV32SIM_FLASH_WAIT(mhz) (((mhz) > 24) ? 1 : 0)
+
+// Why a run stopped
+enum {
+	RV32SIM_RETURNED = 0,
+	RV32SIM_WFI, // wfi (sleep or standby entry)
+	RV32SIM_LIMIT, // instruction limit reached
+	RV32SIM_ILLEGAL, // not RV32EC
+	RV32SIM_BUS_ERROR, // unmapped or misaligned access
+	RV32SIM_BREAK // ecall / ebreak
+};
+
+typedef struct tagRV32SimSymbol
+{
+	char szName[40];
+	uint32_t u32Addr, u32Size;
+	int bFunction; // or an object
+	// profile
+	uint64_t u64Cycles, u64Instructions; // spent in this function itself
+	uint32_t u32Calls;
+} RV32SIM_SYMBOL;
+
+typedef struct tagRV32Sim RV32SIM;
+// Peripheral hook; return 1 if the access was handled (*pValue is the read result)
+typedef int (*RV32SIM_IO)(RV32SIM *pSim, uint32_t u32Addr, int iSize, int bWrite, uint32_t *pValue);
+
+struct tagRV32Sim
+{
+	uint32_t x[16];
+	uint32_t pc;
+	uint32_t u32CSR[4096];
+	uint8_t u8Flash[RV32SIM_FLASH_SIZE];
+	uint8_t u8RAM[RV32SIM_RAM_SIZE];
+	uint8_t u8Scratch[RV32SIM_SCRATCH_SIZE];
+	uint8_t u8Periph[RV32SIM_PERIPH_SIZE];
+	uint8_t u8Core[RV32SIM_CORE_SIZE];
+	uint8_t u8RAMImage[RV32SIM_RAM_SIZE]; // initialized data from the image
+	uint32_t u32Entry;
+	uint32_t u32GP; // __global_pointer$ from the ELF, for calls without the startup code
+	RV32SIM_IO pfnIO;
+	void *pUser;
+	int iFlashWait; // wait states: 0 up to 24MHz, 1 above
+	int bWaitRAM; // charge them for code fetched from RAM too (as if it was in FLASH)
+	uint32_t u32FetchWord; // address of the word the pipeline fetched last
+	uint64_t u64Cycles, u64Instructions;
+	uint32_t u32StopPC; // where the run stopped
+	uint32_t u32StopInsn;
+	RV32SIM_SYMBOL symbols[RV32SIM_MAX_SYMBOLS]; // functions, sorted by address
+	int iSymbols;
+	int iLastSymbol; // cache for the profiler
+};
+
+void rv32simInit(RV32SIM *pSim);
+// Load an image into FLASH (and the RAM image for ELF .data); returns 0 on success
+int rv32simLoadELF(RV32SIM *pSim, const char *szFile);
+int rv32simLoadHex(RV32SIM *pSim, const char *szFile);
+// Put the CPU in the power-on state (RAM from the image, pc at the entry point)
+void rv32simReset(RV32SIM *pSim);
+// Run until one of the stop reasons above (u64MaxInstructions = 0 for no limit)
+int rv32simRun(RV32SIM *pSim, uint64_t u64MaxInstructions);
+// Call a function: 6 arguments in a0-a5, the rest on the stack; the result is in x[10]
+// (symbols in FLASH are at RV32SIM_FLASH_BASE, an image linked at 0 runs at 0)
+int rv32simCall(RV32SIM *pSim, uint32_t u32Addr, const uint32_t *pArgs, int iArgs, uint64_t u64MaxInstructions);
+RV32SIM_SYMBOL *rv32simFindSymbol(RV32SIM *pSim, const char *szName);
+void rv32simClearProfile(RV32SIM *pSim);
+// Memory access from the harness (any mapped region)
+int rv32simRead(RV32SIM *pSim, uint32_t u32Addr, int iSize, uint32_t *pValue);
+int rv32simWrite(RV32SIM *pSim, uint32_t u32Addr, int iSize, uint32_t u32Value);
+const char *rv32simStopReason(int iReason);
+// Hook for running without peripheral models: polled status bits read as ready
+int rv32simStubIO(RV32SIM *pSim, uint32_t u32Addr, int iSize, int bWrite, uint32_t *pValue);
+
+#endif /* HOST_RV32SIM_H_ */
@@ -0,0 +1,292 @@
+//
+// Firmware cycle benchmarks
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Calls firmware functions in the instruction set simulator and reports
+// the cycles each one takes, with the functions the time went to.
+// The report only depends on the image and the script, so two builds can
+// be compared line by line:
+//
+// rvbench <firmware .elf> <script> [-mhz <clock>] [-flash] [-baseline <old report>]
+//  -mhz       HCLK, for the FLASH wait states (none up to 24MHz) and the
+//             time in us; the default is 24
+//  -flash     charge the wait states for the .ramfunc code as well, as if
+//             it was in FLASH, to see what running it from RAM saves
+//
+// Script lines are "label function arguments..."; an argument is a number,
+// a symbol (its address, +offset allowed), a "string" or buf:<size>,
+// both of which are put in the scratch memory after the RAM.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "rv32sim.h"
+
+#define MAX_ARGS 10
+#define MAX_INSTRUCTIONS 50000000
+#define TOP_FUNCTIONS 5
+#define MAX_BASELINE 100
+
+typedef struct tagBaseline
+{
+	char szLabel[40];
+	uint64_t u64Cycles;
+} BASELINE;
+
+static RV32SIM *pSim;
+static int iMHz = 24;
+static BASELINE baseline[MAX_BASELINE];
+static int iBaselines;
+static uint32_t u32ScratchNext;
+
+// string argument (C escapes) into scratch memory
+static int ScratchString(const char *s, int iLen, uint32_t *pAddr)
+{
+	uint32_t u32Addr = u32ScratchNext;
+	int i;
+
+	for (i=0; i<iLen; i++) {
+		unsigned int c = (unsigned char)s[i];
+		if (c == '\\' && i + 1 < iLen) {
+			c = (unsigned char)s[++i];
+			if (c == 'n') c = '\n';
+			else if (c == 't') c = '\t';
+			else if (c == '0') c = 0;
+			else if (c == 'x' && i + 2 < iLen) {
+				sscanf(&s[i+1], "%2x", &c);
+				i += 2;
+			}
+		}
+		if (rv32simWrite(pSim, u32ScratchNext++, 1, c))
+			return -1;
+	}
+	if (rv32simWrite(pSim, u32ScratchNext++, 1, 0))
+		return -1;
+	u32ScratchNext = (u32ScratchNext + 3) & ~3u;
+	*pAddr = u32Addr;
+	return 0;
+} /* ScratchString() */
+
+// one argument; returns the text after it or NULL on error
+static const char *ParseArg(const char *s, uint32_t *pValue)
+{
+	const char *pEnd;
+	char szName[64];
+	RV32SIM_SYMBOL *pSym;
+	int i;
+
+	if (*s == '"') {
+		pEnd = s + 1;
+		while (*pEnd && *pEnd != '"') {
+			if (*pEnd == '\\' && pEnd[1])
+				pEnd++;
+			pEnd++;
+		}
+		if (*pEnd != '"' || ScratchString(s + 1, (int)(pEnd - s - 1), pValue))
+			return NULL;
+		return pEnd + 1;
+	}
+	if (strncmp(s, "buf:", 4) == 0) {
+		i = (int)strtol(s + 4, (char **)&pEnd, 0);
+		if (i <= 0 || u32ScratchNext + i > RV32SIM_SCRATCH_BASE + RV32SIM_SCRATCH_SIZE)
+			return NULL;
+		*pValue = u32ScratchNext; // scratch is zeroed by rv32simReset()
+		u32ScratchNext = (u32ScratchNext + i + 3) & ~3u;
+		return pEnd;
+	}
+	if (isdigit((unsigned char)*s) || *s == '-') {
+		*pValue = (uint32_t)strtoll(s, (char **)&pEnd, 0);
+		return pEnd;
+	}
+	for (i=0; i<(int)sizeof(szName)-1 && (isalnum((unsigned char)s[i]) || s[i] == '_'); i++)
+		szName[i] = s[i];
+	szName[i] = 0;
+	pSym = rv32simFindSymbol(pSim, szName);
+	if (!pSym)
+		return NULL;
+	*pValue = pSym->u32Addr;
+	s += i;
+	if (*s == '+')
+		*pValue += (uint32_t)strtol(s + 1, (char **)&s, 0);
+	return s;
+} /* ParseArg() */
+
+static int CompareCycles(const void *p1, const void *p2)
+{
+	const RV32SIM_SYMBOL *s1 = *(const RV32SIM_SYMBOL * const *)p1, *s2 = *(const RV32SIM_SYMBOL * const *)p2;
+
+	if (s1->u64Cycles != s2->u64Cycles)
+		return (s1->u64Cycles < s2->u64Cycles) ? 1 : -1;
+	return strcmp(s1->szName, s2->szName);
+} /* CompareCycles() */
+
+static void PrintDelta(const char *szLabel, uint64_t u64Cycles)
+{
+	int i;
+	long long llDelta;
+
+	for (i=0; i<iBaselines; i++) {
+		if (strcmp(baseline[i].szLabel, szLabel) == 0) {
+			llDelta = (long long)u64Cycles - (long long)baseline[i].u64Cycles;
+			printf(" delta %+lld (%+.1f%%)", llDelta, baseline[i].u64Cycles ? 100.0 * llDelta / baseline[i].u64Cycles : 0.0);
+			return;
+		}
+	}
+	if (iBaselines)
+		printf(" delta new");
+} /* PrintDelta() */
+
+// run one script line; returns 0 if the function came back (or reached wfi)
+static int RunBench(const char *szLine, int iLine)
+{
+	char szLabel[40], szFunction[64];
+	uint32_t u32Args[MAX_ARGS];
+	RV32SIM_SYMBOL *pFunction, *pTop[RV32SIM_MAX_SYMBOLS];
+	const char *s;
+	int i, n, iArgs = 0, iTop = 0, rc;
+
+	if (sscanf(szLine, "%39s %63s%n", szLabel, szFunction, &n) != 2)
+		return 0; // blank
+	pFunction = rv32simFindSymbol(pSim, szFunction);
+	if (!pFunction) {
+		fprintf(stderr, "line %d: no function %s in the image\n", iLine, szFunction);
+		return -1;
+	}
+	rv32simReset(pSim); // same RAM contents for every bench
+	pSim->pfnIO = rv32simStubIO;
+	u32ScratchNext = RV32SIM_SCRATCH_BASE;
+	s = szLine + n;
+	while (1) {
+		while (*s == ' ' || *s == '\t')
+			s++;
+		if (*s == 0 || *s == '\n' || *s == '\r' || *s == '#')
+			break;
+		if (iArgs == MAX_ARGS || (s = ParseArg(s, &u32Args[iArgs])) == NULL) {
+			fprintf(stderr, "line %d: bad argument %d\n", iLine, iArgs + 1);
+			return -1;
+		}
+		iArgs++;
+	}
+	rv32simClearProfile(pSim);
+	rc = rv32simCall(pSim, pFunction->u32Addr, u32Args, iArgs, MAX_INSTRUCTIONS);
+	printf("bench %-24s cycles %10llu instret %10llu us %9.1f", szLabel, (unsigned long long)pSim->u64Cycles,
+		(unsigned long long)pSim->u64Instructions, (double)pSim->u64Cycles / iMHz);
+	PrintDelta(szLabel, pSim->u64Cycles);
+	printf("\n");
+	for (i=0; i<pSim->iSymbols; i++) {
+		if (pSim->symbols[i].u64Cycles)
+			pTop[iTop++] = &pSim->symbols[i];
+	}
+	qsort(pTop, iTop, sizeof(pTop[0]), CompareCycles);
+	for (i=0; i<iTop && i<TOP_FUNCTIONS; i++)
+		printf("    %-28s cycles %10llu instret %10llu calls %6u\n", pTop[i]->szName, (unsigned long long)pTop[i]->u64Cycles,
+			(unsigned long long)pTop[i]->u64Instructions, pTop[i]->u32Calls);
+	if (rc != RV32SIM_RETURNED && rc != RV32SIM_WFI) {
+		fprintf(stderr, "%s: %s at %08x (%08x)\n", szLabel, rv32simStopReason(rc), pSim->u32StopPC, pSim->u32StopInsn);
+		return -1;
+	}
+	return 0;
+} /* RunBench() */
+
+static void ReadBaseline(const char *szFile)
+{
+	char szLine[256];
+	unsigned long long ull;
+	FILE *f;
+
+	f = fopen(szFile, "r");
+	if (!f) {
+		fprintf(stderr, "can't read the baseline %s\n", szFile);
+		return;
+	}
+	while (iBaselines < MAX_BASELINE && fgets(szLine, sizeof(szLine), f)) {
+		if (sscanf(szLine, "bench %39s cycles %llu", baseline[iBaselines].szLabel, &ull) == 2)
+			baseline[iBaselines++].u64Cycles = ull;
+	}
+	fclose(f);
+} /* ReadBaseline() */
+
+// the functions linked to run from RAM and what they cost there
+static void PrintRAMCode(void)
+{
+	uint32_t u32Bytes = 0;
+	int i, iCount = 0;
+
+	for (i=0; i<pSim->iSymbols; i++) {
+		RV32SIM_SYMBOL *pSym = &pSim->symbols[i];
+		if (pSym->bFunction && pSym->u32Addr - RV32SIM_RAM_BASE < RV32SIM_RAM_SIZE) {
+			printf("ramfunc %-28s %5u bytes\n", pSym->szName, pSym->u32Size);
+			u32Bytes += pSym->u32Size;
+			iCount++;
+		}
+	}
+	printf("ramfunc total %u bytes in %d functions, %dMHz, %d FLASH wait state%s%s\n", u32Bytes, iCount, iMHz,
+		pSim->iFlashWait, (pSim->iFlashWait == 1) ? "" : "s", pSim->bWaitRAM ? " (charged to RAM code too)" : "");
+} /* PrintRAMCode() */
+
+int main(int argc, char *argv[])
+{
+	char szLine[512];
+	const char *szBaseline = NULL;
+	FILE *f;
+	int i, iLine = 0, iFailed = 0, bFlash = 0;
+
+	for (i=3; i<argc; i++) {
+		if (strcmp(argv[i], "-mhz") == 0 && i+1 < argc)
+			iMHz = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-flash") == 0)
+			bFlash = 1;
+		else if (strcmp(argv[i], "-baseline") == 0 && i+1 < argc)
+			szBaseline = argv[++i];
+		else
+			argc = 0;
+	}
+	if (argc < 3 || iMHz <= 0) {
+		fprintf(stderr, "usage: rvbench <firmware .elf> <script> [-mhz <clock>] [-flash] [-baseline <old report>]\n");
+		return 2;
+	}
+	pSim = (RV32SIM *)malloc(sizeof(RV32SIM));
+	if (!pSim)
+		return 2;
+	rv32simInit(pSim);
+	if (rv32simLoadELF(pSim, argv[1]) || pSim->iSymbols == 0) {
+		fprintf(stderr, "can't load %s (an ELF with symbols is needed)\n", argv[1]);
+		return 2;
+	}
+	pSim->iFlashWait = RV32SIM_FLASH_WAIT(iMHz);
+	pSim->bWaitRAM = bFlash;
+	if (szBaseline)
+		ReadBaseline(szBaseline);
+	PrintRAMCode();
+	f = fopen(argv[2], "r");
+	if (!f) {
+		fprintf(stderr, "can't read %s\n", argv[2]);
+		return 2;
+	}
+	while (fgets(szLine, sizeof(szLine), f)) {
+		iLine++;
+		if (szLine[0] == '#')
+			continue;
+		if (RunBench(szLine, iLine))
+			iFailed++;
+	}
+	fclose(f);
+	free(pSim);
+	return iFailed ? 1 : 0;
+} /* main() */
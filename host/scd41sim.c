@@ -0,0 +1,404 @@
+//
+// SCD41 CO2 sensor model for the host build
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "scd41sim.h"
+
+#define MS_NS 1000000ull
+#define SEC_NS 1000000000ull
+#define PERIOD_NORMAL_NS (5 * SEC_NS)
+#define PERIOD_LOW_POWER_NS (30 * SEC_NS)
+#define SINGLE_SHOT_NS (5 * SEC_NS)
+#define FRC_MIN_RUN_NS (180 * SEC_NS) // periodic measurement needed before a recalibration
+
+// states a command is accepted in
+#define IN_IDLE (1 << SCD41SIM_IDLE)
+#define IN_MEASURING ((1 << SCD41SIM_PERIODIC) | (1 << SCD41SIM_LOW_POWER))
+#define IN_AWAKE (IN_IDLE | IN_MEASURING)
+
+typedef struct tagSCD41SimCmd
+{
+	uint16_t u16Cmd;
+	uint16_t u16ExecMs;
+	uint8_t bArg; // followed by a word + CRC
+	uint8_t u8States;
+} SCD41SIM_CMD;
+
+// every command in User/scd41.h
+static const SCD41SIM_CMD commands[] = {
+	{0x21b1, 0, 0, IN_IDLE}, // start periodic measurement
+	{0x21ac, 0, 0, IN_IDLE}, // start low power periodic measurement
+	{0x219d, 5000, 0, IN_IDLE}, // measure single shot
+	{0xec05, 1, 0, IN_AWAKE}, // read measurement
+	{0x3f86, 500, 0, IN_AWAKE}, // stop periodic measurement
+	{0x2416, 1, 1, IN_IDLE}, // set automatic self calibration enabled
+	{0xe4b8, 1, 0, IN_AWAKE}, // get data ready status
+	{0x36e0, 1, 0, IN_IDLE}, // power down
+	{0x36f6, 20, 0, IN_IDLE}, // wake up (sleep is handled when addressed)
+	{0x362f, 400, 1, IN_IDLE} // perform forced recalibration
+};
+
+uint8_t scd41simCRC8(const uint8_t *pData, int iLen)
+{
+	uint8_t u8CRC = 0xff;
+	int i;
+
+	while (iLen--) {
+		u8CRC ^= *pData++;
+		for (i=0; i<8; i++)
+			u8CRC = (u8CRC & 0x80) ? (uint8_t)((u8CRC << 1) ^ 0x31) : (uint8_t)(u8CRC << 1);
+	}
+	return u8CRC;
+} /* scd41simCRC8() */
+
+// consume one use of a fault; returns 1 if it applies
+static int scd41simTakeFault(SCD41SIM *pSim, int iFault)
+{
+	if (pSim->iFault[iFault] == 0)
+		return 0;
+	if (pSim->iFault[iFault] > 0)
+		pSim->iFault[iFault]--;
+	return 1;
+} /* scd41simTakeFault() */
+
+void scd41simSample(const SCD41SIM *pSim, uint64_t u64Ns, float *pCO2, float *pTemperature, float *pHumidity)
+{
+	const SCD41SIM_POINT *p0, *p1;
+	double dSecs = (double)u64Ns / SEC_NS, dT;
+	int i;
+
+	if (pSim->iPoints == 0) {
+		*pCO2 = 420.0f; *pTemperature = 22.0f; *pHumidity = 45.0f;
+		return;
+	}
+	for (i=1; i<pSim->iPoints && pSim->points[i].u32Secs < dSecs; i++) {}
+	if (i == pSim->iPoints || dSecs <= pSim->points[0].u32Secs) { // hold the ends
+		p0 = &pSim->points[(dSecs <= pSim->points[0].u32Secs) ? 0 : pSim->iPoints-1];
+		*pCO2 = p0->fCO2; *pTemperature = p0->fTemperature; *pHumidity = p0->fHumidity;
+		return;
+	}
+	p0 = &pSim->points[i-1];
+	p1 = &pSim->points[i];
+	dT = (dSecs - p0->u32Secs) / (double)(p1->u32Secs - p0->u32Secs);
+	*pCO2 = (float)(p0->fCO2 + (p1->fCO2 - p0->fCO2) * dT);
+	*pTemperature = (float)(p0->fTemperature + (p1->fTemperature - p0->fTemperature) * dT);
+	*pHumidity = (float)(p0->fHumidity + (p1->fHumidity - p0->fHumidity) * dT);
+} /* scd41simSample() */
+
+static uint16_t scd41simWord(double d, double dMax)
+{
+	if (d < 0) d = 0;
+	if (d > dMax) d = dMax;
+	return (uint16_t)(d + 0.5);
+} /* scd41simWord() */
+
+static void scd41simMeasure(SCD41SIM *pSim, uint64_t u64Ns)
+{
+	float fCO2, fTemperature, fHumidity;
+
+	scd41simSample(pSim, u64Ns, &fCO2, &fTemperature, &fHumidity);
+	if (pSim->bReady)
+		pSim->stats.u32Missed++;
+	pSim->u16CO2 = scd41simWord(fCO2 + pSim->iFRCCorrection, 40000);
+	pSim->u16Temperature = scd41simWord((fTemperature + 45.0) * 65535.0 / 175.0, 65535);
+	pSim->u16Humidity = scd41simWord(fHumidity * 65535.0 / 100.0, 65535);
+	pSim->bReady = 1;
+	pSim->u64ReadyNs = u64Ns;
+	pSim->stats.u32Measurements++;
+} /* scd41simMeasure() */
+
+// run the measurement schedule up to now
+static void scd41simUpdate(SCD41SIM *pSim)
+{
+	uint64_t u64Now = hostNanos();
+	uint64_t u64Period = (pSim->iState == SCD41SIM_LOW_POWER) ? PERIOD_LOW_POWER_NS : PERIOD_NORMAL_NS;
+
+	if (pSim->iState == SCD41SIM_PERIODIC || pSim->iState == SCD41SIM_LOW_POWER) {
+		while (u64Now >= pSim->u64Next) {
+			scd41simMeasure(pSim, pSim->u64Next);
+			pSim->u64Next += u64Period;
+		}
+	} else if (pSim->bSingleShot && u64Now >= pSim->u64Next) {
+		scd41simMeasure(pSim, pSim->u64Next);
+		pSim->bSingleShot = 0;
+	}
+} /* scd41simUpdate() */
+
+static void scd41simRespond(SCD41SIM *pSim, int iWords, uint16_t u16W0, uint16_t u16W1, uint16_t u16W2)
+{
+	pSim->u16Response[0] = u16W0;
+	pSim->u16Response[1] = u16W1;
+	pSim->u16Response[2] = u16W2;
+	pSim->iResponseWords = iWords;
+	pSim->iReadPos = 0;
+	pSim->u64ResponseAt = pSim->u64BusyUntil;
+} /* scd41simRespond() */
+
+static void scd41simExecute(SCD41SIM *pSim, const SCD41SIM_CMD *pCmd, uint16_t u16Arg)
+{
+	uint64_t u64Now = hostNanos();
+	float fCO2, fTemperature, fHumidity;
+	int iCorrection;
+
+	pSim->stats.u32Commands++;
+	pSim->u64BusyUntil = u64Now + pCmd->u16ExecMs * MS_NS;
+	pSim->iResponseWords = 0;
+	switch (pCmd->u16Cmd) {
+	case 0x21b1:
+	case 0x21ac:
+		pSim->iState = (pCmd->u16Cmd == 0x21b1) ? SCD41SIM_PERIODIC : SCD41SIM_LOW_POWER;
+		pSim->u64Next = u64Now + ((pCmd->u16Cmd == 0x21b1) ? PERIOD_NORMAL_NS : PERIOD_LOW_POWER_NS);
+		pSim->u64PeriodicStart = u64Now;
+		break;
+	case 0x219d:
+		pSim->bSingleShot = 1;
+		pSim->u64Next = u64Now + SINGLE_SHOT_NS;
+		break;
+	case 0xec05:
+		if (pSim->bReady) {
+			scd41simRespond(pSim, 3, pSim->u16CO2, pSim->u16Temperature, pSim->u16Humidity);
+			pSim->bReady = 0;
+			pSim->stats.u32Reads++;
+			pSim->stats.u64LatencyNs += u64Now - pSim->u64ReadyNs;
+			if (u64Now - pSim->u64ReadyNs > pSim->stats.u64MaxLatencyNs)
+				pSim->stats.u64MaxLatencyNs = u64Now - pSim->u64ReadyNs;
+		} // else the read is NACKed
+		break;
+	case 0x3f86:
+		if (pSim->iState != SCD41SIM_IDLE)
+			pSim->u64PeriodicNs = u64Now - pSim->u64PeriodicStart;
+		pSim->iState = SCD41SIM_IDLE;
+		pSim->bSingleShot = 0;
+		break;
+	case 0x2416:
+		pSim->bASC = (u16Arg != 0);
+		break;
+	case 0xe4b8:
+		if (pSim->bReady && !scd41simTakeFault(pSim, SCD41SIM_FAULT_NOT_READY)) {
+			pSim->stats.u32ReadyPolls++;
+			scd41simRespond(pSim, 1, 0x8006, 0, 0);
+		} else {
+			pSim->stats.u32NotReadyPolls++;
+			scd41simRespond(pSim, 1, 0x8000, 0, 0);
+		}
+		break;
+	case 0x36e0:
+		pSim->iState = SCD41SIM_SLEEP;
+		pSim->bReady = 0;
+		break;
+	case 0x36f6:
+		break;
+	case 0x362f:
+		scd41simSample(pSim, u64Now, &fCO2, &fTemperature, &fHumidity);
+		if (pSim->u64PeriodicNs < FRC_MIN_RUN_NS || scd41simTakeFault(pSim, SCD41SIM_FAULT_FRC)) {
+			scd41simRespond(pSim, 1, 0xffff, 0, 0);
+		} else {
+			iCorrection = (int)u16Arg - (int)(fCO2 + 0.5f);
+			pSim->iFRCCorrection = iCorrection;
+			scd41simRespond(pSim, 1, (uint16_t)(iCorrection + 0x8000), 0, 0);
+		}
+		break;
+	}
+} /* scd41simExecute() */
+
+static int scd41simStart(HOST_I2C_DEVICE *pDev, int bRead)
+{
+	SCD41SIM *pSim = (SCD41SIM *)pDev->pUser;
+	uint64_t u64Now = hostNanos();
+
+	scd41simUpdate(pSim);
+	pSim->iCmdLen = 0;
+	if (scd41simTakeFault(pSim, SCD41SIM_FAULT_NACK))
+		goto nack;
+	if (pSim->iState == SCD41SIM_SLEEP) { // wake_up is never acknowledged
+		pSim->iState = SCD41SIM_IDLE;
+		pSim->u64BusyUntil = u64Now + 20 * MS_NS;
+		goto nack;
+	}
+	if (u64Now < pSim->u64BusyUntil) {
+		pSim->stats.u32Violations++;
+		goto nack;
+	}
+	if (bRead) {
+		if (pSim->iResponseWords == 0) // nothing to read (e.g. no measurement ready)
+			goto nack;
+		pSim->iReadPos = 0;
+		if (scd41simTakeFault(pSim, SCD41SIM_FAULT_CRC))
+			pSim->iReadPos = -1; // marks this read as corrupted
+	}
+	return 1;
+nack:
+	pSim->stats.u32Nacks++;
+	return 0;
+} /* scd41simStart() */
+
+static int scd41simWrite(HOST_I2C_DEVICE *pDev, uint8_t u8Data)
+{
+	SCD41SIM *pSim = (SCD41SIM *)pDev->pUser;
+	const SCD41SIM_CMD *pCmd = NULL;
+	uint16_t u16Cmd;
+	int i;
+
+	if (pSim->iCmdLen >= (int)sizeof(pSim->u8Cmd))
+		goto nack;
+	pSim->u8Cmd[pSim->iCmdLen++] = u8Data;
+	if (pSim->iCmdLen < 2)
+		return 1;
+	u16Cmd = (uint16_t)((pSim->u8Cmd[0] << 8) | pSim->u8Cmd[1]);
+	for (i=0; i<(int)(sizeof(commands)/sizeof(commands[0])); i++) {
+		if (commands[i].u16Cmd == u16Cmd)
+			pCmd = &commands[i];
+	}
+	if (!pCmd || !(pCmd->u8States & (1 << pSim->iState))) {
+		pSim->stats.u32Illegal++;
+		goto nack;
+	}
+	if (!pCmd->bArg) {
+		if (pSim->iCmdLen == 2)
+			scd41simExecute(pSim, pCmd, 0);
+		else
+			goto nack; // unexpected argument
+		return 1;
+	}
+	if (pSim->iCmdLen == 5) {
+		if (scd41simCRC8(&pSim->u8Cmd[2], 2) != pSim->u8Cmd[4]) {
+			pSim->stats.u32BadCRC++;
+			goto nack;
+		}
+		scd41simExecute(pSim, pCmd, (uint16_t)((pSim->u8Cmd[2] << 8) | pSim->u8Cmd[3]));
+	}
+	return 1;
+nack:
+	pSim->stats.u32Nacks++;
+	return 0;
+} /* scd41simWrite() */
+
+static uint8_t scd41simRead(HOST_I2C_DEVICE *pDev)
+{
+	SCD41SIM *pSim = (SCD41SIM *)pDev->pUser;
+	int bCorrupt = (pSim->iReadPos < 0), iPos, iWord;
+	uint8_t u8Word[2], u8Data;
+
+	iPos = bCorrupt ? -pSim->iReadPos - 1 : pSim->iReadPos;
+	iWord = iPos / 3;
+	if (iWord >= pSim->iResponseWords) {
+		u8Data = 0xff; // past the response
+	} else {
+		u8Word[0] = (uint8_t)(pSim->u16Response[iWord] >> 8);
+		u8Word[1] = (uint8_t)pSim->u16Response[iWord];
+		if (iPos % 3 < 2) {
+			u8Data = u8Word[iPos % 3];
+		} else {
+			u8Data = scd41simCRC8(u8Word, 2);
+			if (bCorrupt) {
+				u8Data ^= 0x5a;
+				pSim->stats.u32CRCFaults++;
+			}
+		}
+	}
+	iPos++;
+	pSim->iReadPos = bCorrupt ? -iPos - 1 : iPos;
+	return u8Data;
+} /* scd41simRead() */
+
+static void scd41simStop(HOST_I2C_DEVICE *pDev)
+{
+	SCD41SIM *pSim = (SCD41SIM *)pDev->pUser;
+
+	if (pSim->iReadPos != 0) // a response is only read once
+		pSim->iResponseWords = 0;
+	pSim->iReadPos = 0;
+} /* scd41simStop() */
+
+void scd41simAttach(SCD41SIM *pSim)
+{
+	memset(pSim, 0, sizeof(SCD41SIM));
+	pSim->iState = SCD41SIM_IDLE;
+	pSim->bASC = 1;
+	pSim->dev.u8Addr = SCD41SIM_ADDR;
+	pSim->dev.pUser = pSim;
+	pSim->dev.pfnStart = scd41simStart;
+	pSim->dev.pfnWrite = scd41simWrite;
+	pSim->dev.pfnRead = scd41simRead;
+	pSim->dev.pfnStop = scd41simStop;
+	hostI2CAttach(&pSim->dev);
+} /* scd41simAttach() */
+
+void scd41simDetach(SCD41SIM *pSim)
+{
+	hostI2CDetach(&pSim->dev);
+} /* scd41simDetach() */
+
+void scd41simSetWaveform(SCD41SIM *pSim, const SCD41SIM_POINT *pPoints, int iCount)
+{
+	if (iCount > SCD41SIM_MAX_POINTS)
+		iCount = SCD41SIM_MAX_POINTS;
+	memcpy(pSim->points, pPoints, iCount * sizeof(SCD41SIM_POINT));
+	pSim->iPoints = iCount;
+} /* scd41simSetWaveform() */
+
+int scd41simLoadWaveform(SCD41SIM *pSim, const char *szFile)
+{
+	char szLine[256], *p;
+	SCD41SIM_POINT *pPt;
+	FILE *f;
+	unsigned int uSecs;
+
+	f = fopen(szFile, "r");
+	if (!f)
+		return -1;
+	pSim->iPoints = 0;
+	while (fgets(szLine, sizeof(szLine), f) && pSim->iPoints < SCD41SIM_MAX_POINTS) {
+		if ((p = strchr(szLine, '#')) != NULL)
+			*p = 0;
+		pPt = &pSim->points[pSim->iPoints];
+		if (sscanf(szLine, "%u %f %f %f", &uSecs, &pPt->fCO2, &pPt->fTemperature, &pPt->fHumidity) != 4 &&
+			sscanf(szLine, "%*u,%u,%f,%f,%f", &uSecs, &pPt->fCO2, &pPt->fTemperature, &pPt->fHumidity) != 4)
+			continue; // blank, comment or CSV header
+		if (pSim->iPoints && uSecs <= pSim->points[pSim->iPoints-1].u32Secs) {
+			fprintf(stderr, "%s: times must increase (%u)\n", szFile, uSecs);
+			fclose(f);
+			return -1;
+		}
+		pPt->u32Secs = uSecs;
+		pSim->iPoints++;
+	}
+	fclose(f);
+	return pSim->iPoints;
+} /* scd41simLoadWaveform() */
+
+void scd41simFault(SCD41SIM *pSim, int iFault, int iCount)
+{
+	if (iFault >= 0 && iFault < SCD41SIM_FAULT_COUNT)
+		pSim->iFault[iFault] = iCount;
+} /* scd41simFault() */
+
+void scd41simGetStats(SCD41SIM *pSim, SCD41SIM_STATS *pStats)
+{
+	scd41simUpdate(pSim);
+	*pStats = pSim->stats;
+} /* scd41simGetStats() */
+
+int scd41simState(SCD41SIM *pSim)
+{
+	scd41simUpdate(pSim);
+	return pSim->iState;
+} /* scd41simState() */
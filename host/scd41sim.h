@@ -0,0 +1,121 @@
+//
+// SCD41 CO2 sensor model for the host build
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// An I2C slave at 0x62 which behaves like the SCD41 as the datasheet
+// describes it: 16-bit commands with CRC-8 protected arguments and
+// responses, execution times (the sensor NACKs while busy), 5s periodic,
+// 30s low power periodic and 5s single shot measurements, the data ready
+// status, sleep / wake up and forced recalibration.
+// The readings follow a CO2 / temperature / humidity waveform and faults
+// can be injected to exercise the error handling of the driver.
+//
+// Waveform files have one point per line, linearly interpolated:
+//   <seconds> <CO2 ppm> <temperature C> <humidity %>
+// '#' starts a comment. A recorded history (co2_console dump, CSV with
+// seq,seconds,co2,temp,rh) can be used as it is.
+//
+#ifndef HOST_SCD41SIM_H_
+#define HOST_SCD41SIM_H_
+
+#include "host.h"
+
+#define SCD41SIM_ADDR 0x62
+#define SCD41SIM_MAX_POINTS 256
+
+// Sensor states
+enum {
+	SCD41SIM_IDLE = 0,
+	SCD41SIM_PERIODIC, // 5s
+	SCD41SIM_LOW_POWER, // 30s
+	SCD41SIM_SLEEP // power down
+};
+
+// Injectable faults
+enum {
+	SCD41SIM_FAULT_NACK = 0, // address NACKed
+	SCD41SIM_FAULT_CRC, // response words with a wrong CRC
+	SCD41SIM_FAULT_NOT_READY, // data ready status stuck at 0
+	SCD41SIM_FAULT_FRC, // forced recalibration answers 0xffff
+	SCD41SIM_FAULT_COUNT
+};
+
+typedef struct tagSCD41SimPoint
+{
+	uint32_t u32Secs;
+	float fCO2, fTemperature, fHumidity;
+} SCD41SIM_POINT;
+
+typedef struct tagSCD41SimStats
+{
+	uint32_t u32Commands; // complete, accepted commands
+	uint32_t u32Measurements; // measurements completed
+	uint32_t u32Reads; // measurements read out
+	uint32_t u32Missed; // measurements replaced before they were read
+	uint32_t u32ReadyPolls, u32NotReadyPolls; // data ready status reads
+	uint32_t u32Violations; // addressed while still executing a command
+	uint32_t u32Illegal; // command not allowed in the current state, or unknown
+	uint32_t u32BadCRC; // argument CRC errors from the host
+	uint32_t u32Nacks; // all NACKs given
+	uint32_t u32CRCFaults; // response words sent with a bad CRC
+	uint64_t u64LatencyNs, u64MaxLatencyNs; // data ready -> read measurement (total, worst)
+} SCD41SIM_STATS;
+
+typedef struct tagSCD41Sim
+{
+	HOST_I2C_DEVICE dev;
+	SCD41SIM_POINT points[SCD41SIM_MAX_POINTS];
+	int iPoints;
+	int iState;
+	int bASC; // automatic self calibration enabled
+	int iFRCCorrection; // last forced recalibration offset (ppm)
+	uint64_t u64Next; // next measurement due (periodic or single shot)
+	int bSingleShot; // single shot in progress
+	uint64_t u64BusyUntil; // command execution time
+	uint64_t u64PeriodicStart, u64PeriodicNs; // time spent measuring before the last stop
+	// last measurement
+	int bReady;
+	uint64_t u64ReadyNs;
+	uint16_t u16CO2, u16Temperature, u16Humidity; // raw sensor words
+	// transaction
+	uint8_t u8Cmd[5];
+	int iCmdLen;
+	uint16_t u16Response[3];
+	int iResponseWords, iReadPos;
+	uint64_t u64ResponseAt; // response readable from
+	int iFault[SCD41SIM_FAULT_COUNT]; // transactions left to fault, -1 = until cleared
+	SCD41SIM_STATS stats;
+} SCD41SIM;
+
+// Power-on state (idle) at SCD41SIM_ADDR, constant 420ppm / 22C / 45% until
+// a waveform is given
+void scd41simAttach(SCD41SIM *pSim);
+void scd41simDetach(SCD41SIM *pSim);
+int scd41simLoadWaveform(SCD41SIM *pSim, const char *szFile);
+void scd41simSetWaveform(SCD41SIM *pSim, const SCD41SIM_POINT *pPoints, int iCount);
+// Waveform value at simulated time u64Ns
+void scd41simSample(const SCD41SIM *pSim, uint64_t u64Ns, float *pCO2, float *pTemperature, float *pHumidity);
+// Fault for the next iCount transactions (or reads for FAULT_CRC); -1 = until cleared with 0
+void scd41simFault(SCD41SIM *pSim, int iFault, int iCount);
+// Brings the measurements up to the current simulated time
+void scd41simGetStats(SCD41SIM *pSim, SCD41SIM_STATS *pStats);
+int scd41simState(SCD41SIM *pSim);
+uint8_t scd41simCRC8(const uint8_t *pData, int iLen);
+
+#endif /* HOST_SCD41SIM_H_ */
@@ -0,0 +1,418 @@
+//
+// SSD1306 OLED controller model for the host build
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdio.h>
+#include <string.h>
+#include "ssd1306.h"
+
+#define SSD1306_FRAME_NS 9500000 // ~105Hz frame rate with the D5 80 oscillator setting
+
+// frames between scroll steps, by the 3-bit interval code
+static const uint16_t u16ScrollFrames[8] = {5, 64, 128, 256, 3, 4, 25, 2};
+
+// argument bytes which follow each command opcode
+static int ssd1306ArgCount(uint8_t u8Cmd)
+{
+	switch (u8Cmd) {
+	case 0x20: case 0x81: case 0x8d: case 0xa8: case 0xd3:
+	case 0xd5: case 0xd9: case 0xda: case 0xdb:
+		return 1;
+	case 0x21: case 0x22: case 0xa3:
+		return 2;
+	case 0x29: case 0x2a:
+		return 5;
+	case 0x26: case 0x27:
+		return 6;
+	default:
+		return 0;
+	}
+} /* ssd1306ArgCount() */
+
+static void ssd1306Reset(SSD1306 *pOLED)
+{
+	HOST_I2C_DEVICE dev = pOLED->dev;
+
+	memset(pOLED, 0, sizeof(SSD1306));
+	pOLED->dev = dev;
+	pOLED->u8Mode = 2; // page addressing
+	pOLED->u8ColEnd = SSD1306_WIDTH - 1;
+	pOLED->u8PageEnd = SSD1306_PAGES - 1;
+	pOLED->u8Contrast = 0x7f;
+	pOLED->u8Mux = SSD1306_HEIGHT - 1;
+	pOLED->u8VScrollRows = SSD1306_HEIGHT;
+} /* ssd1306Reset() */
+
+static void ssd1306Command(SSD1306 *pOLED)
+{
+	uint8_t *c = pOLED->u8Cmd;
+
+	pOLED->stats.u32Commands++;
+	pOLED->bWrapped = 0;
+	if (c[0] < 0x10) { // page mode column, low nibble
+		pOLED->u8Col = (pOLED->u8Col & 0xf0) | c[0];
+		return;
+	}
+	if (c[0] < 0x20) { // high nibble
+		if (c[0] >= 0x18)
+			pOLED->stats.u32Unknown++;
+		pOLED->u8Col = (uint8_t)(((c[0] & 0x07) << 4) | (pOLED->u8Col & 0x0f));
+		return;
+	}
+	if (c[0] >= 0x40 && c[0] < 0x80) {
+		pOLED->u8StartLine = c[0] & 0x3f;
+		return;
+	}
+	if (c[0] >= 0xb0 && c[0] < 0xb8) {
+		pOLED->u8Page = c[0] & 7;
+		return;
+	}
+	switch (c[0]) {
+	case 0x20:
+		pOLED->u8Mode = c[1] & 3;
+		if (pOLED->u8Mode == 3) pOLED->u8Mode = 2; // invalid
+		break;
+	case 0x21:
+		pOLED->u8ColStart = pOLED->u8Col = c[1] & 0x7f;
+		pOLED->u8ColEnd = c[2] & 0x7f;
+		break;
+	case 0x22:
+		pOLED->u8PageStart = pOLED->u8Page = c[1] & 7;
+		pOLED->u8PageEnd = c[2] & 7;
+		break;
+	case 0x26: case 0x27: // horizontal scroll setup
+	case 0x29: case 0x2a: // vertical and horizontal
+		pOLED->bScrollLeft = (c[0] == 0x27 || c[0] == 0x2a);
+		pOLED->bScrollVertical = (c[0] >= 0x29);
+		pOLED->u8ScrollStart = c[2] & 7;
+		pOLED->u8ScrollInterval = c[3] & 7;
+		pOLED->u8ScrollEnd = c[4] & 7;
+		pOLED->u8ScrollVOffset = pOLED->bScrollVertical ? (c[5] & 0x3f) : 0;
+		break;
+	case 0x2e:
+		pOLED->bScroll = 0;
+		break;
+	case 0x2f:
+		pOLED->bScroll = 1;
+		pOLED->u64ScrollNs = hostNanos();
+		break;
+	case 0xa3:
+		pOLED->u8VScrollTop = c[1] & 0x3f;
+		pOLED->u8VScrollRows = c[2] & 0x7f;
+		break;
+	case 0x81:
+		pOLED->u8Contrast = c[1];
+		break;
+	case 0x8d:
+		pOLED->bChargePump = (c[1] & 0x04) != 0;
+		break;
+	case 0xa0: case 0xa1:
+		pOLED->bSegRemap = c[0] & 1;
+		break;
+	case 0xa4: case 0xa5:
+		pOLED->bEntireOn = c[0] & 1;
+		break;
+	case 0xa6: case 0xa7:
+		pOLED->bInvert = c[0] & 1;
+		break;
+	case 0xa8:
+		pOLED->u8Mux = c[1] & 0x3f;
+		break;
+	case 0xae: case 0xaf:
+		pOLED->bOn = c[0] & 1;
+		break;
+	case 0xc0: case 0xc8:
+		pOLED->bComRemap = (c[0] == 0xc8);
+		break;
+	case 0xd3:
+		pOLED->u8Offset = c[1] & 0x3f;
+		break;
+	case 0xd5: case 0xd9: case 0xda: case 0xdb: case 0xe3: // timing and analog settings, NOP
+		break;
+	default:
+		pOLED->stats.u32Unknown++;
+		break;
+	}
+} /* ssd1306Command() */
+
+// write one byte to GDDRAM and advance the pointer for the addressing mode
+static void ssd1306Data(SSD1306 *pOLED, uint8_t u8Data)
+{
+	pOLED->stats.u32DataBytes++;
+	if (pOLED->bWrapped) { // kept on writing after the last column
+		pOLED->stats.u32Wraps++;
+		pOLED->bWrapped = 0;
+	}
+	pOLED->u8RAM[pOLED->u8Page & 7][pOLED->u8Col & 0x7f] = u8Data;
+	switch (pOLED->u8Mode) {
+	case 0: // horizontal
+		if (pOLED->u8Col++ >= pOLED->u8ColEnd) {
+			pOLED->u8Col = pOLED->u8ColStart;
+			if (pOLED->u8Page++ >= pOLED->u8PageEnd)
+				pOLED->u8Page = pOLED->u8PageStart;
+		}
+		break;
+	case 1: // vertical
+		if (pOLED->u8Page++ >= pOLED->u8PageEnd) {
+			pOLED->u8Page = pOLED->u8PageStart;
+			if (pOLED->u8Col++ >= pOLED->u8ColEnd)
+				pOLED->u8Col = pOLED->u8ColStart;
+		}
+		break;
+	default: // page: the column wraps, the page stays
+		pOLED->bWrapped = (pOLED->u8Col == SSD1306_WIDTH - 1);
+		pOLED->u8Col = (pOLED->u8Col + 1) & 0x7f;
+		break;
+	}
+} /* ssd1306Data() */
+
+static int ssd1306Start(HOST_I2C_DEVICE *pDev, int bRead)
+{
+	SSD1306 *pOLED = (SSD1306 *)pDev->pUser;
+
+	pOLED->stats.u32Transactions++;
+	pOLED->stats.u32Bytes++; // address
+	pOLED->bFirst = 1;
+	pOLED->bSingle = 0;
+	pOLED->iCmdLen = 0;
+	(void)bRead;
+	return 1;
+} /* ssd1306Start() */
+
+static int ssd1306Write(HOST_I2C_DEVICE *pDev, uint8_t u8Data)
+{
+	SSD1306 *pOLED = (SSD1306 *)pDev->pUser;
+
+	pOLED->stats.u32Bytes++;
+	if (pOLED->bFirst) { // control byte: Co and D/C#
+		pOLED->bFirst = 0;
+		pOLED->bSingle = (u8Data & 0x80) != 0;
+		pOLED->bData = (u8Data & 0x40) != 0;
+		return 1;
+	}
+	if (pOLED->bData) {
+		ssd1306Data(pOLED, u8Data);
+	} else {
+		if (pOLED->iCmdLen == 0)
+			pOLED->iCmdNeed = 1 + ssd1306ArgCount(u8Data);
+		pOLED->u8Cmd[pOLED->iCmdLen++] = u8Data;
+		if (pOLED->iCmdLen == pOLED->iCmdNeed) {
+			ssd1306Command(pOLED);
+			pOLED->iCmdLen = 0;
+		}
+	}
+	if (pOLED->bSingle && pOLED->iCmdLen == 0)
+		pOLED->bFirst = 1; // another control byte follows
+	return 1;
+} /* ssd1306Write() */
+
+// status byte: D6 = display off
+static uint8_t ssd1306Read(HOST_I2C_DEVICE *pDev)
+{
+	SSD1306 *pOLED = (SSD1306 *)pDev->pUser;
+
+	pOLED->stats.u32Bytes++;
+	return pOLED->bOn ? 0x00 : 0x40;
+} /* ssd1306Read() */
+
+void ssd1306Attach(SSD1306 *pOLED, uint8_t u8Addr)
+{
+	memset(&pOLED->dev, 0, sizeof(pOLED->dev));
+	ssd1306Reset(pOLED);
+	pOLED->dev.u8Addr = u8Addr;
+	pOLED->dev.pUser = pOLED;
+	pOLED->dev.pfnStart = ssd1306Start;
+	pOLED->dev.pfnWrite = ssd1306Write;
+	pOLED->dev.pfnRead = ssd1306Read;
+	hostI2CAttach(&pOLED->dev);
+} /* ssd1306Attach() */
+
+void ssd1306Detach(SSD1306 *pOLED)
+{
+	hostI2CDetach(&pOLED->dev);
+} /* ssd1306Detach() */
+
+void ssd1306ResetStats(SSD1306 *pOLED)
+{
+	memset(&pOLED->stats, 0, sizeof(pOLED->stats));
+} /* ssd1306ResetStats() */
+
+uint64_t ssd1306BusNs(const SSD1306 *pOLED, uint32_t u32Hz)
+{
+	uint64_t u64Bits = (uint64_t)pOLED->stats.u32Transactions * 2 + (uint64_t)pOLED->stats.u32Bytes * 9;
+
+	return (u64Bits * 1000000000ull) / u32Hz;
+} /* ssd1306BusNs() */
+
+void ssd1306Render(const SSD1306 *pOLED, uint8_t *pPixels)
+{
+	int x, y, iCol, iRow, iSteps = 0;
+
+	if (!pOLED->bOn || !pOLED->bChargePump) { // no panel voltage, nothing lit
+		memset(pPixels, 0, SSD1306_WIDTH * SSD1306_HEIGHT);
+		return;
+	}
+	if (pOLED->bScroll)
+		iSteps = (int)((hostNanos() - pOLED->u64ScrollNs) / SSD1306_FRAME_NS / u16ScrollFrames[pOLED->u8ScrollInterval]);
+	for (y=0; y<SSD1306_HEIGHT; y++) {
+		int iCom = pOLED->bComRemap ? y : (SSD1306_HEIGHT - 1 - y);
+		iRow = iCom + pOLED->u8StartLine + pOLED->u8Offset;
+		if (pOLED->bScroll && pOLED->bScrollVertical && iCom >= pOLED->u8VScrollTop && iCom < pOLED->u8VScrollTop + pOLED->u8VScrollRows)
+			iRow += iSteps * pOLED->u8ScrollVOffset;
+		iRow &= SSD1306_HEIGHT - 1;
+		for (x=0; x<SSD1306_WIDTH; x++) {
+			uint8_t u8Pix;
+			if (iCom > pOLED->u8Mux) { // beyond the multiplex ratio
+				*pPixels++ = 0;
+				continue;
+			}
+			if (pOLED->bEntireOn) {
+				*pPixels++ = 1;
+				continue;
+			}
+			iCol = pOLED->bSegRemap ? x : (SSD1306_WIDTH - 1 - x);
+			if (pOLED->bScroll && (iRow >> 3) >= pOLED->u8ScrollStart && (iRow >> 3) <= pOLED->u8ScrollEnd)
+				iCol = (iCol + (pOLED->bScrollLeft ? iSteps : -iSteps)) & (SSD1306_WIDTH - 1);
+			u8Pix = (pOLED->u8RAM[iRow >> 3][iCol] >> (iRow & 7)) & 1;
+			*pPixels++ = u8Pix ^ pOLED->bInvert;
+		}
+	}
+} /* ssd1306Render() */
+
+int ssd1306WritePBM(const SSD1306 *pOLED, const char *szFile)
+{
+	uint8_t u8Pixels[SSD1306_WIDTH * SSD1306_HEIGHT];
+	FILE *f;
+	int x, y;
+
+	f = fopen(szFile, "w");
+	if (!f)
+		return -1;
+	ssd1306Render(pOLED, u8Pixels);
+	fprintf(f, "P1\n%d %d\n", SSD1306_WIDTH, SSD1306_HEIGHT);
+	for (y=0; y<SSD1306_HEIGHT; y++) {
+		for (x=0; x<SSD1306_WIDTH; x++)
+			fputc('0' + u8Pixels[y * SSD1306_WIDTH + x], f);
+		fputc('\n', f);
+	}
+	fclose(f);
+	return 0;
+} /* ssd1306WritePBM() */
+
+int ssd1306ComparePBM(const SSD1306 *pOLED, const char *szFile)
+{
+	uint8_t u8Pixels[SSD1306_WIDTH * SSD1306_HEIGHT];
+	FILE *f;
+	int c, i = 0, iWidth, iHeight, iDiff = 0;
+
+	f = fopen(szFile, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "P1 %d %d", &iWidth, &iHeight) != 2 || iWidth != SSD1306_WIDTH || iHeight != SSD1306_HEIGHT) {
+		fclose(f);
+		return -1;
+	}
+	ssd1306Render(pOLED, u8Pixels);
+	while (i < SSD1306_WIDTH * SSD1306_HEIGHT && (c = fgetc(f)) != EOF) {
+		if (c != '0' && c != '1')
+			continue; // whitespace
+		iDiff += ((c - '0') != u8Pixels[i++]);
+	}
+	fclose(f);
+	if (i != SSD1306_WIDTH * SSD1306_HEIGHT)
+		return -1; // truncated
+	return iDiff;
+} /* ssd1306ComparePBM() */
+
+//
+// PNG output, uncompressed (zlib stored block) so no library is needed
+// 8-bit gray; lit pixels follow the contrast setting
+//
+static uint32_t PNGCrc(uint32_t u32Crc, const uint8_t *pData, int iLen)
+{
+	int i;
+
+	u32Crc = ~u32Crc;
+	while (iLen--) {
+		u32Crc ^= *pData++;
+		for (i=0; i<8; i++)
+			u32Crc = (u32Crc >> 1) ^ (0xedb88320 & -(u32Crc & 1));
+	}
+	return ~u32Crc;
+} /* PNGCrc() */
+
+static void PNGPut32(uint8_t *p, uint32_t u32)
+{
+	p[0] = (uint8_t)(u32 >> 24); p[1] = (uint8_t)(u32 >> 16);
+	p[2] = (uint8_t)(u32 >> 8); p[3] = (uint8_t)u32;
+} /* PNGPut32() */
+
+static void PNGChunk(FILE *f, const char *szType, const uint8_t *pData, int iLen)
+{
+	uint8_t u8Hdr[8], u8Crc[4];
+
+	PNGPut32(u8Hdr, (uint32_t)iLen);
+	memcpy(&u8Hdr[4], szType, 4);
+	fwrite(u8Hdr, 1, 8, f);
+	fwrite(pData, 1, iLen, f);
+	PNGPut32(u8Crc, PNGCrc(PNGCrc(0, &u8Hdr[4], 4), pData, iLen));
+	fwrite(u8Crc, 1, 4, f);
+} /* PNGChunk() */
+
+int ssd1306WritePNG(const SSD1306 *pOLED, const char *szFile)
+{
+	static const uint8_t u8Sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	uint8_t u8Pixels[SSD1306_WIDTH * SSD1306_HEIGHT];
+	enum { RAW = SSD1306_HEIGHT * (SSD1306_WIDTH + 1) }; // filter byte per row
+	uint8_t u8IHDR[13], u8IDAT[2 + 5 + RAW + 4], *d;
+	uint32_t a = 1, b = 0;
+	uint8_t u8Lit = (uint8_t)(55 + (pOLED->u8Contrast * 200) / 255);
+	FILE *f;
+	int x, y;
+
+	f = fopen(szFile, "wb");
+	if (!f)
+		return -1;
+	ssd1306Render(pOLED, u8Pixels);
+	PNGPut32(u8IHDR, SSD1306_WIDTH);
+	PNGPut32(&u8IHDR[4], SSD1306_HEIGHT);
+	u8IHDR[8] = 8; // bit depth
+	u8IHDR[9] = 0; // gray
+	u8IHDR[10] = u8IHDR[11] = u8IHDR[12] = 0;
+	d = u8IDAT;
+	*d++ = 0x78; *d++ = 0x01; // zlib header, no compression
+	*d++ = 0x01; // final stored block
+	*d++ = RAW & 0xff; *d++ = RAW >> 8;
+	*d++ = ~RAW & 0xff; *d++ = (~RAW >> 8) & 0xff;
+	for (y=0; y<SSD1306_HEIGHT; y++) {
+		*d++ = 0; // no filter
+		for (x=0; x<SSD1306_WIDTH; x++)
+			*d++ = u8Pixels[y * SSD1306_WIDTH + x] ? u8Lit : 0;
+	}
+	for (x=7; x<7+RAW; x++) { // Adler-32 of the raw data
+		a = (a + u8IDAT[x]) % 65521;
+		b = (b + a) % 65521;
+	}
+	PNGPut32(d, (b << 16) | a);
+	fwrite(u8Sig, 1, 8, f);
+	PNGChunk(f, "IHDR", u8IHDR, sizeof(u8IHDR));
+	PNGChunk(f, "IDAT", u8IDAT, sizeof(u8IDAT));
+	PNGChunk(f, "IEND", NULL, 0);
+	fclose(f);
+	return 0;
+} /* ssd1306WritePNG() */
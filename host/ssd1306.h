@@ -0,0 +1,88 @@
+//
+// SSD1306 OLED controller model for the host build
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Interprets the command / data stream the firmware sends to the display
+// on I2C (control byte, then commands or GDDRAM data) and keeps the
+// controller state: page, horizontal and vertical addressing, column and
+// page windows, scrolling, contrast, inversion, remapping and power.
+// The visible frame can be saved as PBM or PNG, and the traffic is
+// counted so the cost of each screen can be reported.
+//
+#ifndef HOST_SSD1306_H_
+#define HOST_SSD1306_H_
+
+#include "host.h"
+
+#define SSD1306_WIDTH 128
+#define SSD1306_HEIGHT 64
+#define SSD1306_PAGES (SSD1306_HEIGHT / 8)
+
+// Traffic addressed to the display
+typedef struct tagSSD1306Stats
+{
+	uint32_t u32Transactions; // START conditions addressed to the display
+	uint32_t u32Bytes; // bus bytes, including the address and control bytes
+	uint32_t u32Commands; // command opcodes (arguments not counted)
+	uint32_t u32DataBytes; // bytes written to GDDRAM
+	uint32_t u32Unknown; // opcodes the SSD1306 doesn't have (page 8+, column 128+...)
+	uint32_t u32Wraps; // page mode data which went on past the last column to column 0
+} SSD1306_STATS;
+
+typedef struct tagSSD1306
+{
+	HOST_I2C_DEVICE dev;
+	uint8_t u8RAM[SSD1306_PAGES][SSD1306_WIDTH]; // GDDRAM, LSB = top row of the page
+	// addressing
+	uint8_t u8Mode; // 0 = horizontal, 1 = vertical, 2 = page
+	uint8_t u8Col, u8Page; // RAM pointer
+	uint8_t u8ColStart, u8ColEnd, u8PageStart, u8PageEnd;
+	// display
+	uint8_t u8Contrast, u8StartLine, u8Offset, u8Mux;
+	uint8_t bOn, bChargePump, bInvert, bEntireOn, bSegRemap, bComRemap;
+	// scrolling
+	uint8_t bScroll, bScrollLeft, bScrollVertical;
+	uint8_t u8ScrollStart, u8ScrollEnd, u8ScrollInterval, u8ScrollVOffset;
+	uint8_t u8VScrollTop, u8VScrollRows;
+	uint64_t u64ScrollNs; // when the scroll was activated
+	// stream parser
+	uint8_t bFirst, bData, bSingle; // next byte is a control byte / data / one byte then control
+	uint8_t bWrapped; // the page mode column pointer just went from the last column to 0
+	uint8_t u8Cmd[8]; // command being collected
+	int iCmdLen, iCmdNeed;
+	SSD1306_STATS stats;
+} SSD1306;
+
+// Reset the controller (power-on defaults) and attach it to the I2C bus
+void ssd1306Attach(SSD1306 *pOLED, uint8_t u8Addr);
+void ssd1306Detach(SSD1306 *pOLED);
+void ssd1306ResetStats(SSD1306 *pOLED);
+// Bus time of the counted traffic at u32Hz (9 clocks per byte + START/STOP)
+uint64_t ssd1306BusNs(const SSD1306 *pOLED, uint32_t u32Hz);
+// What the panel shows now: one byte per pixel, 1 = lit, row by row
+// (A1/C8 remapping is the upright orientation of the module)
+void ssd1306Render(const SSD1306 *pOLED, uint8_t *pPixels);
+// Save the visible frame; plain PBM (P1) is diff friendly for golden files
+int ssd1306WritePBM(const SSD1306 *pOLED, const char *szFile);
+int ssd1306WritePNG(const SSD1306 *pOLED, const char *szFile);
+// Compare the visible frame with a PBM file; returns the number of
+// differing pixels, or -1 if the file can't be read
+int ssd1306ComparePBM(const SSD1306 *pOLED, const char *szFile);
+
+#endif /* HOST_SSD1306_H_ */
@@ -0,0 +1,461 @@
+//
+// Pocket CO2 host simulation test
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Runs the firmware modules against the simulated peripherals and checks
+// the time, power and bus accounting of the simulation along the way.
+//
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "Arduino.h"
+#include "pwm.h"
+#include "pattern.h"
+#include "clock.h"
+#include "telemetry.h"
+#include "ram.h"
+#include "diag.h"
+#include "scratch.h"
+#include "buttons.h"
+#include "host.h"
+
+// from main.c (its main() is renamed to FirmwareMain() in this build)
+void ReadFlash(void);
+int ReadResume(void);
+void StartResume(int iMode);
+void WriteResume(void);
+void ClearResume(void);
+// the layout of its RESUME, one of its modes and the size of its ring
+typedef struct tagResume
+{
+	uint32_t u32Magic;
+	uint32_t u32Seq;
+	int iMode;
+	int iSample;
+	uint16_t u16MinCO2, u16MaxCO2;
+	int16_t i16MinTemp, i16MaxTemp;
+} RESUME;
+extern RESUME resume;
+#define MODE_LOW_POWER 1
+#define RESUME_SLOTS 14
+
+#define MS(n) ((uint64_t)(n) * 1000000)
+#define US(n) ((uint64_t)(n) * 1000)
+
+static int iErrors;
+static jmp_buf jbFault;
+static char szFault[128];
+static uint8_t u8Uart[256];
+static int iUartLen;
+
+// fake I2C device: a register file with an auto-incrementing pointer
+typedef struct tagFakeDevice
+{
+	uint8_t u8Regs[16];
+	uint8_t u8Ptr;
+	int bFirst;
+	int iStops;
+} FAKE_DEVICE;
+
+static void Check(int bOk, const char *szWhat, long long llGot, long long llWant)
+{
+	if (!bOk) {
+		iErrors++;
+		fprintf(stderr, "%s: got %lld, expected %lld\n", szWhat, llGot, llWant);
+	}
+} /* Check() */
+
+static void CheckNear(const char *szWhat, uint64_t u64Got, uint64_t u64Want, uint64_t u64Slack)
+{
+	Check(u64Got + u64Slack >= u64Want && u64Got <= u64Want + u64Slack, szWhat, (long long)u64Got, (long long)u64Want);
+} /* CheckNear() */
+
+static void OnFault(const char *szMsg)
+{
+	strncpy(szFault, szMsg, sizeof(szFault)-1);
+	longjmp(jbFault, 1);
+} /* OnFault() */
+
+static void OnUart(uint8_t u8Data)
+{
+	if (iUartLen < (int)sizeof(u8Uart))
+		u8Uart[iUartLen++] = u8Data;
+} /* OnUart() */
+
+static int FakeStart(HOST_I2C_DEVICE *pDev, int bRead)
+{
+	FAKE_DEVICE *pFake = (FAKE_DEVICE *)pDev->pUser;
+
+	pFake->bFirst = !bRead;
+	return 1;
+} /* FakeStart() */
+
+static int FakeWrite(HOST_I2C_DEVICE *pDev, uint8_t u8Data)
+{
+	FAKE_DEVICE *pFake = (FAKE_DEVICE *)pDev->pUser;
+
+	if (pFake->bFirst)
+		pFake->u8Ptr = u8Data & 0xf;
+	else
+		pFake->u8Regs[pFake->u8Ptr++ & 0xf] = u8Data;
+	pFake->bFirst = 0;
+	return 1;
+} /* FakeWrite() */
+
+static uint8_t FakeRead(HOST_I2C_DEVICE *pDev)
+{
+	FAKE_DEVICE *pFake = (FAKE_DEVICE *)pDev->pUser;
+
+	return pFake->u8Regs[pFake->u8Ptr++ & 0xf];
+} /* FakeRead() */
+
+static void FakeStop(HOST_I2C_DEVICE *pDev)
+{
+	((FAKE_DEVICE *)pDev->pUser)->iStops++;
+} /* FakeStop() */
+
+static void TestDelay(void)
+{
+	HOST_STATS stats;
+	uint64_t u64Start;
+	uint32_t u32Tick;
+
+	Delay_Init();
+	u64Start = hostNanos();
+	u32Tick = Delay_GetTick();
+	Delay_Ms(100);
+	CheckNear("Delay_Ms(100) ns", hostNanos() - u64Start, MS(100), US(50));
+	CheckNear("Delay_Ms(100) ticks", Delay_GetTick() - u32Tick, Delay_MsToTicks(100), Delay_MsToTicks(1));
+	hostGetStats(&stats);
+	Check(stats.u64SleepNs > MS(99), "Delay_Ms(100) asleep ns", (long long)stats.u64SleepNs, (long long)MS(99));
+	u64Start = hostNanos();
+	Delay_Us(250);
+	CheckNear("Delay_Us(250) ns", hostNanos() - u64Start, US(250), US(10));
+} /* TestDelay() */
+
+static void TestI2C(void)
+{
+	static FAKE_DEVICE fake;
+	static HOST_I2C_DEVICE dev = {0x3c, &fake, FakeStart, FakeWrite, FakeRead, FakeStop, NULL};
+	HOST_STATS before, after;
+	uint8_t u8Data[4] = {0x02, 0x11, 0x22, 0x33};
+	uint64_t u64Start;
+
+	hostI2CAttach(&dev);
+	I2CInit(400000);
+	Check(hostI2CSpeed() == 400000, "I2C speed", hostI2CSpeed(), 400000);
+	hostGetStats(&before);
+	u64Start = hostNanos();
+	I2CWrite(0x3c, u8Data, 4);
+	hostGetStats(&after);
+	Check(fake.u8Regs[2] == 0x11 && fake.u8Regs[4] == 0x33, "I2C register written", fake.u8Regs[4], 0x33);
+	Check(after.u32I2CTransactions - before.u32I2CTransactions == 1, "I2C transactions", after.u32I2CTransactions - before.u32I2CTransactions, 1);
+	Check(after.u32I2CBytes - before.u32I2CBytes == 5, "I2C bytes (address + 4)", after.u32I2CBytes - before.u32I2CBytes, 5);
+	// start + 5 bytes of 9 bits + stop at 400kHz
+	CheckNear("I2C write ns", hostNanos() - u64Start, (uint64_t)47 * 2500, US(20));
+	u8Data[0] = 0x03;
+	I2CWrite(0x3c, u8Data, 1);
+	memset(u8Data, 0, sizeof(u8Data));
+	I2CRead(0x3c, u8Data, 2);
+	Check(u8Data[0] == 0x22 && u8Data[1] == 0x33, "I2C read back", u8Data[1], 0x33);
+	Check(fake.iStops == 3, "I2C stops", fake.iStops, 3);
+	Check(I2CTest(0x3c) == 1, "I2CTest(present)", 0, 1);
+	szFault[0] = 0;
+	if (setjmp(jbFault) == 0)
+		I2CTest(0x50); // nobody answers; the polling loop never ends on the chip either
+	Check(strstr(szFault, "no ACK") != NULL, "I2C NACK reported as a hang", 0, 1);
+	hostI2CDetach(&dev);
+} /* TestI2C() */
+
+static void TestPwm(void)
+{
+	uint64_t u64Start;
+
+	pinMode(0xc3, OUTPUT);
+	Check(hostGetPwm(0xc3) == -1, "PWM off", hostGetPwm(0xc3), -1);
+	u64Start = hostNanos();
+	pwmRamp(0xc3, 200, 100);
+	Check(pwmActive(), "PWM ramp running", 0, 1);
+	pwmWait(0xc3);
+	CheckNear("PWM ramp ns", hostNanos() - u64Start, MS(100), MS(PWM_TICK_MS));
+	Delay_Ms(PWM_TICK_MS); // the compare is preloaded: the last step takes effect at the next update
+	Check(hostGetPwm(0xc3) == 200, "PWM duty after ramp", hostGetPwm(0xc3), 200);
+	pwmLock(); // the calls inside take it too and must not let the tick in early
+	pwmSet(0xc3, 0);
+	Check(!NVIC_GetStatusIRQ(TIM1_UP_IRQn), "TIM1 IRQ masked in a nested lock", 1, 0);
+	pwmUnlock();
+	Check(NVIC_GetStatusIRQ(TIM1_UP_IRQn), "TIM1 IRQ unmasked after it", 0, 1);
+	Delay_Ms(PWM_TICK_MS * 2);
+	Check(!pwmActive(), "PWM stopped", pwmActive(), 0);
+	Check(hostGetPwm(0xc3) == 0, "PWM output low after the stop", hostGetPwm(0xc3), 0);
+	pwmSet(0xc5, 128); // the motor's timer has no tick; stopping it must not leave it on
+	Delay_Ms(1);
+	Check(hostGetPwm(0xc5) == 128, "motor PWM duty", hostGetPwm(0xc5), 128);
+	pwmSet(0xc5, 0);
+	Check(hostGetPwm(0xc5) == 0, "motor PWM output low after the stop", hostGetPwm(0xc5), 0);
+} /* TestPwm() */
+
+// every output of a pattern really goes low when it ends, including the
+// one still lit in its last step
+static void TestPattern(void)
+{
+	static const PATTERN_STEP steps[] = {{PAT_MOTOR | PAT_RED | PAT_GREEN, 5}, {PAT_GREEN, 5}, {0, 0}};
+	static const PATTERN pattern = {steps, 2, PATTERN_PRI_STATUS};
+
+	patternInit(0xc5, 0xc4, 0xc3, 96);
+	patternPlay(&pattern, 0);
+	Delay_Ms(PWM_TICK_MS * 3);
+	Check(hostGetPwm(0xc4) == 96, "pattern red on", hostGetPwm(0xc4), 96);
+	Check(hostGetPwm(0xc5) > 0, "pattern motor on", hostGetPwm(0xc5), 1);
+	Delay_Ms(PWM_TICK_MS * 20); // two plays and the tick that ends it
+	Check(!pwmActive(), "pattern ended", pwmActive(), 0);
+	Check(hostGetPwm(0xc3) <= 0, "pattern green low after the end", hostGetPwm(0xc3), 0);
+	Check(hostGetPwm(0xc4) <= 0, "pattern red low after the end", hostGetPwm(0xc4), 0);
+	Check(hostGetPwm(0xc5) <= 0, "pattern motor low after the end", hostGetPwm(0xc5), 0);
+} /* TestPattern() */
+
+// a user added by an interrupt handler while clockSleep() has the clock
+// gated gets it running again, and clockWake() leaves it running
+static void TestClock(void)
+{
+	uint16_t u16Gated;
+
+	clockAcquire(CLOCK_SPI1);
+	u16Gated = clockSleep();
+	Check((RCC->APB2PCENR & RCC_APB2Periph_SPI1) == 0, "SPI1 gated in sleep", 1, 0);
+	clockAcquire(CLOCK_SPI1);
+	Check((RCC->APB2PCENR & RCC_APB2Periph_SPI1) != 0, "SPI1 running after an acquire in sleep", 0, 1);
+	clockRelease(CLOCK_SPI1);
+	clockWake(u16Gated);
+	Check((RCC->APB2PCENR & RCC_APB2Periph_SPI1) != 0, "SPI1 running after the wake", 0, 1);
+	clockRelease(CLOCK_SPI1);
+	Check((RCC->APB2PCENR & RCC_APB2Periph_SPI1) == 0, "SPI1 off without users", 1, 0);
+} /* TestClock() */
+
+static void TestTelemetry(void)
+{
+	TELEMETRY_RECORD rec = {3600, 812, 235, 456, 0, 1, 3000};
+	HOST_STATS stats;
+	int iLen;
+
+	telemetryInit(115200);
+	iUartLen = 0;
+	telemetrySend(&rec);
+	while (telemetryBusy())
+		Delay_Ms(1);
+	Check(iUartLen == TELEMETRY_FRAME_LEN, "telemetry frame length", iUartLen, TELEMETRY_FRAME_LEN);
+	if (iUartLen != TELEMETRY_FRAME_LEN)
+		return;
+	iLen = 3 + TELEMETRY_PAYLOAD_LEN;
+	Check(u8Uart[0] == TELEMETRY_SYNC0 && u8Uart[1] == TELEMETRY_SYNC1, "telemetry sync", u8Uart[1], TELEMETRY_SYNC1);
+	Check(telemetryCRC16(&u8Uart[2], iLen - 2) == (u8Uart[iLen] | (u8Uart[iLen+1] << 8)), "telemetry CRC", u8Uart[iLen], 0);
+	Check((u8Uart[9] | (u8Uart[10] << 8)) == 812, "telemetry CO2", u8Uart[9] | (u8Uart[10] << 8), 812);
+	hostGetStats(&stats);
+	Check(stats.u32UartBytes >= TELEMETRY_FRAME_LEN, "UART bytes", stats.u32UartBytes, TELEMETRY_FRAME_LEN);
+	hostSetVDD(3000);
+	CheckNear("VDD mV", readVDD(), 3000, 10);
+	hostSetVDD(2600); // calibrated by the first call, it still converts
+	CheckNear("VDD mV again", readVDD(), 2600, 10);
+	hostSetVDD(3300);
+} /* TestTelemetry() */
+
+static void TestFlash(void)
+{
+	HOST_STATS before, after;
+
+	hostGetStats(&before);
+	ReadFlash(); // erased: writes the defaults
+	ReadFlash(); // valid now: no write
+	hostGetStats(&after);
+	Check(after.u32FlashErases - before.u32FlashErases == 1, "FLASH erases", after.u32FlashErases - before.u32FlashErases, 1);
+	Check(after.u32FlashWrites - before.u32FlashWrites == 1, "FLASH writes", after.u32FlashWrites - before.u32FlashWrites, 1);
+} /* TestFlash() */
+
+// the checkpoints go round the ring without an erase until it wraps,
+// and the latest one is read back
+static void TestResume(void)
+{
+	HOST_STATS before, after;
+	int i;
+
+	Check(ReadResume() == 0, "no checkpoint in erased FLASH", 1, 0);
+	hostGetStats(&before);
+	StartResume(MODE_LOW_POWER);
+	for (i=1; i<RESUME_SLOTS; i++) {
+		resume.iSample = i;
+		WriteResume();
+	}
+	hostGetStats(&after);
+	Check(after.u32FlashErases == before.u32FlashErases, "no erase before the ring wraps", after.u32FlashErases - before.u32FlashErases, 0);
+	Check(after.u32FlashWrites - before.u32FlashWrites == RESUME_SLOTS, "a write per checkpoint", after.u32FlashWrites - before.u32FlashWrites, RESUME_SLOTS);
+	resume.iSample = 0;
+	Check(ReadResume() == 1, "checkpoint found", 0, 1);
+	Check(resume.iSample == RESUME_SLOTS-1, "latest checkpoint", resume.iSample, RESUME_SLOTS-1);
+	hostGetStats(&before);
+	resume.iSample = 100;
+	WriteResume(); // wraps
+	hostGetStats(&after);
+	Check(after.u32FlashErases - before.u32FlashErases == RESUME_SLOTS, "ring erased once when it wraps", after.u32FlashErases - before.u32FlashErases, RESUME_SLOTS);
+	resume.iSample = 0;
+	Check(ReadResume() == 1 && resume.iSample == 100, "checkpoint after the wrap", resume.iSample, 100);
+	ClearResume();
+	Check(ReadResume() == 0, "no checkpoint after a clear", 1, 0);
+} /* TestResume() */
+
+static void TestStandby(void)
+{
+	HOST_STATS before, after;
+	uint64_t u64Start;
+	uint32_t u32Tick;
+
+	hostGetStats(&before);
+	u64Start = hostNanos();
+	u32Tick = Delay_GetTick();
+	Standby82ms(2);
+	hostGetStats(&after);
+	CheckNear("Standby82ms(2) ns", hostNanos() - u64Start, MS(164), MS(10));
+	CheckNear("SysTick stopped in standby", Delay_GetTick() - u32Tick, 0, Delay_MsToTicks(2));
+	Check(after.u32Standbys - before.u32Standbys == 1, "standby entries", after.u32Standbys - before.u32Standbys, 1);
+	Check(after.u64StandbyNs - before.u64StandbyNs > MS(150), "standby ns", (long long)(after.u64StandbyNs - before.u64StandbyNs), (long long)MS(150));
+} /* TestStandby() */
+
+// a button press ends the standby early and still reaches the button driver
+static void TestStandbyWake(void)
+{
+	BTN_EVENT event;
+	uint64_t u64Start;
+	int rc;
+
+	btnInit(0xd2, 0xd3);
+	u64Start = hostNanos();
+	hostSchedulePin(0xd2, 0, u64Start + MS(300));
+	hostSchedulePin(0xd2, 1, u64Start + MS(600));
+	rc = Standby82msWake(25, 0xd2, 0xd3);
+	Check(rc == 1, "woken by the button", rc, 1);
+	CheckNear("button wake ns", hostNanos() - u64Start, MS(300), MS(10));
+	rc = btnWaitEvent(&event, 500);
+	Check(rc == 1 && event.u8Type == BTN_EVT_PRESS && event.u8Buttons == 1, "press after the wake", event.u8Type, BTN_EVT_PRESS);
+	btnFlush();
+	u64Start = hostNanos();
+	rc = Standby82msWake(2, 0xd2, 0xd3);
+	Check(rc == 0, "woken by the timer", rc, 0);
+	CheckNear("timer wake ns", hostNanos() - u64Start, MS(164), MS(10));
+	Check(btnGetState() == 0, "buttons released", btnGetState(), 0);
+} /* TestStandbyWake() */
+
+// awake and standby time go to their own counters
+static void TestDiag(void)
+{
+	DIAG_COUNTERS before, after;
+
+	diagGetCounters(&before);
+	Standby82ms(25); // 2.05s
+	Delay_Ms(3000);
+	diagGetCounters(&after);
+	CheckNear("diag standby secs", after.u32StandbySecs - before.u32StandbySecs, 2, 1);
+	CheckNear("diag awake secs", after.u32AwakeSecs - before.u32AwakeSecs, 3, 1);
+	Check(after.u32Wakes > before.u32Wakes, "diag wakes", after.u32Wakes - before.u32Wakes, 1);
+	Check(after.u32ChargeUAh >= before.u32ChargeUAh + 1, "diag charge uAh", after.u32ChargeUAh - before.u32ChargeUAh, 1);
+	Check(after.u16Errors[DIAG_ERR_I2C] == 0, "diag I2C errors", after.u16Errors[DIAG_ERR_I2C], 0);
+} /* TestDiag() */
+
+// the high-water mark over the painted RAM of host.c's layout
+static void TestRAM(void)
+{
+	RAM_USAGE usage;
+	uint32_t *pRAM = hostRAM();
+
+	hostReset(); // paints it, like the startup code
+	ramGetUsage(&usage);
+	Check(usage.u16Code == 0 && usage.u16Data == 0x40 && usage.u16Bss == 0x4c0, "data + bss", usage.u16Data + usage.u16Bss, 0x500);
+	Check(usage.u16Heap == 0x200 && usage.u16Stack == 0x100, "heap + stack", usage.u16Heap + usage.u16Stack, 0x300);
+	Check(usage.u16StackPeak == 0 && usage.u16Free == 0x300, "untouched", usage.u16StackPeak, 0);
+	pRAM[HOST_RAM_SIZE/4 - 25] = 0; // 100 bytes down
+	pRAM[HOST_RAM_SIZE/4 - 10] = 0;
+	Check(ramStackPeak() == 100, "stack peak", ramStackPeak(), 100);
+	pRAM[0x6f0/4] = 0x12345678; // past __stack_size
+	ramGetUsage(&usage);
+	Check(usage.u16StackPeak == 0x110 && usage.u16Free == 0x1f0, "overflow", usage.u16StackPeak, 0x110);
+	hostReset();
+} /* TestRAM() */
+
+// LIFO allocation, word aligned, and an overflow stops the firmware
+static void TestScratch(void)
+{
+	int iMark = scratchMark(), iStatus;
+	uint8_t *p1, *p2;
+	pid_t pid;
+
+	p1 = scratchAlloc(9);
+	p2 = scratchAlloc(SCRATCH_LEAF);
+	Check(p2 - p1 == 12 && ((uintptr_t)p1 & 3) == 0, "scratch rounding", p2 - p1, 12);
+	Check(scratchMark() == iMark + 12 + SCRATCH_LEAF, "scratch top", scratchMark(), iMark + 12 + SCRATCH_LEAF);
+	scratchRelease(iMark + 12);
+	Check(scratchAlloc(4) == p2, "scratch reuse", 0, 0);
+	Check(scratchPeak() == iMark + 12 + SCRATCH_LEAF, "scratch peak", scratchPeak(), iMark + 12 + SCRATCH_LEAF);
+	fflush(NULL);
+	pid = fork(); // it aborts, so in a child
+	if (pid == 0) {
+		scratchAlloc(SCRATCH_SIZE);
+		_exit(0);
+	}
+	Check(pid > 0 && waitpid(pid, &iStatus, 0) == pid && WIFSIGNALED(iStatus) && WTERMSIG(iStatus) == SIGABRT,
+		"scratch overflow aborts", 0, 1);
+	scratchRelease(iMark);
+	Check(scratchMark() == 0, "scratch released", scratchMark(), 0);
+} /* TestScratch() */
+
+int main(void)
+{
+	HOST_HOOKS hooks = {0};
+
+	hooks.pfnFault = OnFault;
+	hooks.pfnUart = OnUart;
+	hostSetHooks(&hooks);
+	if (setjmp(jbFault)) {
+		fprintf(stderr, "test_host: unexpected fault: %s\n", szFault);
+		return 1;
+	}
+	TestDelay();
+	TestI2C();
+	if (setjmp(jbFault)) {
+		fprintf(stderr, "test_host: unexpected fault: %s\n", szFault);
+		return 1;
+	}
+	TestPwm();
+	TestPattern();
+	TestClock();
+	TestTelemetry();
+	TestFlash();
+	TestResume();
+	TestStandby();
+	TestStandbyWake();
+	TestDiag();
+	TestRAM();
+	TestScratch();
+	if (iErrors) {
+		fprintf(stderr, "test_host: %d errors\n", iErrors);
+		return 1;
+	}
+	printf("test_host: firmware runs on the simulated peripherals\n");
+	return 0;
+} /* main() */
@@ -0,0 +1,324 @@
+//
+// RV32EC simulator test
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Checks the instruction set simulator (rv32sim.c) with small hand
+// assembled programs, results and cycle counts both, then runs the
+// firmware image from reset to make sure every instruction in it decodes.
+//
+// test_rv32sim [firmware .hex or .elf]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rv32sim.h"
+
+static RV32SIM *pSim;
+static int iErrors;
+
+static void Check(int bOk, const char *szWhat, long long llGot, long long llWant)
+{
+	if (!bOk) {
+		iErrors++;
+		fprintf(stderr, "%s: got %lld, expected %lld\n", szWhat, llGot, llWant);
+	}
+} /* Check() */
+
+#define CHECK_EQ(what, got, want) Check((long long)(got) == (long long)(want), what, (long long)(got), (long long)(want))
+
+// main: calls sum(10) and sum(5), returns the total
+//  0: 1161     addi sp,sp,-8
+//  2: c206     sw ra,4(sp)
+//  4: 4529     li a0,10
+//  6: 2809     jal sum
+//  8: c02a     sw a0,0(sp)
+//  a: 4515     li a0,5
+//  c: 2031     jal sum
+//  e: 4582     lw a1,0(sp)
+// 10: 952e     add a0,a0,a1
+// 12: 4092     lw ra,4(sp)
+// 14: 0121     addi sp,sp,8
+// 16: 8082     ret
+// sum: a0 + (a0-1) + ... + 1
+// 18: 4781     li a5,0
+// 1a: 97aa     add a5,a5,a0
+// 1c: 157d     addi a0,a0,-1
+// 1e: fd75     bnez a0,1a
+// 20: 853e     mv a0,a5
+// 22: 8082     ret
+static const uint8_t ucSum[] = {
+	0x61,0x11, 0x06,0xc2, 0x29,0x45, 0x09,0x28, 0x2a,0xc0, 0x15,0x45, 0x31,0x20, 0x82,0x45,
+	0x2e,0x95, 0x92,0x40, 0x21,0x01, 0x82,0x80,
+	0x81,0x47, 0xaa,0x97, 0x7d,0x15, 0x75,0xfd, 0x3e,0x85, 0x82,0x80};
+
+// ops(a0 = results): one of most RV32E instructions, each result stored
+static const uint8_t ucOps[] = {
+	0xb7,0x55,0x34,0x12, // lui a1,0x12345
+	0x93,0x85,0x85,0x67, // addi a1,a1,0x678
+	0x0c,0xc1,           // sw a1,0(a0)
+	0xc1,0x56,           // li a3,-16
+	0x13,0xd7,0x26,0x40, // srai a4,a3,2
+	0x93,0xd7,0xc6,0x01, // srli a5,a3,28
+	0x58,0xc1, 0x1c,0xc5, // sw a4,4(a0); sw a5,8(a0)
+	0x33,0xa7,0xb6,0x00, // slt a4,a3,a1
+	0xb3,0xb7,0xb6,0x00, // sltu a5,a3,a1
+	0x58,0xc5, 0x1c,0xc9, // sw a4,12(a0); sw a5,16(a0)
+	0x13,0x07,0x00,0xf8, // li a4,-128
+	0x23,0x0a,0xe5,0x00, // sb a4,20(a0)
+	0x83,0x07,0x45,0x01, // lb a5,20(a0)
+	0x83,0x42,0x45,0x01, // lbu t0,20(a0)
+	0x1c,0xcd,           // sw a5,24(a0)
+	0x23,0x2e,0x55,0x00, // sw t0,28(a0)
+	0x23,0x10,0xd5,0x02, // sh a3,32(a0)
+	0x83,0x17,0x05,0x02, // lh a5,32(a0)
+	0x83,0x52,0x05,0x02, // lhu t0,32(a0)
+	0x5c,0xd1,           // sw a5,36(a0)
+	0x23,0x24,0x55,0x02, // sw t0,40(a0)
+	0x13,0x07,0x80,0x08, // li a4,0x88
+	0x73,0x10,0x07,0x30, // csrw mstatus,a4
+	0xf3,0xe7,0x00,0x30, // csrrsi a5,mstatus,1
+	0xf3,0x22,0x00,0x30, // csrr t0,mstatus
+	0x5c,0xd5,           // sw a5,44(a0)
+	0x23,0x28,0x55,0x02, // sw t0,48(a0)
+	0xb3,0x87,0xd5,0x40, // sub a5,a1,a3
+	0x13,0xc7,0xf7,0xff, // not a4,a5
+	0x5c,0xd9, 0x18,0xdd, // sw a5,52(a0); sw a4,56(a0)
+	0x97,0x07,0x00,0x00, // auipc a5,0 (at 0x6e)
+	0x5c,0xdd,           // sw a5,60(a0)
+	0x82,0x80};          // ret
+static const uint32_t u32OpsResults[] = {0x12345678, 0xfffffffc, 15, 1, 0, 0x80, 0xffffff80, 0x80,
+	0xfff0, 0xfffffff0, 0xfff0, 0x88, 0x89, 0x12345688, 0xedcba977, RV32SIM_FLASH_BASE + 0x6e};
+
+// a 32-bit instruction which straddles two flash words costs a cycle more
+static const uint8_t ucSplit[] = {
+	0x01,0x00,           // nop
+	0x93,0x82,0x12,0x00, // addi t0,t0,1
+	0x82,0x80};          // ret
+
+static void Load(uint32_t u32Addr, const uint8_t *pCode, int iLen)
+{
+	memcpy(&pSim->u8Flash[u32Addr - RV32SIM_FLASH_BASE], pCode, iLen);
+} /* Load() */
+
+static void TestOps(void)
+{
+	uint32_t u32Arg = RV32SIM_SCRATCH_BASE, u32;
+	int i, rc;
+
+	rv32simInit(pSim);
+	Load(RV32SIM_FLASH_BASE, ucOps, sizeof(ucOps));
+	rv32simReset(pSim);
+	rc = rv32simCall(pSim, RV32SIM_FLASH_BASE, &u32Arg, 1, 1000);
+	CHECK_EQ("ops stop reason", rc, RV32SIM_RETURNED);
+	for (i=0; i<(int)(sizeof(u32OpsResults)/sizeof(uint32_t)); i++) {
+		rv32simRead(pSim, u32Arg + 4*i, 4, &u32);
+		CHECK_EQ("ops result", u32, u32OpsResults[i]);
+	}
+	// straddling fetch: nop 1, addi 1 + 1, ret 3
+	Load(RV32SIM_FLASH_BASE + 0x100, ucSplit, sizeof(ucSplit));
+	rv32simClearProfile(pSim);
+	rv32simCall(pSim, RV32SIM_FLASH_BASE + 0x100, NULL, 0, 100);
+	CHECK_EQ("split fetch cycles", pSim->u64Cycles, 6);
+	CHECK_EQ("split fetch instructions", pSim->u64Instructions, 3);
+} /* TestOps() */
+
+// sum(10) with a FLASH wait state: the loop fetches two new words per pass
+// (18 and 1c), the first pass and the exit one more each; none from RAM
+static void TestWait(void)
+{
+	uint32_t u32Arg = 10;
+
+	rv32simInit(pSim);
+	Load(RV32SIM_FLASH_BASE, ucSum, sizeof(ucSum));
+	memcpy(pSim->u8RAMImage, ucSum, sizeof(ucSum)); // like .ramfunc, copied at reset
+	pSim->iFlashWait = RV32SIM_FLASH_WAIT(48);
+	rv32simReset(pSim);
+	rv32simCall(pSim, RV32SIM_FLASH_BASE + 0x18, &u32Arg, 1, 1000);
+	CHECK_EQ("sum(10) from FLASH at 48MHz", pSim->u64Cycles, 53 + 21);
+	rv32simReset(pSim);
+	rv32simClearProfile(pSim);
+	rv32simCall(pSim, RV32SIM_RAM_BASE + 0x18, &u32Arg, 1, 1000);
+	CHECK_EQ("sum(10) from RAM at 48MHz", pSim->u64Cycles, 53);
+	CHECK_EQ("sum(10) result", pSim->x[10], 55);
+	pSim->bWaitRAM = 1;
+	rv32simReset(pSim);
+	rv32simClearProfile(pSim);
+	rv32simCall(pSim, RV32SIM_RAM_BASE + 0x18, &u32Arg, 1, 1000);
+	CHECK_EQ("sum(10) from RAM charged as FLASH", pSim->u64Cycles, 53 + 21);
+	CHECK_EQ("no wait state at 24MHz", RV32SIM_FLASH_WAIT(24), 0);
+} /* TestWait() */
+
+// what isn't RV32EC has to stop the run where it is
+static void TestStops(void)
+{
+	static const struct {
+		uint32_t u32Insn, u32A0;
+		int iReason;
+		const char *szName;
+	} stops[] = {
+		{0x02b50533, 0, RV32SIM_ILLEGAL, "mul a0,a0,a1"},
+		{0x00050813, 0, RV32SIM_ILLEGAL, "addi a6,a0,0"},
+		{0x10500073, 0, RV32SIM_WFI, "wfi"},
+		{0x00100073, 0, RV32SIM_BREAK, "ebreak"},
+		{0x00152503, RV32SIM_RAM_BASE, RV32SIM_BUS_ERROR, "lw a0,1(a0)"}, // misaligned
+		{0x00052503, 0x30000000, RV32SIM_BUS_ERROR, "lw a0,0(a0)"}}; // unmapped
+	int i, rc;
+
+	for (i=0; i<(int)(sizeof(stops)/sizeof(stops[0])); i++) {
+		rv32simInit(pSim);
+		memcpy(pSim->u8Flash, &stops[i].u32Insn, 4);
+		rv32simReset(pSim);
+		rc = rv32simCall(pSim, RV32SIM_FLASH_BASE, &stops[i].u32A0, 1, 10);
+		if (rc != stops[i].iReason || pSim->u32StopPC != RV32SIM_FLASH_BASE) {
+			iErrors++;
+			fprintf(stderr, "%s: stopped with %s at %08x\n", stops[i].szName, rv32simStopReason(rc), pSim->u32StopPC);
+		}
+	}
+} /* TestStops() */
+
+static void Put16(uint8_t *p, uint32_t u32) { p[0] = (uint8_t)u32; p[1] = (uint8_t)(u32 >> 8); }
+static void Put32(uint8_t *p, uint32_t u32) { Put16(p, u32); Put16(p + 2, u32 >> 16); }
+
+// The smallest ELF the linker could have made of ucSum: one segment and
+// a symbol table with main and sum. Checks the loader and the profile.
+static void TestELF(void)
+{
+	uint8_t ucELF[300];
+	const char *szFile = "test_rv32sim.elf";
+	static const char szStrings[] = "\0main\0sum";
+	RV32SIM_SYMBOL *pMain, *pSum;
+	FILE *f;
+	int rc;
+
+	memset(ucELF, 0, sizeof(ucELF));
+	memcpy(ucELF, "\177ELF\001\001\001", 7);
+	Put16(&ucELF[16], 2); // ET_EXEC
+	Put16(&ucELF[18], 243); // EM_RISCV
+	Put32(&ucELF[20], 1);
+	Put32(&ucELF[24], RV32SIM_FLASH_BASE); // entry
+	Put32(&ucELF[28], 52); // program headers
+	Put32(&ucELF[32], 180); // section headers
+	Put16(&ucELF[40], 52);
+	Put16(&ucELF[42], 32);
+	Put16(&ucELF[44], 1);
+	Put16(&ucELF[46], 40);
+	Put16(&ucELF[48], 3); // null, .symtab, .strtab
+	// PT_LOAD of the code
+	Put32(&ucELF[52], 1);
+	Put32(&ucELF[56], 84);
+	Put32(&ucELF[60], RV32SIM_FLASH_BASE);
+	Put32(&ucELF[64], RV32SIM_FLASH_BASE);
+	Put32(&ucELF[68], sizeof(ucSum));
+	Put32(&ucELF[72], sizeof(ucSum));
+	memcpy(&ucELF[84], ucSum, sizeof(ucSum));
+	memcpy(&ucELF[120], szStrings, sizeof(szStrings));
+	// symbols (the first one is null)
+	Put32(&ucELF[148], 1);
+	Put32(&ucELF[152], RV32SIM_FLASH_BASE);
+	Put32(&ucELF[156], 0x18);
+	ucELF[160] = 0x12; // global function
+	Put32(&ucELF[164], 6);
+	Put32(&ucELF[168], RV32SIM_FLASH_BASE + 0x18);
+	Put32(&ucELF[172], 12);
+	ucELF[176] = 0x12;
+	// section headers
+	Put32(&ucELF[220 + 4], 2); // SHT_SYMTAB
+	Put32(&ucELF[220 + 16], 132);
+	Put32(&ucELF[220 + 20], 48);
+	Put32(&ucELF[220 + 24], 2); // linked to .strtab
+	Put32(&ucELF[220 + 36], 16);
+	Put32(&ucELF[260 + 4], 3); // SHT_STRTAB
+	Put32(&ucELF[260 + 16], 120);
+	Put32(&ucELF[260 + 20], sizeof(szStrings));
+	f = fopen(szFile, "wb");
+	if (!f) {
+		iErrors++;
+		fprintf(stderr, "can't write %s\n", szFile);
+		return;
+	}
+	fwrite(ucELF, 1, sizeof(ucELF), f);
+	fclose(f);
+	rv32simInit(pSim);
+	rc = rv32simLoadELF(pSim, szFile);
+	remove(szFile);
+	CHECK_EQ("ELF load", rc, 0);
+	pMain = rv32simFindSymbol(pSim, "main");
+	pSum = rv32simFindSymbol(pSim, "sum");
+	if (!pMain || !pSum) {
+		iErrors++;
+		fprintf(stderr, "ELF symbols missing\n");
+		return;
+	}
+	rv32simReset(pSim);
+	rc = rv32simCall(pSim, pSim->u32Entry, NULL, 0, 1000);
+	CHECK_EQ("sum stop reason", rc, RV32SIM_RETURNED);
+	CHECK_EQ("sum result", pSim->x[10], 55 + 15);
+	// main: 5 ALU (1) + 4 loads/stores (2) + 2 jal and ret (3) = 22
+	// sum(n): li, n adds/addis, n-1 taken branches (3), the last one (1), mv, ret
+	CHECK_EQ("main cycles", pMain->u64Cycles, 22);
+	CHECK_EQ("sum cycles", pSum->u64Cycles, 53 + 28);
+	CHECK_EQ("main instructions", pMain->u64Instructions, 12);
+	CHECK_EQ("sum instructions", pSum->u64Instructions, 33 + 18);
+	CHECK_EQ("main calls", pMain->u32Calls, 1);
+	CHECK_EQ("sum calls", pSum->u32Calls, 2);
+	CHECK_EQ("total cycles", pSim->u64Cycles, 22 + 53 + 28);
+} /* TestELF() */
+
+// the whole firmware from its reset vector, peripherals stubbed: nothing
+// in it may be outside of RV32EC or touch unmapped memory
+static void TestFirmware(const char *szFile)
+{
+	int rc;
+
+	rv32simInit(pSim);
+	rc = (strstr(szFile, ".hex") != NULL) ? rv32simLoadHex(pSim, szFile) : rv32simLoadELF(pSim, szFile);
+	if (rc) {
+		iErrors++;
+		fprintf(stderr, "can't load %s\n", szFile);
+		return;
+	}
+	rv32simReset(pSim);
+	pSim->pfnIO = rv32simStubIO;
+	rc = rv32simRun(pSim, 2000000);
+	if (rc != RV32SIM_LIMIT && rc != RV32SIM_WFI) {
+		iErrors++;
+		fprintf(stderr, "firmware: %s at %08x (%08x) after %llu instructions\n", rv32simStopReason(rc),
+			pSim->u32StopPC, pSim->u32StopInsn, (unsigned long long)pSim->u64Instructions);
+	}
+} /* TestFirmware() */
+
+int main(int argc, char *argv[])
+{
+	pSim = (RV32SIM *)malloc(sizeof(RV32SIM));
+	if (!pSim)
+		return 2;
+	TestOps();
+	TestWait();
+	TestStops();
+	TestELF();
+	if (argc > 1)
+		TestFirmware(argv[1]);
+	free(pSim);
+	if (iErrors) {
+		fprintf(stderr, "test_rv32sim: %d errors\n", iErrors);
+		return 1;
+	}
+	printf("test_rv32sim: simulator passes\n");
+	return 0;
+} /* main() */
@@ -0,0 +1,252 @@
+//
+// Pocket CO2 SCD41 driver test
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Runs the SCD41 driver (User/scd41.c) against the sensor model: periodic,
+// low power and single shot timing, forced recalibration, and the way the
+// driver copes with injected faults.
+//
+// test_scd41 <waveform file>
+//
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include "Arduino.h"
+#include "scd41.h"
+#include "scd41sim.h"
+
+static SCD41SIM sim;
+static int iErrors;
+static jmp_buf jbFault;
+static char szFault[128];
+
+static void Check(int bOk, const char *szWhat, long long llGot, long long llWant)
+{
+	if (!bOk) {
+		iErrors++;
+		fprintf(stderr, "%s: got %lld, expected %lld\n", szWhat, llGot, llWant);
+	}
+} /* Check() */
+
+static void OnFault(const char *szMsg)
+{
+	strncpy(szFault, szMsg, sizeof(szFault)-1);
+	longjmp(jbFault, 1);
+} /* OnFault() */
+
+// compare the driver's values with the waveform at the time of the measurement
+static void CheckSample(const char *szWhat)
+{
+	float fCO2, fTemperature, fHumidity;
+	int iTemperature, iHumidity;
+
+	scd41simSample(&sim, sim.u64ReadyNs, &fCO2, &fTemperature, &fHumidity);
+	fCO2 += sim.iFRCCorrection;
+	iTemperature = (int)(fTemperature * 10.0f + 0.5f);
+	iHumidity = (int)(fHumidity * 10.0f + 0.5f);
+	Check(_iCO2 == (int)(fCO2 + 0.5f), szWhat, _iCO2, (int)(fCO2 + 0.5f));
+	Check(_iTemperature >= iTemperature - 1 && _iTemperature <= iTemperature + 1, szWhat, _iTemperature, iTemperature);
+	Check(_iHumidity >= iHumidity - 1 && _iHumidity <= iHumidity + 1, szWhat, _iHumidity, iHumidity);
+} /* CheckSample() */
+
+// run pfn, which should hang on a NACK; returns 1 if it did
+static int ExpectHang(int (*pfn)(void))
+{
+	szFault[0] = 0;
+	if (setjmp(jbFault) == 0)
+		pfn();
+	return strstr(szFault, "no ACK") != NULL;
+} /* ExpectHang() */
+
+static int ReadStatus(void)
+{
+	uint16_t u16Status;
+
+	return scd41_readRegister(SCD41_CMD_GET_DATA_READY_STATUS, &u16Status);
+} /* ReadStatus() */
+
+static int SetASC(void)
+{
+	return scd41_sendCMD2(SCD41_CMD_SET_AUTOMATIC_SELF_CALIBRATION_ENABLED, 0);
+} /* SetASC() */
+
+static void TestPeriodic(void)
+{
+	SCD41SIM_STATS stats;
+	int i, rc;
+
+	scd41_start(SCD_POWERMODE_NORMAL);
+	Check(scd41simState(&sim) == SCD41SIM_PERIODIC, "periodic state", scd41simState(&sim), SCD41SIM_PERIODIC);
+	Check(scd41_getSample() == SCD_NOT_READY, "first 5s not ready", 1, SCD_NOT_READY);
+	for (i=0; i<24; i++) { // 2 minutes as RunContinuous polls it
+		Delay_Ms(5000);
+		rc = scd41_getSample();
+		Check(rc == SCD_SUCCESS, "periodic sample", rc, SCD_SUCCESS);
+		CheckSample("periodic values");
+	}
+	scd41_stop();
+	scd41simGetStats(&sim, &stats);
+	Check(scd41simState(&sim) == SCD41SIM_IDLE, "stopped", scd41simState(&sim), SCD41SIM_IDLE);
+	Check(stats.u32Missed == 0, "missed measurements", stats.u32Missed, 0);
+	Check(stats.u32Violations == 0 && stats.u32Illegal == 0 && stats.u32BadCRC == 0, "driver protocol errors",
+		stats.u32Violations + stats.u32Illegal + stats.u32BadCRC, 0);
+	printf("periodic: %u reads, latency avg %.1f ms, max %.1f ms\n", stats.u32Reads,
+		stats.u64LatencyNs / 1e6 / (stats.u32Reads ? stats.u32Reads : 1), stats.u64MaxLatencyNs / 1e6);
+} /* TestPeriodic() */
+
+static void TestLowPower(void)
+{
+	uint64_t u64Start;
+
+	scd41_start(SCD_POWERMODE_LOW);
+	u64Start = hostNanos();
+	Delay_Ms(25000);
+	Check(scd41_getSample() == SCD_NOT_READY, "low power at 25s", 1, SCD_NOT_READY);
+	while (scd41_getSample() == SCD_NOT_READY)
+		Delay_Ms(1000);
+	Check(hostNanos() - u64Start >= 30000000000ull, "low power period", (long long)((hostNanos() - u64Start) / 1000000), 30000);
+	CheckSample("low power values");
+	scd41_stop();
+} /* TestLowPower() */
+
+static void TestSingleShot(void)
+{
+	uint64_t u64Start;
+	int rc;
+
+	scd41_start(SCD_POWERMODE_ONESHOT);
+	u64Start = hostNanos();
+	rc = scd41_getSample();
+	Check(rc == SCD_SUCCESS, "single shot", rc, SCD_SUCCESS);
+	Check(hostNanos() - u64Start >= 5000000000ull, "single shot time", (long long)((hostNanos() - u64Start) / 1000000), 5000);
+	CheckSample("single shot values");
+	Check(scd41simState(&sim) == SCD41SIM_IDLE, "idle after single shot", scd41simState(&sim), SCD41SIM_IDLE);
+	// started and read separately, the caller sleeps in between (the sensor
+	// doesn't answer until the measurement is done)
+	scd41_singleShot();
+	Delay_Ms(SCD41_SINGLE_SHOT_MS);
+	rc = scd41_readSample();
+	Check(rc == SCD_SUCCESS, "single shot read", rc, SCD_SUCCESS);
+	CheckSample("single shot read values");
+} /* TestSingleShot() */
+
+static void TestRecalibrate(void)
+{
+	float fCO2, fTemperature, fHumidity;
+	int rc;
+
+	rc = scd41_recalibrate(423); // the last run was too short
+	Check(rc == SCD_ERROR, "recalibration without 3 minutes of measurements", rc, SCD_ERROR);
+	scd41_start(SCD_POWERMODE_NORMAL);
+	Delay_Ms(181000);
+	scd41_stop();
+	scd41simFault(&sim, SCD41SIM_FAULT_FRC, 1);
+	rc = scd41_recalibrate(423);
+	Check(rc == SCD_ERROR, "recalibration fault", rc, SCD_ERROR);
+	scd41simSample(&sim, hostNanos(), &fCO2, &fTemperature, &fHumidity);
+	rc = scd41_recalibrate(423);
+	Check(rc == SCD_SUCCESS, "recalibration", rc, SCD_SUCCESS);
+	Check(sim.iFRCCorrection == 423 - (int)(fCO2 + 0.5f), "recalibration offset", sim.iFRCCorrection, 423 - (int)(fCO2 + 0.5f));
+	scd41_start(SCD_POWERMODE_NORMAL);
+	Delay_Ms(5100);
+	Check(scd41_getSample() == SCD_SUCCESS, "sample after recalibration", 0, SCD_SUCCESS);
+	CheckSample("recalibrated values");
+	scd41_stop();
+	sim.iFRCCorrection = 0;
+} /* TestRecalibrate() */
+
+static void TestFaults(void)
+{
+	SCD41SIM_STATS before, after;
+	uint8_t u8Data[3];
+	int i;
+
+	scd41_start(SCD_POWERMODE_NORMAL);
+	Delay_Ms(5100);
+	// data ready stuck at 0
+	scd41simFault(&sim, SCD41SIM_FAULT_NOT_READY, -1);
+	for (i=0; i<3; i++)
+		Check(scd41_getSample() == SCD_NOT_READY, "stuck not ready", 1, SCD_NOT_READY);
+	scd41simFault(&sim, SCD41SIM_FAULT_NOT_READY, 0);
+	Check(scd41_getSample() == SCD_SUCCESS, "ready again", 1, SCD_SUCCESS);
+	// a response with a bad CRC (the driver doesn't check them yet)
+	scd41simGetStats(&sim, &before);
+	scd41simFault(&sim, SCD41SIM_FAULT_CRC, 1);
+	scd41_sendCMD(SCD41_CMD_GET_DATA_READY_STATUS);
+	Delay_Ms(5);
+	I2CRead(0x62, u8Data, 3);
+	scd41simGetStats(&sim, &after);
+	Check(scd41_computeCRC8(u8Data, 2) != u8Data[2], "corrupted CRC", u8Data[2], scd41_computeCRC8(u8Data, 2));
+	Check(after.u32CRCFaults - before.u32CRCFaults == 1, "CRC faults", after.u32CRCFaults - before.u32CRCFaults, 1);
+	// the driver can't get past a NACK
+	scd41simFault(&sim, SCD41SIM_FAULT_NACK, 1);
+	Check(ExpectHang(scd41_getSample), "NACK hangs the driver", 0, 1);
+	// command not allowed while measuring
+	scd41simGetStats(&sim, &before);
+	Check(ExpectHang(SetASC), "illegal command NACKed", 0, 1);
+	scd41simGetStats(&sim, &after);
+	Check(after.u32Illegal - before.u32Illegal == 1, "illegal commands", after.u32Illegal - before.u32Illegal, 1);
+	// addressed before the stop command finished
+	scd41_sendCMD(SCD41_CMD_STOP_PERIODIC_MEASUREMENT);
+	Check(ExpectHang(ReadStatus), "execution time violation NACKed", 0, 1);
+	scd41simGetStats(&sim, &after);
+	Check(after.u32Violations - before.u32Violations == 1, "execution time violations", after.u32Violations - before.u32Violations, 1);
+	Delay_Ms(500);
+	// power down, then wake up (never acknowledged, so it hangs too)
+	scd41_sendCMD(SCD41_CMD_POWERDOWN);
+	Delay_Ms(1);
+	Check(scd41simState(&sim) == SCD41SIM_SLEEP, "power down", scd41simState(&sim), SCD41SIM_SLEEP);
+	Check(ExpectHang(ReadStatus), "asleep NACKs", 0, 1);
+	Delay_Ms(20);
+	Check(scd41simState(&sim) == SCD41SIM_IDLE, "woken by the address", scd41simState(&sim), SCD41SIM_IDLE);
+} /* TestFaults() */
+
+int main(int argc, char *argv[])
+{
+	HOST_HOOKS hooks = {0};
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: test_scd41 <waveform file>\n");
+		return 2;
+	}
+	hooks.pfnFault = OnFault;
+	hostSetHooks(&hooks);
+	scd41simAttach(&sim);
+	if (scd41simLoadWaveform(&sim, argv[1]) < 2) {
+		fprintf(stderr, "can't read the waveform %s\n", argv[1]);
+		return 2;
+	}
+	if (setjmp(jbFault)) {
+		fprintf(stderr, "test_scd41: unexpected fault: %s\n", szFault);
+		return 1;
+	}
+	Delay_Init();
+	I2CInit(50000);
+	TestPeriodic();
+	TestLowPower();
+	TestSingleShot();
+	TestRecalibrate();
+	TestFaults();
+	if (iErrors) {
+		fprintf(stderr, "test_scd41: %d errors\n", iErrors);
+		return 1;
+	}
+	printf("test_scd41: driver works against the sensor model\n");
+	return 0;
+} /* main() */
@@ -0,0 +1,228 @@
+//
+// Pocket CO2 screen golden-frame test
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Draws every screen in main.c on the SSD1306 model, compares the frames
+// with the PBM files in host/golden and prints the I2C cost of each one.
+// The I2C trace (User/i2ctrace.c) has to agree with the model on the cost
+// and put it on the UI function that drew the screen.
+//
+// test_screens <golden dir> [-update] [-png <dir>]
+//  -update  rewrite the golden files from the current firmware
+//  -png     also save each frame as a PNG
+//
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "oled.h"
+#include "scd41.h"
+#include "ssd1306.h"
+#include "i2ctrace.h"
+#include "profile.h"
+#include "scratch.h"
+
+// from main.c, in the same order as its enum
+enum
+{
+	SCREEN_STARTING=0,
+	SCREEN_RESUMING,
+	SCREEN_TIMER,
+	SCREEN_STEALTH,
+	SCREEN_CONSOLE,
+	SCREEN_CALIBRATE,
+	SCREEN_CALIBRATING,
+	SCREEN_CAL_SUCCESS,
+	SCREEN_CAL_FAILED
+};
+void ReadFlash(void);
+void ShowScreen(int iScreen);
+void ShowMenu(int iSelItem, int bFull);
+void ShowCurrent(void);
+void ShowTime(int iSecs);
+void ShowDiagnostics(void *pBench, int iPage); // a DIAG_BENCH of 7 uint32_t
+
+#define OLED_ADDR 0x3c
+#define MENU_TIME 4
+
+static SSD1306 oled;
+
+static void SetSample(int iCO2, int iTemperature, int iHumidity)
+{
+	_iCO2 = (uint16_t)iCO2;
+	_iTemperature = iTemperature;
+	_iHumidity = iHumidity;
+} /* SetSample() */
+
+// each screen is drawn on top of what the previous one left, as on the device
+static void ScrStarting(void) { ShowScreen(SCREEN_STARTING); }
+static void ScrResuming(void) { ShowScreen(SCREEN_RESUMING); }
+static void ScrMenu(void) { ShowMenu(0, 1); }
+static void ScrMenuTimer(void) { ShowMenu(MENU_TIME, 0); }
+static void ScrCurrent(void) { SetSample(1234, 235, 456); ShowCurrent(); }
+static void ScrCurrentLow(void) { SetSample(812, 198, 512); ShowCurrent(); } // 4 -> 3 digits
+static void ScrCurrentHigh(void) { SetSample(2675, 312, 783); ShowCurrent(); }
+static void ScrTimer(void) { ShowScreen(SCREEN_TIMER); ShowTime(300); }
+static void ScrStealth(void) { ShowScreen(SCREEN_STEALTH); }
+static void ScrConsole(void) { ShowScreen(SCREEN_CONSOLE); }
+static void ScrCalibrate(void) { ShowScreen(SCREEN_CALIBRATE); }
+static void ScrCalibrating(void) { ShowScreen(SCREEN_CALIBRATING); ShowTime(210); }
+static void ScrCalSuccess(void) { ShowScreen(SCREEN_CAL_SUCCESS); }
+static void ScrCalFailed(void) { ShowScreen(SCREEN_CALIBRATING); ShowTime(0); ShowScreen(SCREEN_CAL_FAILED); }
+// fills under a tick must not divide by zero; the diagnostics screen has no
+// trace site of its own, so it's counted as a ShowScreen()
+static void ScrDiagZero(void)
+{
+	uint32_t u32Bench[7] = {0};
+	uint8_t u8Site = i2cTraceEnter(TRACE_SITE_SHOWSCREEN);
+
+	ShowDiagnostics(u32Bench, 0);
+	i2cTraceLeave(u8Site);
+} /* ScrDiagZero() */
+
+static const struct {
+	const char *szName;
+	void (*pfnDraw)(void);
+} screens[] = {
+	{"menu", ScrMenu},
+	{"menu_timer", ScrMenuTimer},
+	{"starting", ScrStarting},
+	{"current", ScrCurrent},
+	{"current_low", ScrCurrentLow},
+	{"current_high", ScrCurrentHigh},
+	{"resuming", ScrResuming},
+	{"timer", ScrTimer},
+	{"stealth", ScrStealth},
+	{"console", ScrConsole},
+	{"calibrate", ScrCalibrate},
+	{"calibrating", ScrCalibrating},
+	{"cal_success", ScrCalSuccess},
+	{"cal_failed", ScrCalFailed},
+	{"diag_zero", ScrDiagZero}
+};
+
+// the trace totals must match the bus traffic the model saw, all of it
+// from a UI function, and all of it valid for the SSD1306
+static int CheckTrace(const char *szName, SSD1306 *pOLED)
+{
+	const I2C_TRACE_TOTAL *pTotals = i2cTraceTotals();
+	I2C_TRACE_ENTRY entry;
+	uint32_t u32Transfers = 0, u32Bytes = 0;
+	int i;
+
+	for (i=0; i<TRACE_SITE_COUNT; i++) {
+		u32Transfers += pTotals[i].u16Transfers;
+		u32Bytes += pTotals[i].u32Bytes;
+	}
+	// the model counts the address byte of each transfer too
+	if (u32Transfers != pOLED->stats.u32Transactions || u32Bytes + u32Transfers != pOLED->stats.u32Bytes ||
+		pTotals[TRACE_SITE_OTHER].u16Transfers != 0 || i2cTraceGet(0, &entry) != 0 || entry.u8Addr != OLED_ADDR ||
+		pOLED->stats.u32Unknown != 0 || pOLED->stats.u32Wraps != 0) {
+		fprintf(stderr, "%s: I2C trace has %u transfers, %u bytes (%u outside the UI functions), %u unknown commands, %u column wraps\n",
+			szName, u32Transfers, u32Bytes, pTotals[TRACE_SITE_OTHER].u16Transfers, pOLED->stats.u32Unknown, pOLED->stats.u32Wraps);
+		return 1;
+	}
+	return 0;
+} /* CheckTrace() */
+
+// each scope drawn by the screens was timed once per draw, in the right buckets
+static int CheckProfile(int iScope, uint32_t u32Draws)
+{
+	const PROF_SCOPE *pScope = profileGet(iScope);
+	uint32_t u32Hist = 0;
+	int i;
+
+	for (i=0; i<PROFILE_BUCKETS; i++)
+		u32Hist += pScope->u16Hist[i];
+	if (pScope->u32Count != u32Draws || u32Hist != u32Draws || pScope->u32Min > pScope->u32Max ||
+		pScope->u16Hist[profileBucket(pScope->u32Max)] == 0 || pScope->u16Hist[profileBucket(pScope->u32Min)] == 0 ||
+		profileBucket(0) != 0 || profileBucket(1) != 1 || profileBucket(3) != 2 || profileBucket(0xffffffff) != PROFILE_BUCKETS-1) {
+		fprintf(stderr, "%s: profile has %u passes (%u in the histogram) for %u draws, min %u max %u\n", profileName(iScope),
+			pScope->u32Count, u32Hist, u32Draws, pScope->u32Min, pScope->u32Max);
+		return 1;
+	}
+	return 0;
+} /* CheckProfile() */
+
+int main(int argc, char *argv[])
+{
+	const char *szGolden = NULL, *szPNG = NULL;
+	char szFile[256];
+	int i, iDiff, bUpdate = 0, iErrors = 0;
+	uint64_t u64Start;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-update") == 0)
+			bUpdate = 1;
+		else if (strcmp(argv[i], "-png") == 0 && i+1 < argc)
+			szPNG = argv[++i];
+		else
+			szGolden = argv[i];
+	}
+	if (!szGolden) {
+		fprintf(stderr, "usage: test_screens <golden dir> [-update] [-png <dir>]\n");
+		return 2;
+	}
+	Delay_Init();
+	ReadFlash(); // erased FLASH: default settings
+	ssd1306Attach(&oled, OLED_ADDR);
+	oledInit(OLED_ADDR, 400000);
+	oledContrast(150);
+	profileClear();
+	printf("%-14s %6s %6s %6s %6s %9s %9s\n", "screen", "xfers", "bytes", "cmds", "data", "400k ms", "sim ms");
+	for (i=0; i<(int)(sizeof(screens)/sizeof(screens[0])); i++) {
+		ssd1306ResetStats(&oled);
+		u64Start = hostNanos();
+		I2CSetSpeed(400000);
+		i2cTraceClear();
+		screens[i].pfnDraw();
+		iErrors += CheckTrace(screens[i].szName, &oled);
+		printf("%-14s %6u %6u %6u %6u %9.2f %9.2f\n", screens[i].szName,
+			oled.stats.u32Transactions, oled.stats.u32Bytes, oled.stats.u32Commands, oled.stats.u32DataBytes,
+			ssd1306BusNs(&oled, 400000) / 1e6, (hostNanos() - u64Start) / 1e6);
+		snprintf(szFile, sizeof(szFile), "%s/%s.pbm", szGolden, screens[i].szName);
+		if (bUpdate) {
+			if (ssd1306WritePBM(&oled, szFile) != 0) {
+				fprintf(stderr, "can't write %s\n", szFile);
+				iErrors++;
+			}
+		} else if ((iDiff = ssd1306ComparePBM(&oled, szFile)) != 0) {
+			if (iDiff < 0)
+				fprintf(stderr, "%s: missing or bad golden file\n", szFile);
+			else
+				fprintf(stderr, "%s: %d pixels differ\n", szFile, iDiff);
+			iErrors++;
+		}
+		if (szPNG) {
+			snprintf(szFile, sizeof(szFile), "%s/%s.png", szPNG, screens[i].szName);
+			ssd1306WritePNG(&oled, szFile);
+		}
+	}
+	iErrors += CheckProfile(PROF_SHOWCURRENT, 3); // current, current_low, current_high
+	iErrors += CheckProfile(PROF_SHOWMENU, 2); // menu, menu_timer
+	if (scratchMark() != 0 || scratchPeak() > SCRATCH_SIZE) { // every screen gave its buffers back and they fit
+		fprintf(stderr, "scratch arena: %d bytes still held, peak %d of %d\n", scratchMark(), scratchPeak(), SCRATCH_SIZE);
+		iErrors++;
+	}
+	printf("scratch arena peak %d of %d bytes\n", scratchPeak(), SCRATCH_SIZE);
+	if (iErrors) {
+		fprintf(stderr, "test_screens: %d screens differ (run with -update after checking the PNGs)\n", iErrors);
+		return 1;
+	}
+	return 0;
+} /* main() */
@@ -0,0 +1,190 @@
+//
+// Pocket CO2 serial console client (Linux host)
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Sends one console command and prints the reply. "dump" writes the
+// history as CSV to stdout and re-requests from the next missing
+// sequence number if a frame is lost or corrupted.
+//
+// usage: co2_console [-b baud] <device> get | set <name> <value> | cal [ppm] | dump [seq] | i2c [clear] | prof [clear] | ram
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include "frame.h"
+#include "../User/history.h"
+
+#define TIMEOUT_MS 2000
+#define MAX_RETRIES 5
+
+static FRAME_PARSER parser;
+static char szLine[128];
+static int iLineLen;
+
+//
+// Read until a text line or a frame arrives
+// returns FRAME_TEXT (szLine), FRAME_OK, FRAME_BAD or -1 on timeout/error
+//
+static int ReadItem(int fd)
+{
+	uint8_t u8;
+	struct pollfd pfd;
+	int rc;
+
+	while (1) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, TIMEOUT_MS) <= 0 || read(fd, &u8, 1) != 1)
+			return -1;
+		rc = FrameFeed(&parser, u8);
+		if (rc == FRAME_OK || rc == FRAME_BAD)
+			return rc;
+		if (rc != FRAME_TEXT || u8 == '\r')
+			continue;
+		if (u8 == '\n') {
+			szLine[iLineLen] = 0;
+			iLineLen = 0;
+			return FRAME_TEXT;
+		}
+		if (iLineLen < (int)sizeof(szLine) - 1)
+			szLine[iLineLen++] = (char)u8;
+	}
+} /* ReadItem() */
+
+static void SendCommand(int fd, const char *szCmd)
+{
+	char szTemp[64];
+	int iLen = snprintf(szTemp, sizeof(szTemp), "%s\n", szCmd);
+
+	if (write(fd, szTemp, iLen) != iLen)
+		fprintf(stderr, "co2_console: write error: %s\n", strerror(errno));
+} /* SendCommand() */
+
+//
+// Returns 0 once every entry from u32Seq up to the device's "end" was received
+//
+static int Dump(int fd, uint32_t u32Seq)
+{
+	char szCmd[32];
+	uint8_t *p;
+	uint32_t u32First, u32End;
+	int i, rc, iCount, iRetries = 0, bFirstFrame, bLost;
+
+	printf("seq,seconds,co2_ppm,temp_c,rh_pct\n");
+	while (iRetries <= MAX_RETRIES) {
+		snprintf(szCmd, sizeof(szCmd), "dump %u", u32Seq);
+		SendCommand(fd, szCmd);
+		bFirstFrame = 1;
+		bLost = 0;
+		while ((rc = ReadItem(fd)) >= 0) {
+			if (rc == FRAME_BAD) {
+				bLost = 1;
+				continue;
+			}
+			if (rc == FRAME_TEXT) {
+				if (sscanf(szLine, "end %u", &u32End) != 1)
+					continue;
+				if (!bLost && u32Seq >= u32End)
+					return 0;
+				break; // ask again from the first missing entry
+			}
+			p = &parser.u8Frame[3];
+			if (p[0] != TELEMETRY_TYPE_HISTORY)
+				continue; // a sample frame between the replies
+			iCount = p[1];
+			u32First = FrameGet32(&p[2]);
+			// the device starts at its oldest entry if we asked for older
+			if (u32First != u32Seq && !(bFirstFrame && u32First > u32Seq)) {
+				bLost = 1;
+				continue;
+			}
+			bFirstFrame = 0;
+			if (bLost)
+				continue;
+			for (i=0; i<iCount; i++) {
+				int iTemp = p[8+i*3+1] * HISTORY_TEMP_SCALE - HISTORY_TEMP_OFFSET;
+				int iRH = p[8+i*3+2] * HISTORY_RH_SCALE;
+				printf("%u,%u,%d,%s%d.%d,%d.%d\n", u32First + i, (u32First + i) * FrameGet16(&p[6]),
+					p[8+i*3] * HISTORY_CO2_SCALE, (iTemp < 0) ? "-" : "", abs(iTemp) / 10, abs(iTemp) % 10,
+					iRH / 10, iRH % 10);
+			}
+			u32Seq = u32First + iCount;
+		}
+		iRetries++;
+		fprintf(stderr, "co2_console: resuming the dump at %u\n", u32Seq);
+	}
+	fprintf(stderr, "co2_console: giving up\n");
+	return 1;
+} /* Dump() */
+
+int main(int argc, char *argv[])
+{
+	char szCmd[64];
+	int i, fd, rc, iBaud = 230400, iArg = 1, bLines;
+
+	if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+		iBaud = atoi(argv[2]);
+		iArg = 3;
+	}
+	if (argc < iArg + 2) {
+		fprintf(stderr, "usage: co2_console [-b baud] <device> get | set <name> <value> | cal [ppm] | dump [seq] | i2c [clear] | prof [clear] | ram\n");
+		return 2;
+	}
+	fd = open(argv[iArg], O_RDWR | O_NOCTTY);
+	if (fd < 0 || FrameSetupPort(fd, iBaud) != 0) {
+		fprintf(stderr, "co2_console: can't open %s: %s\n", argv[iArg], strerror(errno));
+		return 1;
+	}
+	tcflush(fd, TCIFLUSH); // drop telemetry which arrived before we asked
+	iArg++;
+	if (strcmp(argv[iArg], "dump") == 0) {
+		rc = Dump(fd, (iArg + 1 < argc) ? (uint32_t)strtoul(argv[iArg+1], NULL, 10) : 0);
+	} else {
+		szCmd[0] = 0;
+		for (i=iArg; i<argc; i++) {
+			if (strlen(szCmd) + strlen(argv[i]) + 2 > sizeof(szCmd))
+				break;
+			if (i > iArg) strcat(szCmd, " ");
+			strcat(szCmd, argv[i]);
+		}
+		SendCommand(fd, szCmd);
+		rc = 1;
+		bLines = (strcmp(argv[iArg], "i2c") == 0 || strcmp(argv[iArg], "prof") == 0); // several lines, then "end"
+		while ((i = ReadItem(fd)) >= 0) { // skip frames and wait for the text reply
+			if (i == FRAME_TEXT && szLine[0] && strncmp(szLine, "Pocket", 6) != 0) { // not the banner
+				if (bLines && strcmp(szLine, "end") == 0) {
+					rc = 0;
+					break;
+				}
+				printf("%s\n", szLine);
+				if (bLines && strcmp(szLine, "err") != 0)
+					continue;
+				rc = (strcmp(szLine, "err") == 0);
+				break;
+			}
+		}
+	}
+	close(fd);
+	return rc;
+} /* main() */
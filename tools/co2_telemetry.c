@@ -0,0 +1,99 @@
+//
+// Pocket CO2 telemetry decoder (Linux host)
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Reads the binary telemetry stream from a serial port (or stdin with "-")
+// and writes one CSV line per valid frame to stdout.
+// Frames with a bad length or CRC are skipped and counted on stderr.
+//
+// usage: co2_telemetry [-b baud] <device | ->
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "frame.h"
+
+static void PrintFrame(const uint8_t *pPayload)
+{
+	int iTemp = (int16_t)FrameGet16(&pPayload[8]);
+	int iRH = FrameGet16(&pPayload[10]);
+
+	printf("%u,%u,%d,%s%d.%d,%d.%d,%d,%d,%d\n", FrameGet32(&pPayload[2]), pPayload[1], FrameGet16(&pPayload[6]),
+		(iTemp < 0) ? "-" : "", abs(iTemp) / 10, abs(iTemp) % 10, iRH / 10, iRH % 10,
+		pPayload[12], pPayload[13], FrameGet16(&pPayload[14]));
+	fflush(stdout);
+} /* PrintFrame() */
+
+int main(int argc, char *argv[])
+{
+	uint8_t u8Buf[256];
+	FRAME_PARSER parser = {0};
+	int i, iLen, iBaud = 115200, fd = 0;
+	int iGood = 0, iBad = 0;
+	const char *szDevice = NULL;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-b") == 0 && i+1 < argc)
+			iBaud = atoi(argv[++i]);
+		else
+			szDevice = argv[i];
+	}
+	if (szDevice == NULL) {
+		fprintf(stderr, "usage: co2_telemetry [-b baud] <device | ->\n");
+		return 2;
+	}
+	if (strcmp(szDevice, "-") != 0) {
+		fd = open(szDevice, O_RDONLY | O_NOCTTY);
+		if (fd < 0) {
+			fprintf(stderr, "co2_telemetry: can't open %s: %s\n", szDevice, strerror(errno));
+			return 1;
+		}
+		if (FrameSetupPort(fd, iBaud) != 0) {
+			fprintf(stderr, "co2_telemetry: can't set %s to %d baud\n", szDevice, iBaud);
+			return 1;
+		}
+	}
+	printf("seconds,seq,co2_ppm,temp_c,rh_pct,status,mode,battery_mv\n");
+	fflush(stdout);
+	while ((iLen = (int)read(fd, u8Buf, sizeof(u8Buf))) > 0) {
+		for (i=0; i<iLen; i++) {
+			switch (FrameFeed(&parser, u8Buf[i])) {
+			case FRAME_OK: // other record types (console dumps) are skipped
+				if (parser.u8Frame[2] == TELEMETRY_PAYLOAD_LEN && parser.u8Frame[3] == TELEMETRY_TYPE_SAMPLE) {
+					PrintFrame(&parser.u8Frame[3]);
+					iGood++;
+				}
+				break;
+			case FRAME_BAD:
+				iBad++;
+				break;
+			}
+		}
+	}
+	// EIO is how a closed pty or unplugged adapter ends the stream
+	if (iLen < 0 && errno != EIO)
+		fprintf(stderr, "co2_telemetry: read error: %s\n", strerror(errno));
+	fprintf(stderr, "co2_telemetry: %d frames, %d bad\n", iGood, iBad);
+	if (fd)
+		close(fd);
+	return 0;
+} /* main() */
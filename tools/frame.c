@@ -0,0 +1,112 @@
+//
+// Pocket CO2 frame parser for the host tools
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <termios.h>
+#include <unistd.h>
+#include "frame.h"
+
+// Same CRC-16/CCITT-FALSE as the firmware
+uint16_t FrameCRC16(const uint8_t *pData, int iLen)
+{
+	uint16_t u16CRC = 0xffff;
+	int i;
+
+	while (iLen--) {
+		u16CRC ^= (uint16_t)(*pData++) << 8;
+		for (i=0; i<8; i++)
+			u16CRC = (u16CRC & 0x8000) ? (uint16_t)((u16CRC << 1) ^ 0x1021) : (uint16_t)(u16CRC << 1);
+	}
+	return u16CRC;
+} /* FrameCRC16() */
+
+int FrameGet16(const uint8_t *s)
+{
+	return s[0] | (s[1] << 8);
+} /* FrameGet16() */
+
+uint32_t FrameGet32(const uint8_t *s)
+{
+	return (uint32_t)FrameGet16(s) | ((uint32_t)FrameGet16(&s[2]) << 16);
+} /* FrameGet32() */
+
+int FrameFeed(FRAME_PARSER *p, uint8_t u8)
+{
+	int iLen;
+
+	switch (p->iHave) {
+	case 0:
+		if (u8 != TELEMETRY_SYNC0)
+			return FRAME_TEXT;
+		break;
+	case 1:
+		if (u8 != TELEMETRY_SYNC1) { // text never has SYNC0, so that was noise
+			p->iHave = 0;
+			return (u8 == TELEMETRY_SYNC0) ? FrameFeed(p, u8) : FRAME_TEXT;
+		}
+		break;
+	case 2:
+		if (u8 == 0 || u8 > TELEMETRY_MAX_PAYLOAD) {
+			p->iHave = 0;
+			return FRAME_BAD;
+		}
+		break;
+	}
+	p->u8Frame[p->iHave++] = u8;
+	if (p->iHave < 3)
+		return FRAME_NONE;
+	iLen = p->u8Frame[2];
+	if (p->iHave < 3 + iLen + 2)
+		return FRAME_NONE;
+	p->iHave = 0;
+	if (FrameCRC16(&p->u8Frame[2], 1 + iLen) != FrameGet16(&p->u8Frame[3 + iLen]))
+		return FRAME_BAD;
+	return FRAME_OK;
+} /* FrameFeed() */
+
+static speed_t BaudToSpeed(int iBaud)
+{
+	switch (iBaud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	default: return 0;
+	}
+} /* BaudToSpeed() */
+
+int FrameSetupPort(int fd, int iBaud)
+{
+	struct termios tio;
+	speed_t speed = BaudToSpeed(iBaud);
+
+	if (!isatty(fd))
+		return 0;
+	if (speed == 0 || tcgetattr(fd, &tio) != 0)
+		return -1;
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	return tcsetattr(fd, TCSANOW, &tio);
+} /* FrameSetupPort() */
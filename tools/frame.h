@@ -0,0 +1,49 @@
+//
+// Pocket CO2 frame parser for the host tools
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef TOOLS_FRAME_H_
+#define TOOLS_FRAME_H_
+
+#include <stdint.h>
+#include "../User/telemetry.h"
+
+// FrameFeed() results
+enum {
+	FRAME_NONE = 0, // byte consumed, frame not complete yet
+	FRAME_TEXT, // byte isn't part of a frame
+	FRAME_OK, // pFrame->u8Frame holds a frame with a good CRC
+	FRAME_BAD // bad length or CRC; the frame was dropped
+};
+
+typedef struct tagFrameParser
+{
+	uint8_t u8Frame[TELEMETRY_TX_SIZE];
+	int iHave;
+} FRAME_PARSER;
+
+uint16_t FrameCRC16(const uint8_t *pData, int iLen);
+int FrameFeed(FRAME_PARSER *pParser, uint8_t u8);
+// Little endian field access on a payload
+int FrameGet16(const uint8_t *s);
+uint32_t FrameGet32(const uint8_t *s);
+// Raw mode at the given baud rate if fd is a tty; returns 0 on success
+int FrameSetupPort(int fd, int iBaud);
+
+#endif /* TOOLS_FRAME_H_ */
@@ -0,0 +1,228 @@
+//
+// Pocket CO2 console client test (pseudo-terminal device stand-in)
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Plays the device on the master side of a pty: answers console commands
+// the way the firmware does, interleaves telemetry frames and corrupts one
+// dump frame, then checks what co2_console prints for each command.
+//
+// usage: test_console <path to co2_console>
+//
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "frame.h"
+#include "../User/history.h"
+
+#define FIRST_SEQ 10
+#define NEXT_SEQ (FIRST_SEQ + HISTORY_SIZE) // a full ring held
+
+static int iDumps; // dump commands received
+static int bCorrupt; // corrupt the 3rd frame of the next dump
+
+static void Entry(uint32_t u32Seq, uint8_t *d)
+{
+	d[0] = (uint8_t)(u32Seq * 13);
+	d[1] = (uint8_t)(u32Seq * 7);
+	d[2] = (uint8_t)(u32Seq * 3);
+} /* Entry() */
+
+static void Send(int fd, const void *pData, int iLen)
+{
+	if (write(fd, pData, iLen) != iLen)
+		perror("write");
+} /* Send() */
+
+// Add the sync, length and CRC around the payload at &pFrame[3]
+static int BuildFrame(uint8_t *pFrame, int iPayloadLen)
+{
+	uint16_t u16CRC;
+
+	pFrame[0] = TELEMETRY_SYNC0;
+	pFrame[1] = TELEMETRY_SYNC1;
+	pFrame[2] = (uint8_t)iPayloadLen;
+	u16CRC = FrameCRC16(&pFrame[2], 1 + iPayloadLen);
+	pFrame[3 + iPayloadLen] = (uint8_t)u16CRC;
+	pFrame[4 + iPayloadLen] = (uint8_t)(u16CRC >> 8);
+	return 3 + iPayloadLen + 2;
+} /* BuildFrame() */
+
+static void DeviceCommand(int fd, const char *szCmd)
+{
+	uint8_t u8Frame[TELEMETRY_TX_SIZE];
+	char szReply[128];
+	unsigned int uSeq;
+	int i, iCount, iLen, iVal, iFrame = 0;
+
+	if (strcmp(szCmd, "get") == 0) {
+		snprintf(szReply, sizeof(szReply), "mode=5 alert=0 freq=30 period=5 co2=612 temp=234 rh=456 first=%d next=%d\r\n", FIRST_SEQ, NEXT_SEQ);
+	} else if (sscanf(szCmd, "set mode %d", &iVal) == 1) {
+		strcpy(szReply, (iVal >= 0 && iVal < 6) ? "ok\r\n" : "err\r\n");
+	} else if (sscanf(szCmd, "dump %u", &uSeq) == 1) {
+		iDumps++;
+		memset(u8Frame, 0, sizeof(u8Frame));
+		u8Frame[3] = TELEMETRY_TYPE_SAMPLE; // a sample which went out just before
+		Send(fd, u8Frame, BuildFrame(u8Frame, TELEMETRY_PAYLOAD_LEN));
+		if (uSeq < FIRST_SEQ)
+			uSeq = FIRST_SEQ;
+		while (uSeq < NEXT_SEQ) {
+			iCount = NEXT_SEQ - uSeq;
+			if (iCount > TELEMETRY_HISTORY_MAX) iCount = TELEMETRY_HISTORY_MAX;
+			u8Frame[3] = TELEMETRY_TYPE_HISTORY;
+			u8Frame[4] = (uint8_t)iCount;
+			for (i=0; i<4; i++)
+				u8Frame[5+i] = (uint8_t)(uSeq >> (i*8));
+			u8Frame[9] = (uint8_t)HISTORY_INTERVAL_SECS;
+			u8Frame[10] = (uint8_t)(HISTORY_INTERVAL_SECS >> 8);
+			for (i=0; i<iCount; i++)
+				Entry(uSeq + i, &u8Frame[11 + i*3]);
+			iLen = BuildFrame(u8Frame, 8 + 3*iCount);
+			if (bCorrupt && iFrame == 2) { // damaged on the wire
+				u8Frame[12] ^= 0x10;
+				bCorrupt = 0;
+			}
+			Send(fd, u8Frame, iLen);
+			uSeq += iCount;
+			iFrame++;
+		}
+		snprintf(szReply, sizeof(szReply), "end %u\r\n", uSeq);
+	} else {
+		strcpy(szReply, "err\r\n");
+	}
+	Send(fd, szReply, (int)strlen(szReply));
+} /* DeviceCommand() */
+
+//
+// Run the client with one command while playing the device
+// returns the client's exit code; its stdout is in szOut
+//
+static int RunClient(const char *szClient, const char *szArg1, const char *szArg2, const char *szArg3, char *szOut, int iMax)
+{
+	struct pollfd pfd[2];
+	char szCmd[64], szSlave[64];
+	int fdMaster, fdPipe[2], iOut = 0, iCmd = 0, iLen, iStatus;
+	uint8_t u8Buf[256];
+	pid_t pid;
+
+	fdMaster = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fdMaster < 0 || grantpt(fdMaster) || unlockpt(fdMaster) || pipe(fdPipe)) {
+		perror("pty");
+		exit(1);
+	}
+	strncpy(szSlave, ptsname(fdMaster), sizeof(szSlave) - 1);
+	szSlave[sizeof(szSlave) - 1] = 0;
+	pid = fork();
+	if (pid == 0) {
+		dup2(fdPipe[1], 1);
+		close(fdPipe[0]);
+		close(fdMaster);
+		execl(szClient, szClient, szSlave, szArg1, szArg2, szArg3, (char *)NULL);
+		perror("exec");
+		_exit(1);
+	}
+	close(fdPipe[1]);
+	while (1) {
+		pfd[0].fd = fdMaster; pfd[0].events = POLLIN;
+		pfd[1].fd = fdPipe[0]; pfd[1].events = POLLIN;
+		poll(pfd, 2, 100);
+		if (pfd[1].revents) {
+			iLen = (int)read(fdPipe[0], &szOut[iOut], iMax - 1 - iOut);
+			if (iLen <= 0)
+				break; // the client has exited
+			iOut += iLen;
+		}
+		if (pfd[0].revents & POLLIN) {
+			iLen = (int)read(fdMaster, u8Buf, sizeof(u8Buf));
+			for (int i=0; i<iLen; i++) {
+				if (u8Buf[i] == '\n') {
+					szCmd[iCmd] = 0;
+					iCmd = 0;
+					DeviceCommand(fdMaster, szCmd);
+				} else if (iCmd < (int)sizeof(szCmd) - 1) {
+					szCmd[iCmd++] = (char)u8Buf[i];
+				}
+			}
+		} else if (pfd[0].revents) {
+			usleep(1000); // hang-up while the client has the slave closed
+		}
+	}
+	szOut[iOut] = 0;
+	close(fdPipe[0]);
+	close(fdMaster);
+	waitpid(pid, &iStatus, 0);
+	return WIFEXITED(iStatus) ? WEXITSTATUS(iStatus) : -1;
+} /* RunClient() */
+
+static int Check(const char *szName, int bOK)
+{
+	printf("%s: %s\n", szName, bOK ? "PASS" : "FAIL");
+	return bOK ? 0 : 1;
+} /* Check() */
+
+int main(int argc, char *argv[])
+{
+	static char szOut[65536], szExpected[65536];
+	uint8_t u8Entry[3];
+	struct timespec ts0, ts1;
+	int rc, iFail = 0, iTemp, iRH;
+	char *d;
+	uint32_t u32Seq;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: test_console <co2_console>\n");
+		return 2;
+	}
+	alarm(20); // never hang the test run
+
+	rc = RunClient(argv[1], "get", NULL, NULL, szOut, sizeof(szOut));
+	snprintf(szExpected, sizeof(szExpected), "first=%d next=%d\n", FIRST_SEQ, NEXT_SEQ);
+	iFail += Check("get", rc == 0 && strstr(szOut, szExpected) != NULL);
+	rc = RunClient(argv[1], "set", "mode", "1", szOut, sizeof(szOut));
+	iFail += Check("set", rc == 0 && strcmp(szOut, "ok\n") == 0);
+	rc = RunClient(argv[1], "set", "mode", "9", szOut, sizeof(szOut));
+	iFail += Check("set out of range", rc == 1 && strcmp(szOut, "err\n") == 0);
+
+	// the whole ring, with one frame corrupted on the way
+	d = szExpected + sprintf(szExpected, "seq,seconds,co2_ppm,temp_c,rh_pct\n");
+	for (u32Seq = FIRST_SEQ; u32Seq < NEXT_SEQ; u32Seq++) {
+		Entry(u32Seq, u8Entry);
+		iTemp = u8Entry[1] * HISTORY_TEMP_SCALE - HISTORY_TEMP_OFFSET;
+		iRH = u8Entry[2] * HISTORY_RH_SCALE;
+		d += sprintf(d, "%u,%u,%d,%s%d.%d,%d.%d\n", u32Seq, u32Seq * HISTORY_INTERVAL_SECS, u8Entry[0] * HISTORY_CO2_SCALE,
+			(iTemp < 0) ? "-" : "", abs(iTemp) / 10, abs(iTemp) % 10, iRH / 10, iRH % 10);
+	}
+	iDumps = 0;
+	bCorrupt = 1;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	rc = RunClient(argv[1], "dump", NULL, NULL, szOut, sizeof(szOut));
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	iFail += Check("dump 24h with a resume", rc == 0 && iDumps == 2 && strcmp(szOut, szExpected) == 0);
+	printf("dump took %d ms\n", (int)((ts1.tv_sec - ts0.tv_sec) * 1000 + (ts1.tv_nsec - ts0.tv_nsec) / 1000000));
+	iDumps = 0;
+	rc = RunClient(argv[1], "dump", "200", NULL, szOut, sizeof(szOut));
+	iFail += Check("dump from a sequence number", rc == 0 && iDumps == 1 && strncmp(strchr(szOut, '\n') + 1, "200,", 4) == 0);
+	return iFail ? 1 : 0;
+} /* main() */
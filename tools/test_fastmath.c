@@ -0,0 +1,73 @@
+//
+// Pocket CO2 arithmetic kernel test
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Checks every kernel in User/fastmath.h against the C operators over its
+// whole documented input range (the divides by 10 and 60 over all 2^32
+// values, so this takes a few seconds).
+//
+#include <stdio.h>
+#include <stdint.h>
+#include "../User/fastmath.h"
+
+static int iErrors;
+
+static void Fail(const char *szName, uint32_t n, uint32_t u32Got, uint32_t u32Want)
+{
+	if (iErrors++ < 10)
+		fprintf(stderr, "%s(%u) = %u, expected %u\n", szName, n, u32Got, u32Want);
+} /* Fail() */
+
+int main(void)
+{
+	uint32_t n, u32BCD, u32Dec;
+	int i;
+
+	n = 0;
+	do {
+		if (udiv10(n) != n / 10) Fail("udiv10", n, udiv10(n), n / 10);
+		if (udiv60(n) != n / 60) Fail("udiv60", n, udiv60(n), n / 60);
+		if (mul5(n) != n * 5) Fail("mul5", n, mul5(n), n * 5);
+		if (mul7(n) != n * 7) Fail("mul7", n, mul7(n), n * 7);
+		if (mul10(n) != n * 10) Fail("mul10", n, mul10(n), n * 10);
+		if (mul60(n) != n * 60) Fail("mul60", n, mul60(n), n * 60);
+		if (mul500(n) != n * 500) Fail("mul500", n, mul500(n), n * 500);
+	} while (++n != 0);
+	for (n=0; n<65536; n++) {
+		if (udiv500(n) != n / 500) Fail("udiv500", n, udiv500(n), n / 500);
+		if (mul1000(n) != n * 1000) Fail("mul1000", n, mul1000(n), n * 1000);
+		if (mul1750(n) != n * 1750) Fail("mul1750", n, mul1750(n), n * 1750);
+	}
+	for (n=0; n<100000000; n++) {
+		u32BCD = ubcd(n);
+		u32Dec = 0;
+		for (i=28; i>=0; i-=4) {
+			if (((u32BCD >> i) & 0xf) > 9)
+				break;
+			u32Dec = u32Dec * 10 + ((u32BCD >> i) & 0xf);
+		}
+		if (i >= 0 || u32Dec != n) Fail("ubcd", n, u32BCD, n);
+	}
+	if (iErrors) {
+		fprintf(stderr, "test_fastmath: %d errors\n", iErrors);
+		return 1;
+	}
+	printf("test_fastmath: all kernels exact\n");
+	return 0;
+} /* main() */
@@ -0,0 +1,146 @@
+//
+// Pocket CO2 telemetry decoder test (pseudo-terminal loopback)
+// written by Larry Bank
+// bitbank@pobox.com
+// Copyright (c) 2023 BitBank Software, Inc.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Runs the decoder on the slave side of a pty, writes frames (plus noise
+// and a corrupted frame) into the master side the way the USART would
+// and checks the CSV which comes out.
+//
+// usage: test_telemetry <path to co2_telemetry>
+//
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "../User/telemetry.h"
+
+static const char *szExpected =
+	"seconds,seq,co2_ppm,temp_c,rh_pct,status,mode,battery_mv\n"
+	"5,0,612,23.4,45.6,0,0,3012\n"
+	"10,1,1405,-2.5,100.0,0,2,2987\n"
+	"70000,3,0,0.0,0.0,2,1,3300\n"
+	"co2_telemetry: 3 frames, 1 bad\n";
+
+// Independent encoder following the layout in telemetry.h
+static int Encode(uint8_t *pFrame, uint32_t u32Time, uint8_t u8Seq, int iCO2, int iTemp,
+		int iRH, int iStatus, int iMode, int iBattery)
+{
+	uint8_t *d = pFrame;
+	uint16_t u16CRC = 0xffff;
+	int i, j;
+
+	*d++ = TELEMETRY_SYNC0; *d++ = TELEMETRY_SYNC1; *d++ = TELEMETRY_PAYLOAD_LEN;
+	*d++ = TELEMETRY_TYPE_SAMPLE; *d++ = u8Seq;
+	for (i=0; i<4; i++)
+		*d++ = (uint8_t)(u32Time >> (i*8));
+	*d++ = (uint8_t)iCO2; *d++ = (uint8_t)(iCO2 >> 8);
+	*d++ = (uint8_t)iTemp; *d++ = (uint8_t)(iTemp >> 8);
+	*d++ = (uint8_t)iRH; *d++ = (uint8_t)(iRH >> 8);
+	*d++ = (uint8_t)iStatus; *d++ = (uint8_t)iMode;
+	*d++ = (uint8_t)iBattery; *d++ = (uint8_t)(iBattery >> 8);
+	for (i=2; i<3+TELEMETRY_PAYLOAD_LEN; i++) {
+		u16CRC ^= (uint16_t)pFrame[i] << 8;
+		for (j=0; j<8; j++)
+			u16CRC = (u16CRC & 0x8000) ? (uint16_t)((u16CRC << 1) ^ 0x1021) : (uint16_t)(u16CRC << 1);
+	}
+	*d++ = (uint8_t)u16CRC; *d++ = (uint8_t)(u16CRC >> 8);
+	return (int)(d - pFrame);
+} /* Encode() */
+
+static void WriteAll(int fd, const uint8_t *pData, int iLen)
+{
+	if (write(fd, pData, iLen) != iLen) {
+		perror("write");
+		exit(1);
+	}
+	usleep(10000); // let the decoder see separate reads
+} /* WriteAll() */
+
+int main(int argc, char *argv[])
+{
+	uint8_t u8Frame[TELEMETRY_FRAME_LEN];
+	static const uint8_t u8Noise[] = {0x00, 0xa5, 0x11, 0x5a, 0xa5};
+	char szOut[1024], szSlave[64];
+	int fdMaster, fdPipe[2], iLen, iOut = 0, iStatus;
+	pid_t pid;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: test_telemetry <co2_telemetry>\n");
+		return 2;
+	}
+	alarm(10); // never hang the test run
+	fdMaster = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fdMaster < 0 || grantpt(fdMaster) || unlockpt(fdMaster) || pipe(fdPipe)) {
+		perror("pty");
+		return 1;
+	}
+	strncpy(szSlave, ptsname(fdMaster), sizeof(szSlave) - 1);
+	szSlave[sizeof(szSlave) - 1] = 0;
+	pid = fork();
+	if (pid == 0) {
+		dup2(fdPipe[1], 1);
+		dup2(fdPipe[1], 2);
+		close(fdPipe[0]);
+		close(fdMaster); // or the hang-up at the end never happens
+		execl(argv[1], argv[1], "-b", "115200", szSlave, (char *)NULL);
+		perror("exec");
+		_exit(1);
+	}
+	close(fdPipe[1]);
+	// the header means the decoder has opened the port and made it raw
+	while (iOut == 0 || szOut[iOut-1] != '\n') {
+		iLen = (int)read(fdPipe[0], &szOut[iOut], sizeof(szOut) - 1 - iOut);
+		if (iLen <= 0) break;
+		iOut += iLen;
+	}
+
+	WriteAll(fdMaster, u8Noise, sizeof(u8Noise)); // garbage and a false sync
+	iLen = Encode(u8Frame, 5, 0, 612, 234, 456, 0, 0, 3012);
+	WriteAll(fdMaster, u8Frame, iLen);
+	iLen = Encode(u8Frame, 10, 1, 1405, -25, 1000, 0, 2, 2987);
+	WriteAll(fdMaster, u8Frame, 7); // split across reads
+	WriteAll(fdMaster, &u8Frame[7], iLen - 7);
+	iLen = Encode(u8Frame, 15, 2, 800, 200, 500, 0, 0, 3000);
+	u8Frame[8] ^= 0x40; // corrupted on the wire
+	WriteAll(fdMaster, u8Frame, iLen);
+	iLen = Encode(u8Frame, 70000, 3, 0, 0, 0, 2, 1, 3300);
+	WriteAll(fdMaster, u8Frame, iLen);
+	usleep(100000);
+	close(fdMaster); // hangs up the slave side; the decoder sees EIO and exits
+
+	while ((iLen = (int)read(fdPipe[0], &szOut[iOut], sizeof(szOut) - 1 - iOut)) > 0)
+		iOut += iLen;
+	szOut[iOut] = 0;
+	waitpid(pid, &iStatus, 0);
+	if (!WIFEXITED(iStatus) || WEXITSTATUS(iStatus) != 0) {
+		fprintf(stderr, "FAIL: decoder exit status %d\n", iStatus);
+		return 1;
+	}
+	if (strcmp(szOut, szExpected) != 0) {
+		fprintf(stderr, "FAIL: got\n%s\nexpected\n%s\n", szOut, szExpected);
+		return 1;
+	}
+	printf("telemetry pty loopback: PASS\n");
+	return 0;
+} /* main() */